@@ -0,0 +1,1190 @@
+/*
+ * Microbenchmarks for the initiative tracker.
+ *
+ * Build and run with `make bench`. The tracker source is included directly
+ * (with its main() compiled out) so internal functions can be timed.
+ */
+#define INITIATIVE_NO_MAIN
+#include "initiative.c"
+
+#define BENCH_MIN_NS 200000000.0 /* Run each case for at least 0.2 s */
+#define CORE_WARMUP_NS 20000000.0     /* Untimed warmup per core case */
+#define CORE_REPETITION_NS 2000000.0  /* Target length of one timed repetition */
+#define CORE_REPETITIONS 15
+#define CORE_MIN_REPETITIONS 5
+#define CORE_CASE_BUDGET_NS 1000000000.0 /* Stop adding repetitions after 1 s */
+#define CORE_SAVE_PATH "/tmp/initiative_bench.save"
+#define CORE_AUTOSAVE_PATH "/tmp/initiative_bench.autosave"
+#define CORE_JSON_PATH "/tmp/initiative_bench.json"
+
+/* Keeps results observable so the optimizer cannot drop the work */
+static volatile long long bench_sink;
+
+typedef enum {
+    BENCH_TEXT,
+    BENCH_CSV,
+    BENCH_JSON
+} BenchFormat;
+
+/* One roster under test; `base` is the pristine copy restored between repetitions */
+typedef struct {
+    GameState state;
+    Combatant* base;
+    int n;
+    int poisoned;
+    uint32_t rng;
+    long long op;
+    Autosaver* autosave;     /* Started by the autosave case only */
+} CoreBench;
+
+typedef struct {
+    const char* name;
+    void (*reset)(CoreBench* b);  /* Untimed, before each repetition (may be NULL) */
+    void (*op)(CoreBench* b);     /* One timed operation */
+    int max_batch;                /* 0 = no limit */
+    int grows_roster;             /* Cap the batch at n/10 so the roster stays near n */
+} CoreCase;
+
+typedef struct {
+    const char* name;
+    int n;
+    int batch;
+    int repetitions;
+    double median_ns, min_ns, max_ns, mean_ns;
+} CoreResult;
+
+/* Benchmark Prototypes */
+double bench_now_ns(void);
+void bench_fill(GameState* state, int count);
+void aos_classify_hp(const GameState* state, uint8_t* band);
+int aos_query_enemies_below(const GameState* state, int percent, int* out);
+int aos_query_dying_players(const GameState* state, int* out);
+void bench_layouts(int count);
+void bench_hp_kernels(int count);
+int bench_view_equal(const ViewData* a, const ViewData* b);
+int bench_compare_double(const void* a, const void* b);
+void bench_broadcast(int viewers, int combatants);
+int bench_session_line(char* buf, size_t size, GameState* state);
+char* bench_print_to_string(GameState* state);
+double bench_record_session(GameState* recorded, int commands);
+void bench_replay(int commands);
+void bench_bestiary_name(char* buf, size_t size, int i);
+void bench_bestiary(int entries);
+void bench_import(int rows);
+void bench_history(int events);
+
+/* Core Operation Suite Prototypes */
+void core_restore(CoreBench* b);
+uint32_t core_next(CoreBench* b);
+void core_reset_log(CoreBench* b);
+void core_reset_shuffle(CoreBench* b);
+void core_reset_expiry(CoreBench* b);
+void core_reset_save_file(CoreBench* b);
+void core_reset_json_file(CoreBench* b);
+void core_reset_autosave(CoreBench* b);
+void core_op_sort(CoreBench* b);
+void core_op_sort_shuffled(CoreBench* b);
+void core_op_lookup(CoreBench* b);
+void core_op_log(CoreBench* b);
+void core_op_snapshot(CoreBench* b);
+void core_op_undo(CoreBench* b);
+void core_op_expire_round(CoreBench* b);
+void core_op_duplicate(CoreBench* b);
+void core_op_save(CoreBench* b);
+void core_op_load(CoreBench* b);
+void core_op_save_json(CoreBench* b);
+void core_op_load_json(CoreBench* b);
+void core_op_autosave(CoreBench* b);
+double core_repetition(CoreBench* b, const CoreCase* cc, int batch);
+void core_run_case(const CoreCase* cc, int n, CoreResult* result);
+void core_print_result(const CoreResult* r, BenchFormat format, int first);
+void bench_core(BenchFormat format);
+
+double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * Fill `state` with a mixed encounter: half players, half enemies, HP spread
+ * across every band, with a sprinkling of dead and stable combatants.
+ */
+void bench_fill(GameState* state, int count) {
+    if (!ensure_combatant_capacity(state, count)) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        Combatant* c = &state->combatants[i];
+        memset(c, 0, sizeof(*c));
+        c->id = i + 1;
+        snprintf(c->name, NAME_LENGTH, "Bench %d", i + 1);
+        c->type = (rand() % 2) ? TYPE_PLAYER : TYPE_ENEMY;
+        c->initiative = rand() % 25;
+        c->max_hp = 10 + rand() % 90;
+        c->hp = rand() % (c->max_hp + 1);
+        c->is_dead = (rand() % 20) == 0;
+        c->is_stable = (c->hp == 0 && (rand() % 2) == 0);
+    }
+    state->count = count;
+    state->next_id = count + 1;
+    sort_combatants(state);
+}
+
+/* --- AoS reference implementations (what the scans did before the mirror) --- */
+
+void aos_classify_hp(const GameState* state, uint8_t* band) {
+    for (int i = 0; i < state->count; i++) {
+        const Combatant* c = &state->combatants[i];
+        if (c->hp <= 0 || c->is_dead) {
+            band[i] = (uint8_t)((c->type == TYPE_ENEMY || c->is_dead) ? HP_BAND_DEAD : HP_BAND_UNCONSCIOUS);
+        } else if (c->hp <= c->max_hp / 4) {
+            band[i] = HP_BAND_CRITICAL;
+        } else if (c->hp <= c->max_hp / 2) {
+            band[i] = HP_BAND_HURT;
+        } else {
+            band[i] = HP_BAND_GOOD;
+        }
+    }
+}
+
+int aos_query_enemies_below(const GameState* state, int percent, int* out) {
+    int n = 0;
+    for (int i = 0; i < state->count; i++) {
+        const Combatant* c = &state->combatants[i];
+        if (c->type == TYPE_ENEMY && !c->is_dead && c->hp > 0 &&
+            (long long)c->hp * 100 < (long long)c->max_hp * percent) {
+            out[n++] = i;
+        }
+    }
+    return n;
+}
+
+int aos_query_dying_players(const GameState* state, int* out) {
+    int n = 0;
+    for (int i = 0; i < state->count; i++) {
+        const Combatant* c = &state->combatants[i];
+        if (c->type == TYPE_PLAYER && c->hp <= 0 && !c->is_stable && !c->is_dead) {
+            out[n++] = i;
+        }
+    }
+    return n;
+}
+
+/* Time `body` repeatedly for at least BENCH_MIN_NS; yields ns per combatant */
+#define BENCH_RUN(result, count, body) do {                          \
+        long long iters_ = 0;                                        \
+        double start_ = bench_now_ns(), elapsed_;                    \
+        do {                                                         \
+            body;                                                    \
+            iters_++;                                                \
+            elapsed_ = bench_now_ns() - start_;                      \
+        } while (elapsed_ < BENCH_MIN_NS);                           \
+        (result) = elapsed_ / (double)iters_ / (double)(count);      \
+    } while (0)
+
+/**
+ * Compare the AoS scans against the SoA mirror for one encounter size.
+ */
+void bench_layouts(int count) {
+    GameState state;
+    init_state(&state);
+    state.headless = 1;
+    bench_fill(&state, count);
+
+    int* out = (int*)malloc((size_t)count * sizeof(int));
+    uint8_t* band = (uint8_t*)malloc((size_t)count);
+    if (!out || !band || !hot_sync(&state)) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+
+    /* Both layouts must agree before timing means anything */
+    aos_classify_hp(&state, band);
+    if (memcmp(band, state.hot.hp_band, (size_t)count) != 0 ||
+        aos_query_enemies_below(&state, 25, out) != hot_query_enemies_below(&state.hot, 25, out) ||
+        aos_query_dying_players(&state, out) != hot_query_dying_players(&state.hot, out)) {
+        fprintf(stderr, "bench: AoS and SoA results differ\n");
+        exit(1);
+    }
+
+    double aos, soa, sync;
+    BENCH_RUN(sync, count, { hot_sync(&state); bench_sink += state.hot.count; });
+
+    BENCH_RUN(aos, count, { aos_classify_hp(&state, band); bench_sink += band[count / 2]; });
+    BENCH_RUN(soa, count, { hot_classify_hp(&state.hot); bench_sink += state.hot.hp_band[count / 2]; });
+    printf("%-22s %8d %10.3f %10.3f %8.2fx %10.3f %8.2fx\n", "classify_hp", count, aos, soa, aos / soa,
+        sync + soa, aos / (sync + soa));
+
+    BENCH_RUN(aos, count, { bench_sink += aos_query_enemies_below(&state, 25, out); });
+    BENCH_RUN(soa, count, { bench_sink += hot_query_enemies_below(&state.hot, 25, out); });
+    printf("%-22s %8d %10.3f %10.3f %8.2fx %10.3f %8.2fx\n", "enemies_below_25", count, aos, soa, aos / soa,
+        sync + soa, aos / (sync + soa));
+
+    BENCH_RUN(aos, count, { bench_sink += aos_query_dying_players(&state, out); });
+    BENCH_RUN(soa, count, { bench_sink += hot_query_dying_players(&state.hot, out); });
+    printf("%-22s %8d %10.3f %10.3f %8.2fx %10.3f %8.2fx\n", "dying_players", count, aos, soa, aos / soa,
+        sync + soa, aos / (sync + soa));
+
+    printf("%-22s %8d %10s %10.3f\n", "hot_sync (AoS->SoA)", count, "-", sync);
+
+    free(out);
+    free(band);
+    cleanup_state(&state);
+}
+
+/**
+ * Time each available HP kernel on one damage vector and check they agree
+ * with the scalar kernel bit for bit.
+ */
+void bench_hp_kernels(int count) {
+    struct { const char* name; HpKernelFn fn; } kernels[3];
+    int num_kernels = 0;
+    kernels[num_kernels].name = "scalar";
+    kernels[num_kernels++].fn = hp_kernel_scalar;
+#ifdef HP_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[num_kernels].name = "sse2";
+        kernels[num_kernels++].fn = hp_kernel_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[num_kernels].name = "avx2";
+        kernels[num_kernels++].fn = hp_kernel_avx2;
+    }
+#endif
+
+    int words = (count + 63) / 64;
+    int* hp = (int*)malloc((size_t)count * sizeof(int));
+    int* max_hp = (int*)malloc((size_t)count * sizeof(int));
+    int* delta = (int*)malloc((size_t)count * sizeof(int));
+    int* ref_hp = (int*)malloc((size_t)count * sizeof(int));
+    int* new_hp = (int*)malloc((size_t)count * sizeof(int));
+    uint64_t* ref_words = (uint64_t*)calloc((size_t)words * 4, sizeof(uint64_t));
+    uint64_t* mask_words = (uint64_t*)calloc((size_t)words * 4, sizeof(uint64_t));
+    if (!hp || !max_hp || !delta || !ref_hp || !new_hp || !ref_words || !mask_words) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+
+    /* Mixed group: some already down, damage and healing both present */
+    for (int i = 0; i < count; i++) {
+        max_hp[i] = 10 + rand() % 190;
+        hp[i] = (rand() % 10 == 0) ? 0 : 1 + rand() % max_hp[i];
+        delta[i] = (rand() % 4 == 0) ? rand() % 30 : -(rand() % 250);
+    }
+
+    HpKernelMasks ref = { ref_words, ref_words + words, ref_words + words * 2, ref_words + words * 3 };
+    HpKernelMasks masks = { mask_words, mask_words + words, mask_words + words * 2, mask_words + words * 3 };
+    hp_kernel_scalar(hp, max_hp, delta, ref_hp, count, &ref);
+
+    double scalar_ns = 0.0;
+    for (int k = 0; k < num_kernels; k++) {
+        memset(mask_words, 0, (size_t)words * 4 * sizeof(uint64_t));
+        kernels[k].fn(hp, max_hp, delta, new_hp, count, &masks);
+        if (memcmp(new_hp, ref_hp, (size_t)count * sizeof(int)) != 0 ||
+            memcmp(mask_words, ref_words, (size_t)words * 4 * sizeof(uint64_t)) != 0) {
+            fprintf(stderr, "bench: %s kernel disagrees with scalar\n", kernels[k].name);
+            exit(1);
+        }
+
+        double ns;
+        BENCH_RUN(ns, count, {
+            memset(mask_words, 0, (size_t)words * 4 * sizeof(uint64_t));
+            kernels[k].fn(hp, max_hp, delta, new_hp, count, &masks);
+            bench_sink += new_hp[count / 2];
+        });
+        if (k == 0) scalar_ns = ns;
+        char label[32];
+        snprintf(label, sizeof(label), "hp_kernel_%s", kernels[k].name);
+        printf("%-22s %8d %10.3f %10s %8.2fx\n", label, count, ns, "-", scalar_ns / ns);
+    }
+
+    free(hp);
+    free(max_hp);
+    free(delta);
+    free(ref_hp);
+    free(new_hp);
+    free(ref_words);
+    free(mask_words);
+}
+
+int bench_compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* Decoded spectator state matches the tracker's view (writer_pid is not streamed) */
+int bench_view_equal(const ViewData* a, const ViewData* b) {
+    return a->round == b->round && a->total == b->total && a->count == b->count &&
+           memcmp(a->entries, b->entries, (size_t)a->count * sizeof(ViewEntry)) == 0;
+}
+
+/**
+ * Stream a run of HP, turn and condition changes to `viewers` spectators.
+ * Each frame is timed from the DM-side publish until the last spectator has
+ * decoded it, and every spectator's decoded view is checked against the
+ * tracker's.
+ */
+void bench_broadcast(int viewers, int combatants) {
+    enum { FRAMES = 2000, VIEWER_BUFFER = 16384 };
+    GameState state;
+    init_state(&state);
+    state.headless = 1;
+    bench_fill(&state, combatants);
+    for (int i = 0; i < state.count; i++) {
+        state.combatants[i].is_dead = 0;
+        state.combatants[i].hp = state.combatants[i].max_hp;
+    }
+    state.current_turn_id = state.combatants[0].id;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/initiative_bench_%ld.sock", (long)getpid());
+    state.broadcast = broadcast_start(path);
+    if (!state.broadcast) exit(1);
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    broadcast_address(path, &addr, &addr_len);
+    int* fds = (int*)malloc((size_t)viewers * sizeof(int));
+    ViewData* decoded = (ViewData*)calloc((size_t)viewers, sizeof(ViewData));
+    char* bufs = (char*)malloc((size_t)viewers * VIEWER_BUFFER);
+    size_t* lens = (size_t*)calloc((size_t)viewers, sizeof(size_t));
+    uint64_t* versions = (uint64_t*)malloc((size_t)viewers * sizeof(uint64_t));
+    int* frame_states = (int*)calloc((size_t)viewers, sizeof(int));
+    int* frames_seen = (int*)calloc((size_t)viewers, sizeof(int));
+    double* latency_us = (double*)malloc(FRAMES * sizeof(double));
+    int epoll_fd = epoll_create1(0);
+    if (!fds || !decoded || !bufs || !lens || !versions || !frame_states || !frames_seen || !latency_us || epoll_fd < 0) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    for (int v = 0; v < viewers; v++) {
+        fds[v] = view_stream_connect(&addr, addr_len);
+        if (fds[v] < 0) {
+            fprintf(stderr, "bench: spectator %d cannot connect: %s\n", v, strerror(errno));
+            exit(1);
+        }
+        versions[v] = UINT64_MAX;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)v;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[v], &ev);
+    }
+
+    /* Drain spectator sockets until every one has decoded `target` frames */
+    struct epoll_event events[64];
+#define BENCH_WAIT_FRAMES(target) do {                                                        \
+        int behind_ = 0;                                                                      \
+        for (int v_ = 0; v_ < viewers; v_++) behind_ += frames_seen[v_] < (target);           \
+        while (behind_ > 0) {                                                                 \
+            int n_ = epoll_wait(epoll_fd, events, 64, 5000);                                  \
+            if (n_ <= 0) { fprintf(stderr, "bench: spectators stalled\n"); exit(1); }        \
+            for (int e_ = 0; e_ < n_; e_++) {                                                 \
+                int v_ = (int)events[e_].data.u32;                                            \
+                char* buf_ = bufs + (size_t)v_ * VIEWER_BUFFER;                               \
+                for (;;) {                                                                    \
+                    ssize_t got_ = read(fds[v_], buf_ + lens[v_], VIEWER_BUFFER - lens[v_] - 1); \
+                    if (got_ <= 0) break;                                                     \
+                    lens[v_] += (size_t)got_;                                                 \
+                    size_t start_ = 0;                                                        \
+                    for (size_t i_ = 0; i_ < lens[v_]; i_++) {                                \
+                        if (buf_[i_] != '\n') continue;                                      \
+                        buf_[i_] = '\0';                                                     \
+                        if (view_apply_line(&decoded[v_], buf_ + start_, &versions[v_], &frame_states[v_]) && \
+                            ++frames_seen[v_] == (target)) behind_--;                          \
+                        start_ = i_ + 1;                                                      \
+                    }                                                                         \
+                    memmove(buf_, buf_ + start_, lens[v_] - start_);                          \
+                    lens[v_] -= start_;                                                       \
+                }                                                                             \
+            }                                                                                 \
+        }                                                                                     \
+    } while (0)
+
+    BENCH_WAIT_FRAMES(1); /* Joining keyframe */
+
+    ViewData expected;
+    double publish_ns = 0.0;
+    long long delta_frames = 0, delta_bytes = 0;
+    int mismatches = 0;
+    int sent = 0;
+    while (sent < FRAMES) {
+        /* One DM action per frame: an HP change, a condition toggle or a turn */
+        Combatant* c = &state.combatants[rand() % state.count];
+        switch (rand() % 3) {
+            case 0: apply_hp_change(&state, c, (rand() % 2) ? -(1 + rand() % 6) : 1 + rand() % 6, 0); break;
+            case 1: {
+                int cond = rand() % NUM_CONDITIONS;
+                set_condition(&state, c, cond, !effect_test(&state, c, cond));
+                break;
+            }
+            default: next_turn(&state); break;
+        }
+
+        long long queued_before = state.broadcast->bytes_queued;
+        uint64_t submitted_before = state.broadcast->pending_seq;
+        double start = bench_now_ns();
+        view_publish(&state);
+        double published = bench_now_ns();
+        publish_ns += published - start;
+        if (state.broadcast->pending_seq == submitted_before) continue; /* Action left the view unchanged */
+        broadcast_kick(state.broadcast);
+
+        int f = sent++;
+        BENCH_WAIT_FRAMES(f + 2);
+        double delivered = bench_now_ns();
+        latency_us[f] = (delivered - start) / 1e3;
+        if ((state.broadcast->frames_since_keyframe) != 0) {
+            delta_frames++;
+            delta_bytes += (state.broadcast->bytes_queued - queued_before) / viewers;
+        }
+        view_fill(&state, &expected);
+        if (!bench_view_equal(&decoded[f % viewers], &expected)) mismatches++;
+    }
+    for (int v = 0; v < viewers; v++) {
+        if (!bench_view_equal(&decoded[v], &expected)) mismatches++;
+    }
+#undef BENCH_WAIT_FRAMES
+
+    double fill_ns;
+    BENCH_RUN(fill_ns, 1, { view_fill(&state, &expected); bench_sink += expected.count; });
+    broadcast_encode_keyframe(state.broadcast);
+    size_t keyframe_bytes = state.broadcast->keyframe.len;
+    long long dropped = state.broadcast->dropped;
+
+    qsort(latency_us, FRAMES, sizeof(double), bench_compare_double);
+    printf("%-22s %8d %10.2f %10.2f %10.1f %10.1f %8lld %8zu %5lld\n", "broadcast", viewers,
+        publish_ns / sent / 1e3, fill_ns / 1e3, latency_us[FRAMES / 2], latency_us[FRAMES * 99 / 100],
+        delta_frames ? delta_bytes / delta_frames : 0, keyframe_bytes, dropped);
+    if (mismatches > 0 || dropped > 0) {
+        fprintf(stderr, "bench: %d spectator views differ from the tracker, %lld dropped\n", mismatches, dropped);
+        exit(1);
+    }
+
+    for (int v = 0; v < viewers; v++) close(fds[v]);
+    close(epoll_fd);
+    broadcast_stop(state.broadcast);
+    state.broadcast = NULL;
+    free(fds);
+    free(decoded);
+    free(bufs);
+    free(lens);
+    free(versions);
+    free(frame_states);
+    free(frames_seen);
+    free(latency_us);
+    cleanup_state(&state);
+}
+
+/**
+ * One line of a synthetic session: mostly HP changes and turns, with
+ * conditions, mob damage, death saves, marks, the odd duplicate and undo.
+ */
+int bench_session_line(char* buf, size_t size, GameState* state) {
+    if (state->count == 0) return snprintf(buf, size, "add enemy Orc 10 1 80");
+    int id = state->combatants[rand() % state->count].id;
+    int roll = rand() % 100;
+    if (roll < 25) return snprintf(buf, size, "damage #%d %d", id, 1 + rand() % 10);
+    if (roll < 40) return snprintf(buf, size, "heal #%d %d", id, 1 + rand() % 10);
+    if (roll < 60) return snprintf(buf, size, "next");
+    if (roll < 68) return snprintf(buf, size, "condition #%d %s", id, (rand() % 2) ? "poisoned" : "prone");
+    if (roll < 72) return snprintf(buf, size, "duration #%d poisoned %d", id, 1 + rand() % 3);
+    if (roll < 78) return snprintf(buf, size, "mobhp #11 spread -%d", 1 + rand() % 6);
+    if (roll < 83) return snprintf(buf, size, "deathsave #%d", 1 + rand() % 4);
+    if (roll < 86) return snprintf(buf, size, "togglemark #%d", id);
+    if (roll < 88) return snprintf(buf, size, "group %d", (rand() % 2) ? 4 : -4);
+    if (roll < 90) return snprintf(buf, size, "stabilize #%d", 1 + rand() % 4);
+    if (roll < 94) return snprintf(buf, size, "undo");
+    if (roll < 95) return snprintf(buf, size, "dup #%d 1", id);
+    if (roll < 97) return snprintf(buf, size, "init #%d %d", id, rand() % 25);
+    return snprintf(buf, size, "prev");
+}
+
+char* bench_print_to_string(GameState* state) {
+    char* text = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&text, &len);
+    if (!f) return NULL;
+    batch_print_state(state, f);
+    fclose(f);
+    return text;
+}
+
+/**
+ * Seat a fixed party and run `commands` synthetic session lines through the
+ * batch parser into `recorded` (an initialised, headless state).
+ *
+ * @return Elapsed milliseconds
+ */
+double bench_record_session(GameState* recorded, int commands) {
+    seed_commands(recorded, 12345);
+    char line[256];
+    const char* setup[] = {
+        "add player Ann 15 2 30", "add player Bo 12 1 30", "add player Cy 9 0 30", "add player Di 7 3 30",
+        "add enemy Orc 14 1 80", "add enemy Orc 11 1 80", "add enemy Ogre 8 0 120", "add enemy Imp 16 4 40",
+        "add enemy Imp 6 4 40", "add enemy Wolf 13 2 60", "addmob Rats 10 2 7 200"
+    };
+    double start = bench_now_ns();
+    for (size_t i = 0; i < sizeof(setup) / sizeof(setup[0]); i++) {
+        snprintf(line, sizeof(line), "%s", setup[i]);
+        execute_batch_command(recorded, line, 0);
+    }
+    for (int i = 0; i < commands; i++) {
+        bench_session_line(line, sizeof(line), recorded);
+        execute_batch_command(recorded, line, i + 1);
+    }
+    return (bench_now_ns() - start) / 1e6;
+}
+
+/**
+ * Record a `commands`-long session, then rebuild it from the journal twice:
+ * straight through the reducer, and by running the written journal file as a
+ * batch script. Both must end in the same state.
+ */
+void bench_replay(int commands) {
+    FILE* quiet = fopen("/dev/null", "w");
+    if (!quiet) exit(1);
+
+    GameState recorded;
+    init_state(&recorded);
+    recorded.headless = 1;
+    recorded.err = quiet;
+    recorded.out = quiet;
+    double record_ms = bench_record_session(&recorded, commands);
+    char line[256];
+
+    /* Straight through the reducer */
+    GameState replayed;
+    init_state(&replayed);
+    replayed.headless = 1;
+    replayed.err = quiet;
+    double start = bench_now_ns();
+    for (int i = 0; i < recorded.journal_count; i++) {
+        Command cmd = recorded.journal[i];
+        apply_command(&replayed, &cmd);
+    }
+    double reducer_ms = (bench_now_ns() - start) / 1e6;
+
+    /* Through the written journal, parsed line by line */
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/initiative_bench_%ld.journal", (long)getpid());
+    if (!journal_write(&recorded, path)) exit(1);
+    GameState parsed;
+    init_state(&parsed);
+    parsed.headless = 1;
+    parsed.err = quiet;
+    start = bench_now_ns();
+    FILE* f = fopen(path, "r");
+    if (!f) exit(1);
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        if (line[0] != '#') execute_batch_command(&parsed, line, line_no);
+    }
+    fclose(f);
+    double parsed_ms = (bench_now_ns() - start) / 1e6;
+    unlink(path);
+
+    char* want = bench_print_to_string(&recorded);
+    char* got_reducer = bench_print_to_string(&replayed);
+    char* got_parsed = bench_print_to_string(&parsed);
+    int match = want && got_reducer && got_parsed && strcmp(want, got_reducer) == 0 && strcmp(want, got_parsed) == 0 &&
+                replayed.journal_count == recorded.journal_count && parsed.journal_count == recorded.journal_count;
+
+    printf("%-22s %8d %10d %10.2f %10.2f %10.2f %10.3f %6s\n", "replay", commands, recorded.journal_count,
+        record_ms, reducer_ms, parsed_ms, reducer_ms * 1000.0 / recorded.journal_count, match ? "yes" : "NO");
+
+    free(want);
+    free(got_reducer);
+    free(got_parsed);
+    cleanup_state(&recorded);
+    cleanup_state(&replayed);
+    cleanup_state(&parsed);
+    fclose(quiet);
+    if (!match) exit(1);
+}
+
+/* Pronounceable names share prefixes the way real stat blocks do ("Goblin", "Goblin Boss") */
+void bench_bestiary_name(char* buf, size_t size, int i) {
+    static const char* syllables[] = {"gob", "lin", "or", "ke", "dra", "gon", "sha", "dow", "tro", "ll",
+        "wy", "vern", "ba", "sil", "isk", "mi", "no", "taur", "ske", "ton"};
+    int n = 2 + rand() % 3;
+    size_t len = 0;
+    for (int k = 0; k < n && len < size; k++) {
+        len += (size_t)snprintf(buf + len, size - len, "%s", syllables[rand() % 20]);
+    }
+    if (len < size) snprintf(buf + len, size - len, " %d", i);
+    buf[0] = (char)toupper((unsigned char)buf[0]);
+}
+
+/**
+ * Index build, reopen from the prebuilt index, and autocomplete lookups
+ * over a generated bestiary, against a linear scan of the same index.
+ */
+void bench_bestiary(int entries) {
+    char path[64], index_path[72], name[64];
+    snprintf(path, sizeof(path), "/tmp/initiative_bench_%ld.bestiary", (long)getpid());
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    FILE* f = fopen(path, "w");
+    if (!f) exit(1);
+    fprintf(f, "# name|dex|hp|hp dice|conditions\n");
+    for (int i = 0; i < entries; i++) {
+        bench_bestiary_name(name, sizeof(name), i);
+        int dice = 1 + rand() % 12, sides = 6 + 2 * (rand() % 4);
+        fprintf(f, "%s|%d|%d|%dd%d+%d|%s\n", name, rand() % 7 - 1, dice * (sides + 1) / 2 + dice, dice, sides, dice,
+            (rand() % 10) ? "" : "Invisible");
+    }
+    fclose(f);
+    unlink(index_path);
+
+    Bestiary b;
+    memset(&b, 0, sizeof(b));
+    double start = bench_now_ns();
+    if (bestiary_open(&b, path) != entries) exit(1);
+    double build_ms = (bench_now_ns() - start) / 1e6;
+    bestiary_close(&b);
+    start = bench_now_ns();
+    if (bestiary_open(&b, path) != entries || !b.index_reused) exit(1);
+    double open_us = (bench_now_ns() - start) / 1e3;
+
+    /* Prefixes of 1-4 characters taken from real names, as typed */
+    enum { QUERIES = 4096 };
+    static char prefixes[QUERIES][8];
+    for (int q = 0; q < QUERIES; q++) {
+        BestiaryEntry e;
+        bestiary_entry(&b, rand() % b.count, &e);
+        snprintf(prefixes[q], sizeof(prefixes[q]), "%.*s", 1 + rand() % 4, e.name);
+    }
+
+    double search_ns, suggest_ns, scan_ns;
+    int first;
+    long long queries = 0;
+    start = bench_now_ns();
+    do {
+        for (int q = 0; q < QUERIES; q++) bench_sink += bestiary_search(&b, prefixes[q], &first) + first;
+        queries += QUERIES;
+    } while (bench_now_ns() - start < BENCH_MIN_NS);
+    search_ns = (bench_now_ns() - start) / (double)queries;
+
+    /* What one keystroke costs the add prompt: the search plus parsing the listed names */
+    queries = 0;
+    start = bench_now_ns();
+    do {
+        for (int q = 0; q < QUERIES; q++) {
+            int matches = bestiary_search(&b, prefixes[q], &first);
+            for (int i = 0; i < matches && i < BESTIARY_SUGGESTIONS; i++) {
+                BestiaryEntry e;
+                bestiary_entry(&b, first + i, &e);
+                bench_sink += e.hp;
+            }
+        }
+        queries += QUERIES;
+    } while (bench_now_ns() - start < BENCH_MIN_NS);
+    suggest_ns = (bench_now_ns() - start) / (double)queries;
+
+    queries = 0;
+    start = bench_now_ns();
+    do {
+        for (int q = 0; q < 64; q++) {
+            size_t length = strlen(prefixes[q]);
+            for (int i = 0; i < b.count; i++) bench_sink += bestiary_prefix_cmp(&b, i, prefixes[q], length) == 0;
+        }
+        queries += 64;
+    } while (bench_now_ns() - start < BENCH_MIN_NS);
+    scan_ns = (bench_now_ns() - start) / (double)queries;
+
+    printf("%-22s %8d %10.2f %10.1f %10.1f %10.1f %10.0f %8.0fx\n", "bestiary", entries, build_ms, open_us,
+        search_ns, suggest_ns, scan_ns, scan_ns / search_ns);
+
+    bestiary_close(&b);
+    unlink(path);
+    unlink(index_path);
+}
+
+/* A spreadsheet-style roster (header, extra column, dice, quoted conditions) through the import command */
+void bench_import(int rows) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/initiative_bench_%ld.csv", (long)getpid());
+    FILE* f = fopen(path, "w");
+    if (!f) exit(1);
+    fprintf(f, "name,class,type,init,dex,hp,conditions\n");
+    for (int i = 0; i < rows; i++) {
+        int kind = rand() % 4;
+        if (kind == 0) fprintf(f, "Hero %d,Fighter,player,%d,%d,%d,\n", i, rand() % 20 + 1, rand() % 5, 20 + rand() % 60);
+        else if (kind == 1) fprintf(f, "Goblin %d,,enemy,d20+2,2,2d6,\n", i);
+        else if (kind == 2) fprintf(f, "Orc %d,,enemy,,1,15,\"Poisoned;Prone\"\n", i);
+        else fprintf(f, "Shade %d,,enemy,%d,2,3d8+3,Invisible\n", i, rand() % 20 + 1);
+    }
+    long bytes = ftell(f);
+    fclose(f);
+
+    GameState state;
+    init_state(&state);
+    state.headless = 1;
+    state.err = fopen("/dev/null", "w");
+    if (!state.err) exit(1);
+    Command cmd = make_command(CMD_IMPORT, -1);
+    snprintf(cmd.file.path, sizeof(cmd.file.path), "%s", path);
+    double start = bench_now_ns();
+    int ok = apply_command(&state, &cmd) && state.count == rows;
+    double import_ms = (bench_now_ns() - start) / 1e6;
+
+    printf("%-22s %8d %10.2f %10.2f %10.1f %10.0f %6s\n", "import_roster", rows, (double)bytes / 1e6, import_ms,
+        import_ms * 1e6 / rows, rows / (import_ms / 1e3), ok ? "yes" : "NO");
+
+    fclose(state.err);
+    cleanup_state(&state);
+    unlink(path);
+    if (!ok) exit(1);
+}
+
+/*
+ * Campaign history: what log_event costs the TUI thread with the SQLite
+ * sink attached (the writer runs concurrently), how long until every row
+ * is committed, and a per-combatant damage total with and without its index.
+ */
+void bench_history(int events) {
+#ifndef INITIATIVE_SQLITE
+    printf("%-22s %8d  skipped: build with `make SQLITE=1`\n", "history_sink", events);
+#else
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/initiative_bench_%ld.db", (long)getpid());
+    GameState state;
+    init_state(&state);
+    bench_fill(&state, 40);
+
+    double plain_ns = 0.0, sink_ns = 0.0, disk_ms = 0.0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            state.history = history_start(path);
+            if (!state.history) exit(1);
+        }
+        double start = bench_now_ns();
+        for (int i = 0; i < events; i++) {
+            if (state.log_count >= 10000) state.log_count = 0;
+            Combatant* c = &state.combatants[i % state.count];
+            log_event(&state, c, HISTORY_DAMAGE, 1 + i % 12, "%s took %d damage (%d/%d).", c->name, 1 + i % 12, c->hp, c->max_hp);
+            if (i % 400 == 399) {
+                state.round++;
+                history_snapshot(state.history, &state);
+            }
+        }
+        double elapsed = bench_now_ns() - start;
+        if (pass == 0) {
+            plain_ns = elapsed / events;
+        } else {
+            sink_ns = elapsed / events;
+            history_stop(state.history);  /* Returns once every row is committed */
+            state.history = NULL;
+            disk_ms = (bench_now_ns() - start) / 1e6;
+        }
+    }
+
+    sqlite3* db;
+    if (sqlite3_open(path, &db) != SQLITE_OK) exit(1);
+    double query_ns[2];
+    long long total[2] = {0, 0};
+    const char* queries[2] = {
+        "SELECT SUM(amount) FROM events WHERE combatant = 'bench 7' AND kind = 'damage' AND undone = 0",
+        "SELECT SUM(amount) FROM events NOT INDEXED WHERE combatant = 'bench 7' AND kind = 'damage' AND undone = 0"
+    };
+    for (int q = 0; q < 2; q++) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, queries[q], -1, &stmt, NULL) != SQLITE_OK) exit(1);
+        int runs = 0;
+        double start = bench_now_ns();
+        do {
+            if (sqlite3_step(stmt) == SQLITE_ROW) total[q] = sqlite3_column_int64(stmt, 0);
+            sqlite3_reset(stmt);
+            runs++;
+        } while (bench_now_ns() - start < BENCH_MIN_NS / 4);
+        query_ns[q] = (bench_now_ns() - start) / runs;
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+
+    printf("%-22s %8d %10.1f %10.1f %10.1f %10.0f %10.1f %10.1f %6s\n", "history_sink", events, plain_ns, sink_ns,
+        disk_ms, events / (disk_ms / 1e3), query_ns[0] / 1e3, query_ns[1] / 1e3,
+        total[0] == total[1] && total[0] > 0 ? "yes" : "NO");
+    cleanup_state(&state);
+    unlink(path);
+    char side[80];
+    snprintf(side, sizeof(side), "%s-wal", path);
+    unlink(side);
+    snprintf(side, sizeof(side), "%s-shm", path);
+    unlink(side);
+#endif
+}
+
+ /* --- Core Operation Suite --- */
+
+/*
+ * Per-operation timings of the engine primitives on synthetic rosters from
+ * 10 to 100k combatants. Each case gets an untimed warmup, then
+ * CORE_REPETITIONS timed repetitions of `batch` operations (batch is sized
+ * so one repetition takes about CORE_REPETITION_NS). The untimed reset hook
+ * runs before every repetition so cases that grow or consume state measure
+ * the same work each time. Results print as a table, CSV or JSON.
+ */
+
+/**
+ * Copy the pristine roster back and clear everything a previous repetition
+ * accumulated: log, undo stack, effect entries, expiry heap, name index.
+ */
+void core_restore(CoreBench* b) {
+    GameState* state = &b->state;
+    memcpy(state->combatants, b->base, (size_t)b->n * sizeof(Combatant));
+    state->count = b->n;
+    state->next_id = b->n + 1;
+    state->round = 1;
+    state->log_count = 0;
+    state->undo_count = 0;
+    effect_store_clear(&state->effect_store);
+    name_index_clear(state);
+    name_index_rebuild(state);
+    eligible_rebuild(state);
+    scheduler_rebuild(state);
+}
+
+uint32_t core_next(CoreBench* b) {
+    b->rng ^= b->rng << 13;
+    b->rng ^= b->rng >> 17;
+    b->rng ^= b->rng << 5;
+    return b->rng;
+}
+
+void core_reset_log(CoreBench* b) {
+    b->state.log_count = 0;
+}
+
+void core_reset_shuffle(CoreBench* b) {
+    core_restore(b);
+    Combatant* c = b->state.combatants;
+    for (int i = b->n - 1; i > 0; i--) {
+        int j = (int)(core_next(b) % (uint32_t)(i + 1));
+        Combatant t = c[i];
+        c[i] = c[j];
+        c[j] = t;
+    }
+}
+
+/*
+ * Every combatant gets a condition that runs out within the next 10 rounds.
+ * Timers are written directly and queued in one rebuild: going through
+ * set_condition_expiry() would time its per-call lookups as setup.
+ */
+void core_reset_expiry(CoreBench* b) {
+    core_restore(b);
+    for (int i = 0; i < b->n; i++) {
+        Combatant* c = &b->state.combatants[i];
+        effect_assign(&b->state, c, b->poisoned, 1);
+        add_effect_timer(&b->state, c, b->poisoned, b->state.round + 1 + i % 10, EXPIRE_ROUND_START, -1);
+    }
+    scheduler_rebuild(&b->state);
+}
+
+void core_reset_save_file(CoreBench* b) {
+    core_restore(b);
+    if (!save_state_to_path(&b->state, CORE_SAVE_PATH)) {
+        fprintf(stderr, "bench: cannot write %s\n", CORE_SAVE_PATH);
+        exit(1);
+    }
+}
+
+void core_reset_json_file(CoreBench* b) {
+    core_restore(b);
+    if (!save_state_to_path(&b->state, CORE_JSON_PATH)) {
+        fprintf(stderr, "bench: cannot write %s\n", CORE_JSON_PATH);
+        exit(1);
+    }
+}
+
+void core_reset_autosave(CoreBench* b) {
+    core_reset_log(b);
+    if (b->autosave) return;
+    b->autosave = autosave_start(&b->state, CORE_AUTOSAVE_PATH, AUTOSAVE_INTERVAL_S, AUTOSAVE_CHANGES);
+    if (!b->autosave) {
+        fprintf(stderr, "bench: cannot start the autosave thread\n");
+        exit(1);
+    }
+}
+
+/* Re-sort after one initiative change - what the tracker does on every add or reroll */
+void core_op_sort(CoreBench* b) {
+    b->state.combatants[core_next(b) % (uint32_t)b->n].initiative = (int)(core_next(b) % 25);
+    sort_combatants(&b->state);
+}
+
+void core_op_sort_shuffled(CoreBench* b) {
+    sort_combatants(&b->state);
+}
+
+void core_op_lookup(CoreBench* b) {
+    bench_sink += get_index_by_id(&b->state, 1 + (int)(core_next(b) % (uint32_t)b->n));
+}
+
+void core_op_log(CoreBench* b) {
+    log_action(&b->state, "%s takes %d damage.", b->state.combatants[0].name, (int)(b->op & 63));
+}
+
+void core_op_snapshot(CoreBench* b) {
+    save_undo_state(&b->state);
+}
+
+void core_op_undo(CoreBench* b) {
+    save_undo_state(&b->state);
+    undo_last_action(&b->state);
+}
+
+void core_op_expire_round(CoreBench* b) {
+    b->state.round++;
+    decrement_condition_durations(&b->state);
+}
+
+void core_op_duplicate(CoreBench* b) {
+    bench_sink += duplicate_at(&b->state, (int)(core_next(b) % (uint32_t)b->n), 1);
+}
+
+void core_op_save(CoreBench* b) {
+    bench_sink += save_state_to_path(&b->state, CORE_SAVE_PATH);
+}
+
+void core_op_load(CoreBench* b) {
+    bench_sink += load_state_from_path(&b->state, CORE_SAVE_PATH);
+}
+
+void core_op_save_json(CoreBench* b) {
+    bench_sink += save_state_to_path(&b->state, CORE_JSON_PATH);
+}
+
+void core_op_load_json(CoreBench* b) {
+    bench_sink += load_state_from_path(&b->state, CORE_JSON_PATH);
+}
+
+/* The UI-thread share of an autosave; the writer thread saves in the background */
+void core_op_autosave(CoreBench* b) {
+    autosave_publish(b->autosave, &b->state);
+}
+
+static const CoreCase core_cases[] = {
+    {"sort_combatants", core_restore, core_op_sort, 0, 0},
+    {"sort_shuffled", core_reset_shuffle, core_op_sort_shuffled, 1, 0},
+    {"get_index_by_id", NULL, core_op_lookup, 0, 0},
+    {"log_action", core_reset_log, core_op_log, 0, 0},
+    {"save_undo_state", core_reset_log, core_op_snapshot, 0, 0},
+    {"undo_last_action", core_reset_log, core_op_undo, 0, 0},
+    {"decrement_durations", core_reset_expiry, core_op_expire_round, 10, 0},
+    {"duplicate_at", core_restore, core_op_duplicate, 0, 1},
+    {"save_state", core_reset_log, core_op_save, 0, 0},
+    {"load_state", core_reset_save_file, core_op_load, 0, 0},
+    {"save_json", core_reset_log, core_op_save_json, 0, 0},
+    {"load_json", core_reset_json_file, core_op_load_json, 0, 0},
+    {"autosave_publish", core_reset_autosave, core_op_autosave, 0, 0},
+};
+
+/**
+ * Run one repetition: reset (untimed), then `batch` operations.
+ *
+ * @return Nanoseconds per operation
+ */
+double core_repetition(CoreBench* b, const CoreCase* cc, int batch) {
+    if (cc->reset) cc->reset(b);
+    double start = bench_now_ns();
+    for (int i = 0; i < batch; i++) {
+        cc->op(b);
+        b->op++;
+    }
+    return (bench_now_ns() - start) / (double)batch;
+}
+
+void core_run_case(const CoreCase* cc, int n, CoreResult* result) {
+    CoreBench b;
+    memset(&b, 0, sizeof(b));
+    init_state(&b.state);
+    b.state.headless = 1;
+    b.state.err = fopen("/dev/null", "w");
+    b.state.out = b.state.err;
+    b.n = n;
+    b.rng = 2463534242u;
+    b.poisoned = find_effect_by_name(&b.state, "Poisoned");
+    srand(12345);
+    bench_fill(&b.state, n);
+    b.base = (Combatant*)malloc((size_t)n * sizeof(Combatant));
+    if (!b.state.err || !b.base) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    memcpy(b.base, b.state.combatants, (size_t)n * sizeof(Combatant));
+    core_restore(&b);
+
+    /* Size the batch from one operation, then keep resizing it while warming up */
+    int limit = cc->max_batch > 0 ? cc->max_batch : 1000000;
+    if (cc->grows_roster && n / 10 < limit) limit = n / 10 > 0 ? n / 10 : 1;
+    double per_op = core_repetition(&b, cc, 1);
+    int batch = 1;
+    double warm_start = bench_now_ns();
+    do {
+        double want = CORE_REPETITION_NS / (per_op > 1.0 ? per_op : 1.0);
+        batch = want < 1.0 ? 1 : (want > (double)limit ? limit : (int)want);
+        per_op = core_repetition(&b, cc, batch);
+    } while (bench_now_ns() - warm_start < CORE_WARMUP_NS);
+
+    /* Slow cases stop early once over budget, but never below the minimum */
+    double samples[CORE_REPETITIONS];
+    double sum = 0.0;
+    int reps = 0;
+    double case_start = bench_now_ns();
+    while (reps < CORE_REPETITIONS &&
+           (reps < CORE_MIN_REPETITIONS || bench_now_ns() - case_start < CORE_CASE_BUDGET_NS)) {
+        samples[reps] = core_repetition(&b, cc, batch);
+        sum += samples[reps++];
+    }
+    qsort(samples, (size_t)reps, sizeof(double), bench_compare_double);
+
+    result->name = cc->name;
+    result->n = n;
+    result->batch = batch;
+    result->repetitions = reps;
+    result->median_ns = samples[reps / 2];
+    result->min_ns = samples[0];
+    result->max_ns = samples[reps - 1];
+    result->mean_ns = sum / reps;
+
+    autosave_stop(b.autosave, &b.state);
+    free(b.base);
+    fclose(b.state.err);
+    cleanup_state(&b.state);
+}
+
+void core_print_result(const CoreResult* r, BenchFormat format, int first) {
+    switch (format) {
+        case BENCH_CSV:
+            printf("%s,%d,%d,%d,%.1f,%.1f,%.1f,%.1f\n", r->name, r->n, r->batch, r->repetitions,
+                r->median_ns, r->min_ns, r->max_ns, r->mean_ns);
+            break;
+        case BENCH_JSON:
+            printf("%s    {\"case\": \"%s\", \"n\": %d, \"batch\": %d, \"repetitions\": %d, "
+                "\"median_ns\": %.1f, \"min_ns\": %.1f, \"max_ns\": %.1f, \"mean_ns\": %.1f}",
+                first ? "" : ",\n", r->name, r->n, r->batch, r->repetitions,
+                r->median_ns, r->min_ns, r->max_ns, r->mean_ns);
+            break;
+        default:
+            printf("%-22s %8d %8d %5d %12.1f %12.1f %12.1f %12.1f\n", r->name, r->n, r->batch, r->repetitions,
+                r->median_ns, r->min_ns, r->max_ns, r->mean_ns);
+            break;
+    }
+    fflush(stdout);
+}
+
+void bench_core(BenchFormat format) {
+    const int sizes[] = {10, 100, 1000, 10000, 100000};
+    switch (format) {
+        case BENCH_CSV:
+            printf("case,n,batch,repetitions,median_ns,min_ns,max_ns,mean_ns\n");
+            break;
+        case BENCH_JSON:
+            printf("{\n  \"suite\": \"core\",\n  \"compiler\": \"%s\",\n  \"unit\": \"ns/op\",\n  \"results\": [\n",
+                __VERSION__);
+            break;
+        default:
+            printf("%-22s %8s %8s %5s %12s %12s %12s %12s\n", "case", "n", "batch", "reps", "median ns", "min ns",
+                "max ns", "mean ns");
+            break;
+    }
+    int first = 1;
+    for (size_t c = 0; c < sizeof(core_cases) / sizeof(core_cases[0]); c++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            /* A full roster would only time the "List full" refusal */
+            if (core_cases[c].grows_roster && sizes[s] >= MAX_COMBATANTS) continue;
+            CoreResult result;
+            core_run_case(&core_cases[c], sizes[s], &result);
+            core_print_result(&result, format, first);
+            first = 0;
+        }
+    }
+    if (format == BENCH_JSON) printf("\n  ]\n}\n");
+    unlink(CORE_SAVE_PATH);
+    unlink(CORE_AUTOSAVE_PATH);
+    unlink(CORE_JSON_PATH);
+}
+
+int main(int argc, char** argv) {
+    srand(12345);
+
+    /* `--session <path> [commands]` writes a synthetic journal for `make replaytest` */
+    if (argc >= 3 && strcmp(argv[1], "--session") == 0) {
+        GameState recorded;
+        init_state(&recorded);
+        recorded.headless = 1;
+        recorded.err = fopen("/dev/null", "w");
+        recorded.out = recorded.err;
+        if (!recorded.err) return 1;
+        bench_record_session(&recorded, argc >= 4 ? atoi(argv[3]) : 10000);
+        int ok = journal_write(&recorded, argv[2]);
+        fclose(recorded.err);
+        cleanup_state(&recorded);
+        return ok ? 0 : 1;
+    }
+
+    /* `--format csv|json` prints only the core suite, machine-readable */
+    BenchFormat format = BENCH_TEXT;
+    if (argc >= 3 && strcmp(argv[1], "--format") == 0) {
+        if (strcmp(argv[2], "csv") == 0) {
+            format = BENCH_CSV;
+        } else if (strcmp(argv[2], "json") == 0) {
+            format = BENCH_JSON;
+        } else if (strcmp(argv[2], "text") != 0) {
+            fprintf(stderr, "Usage: %s [--format text|csv|json] | --session <path> [commands]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (format != BENCH_TEXT) {
+        bench_core(format);
+        return 0;
+    }
+
+    /* The mirror is only built on demand, so a real query pays hot_sync() too */
+    printf("%-22s %8s %10s %10s %9s %10s %9s\n", "case", "n", "aos ns/c", "soa ns/c", "speedup", "sync+soa", "real");
+    const int sizes[] = {1000, 10000, 100000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_layouts(sizes[i]);
+    }
+
+    printf("\n%-22s %8s %10s %10s %9s\n", "case", "n", "ns/elem", "", "vs scalar");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench_hp_kernels(sizes[i]);
+    }
+
+    printf("\n%-22s %8s %10s %10s %10s %10s %8s %8s %5s\n", "case", "viewers", "publish us", "fill us",
+        "p50 us", "p99 us", "delta B", "key B", "drop");
+    const int viewer_counts[] = {1, 50, 500};
+    for (size_t i = 0; i < sizeof(viewer_counts) / sizeof(viewer_counts[0]); i++) {
+        bench_broadcast(viewer_counts[i], 40);
+    }
+
+    printf("\n%-22s %8s %10s %10s %10s %10s %10s %6s\n", "case", "commands", "journaled", "record ms",
+        "reduce ms", "parse ms", "us/cmd", "match");
+    bench_replay(10000);
+    bench_replay(100000);
+
+    printf("\n%-22s %8s %10s %10s %10s %10s %10s %9s\n", "case", "entries", "build ms", "open us",
+        "search ns", "suggest ns", "scan ns", "vs scan");
+    bench_bestiary(5000);
+    bench_bestiary(50000);
+
+    printf("\n%-22s %8s %10s %10s %10s %10s %6s\n", "case", "rows", "file MB", "import ms", "ns/row", "rows/s", "count");
+    bench_import(10000);
+    bench_import(100000);
+
+    printf("\n%-22s %8s %10s %10s %10s %10s %10s %10s %6s\n", "case", "events", "log ns", "+sink ns", "on disk ms",
+        "rows/s", "query us", "scan us", "match");
+    bench_history(10000);
+    bench_history(200000);
+
+    printf("\n");
+    bench_core(BENCH_TEXT);
+    return 0;
+}
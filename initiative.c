@@ -3,10 +3,19 @@
  *
  * Compile: gcc initiative.c -lncurses -o initiative
  * Run: ./initiative
+ *      ./initiative --batch script.txt   (or --batch - for stdin)
+ *      ./initiative --serve [socket]      (host many tables over a Unix socket)
+ *      ./initiative --client <table> [socket]
+ *      ./initiative --viewer [address]    (player-facing view of a running tracker)
+ *      ./initiative --broadcast <address> (stream the player view to spectators)
+ *      ./initiative --history [database] (campaign history in SQLite; build with make SQLITE=1)
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ncurses.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdint.h>
@@ -14,12 +23,150 @@
 #include <time.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Server mode multiplexes clients with epoll, so it is Linux-only */
+#ifdef __linux__
+#define SERVER_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
+/* SIMD HP kernels are built for x86 with GCC/Clang and picked at runtime */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define HP_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+/* The campaign history sink needs SQLite; `make SQLITE=1` builds it in */
+#ifdef INITIATIVE_SQLITE
+#include <sqlite3.h>
+#endif
 
-#define MAX_COMBATANTS 50
+/*
+ * USDT probes (provider "initiative") for perf, bpftrace and SystemTap.
+ * Each site is a nop plus an ELF .note.stapsdt entry naming it, its arguments
+ * and its semaphore. A tracer bumps the semaphore while it is attached, and
+ * the site is skipped - arguments included - while it is zero, so a detached
+ * probe costs one predicted branch. Arguments are all 64-bit. Build with
+ * `make PROBES=0` to leave them out entirely.
+ */
+#if !defined(INITIATIVE_NO_PROBES) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define INITIATIVE_PROBES 1
+#define PROBE_NOTE_(name, args)                                                   \
+    "990: nop\n"                                                                  \
+    ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                  \
+    ".balign 4\n"                                                                 \
+    ".4byte 992f-991f, 994f-993f, 3\n"                                            \
+    "991: .asciz \"stapsdt\"\n"                                                   \
+    "992: .balign 4\n"                                                            \
+    "993: .8byte 990b\n"                                                          \
+    ".8byte _.stapsdt.base\n"                                                     \
+    ".8byte initiative_" #name "_semaphore\n"                                     \
+    ".asciz \"initiative\"\n"                                                     \
+    ".asciz \"" #name "\"\n"                                                      \
+    ".asciz \"" args "\"\n"                                                       \
+    "994: .balign 4\n"                                                            \
+    ".popsection\n"                                                               \
+    ".ifndef _.stapsdt.base\n"                                                    \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"       \
+    ".weak _.stapsdt.base\n"                                                      \
+    ".hidden _.stapsdt.base\n"                                                    \
+    "_.stapsdt.base: .space 1\n"                                                  \
+    ".size _.stapsdt.base, 1\n"                                                   \
+    ".popsection\n"                                                               \
+    ".endif\n"
+#define PROBE_ARG_(x) "nor"((long long)(x))
+#define PROBE_SEMAPHORE_(name) \
+    volatile unsigned short initiative_##name##_semaphore __attribute__((unused, section(".probes")))
+#define PROBE_ENABLED(name) __builtin_expect(initiative_##name##_semaphore != 0, 0)
+#define PROBE2(name, a, b) do { if (PROBE_ENABLED(name)) \
+    __asm__ __volatile__(PROBE_NOTE_(name, "-8@%0 -8@%1") :: PROBE_ARG_(a), PROBE_ARG_(b)); } while (0)
+#define PROBE3(name, a, b, c) do { if (PROBE_ENABLED(name)) \
+    __asm__ __volatile__(PROBE_NOTE_(name, "-8@%0 -8@%1 -8@%2") :: PROBE_ARG_(a), PROBE_ARG_(b), \
+        PROBE_ARG_(c)); } while (0)
+#define PROBE4(name, a, b, c, d) do { if (PROBE_ENABLED(name)) \
+    __asm__ __volatile__(PROBE_NOTE_(name, "-8@%0 -8@%1 -8@%2 -8@%3") :: PROBE_ARG_(a), PROBE_ARG_(b), \
+        PROBE_ARG_(c), PROBE_ARG_(d)); } while (0)
+/* Timestamps taken only to feed a probe argument, 0 while nothing is attached */
+#define PROBE_CLOCK(name) (PROBE_ENABLED(name) ? trace_now_ns() : (uint64_t)0)
+
+PROBE_SEMAPHORE_(next_turn);
+PROBE_SEMAPHORE_(hp_change);
+PROBE_SEMAPHORE_(death_save);
+PROBE_SEMAPHORE_(log_action);
+PROBE_SEMAPHORE_(save_state);
+PROBE_SEMAPHORE_(load_state);
+PROBE_SEMAPHORE_(draw_ui);
+#else
+/* sizeof keeps the arguments "used" without evaluating them */
+#define PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(name, a, b, c) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+#define PROBE4(name, a, b, c, d) do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); (void)sizeof(d); } while (0)
+#define PROBE_CLOCK(name) ((uint64_t)0)
+#endif
+
+#define MAX_COMBATANTS 100000 /* Sanity limit - storage grows on demand */
+#define INITIAL_COMBATANT_CAPACITY 16
 #define NAME_LENGTH 32
-#define NUM_CONDITIONS 15
+#define NUM_CONDITIONS 15          /* Built-in conditions - always the first registry entries */
+#define MAX_EFFECTS 256            /* Registry limit - only the first 64 are stored inline per combatant */
+#define EFFECT_NAME_LENGTH 24
+#define UNCONSCIOUS_INDEX 13       /* condition_data index of COND_UNCONSCIOUS */
+#define EFFECTS_FILE_NAME ".dnd_tracker_effects.txt"
+#define HP_KERNEL_LIMIT (1 << 29)  /* |hp|, max_hp and |delta| bound so kernel sums fit in 32 bits */
 #define SAVE_FILE_NAME ".dnd_tracker_save.txt"
 #define LOG_EXPORT_FILE_NAME "combat_log_export.txt"
+#define JOURNAL_FILE_NAME ".dnd_tracker_journal.txt"
+#define AUTOSAVE_FILE_NAME ".dnd_tracker_autosave.txt"
+#define LIBRARY_DIR_NAME ".dnd_tracker_library"
+#define BESTIARY_FILE_NAME ".dnd_tracker_bestiary.txt"  /* Its index is written beside it as <file>.idx */
+#define BESTIARY_INDEX_MAGIC 0x32584942u            /* "BIX2" */
+#define BESTIARY_MAX_LINE 1023                       /* Longer stat block lines are skipped */
+#define BESTIARY_SUGGESTIONS 8                       /* Matches listed above the name prompt */
+#define IMPORT_MAX_FIELDS 32          /* Columns past this are ignored */
+#define IMPORT_MAX_REPORTED 10        /* Bad rows reported one by one, the rest only counted */
+#define SAVE_JSON_FORMAT "initiative-save"   /* "format" of a JSON save */
+#define SAVE_JSON_VERSION 1
+#define JSON_WRITE_BUFFER 16384       /* Bytes buffered before a write */
+#define JSON_MAX_DEPTH 32
+#define LIBRARY_INDEX_NAME "index.txt"
+#define LIBRARY_INDEX_HEADER "# initiative save library v1"
+#define AUTOSAVE_INTERVAL_S 30       /* Pending changes are saved at least this often */
+#define AUTOSAVE_CHANGES 10          /* ...or as soon as this many commands have piled up */
+#define HISTORY_FILE_NAME ".dnd_tracker_history.db"
+#define HISTORY_BATCH_ROWS 256       /* Queued rows that wake the history writer early */
+#define HISTORY_FLUSH_MS 1000        /* Otherwise it commits whatever is queued this often */
+#define HISTORY_MAX_QUEUED 65536     /* Rows past this are dropped while the database is stuck */
+#define COMMAND_PATH_LENGTH 256
+#define INITIAL_JOURNAL_CAPACITY 256
+#define SOCKET_FILE_NAME ".dnd_tracker.sock"
+#define TABLE_NAME_LENGTH 32
+#define SERVER_MAX_LINE 1024         /* Matches the batch script line limit */
+#define SERVER_MAX_PENDING (1 << 20) /* Unsent reply bytes before a client's reads pause */
+#define SERVER_MAX_EVENTS 64
+#define SERVER_INITIAL_TABLES 64     /* Table hash slots - doubles at 50% load */
+#define VIEW_SHM_PREFIX "/dnd_tracker_view"
+#define VIEW_MAX_ENTRIES 256
+#define VIEW_MAGIC 0x31565444u       /* "DTV1" */
+#define VIEW_POLL_MS 100
+#define VIEW_CONDITION_MASK ((1u << NUM_CONDITIONS) - 1)
+#define BROADCAST_KEYFRAME_INTERVAL 64     /* Frames between full keyframes */
+#define BROADCAST_MAX_PENDING (256 * 1024) /* Unsent bytes before a spectator is dropped */
+#define MAX_MOB_UNITS 10000       /* Units per mob entry */
+#define MAX_MOB_UNIT_HP 65535     /* Unit HP is packed into 16 bits */
+#define MOB_HIST_BUCKETS 5        /* Dead, <=25%, <=50%, <=75%, >75% */
 #define MAX_MESSAGE_QUEUE 5
 #define MESSAGE_DISPLAY_TIME 1500 /* milliseconds */
 #define MESSAGE_DISPLAY_DURATION_SECONDS 1.5 /* seconds - matches MESSAGE_DISPLAY_TIME */
@@ -28,7 +175,10 @@
 typedef enum {
     MODE_COMBAT = 0,
     MODE_CONDITIONS = 1,
-    MODE_HELP = 2
+    MODE_HELP = 2,
+    MODE_ARCHIVE = 3,
+    MODE_STATS = 4,
+    MODE_LIBRARY = 5
 } AppMode;
 
 /* Conditions as bit flags - synchronized with condition_data array */
@@ -83,6 +233,45 @@ typedef enum {
     TYPE_ENEMY = 1
 } CombatantType;
 
+/* When a timed condition runs out */
+typedef enum {
+    EXPIRE_ROUND_START = 0,  /* At the start of its expiry round */
+    EXPIRE_TURN_START = 1,   /* At the start of the anchor combatant's turn */
+    EXPIRE_TURN_END = 2      /* At the end of the anchor combatant's turn */
+} ExpiryTiming;
+
+/* Bits of registry entries 64 and up: one pooled word per 64-effect block
+ * with anything set, chained in ascending block order */
+typedef struct {
+    uint64_t bits;
+    int block;      /* Covers effects block*64 .. block*64+63, block >= 1 */
+    int next;       /* Next word of the same combatant, 0 at the end */
+} EffectWord;
+
+/* A timed effect - only effects with a duration get an entry */
+typedef struct {
+    int effect;
+    int expires;    /* Round the effect ends in */
+    int timing;     /* ExpiryTiming */
+    int anchor_id;  /* Combatant whose turn ends it (turn timings), -1 otherwise */
+    int next;       /* Next timer of the same combatant, 0 at the end */
+} EffectTimer;
+
+/* Out-of-line effect storage for the roster and the archive. Entries are
+ * chained from their combatant and recycled through a free list, so memory
+ * follows the effects actually set. Entry 0 is never handed out: a zeroed
+ * Combatant owns nothing. */
+typedef struct {
+    EffectWord* words;
+    int word_count;      /* High-water mark, entry 0 included */
+    int word_capacity;
+    int word_free;       /* Free list head, 0 if empty */
+    EffectTimer* timers;
+    int timer_count;
+    int timer_capacity;
+    int timer_free;
+} EffectStore;
+
 typedef struct {
     int id;
     char name[NAME_LENGTH];
@@ -91,15 +280,107 @@ typedef struct {
     int max_hp;
     int hp;
     CombatantType type;
-    uint16_t conditions;
-    int condition_duration[NUM_CONDITIONS];
+    uint64_t effects;    /* Registry entries 0..63, built-in conditions first */
+    int word_first;      /* Pooled bitset words for entries 64 and up (state->effect_store), 0 if none */
+    int timer_first;     /* Pooled durations, oldest first, 0 if none */
     /* Death Save Tracking */
     int death_save_successes;
     int death_save_failures;
     int is_stable;  /* 1 if stable at 0 HP, 0 otherwise */
     int is_dead;    /* 1 if dead, 0 otherwise */
+    int is_marked;  /* 1 if part of the multi-select for group operations */
+    /* Mob (swarm) data - mob_size is 0 for ordinary combatants */
+    int mob_size;        /* Number of units sharing this initiative slot */
+    int mob_first;       /* Index of the first unit in state->mob_units */
+    int mob_unit_max_hp; /* Max HP of each unit (max_hp/hp hold the pool totals) */
+    int is_expanded;     /* 1 if the mob row is expanded to list its units */
 } Combatant;
 
+/* One unit of a mob - packed so large hordes stay cheap */
+typedef struct {
+    uint16_t hp;
+    uint16_t conditions;
+} MobUnit;
+
+/* How a mob HP change is distributed across its units */
+typedef enum {
+    MOB_TARGET_FOCUS = 0,   /* Damage spills over unit by unit; healing fills units in order */
+    MOB_TARGET_SPREAD = 1,  /* Split evenly across living units */
+    MOB_TARGET_ALL = 2,     /* Every living unit takes the full change (area effects) */
+    MOB_TARGET_UNIT = 3     /* One specific unit */
+} MobTarget;
+
+/* Outcome flags returned by apply_hp_change */
+enum {
+    HP_RESULT_DOWNED  = (1 << 0),  /* Player dropped to 0 HP */
+    HP_RESULT_DIED    = (1 << 1),  /* Became dead (instant death, failures, enemy at 0) */
+    HP_RESULT_REVIVED = (1 << 2)   /* Player back above 0 HP */
+};
+
+/* Turn skip policies - bits of GameState.skip_policy */
+enum {
+    SKIP_DEAD = (1 << 0),           /* Dead players, enemies at 0 HP, wiped-out mobs */
+    SKIP_STABLE = (1 << 1),         /* Stable players at 0 HP */
+    SKIP_INCAPACITATED = (1 << 2)   /* Any condition that includes Incapacitated */
+};
+
+/* Conditions that include Incapacitated (5e) - bits of the first effect word */
+#define INCAPACITATING_CONDITIONS (COND_INCAPACITATED | COND_STUNNED | COND_PARALYZED | \
+                                   COND_PETRIFIED | COND_UNCONSCIOUS)
+
+/* Filters for mark_matching */
+typedef enum {
+    MARK_PLAYERS = 0,
+    MARK_ENEMIES = 1,
+    MARK_PREFIX = 2
+} MarkFilter;
+
+/* Hot Fields - structure-of-arrays copy of the fields bulk queries read.
+ * Built on demand by hot_sync() for `query`; mutations do not keep it
+ * current, the combatant array stays the storage. Index i mirrors combatants[i]. */
+enum {
+    HOT_PLAYER = (1 << 0),
+    HOT_DEAD   = (1 << 1),
+    HOT_STABLE = (1 << 2),
+    HOT_MARKED = (1 << 3),
+    HOT_MOB    = (1 << 4)
+};
+
+/* HP display bands computed by hot_classify_hp */
+typedef enum {
+    HP_BAND_GOOD = 0,
+    HP_BAND_HURT = 1,         /* <= 50% */
+    HP_BAND_CRITICAL = 2,     /* <= 25% */
+    HP_BAND_UNCONSCIOUS = 3,  /* Player at 0 HP */
+    HP_BAND_DEAD = 4
+} HpBand;
+
+typedef struct {
+    int* id;
+    int* hp;
+    int* max_hp;
+    int* initiative;
+    uint64_t* conditions;  /* First effect word - holds the built-in conditions */
+    uint8_t* flags;        /* HOT_* bits */
+    uint8_t* hp_band;      /* HpBand */
+    int count;
+    int capacity;
+} HotFields;
+
+/* Bulk HP kernel output - bit i of word i/64 describes element i.
+ * Elements with any bit set need the full apply_hp_change rules. */
+typedef struct {
+    uint64_t* downed;       /* Was above 0 HP, now at 0 (includes instant deaths) */
+    uint64_t* instant;      /* Overkill >= max HP - 5e instant death */
+    uint64_t* revived;      /* Was at or below 0 HP, now above */
+    uint64_t* hit_at_zero;  /* Took damage while already at 0 HP (death save failures) */
+} HpKernelMasks;
+
+/* new_hp = clamp(hp + delta, 0, max_hp) for n elements, setting HpKernelMasks bits.
+ * Mask words must be zeroed by the caller. */
+typedef void (*HpKernelFn)(const int* hp, const int* max_hp, const int* delta,
+                           int* new_hp, int n, HpKernelMasks* masks);
+
 /* Log Entry Structure */
 typedef struct {
     int round;
@@ -110,15 +391,98 @@ typedef struct {
 
 /* Undo State Structure - Stores a snapshot of key data for undo */
 typedef struct {
-    Combatant combatants[MAX_COMBATANTS];
+    Combatant* combatants;  /* Heap buffer, reused between snapshots */
+    int capacity;
     int count;
+    MobUnit* mob_units;     /* Heap buffer, reused between snapshots */
+    int mob_unit_capacity;
+    int mob_unit_count;
+    EffectStore effects;    /* Copy of state->effect_store, buffers reused too */
     int current_turn_id;
     int selected_id;
     int round;
+    int archive_count;      /* Archive is append-only - undo truncates back to these */
+    int archive_unit_count;
+    int archive_epoch;
+    int step;               /* undo_step this snapshot opened */
 } UndoState;
 
 #define MAX_UNDO_STACK 10 /* Keep the last 10 states */
 
+/* Name Index - maps a base name ("Goblin") to its highest numeric suffix ("Goblin 7") */
+typedef struct {
+    char base[NAME_LENGTH];
+    int highest;
+    int used;
+} NameIndexEntry;
+
+typedef struct {
+    NameIndexEntry* slots;  /* Open addressing, linear probing */
+    int capacity;           /* Power of two, 0 until first use */
+    int count;
+} NameIndex;
+
+#define NAME_INDEX_INITIAL_CAPACITY 64
+
+/* Effect Registry - built-in conditions followed by custom effects (Bless, Hex, ...) */
+typedef struct {
+    char (*names)[EFFECT_NAME_LENGTH];
+    int count;
+    int capacity;
+} EffectRegistry;
+
+/* Expiry Scheduler - min-heaps of pending condition expiries ordered by (round, timing).
+ * `rounds` holds every expiry and drives the start of each round. Turn expiries
+ * are also queued under their anchor, so a turn pops only its own. Entries are
+ * never updated in place: changing or clearing a duration just leaves a stale
+ * entry behind, which is discarded when it is popped. Timers that never run
+ * out (expires == INT_MAX) are not queued at all. */
+typedef struct {
+    int round;
+    int timing;     /* ExpiryTiming */
+    int target_id;
+    int anchor_id;
+    int effect;     /* -1 once fired */
+} ExpiryEvent;
+
+typedef struct {
+    ExpiryEvent* heap;
+    int count;
+    int capacity;
+} ExpiryHeap;
+
+typedef struct {
+    int anchor_id;            /* 0 marks an empty slot */
+    ExpiryHeap turn[2];       /* EXPIRE_TURN_START, EXPIRE_TURN_END */
+} ExpiryAnchor;
+
+typedef struct {
+    ExpiryHeap rounds;
+    ExpiryAnchor* anchors;    /* Open addressing by anchor id, linear probing */
+    int anchor_capacity;      /* Power of two, 0 until first use */
+    int anchor_count;
+} ExpiryScheduler;
+
+#define EXPIRY_ANCHOR_INITIAL_CAPACITY 64
+
+/* Cold Archive - dead and removed combatants, kept out of the turn order.
+ * Append-only: restoring an entry just stamps it, so undo can truncate the
+ * archive and clear newer stamps instead of copying it into every snapshot.
+ * Past ARCHIVE_LIMIT entries the oldest ones undo can no longer reach are dropped. */
+#define ARCHIVE_LIMIT 1024
+
+typedef enum {
+    ARCHIVE_DEAD = 0,
+    ARCHIVE_REMOVED = 1
+} ArchiveReason;
+
+typedef struct {
+    Combatant combatant;  /* For mobs, mob_first indexes state->archive_units */
+    int round;            /* Round it was archived in */
+    ArchiveReason reason;
+    int restored_epoch;   /* Nonzero once restored (archive_epoch at the time) */
+} ArchiveEntry;
+
 /* Message Queue Structure */
 typedef struct {
     char text[128];
@@ -126,8 +490,318 @@ typedef struct {
     time_t timestamp;
 } MessageQueueEntry;
 
+/* Player View - what a player-facing screen may show about one combatant.
+ * Enemies carry only a coarse HP band (never numbers) and only the standard
+ * conditions are published, since custom effects are often DM notes. */
+enum {
+    VIEW_CURRENT = (1 << 0),
+    VIEW_STABLE  = (1 << 1),
+    VIEW_MOB     = (1 << 2)
+};
+
+typedef struct {
+    char name[NAME_LENGTH];
+    int id;
+    uint32_t conditions;         /* Bit i = condition_data[i] */
+    int hp, max_hp;              /* Players only - zero for enemies */
+    uint8_t type;                /* CombatantType */
+    uint8_t band;                /* HpBand; enemies report GOOD, HURT or DEAD */
+    uint8_t flags;               /* VIEW_* bits */
+    uint8_t death_successes, death_failures;
+    uint16_t mob_alive;
+} ViewEntry;
+
+typedef struct {
+    int writer_pid;              /* 0 once the tracker has exited */
+    int round;
+    int count;                   /* Entries published */
+    int total;                   /* Combatants in the encounter */
+    ViewEntry entries[VIEW_MAX_ENTRIES];
+} ViewData;
+
+/* Shared-memory segment: the tracker is the only writer, viewers never
+ * write, so a seqlock lets readers copy a consistent snapshot without
+ * ever making the tracker wait. */
+typedef struct {
+    uint32_t magic;
+    uint32_t size;               /* sizeof(ViewSnapshot) - rejects mismatched builds */
+    _Atomic uint64_t seq;        /* Odd while a write is in progress */
+    ViewData data;
+} ViewSnapshot;
+
+/* Broadcast - one spectator connection, owned by the broadcaster thread */
+typedef struct {
+    int fd;
+    char* out;
+    size_t out_len, out_off, out_cap;
+    int want_out;                /* Registered for EPOLLOUT */
+} BroadcastClient;
+
+typedef struct {
+    char* data;
+    size_t len, cap;
+} BroadcastBuffer;
+
+/* Streams the player view to spectators as keyframes plus typed deltas.
+ * The DM thread only copies its snapshot into `pending`; diffing, encoding
+ * and all socket I/O happen on the broadcaster thread. */
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    int wake_pipe[2];            /* Submit and stop wake the thread through this */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    ViewData pending;            /* Latest snapshot (under lock) */
+    uint64_t pending_seq;        /* Bumped by every submit (under lock) */
+    int stop;                    /* (under lock) */
+    atomic_int wake_pending;     /* Set while a wake byte is unread - skips redundant writes */
+    ViewData submitted;          /* DM thread only: last snapshot handed over */
+    int has_submitted;
+    int wake_due;                /* DM thread only: a submit awaits broadcast_kick */
+
+    /* Broadcaster thread only */
+    ViewData published;          /* State as of `version` */
+    ViewData incoming;
+    uint64_t taken_seq;
+    uint64_t version;
+    int frames_since_keyframe;
+    BroadcastBuffer delta;
+    BroadcastBuffer keyframe;    /* Keyframe for `keyframe_version` */
+    uint64_t keyframe_version;
+    BroadcastClient** clients;
+    int client_count;
+    int client_capacity;
+    long long frames, keyframes, bytes_queued, dropped;
+    char unix_path[sizeof(((struct sockaddr_un*)0)->sun_path)];  /* Socket file to remove on stop; empty for TCP */
+} Broadcaster;
+
+/* Every state change is one of these. Commands are built by the key
+ * handlers, batch scripts and server tables and applied by apply_command(). */
+typedef enum {
+    CMD_ADD = 0,
+    CMD_ADD_MOB,
+    CMD_HP,
+    CMD_MOB_HP,
+    CMD_CONDITION,
+    CMD_UNIT_CONDITION,
+    CMD_EXPIRY,
+    CMD_INITIATIVE,
+    CMD_DUPLICATE,
+    CMD_REMOVE,
+    CMD_DEATH_SAVE,
+    CMD_STABILIZE,
+    CMD_TOGGLE_MARK,
+    CMD_MARK,
+    CMD_MARK_WHERE,
+    CMD_CLEAR_MARKS,
+    CMD_GROUP_HP,
+    CMD_NEXT_TURN,
+    CMD_PREV_TURN,
+    CMD_UNDO,
+    CMD_SKIP_POLICY,
+    CMD_RESTORE,
+    CMD_EFFECT,
+    CMD_EFFECTS_FILE,
+    CMD_LOAD,
+    CMD_IMPORT
+} CommandType;
+
+typedef struct {
+    CommandType type;
+    uint32_t seed;          /* Dice rolled while applying come from this seed */
+    long long elapsed_ms;   /* When it was issued, from session start - paces realtime replay */
+    int target_id;          /* Combatant acted on (archived one for CMD_RESTORE), -1 if none */
+    union {
+        struct { int type, initiative, dex, max_hp, mob_size, unit_hp; char name[NAME_LENGTH]; } add;
+        struct { int change, is_critical; } hp;
+        struct { MobTarget target; int unit, change; } mob_hp;
+        struct { int cond, unit, active; } condition;  /* unit -1 = whole combatant */
+        struct { int cond, duration; ExpiryTiming timing; int anchor_id; } expiry;
+        struct { int value; } initiative;
+        struct { int copies; } duplicate;
+        struct { int to_id; } mark;
+        struct { MarkFilter filter; char prefix[NAME_LENGTH]; } mark_where;
+        struct { int change; } group;
+        struct { int policy; } skip;
+        struct { int revive_hp; } restore;
+        struct { char name[EFFECT_NAME_LENGTH]; } effect;
+        struct { char path[COMMAND_PATH_LENGTH]; } file;
+    };
+} Command;
+
+/* Save Library - one save file per named encounter, plus an index with
+ * one line per encounter so the picker never opens the saves themselves */
+typedef struct {
+    char name[TABLE_NAME_LENGTH];
+    int round;
+    int count;                   /* Combatants in the roster */
+    long long saved_at;          /* Unix time */
+    long long bytes;             /* Size of the save file */
+} LibraryEntry;
+
+typedef struct {
+    LibraryEntry* entries;       /* Most recently saved first */
+    int count;
+    int capacity;
+    int cursor;                  /* Selected row in the picker */
+} Library;
+
+/* Bestiary - a text file of stat blocks, one per line, and a sorted index
+ * of it. Both are read into memory once, so editing or truncating the files
+ * mid-session cannot pull pages out from under a lookup; a prefix search is
+ * two binary searches. */
+typedef struct {
+    int count;                   /* NdS+B; count 0 when there is no roll */
+    int sides;
+    int bonus;
+} DiceSpec;
+
+typedef struct {
+    uint32_t magic;              /* BESTIARY_INDEX_MAGIC */
+    uint32_t count;
+    uint64_t source_size;        /* The index is stale when these differ */
+    int64_t source_mtime;        /* st_mtim, seconds */
+    int64_t source_mtime_ns;     /* st_mtim, nanoseconds - edits within a second still differ */
+} BestiaryIndexHeader;
+
+typedef struct {
+    uint32_t offset;             /* Line start in the bestiary file */
+    uint16_t name_length;
+    uint16_t line_length;
+} BestiaryIndexEntry;
+
+typedef struct {
+    char* text;                  /* The bestiary file */
+    size_t text_size;
+    BestiaryIndexEntry* entries; /* Sorted by name, case-insensitive */
+    int count;
+    int index_reused;            /* 1 when the entries came from an up-to-date index file */
+} Bestiary;
+
+typedef struct {
+    char name[NAME_LENGTH];
+    int dex;
+    int hp;                      /* Average HP */
+    DiceSpec hp_dice;
+    char conditions[128];        /* Comma-separated condition or effect names */
+} BestiaryEntry;
+
+/* Roster import columns; a header row may list them in any order */
+typedef enum {
+    IMPORT_NAME = 0,
+    IMPORT_TYPE,
+    IMPORT_INIT,
+    IMPORT_DEX,
+    IMPORT_HP,
+    IMPORT_CONDITIONS,
+    IMPORT_COLUMNS
+} ImportColumn;
+
+/* Streaming JSON writer: output goes through a fixed buffer, nothing is allocated */
+typedef struct {
+    FILE* f;
+    size_t len;
+    int error;                   /* A write failed */
+    int depth;
+    int pretty_depth;            /* Elements this deep or shallower start on a new line */
+    int after_key;               /* The next value follows a key, no separator */
+    unsigned char first[JSON_MAX_DEPTH];  /* Nothing written yet at this depth */
+    char buf[JSON_WRITE_BUFFER];
+} JsonWriter;
+
+/* Pull tokenizer over a NUL-terminated buffer; the first error stops it */
+typedef struct {
+    const char* start;
+    const char* p;
+    const char* end;
+    int error;
+    char message[96];            /* First error, with its byte offset */
+} JsonReader;
+
+/* What a campaign history row records; the names are the `kind` column */
+typedef enum {
+    HISTORY_NOTE = 0,
+    HISTORY_DAMAGE,
+    HISTORY_HEAL,
+    HISTORY_CONDITION,           /* amount 1 = applied, 0 = removed or ended */
+    HISTORY_DEATH,
+    HISTORY_TURN,
+    HISTORY_UNDONE,              /* amount = first undo step reverted; marks its rows undone */
+    HISTORY_SNAPSHOT,            /* A combatant at the start of a round - goes to `snapshots` */
+    HISTORY_KINDS
+} HistoryKind;
+
+typedef struct {
+    int kind;                    /* HistoryKind */
+    int round;
+    int turn_id;
+    int combatant_id;            /* 0 when the event is about no one in particular */
+    int amount;
+    int step;                    /* Undo step it happened in (GameState.undo_step) */
+    int hp, max_hp;              /* Snapshots only */
+    int is_player;               /* Snapshots only */
+    time_t time;
+    char combatant[NAME_LENGTH];
+    char text[128];              /* Log message, or a snapshot's comma-separated conditions */
+} HistoryRow;
+
+/* Campaign history: the TUI thread queues rows, a writer thread inserts
+ * them into SQLite one transaction per batch. Like the autosave, the
+ * thread owns one buffer while the TUI fills the other. */
 typedef struct {
-    Combatant combatants[MAX_COMBATANTS];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    HistoryRow* rows[2];
+    int row_count[2];            /* (under lock) */
+    int row_capacity[2];
+    int filling;                 /* Buffer the TUI appends to (under lock) */
+    int stop;                    /* (under lock) */
+    char error[160];             /* Last failed batch, empty once reported (under lock) */
+    long long written, batches, dropped;  /* (under lock) */
+    long long session;           /* sessions.id of this run */
+    char path[COMMAND_PATH_LENGTH];
+#ifdef INITIATIVE_SQLITE
+    sqlite3* db;                 /* Writer thread only once started */
+    sqlite3_stmt* insert_event;  /* Prepared once, reset after every row */
+    sqlite3_stmt* insert_snapshot;
+    sqlite3_stmt* mark_undone[2];  /* events, snapshots */
+#endif
+} History;
+
+/* Runtime counters - cumulative for the session, never reset by load or undo */
+typedef struct {
+    long long redraws;
+    long long terminal_bytes;    /* Written by draw_ui's refresh(); -1 when unknown */
+    int io_fd;                   /* /proc/thread-self/io, -1 when not counting */
+    long long io_last;           /* Thread write counter after the last refresh(), -1 if unknown */
+    int io_rebase;               /* Set when this thread wrote anything but the terminal since then */
+    long long log_entries;
+    long long log_reallocs;
+    long long undo_snapshots;
+    long long undo_bytes;        /* Copied into snapshots */
+    long long sorts;
+    long long sort_comparisons;
+    long long saves, save_bytes;
+    uint64_t save_ns;
+    long long loads, load_bytes;
+    uint64_t load_ns;
+    long long autosaves;
+    uint64_t autosave_ns;        /* TUI thread time spent taking snapshots */
+} Stats;
+
+typedef struct {
+    const char* label;
+    size_t bytes;
+} StatsRow;
+
+#define STATS_MEMORY_ROWS 9
+#define STATS_LINES (8 + STATS_MEMORY_ROWS)
+#define STATS_LINE_LENGTH 80
+
+typedef struct {
+    Combatant* combatants;
+    int capacity;
     int count;
     int current_turn_id;
     int selected_id;
@@ -142,6 +816,7 @@ typedef struct {
     /* Undo Stack */
     UndoState undo_stack[MAX_UNDO_STACK];
     int undo_count;
+    int undo_step;                  /* Bumped by every snapshot, never rewound - tags history rows */
 
     /* Message Queue */
     MessageQueueEntry message_queue[MAX_MESSAGE_QUEUE];
@@ -151,9 +826,187 @@ typedef struct {
     AppMode mode;
     int condition_menu_cursor;      /* Selected condition in menu */
     int condition_menu_target_id;   /* ID of combatant being edited */
+    int condition_menu_target_unit; /* Mob unit being edited, -1 for the whole entry */
     int scroll_offset;               /* Scroll offset for long lists */
+    int* visual_map;                 /* Row -> combatant index of the list being drawn */
+    int visual_map_capacity;
+    int headless;                    /* 1 when running without a TUI (batch mode) */
+    int suppress_feedback;           /* Set while a group operation aggregates its own log/messages */
+    int mark_anchor_id;              /* Last combatant toggled with 'm' - start of range marks */
+    FILE* out;                       /* Headless output (stdout unless a server captures it) */
+    FILE* err;                       /* Headless errors (stderr unless a server captures it) */
+    char save_file_name[64];         /* Default save file under $HOME */
+    char journal_file_name[64];      /* Default command journal under $HOME */
+    ViewSnapshot* view;              /* Published player view (TUI only), NULL when off */
+    char view_name[64];              /* Shared-memory object name for `view` */
+    Broadcaster* broadcast;          /* Spectator stream (TUI only), NULL when off */
+    History* history;                /* Campaign history sink (TUI only), NULL when off */
+
+    /* Duplicate Naming */
+    NameIndex name_index;
+
+    /* Mob Units - packed per-unit storage for all mob combatants */
+    MobUnit* mob_units;
+    int mob_unit_count;
+    int mob_unit_capacity;
+
+    /* Conditions and custom effects */
+    EffectRegistry registry;
+    EffectStore effect_store;    /* Bitset words past the first and timers of roster and archive */
+    ExpiryScheduler expiry;
+
+    /* SoA copy for bulk queries, valid only right after hot_sync() */
+    HotFields hot;
+
+    /* Save library picker - filled from the index when it opens */
+    Library library;
+
+    /* Stat blocks offered by the add prompt, empty when there is no bestiary file */
+    Bestiary bestiary;
+
+    /* Cold Archive */
+    ArchiveEntry* archive;
+    int archive_count;
+    int archive_capacity;
+    MobUnit* archive_units;      /* Units of archived mobs */
+    int archive_unit_count;
+    int archive_unit_capacity;
+    int archive_epoch;           /* Bumped by every restore */
+    int archive_cursor;          /* Selected row in the archive view */
+
+    /* Turn Skipping - bit i of `eligible` is set when combatants[i] gets a turn.
+     * Kept current on every status change and rebuilt whenever the roster moves. */
+    int skip_policy;             /* SKIP_* bits */
+    uint64_t* eligible;
+    int eligible_capacity;       /* In 64-bit words */
+
+    /* Command Journal - every applied command in order. Replaying it into a
+     * fresh state reproduces this one, dice included. */
+    Command* journal;
+    int journal_count;
+    int journal_capacity;
+    uint32_t rng;                /* Dice state, reseeded by each command */
+    uint64_t seed_source;        /* Draws the seed of each new command */
+    struct timespec session_start;
+    FILE* record;                /* Journal lines are also appended here as they happen (--record) */
+    Stats stats;
 } GameState;
 
+/* Background autosave: the TUI thread copies the state into whichever
+ * buffer the writer is not serializing, the writer thread saves it. A
+ * snapshot published while the writer is busy replaces the pending one. */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    GameState buffers[2];        /* Save-relevant copies; a buffer belongs to whoever holds its index */
+    int pending;                 /* Buffer waiting for the writer, -1 if none (under lock) */
+    int writing;                 /* Buffer being written, -1 when idle (under lock) */
+    int stop;                    /* (under lock) */
+    int error;                   /* errno of the last failed write, 0 once reported (under lock) */
+    long long written;           /* Snapshots on disk (under lock) */
+    char path[COMMAND_PATH_LENGTH];
+
+    /* TUI thread only */
+    int interval_s;
+    int changes;
+    int journal_mark;            /* journal_count as of the last snapshot */
+    struct timespec last_publish;
+} Autosaver;
+
+
+/* Server Mode - one hosted encounter per table name */
+typedef struct {
+    char name[TABLE_NAME_LENGTH];
+    GameState* state;            /* NULL marks an empty hash slot */
+    long long commands;
+    long long errors;
+} ServerTable;
+
+/* One connection; requests are answered strictly in the order received */
+typedef struct {
+    int fd;
+    int slot;                    /* Index in Server.clients */
+    char* in;                    /* Received bytes not yet parsed into lines */
+    size_t in_len, in_cap;
+    char* out;                   /* Replies not yet written */
+    size_t out_len, out_off, out_cap;
+    unsigned int events;         /* Current epoll interest */
+    int eof;                     /* Peer stopped sending; close once replies drain */
+} ServerClient;
+
+typedef struct {
+    int listen_fd;
+    int epoll_fd;
+    ServerTable* tables;         /* Open addressing on name_index_hash */
+    int table_capacity;          /* Power of two */
+    int table_count;
+    ServerClient** clients;
+    int client_count;
+    int client_capacity;
+    long long commands;
+} Server;
+
+/* Set from SIGINT/SIGTERM to stop the server loop */
+volatile sig_atomic_t server_stop_requested = 0;
+
+/* Bumped by compare_combatants (a qsort callback, so it cannot reach a
+ * GameState); callers fold the difference into their own stats */
+long long combatant_comparisons = 0;
+
+/* Bestiary text the index sort compares names in (qsort has no context argument) */
+const char* bestiary_sort_text = NULL;
+
+/* `kind` column values, by HistoryKind */
+const char* const history_kind_names[HISTORY_KINDS] = {
+    "note", "damage", "heal", "condition", "death", "turn", "undone", "snapshot"
+};
+
+/*
+ * Tracing: scoped spans written into a fixed ring per thread and dumped as
+ * Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev). Off unless
+ * --trace is given; a disabled span costs one load and a branch.
+ */
+#define TRACE_RING_EVENTS 65536  /* Per thread; the oldest spans are overwritten */
+#define TRACE_MAX_THREADS 16
+#define TRACE_NO_ARG INT_MIN
+
+typedef struct {
+    const char* name;            /* String literal - never copied */
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int arg;                     /* Key code or command type, or TRACE_NO_ARG */
+} TraceEvent;
+
+typedef struct {
+    TraceEvent* events;          /* Allocated once, on the thread's first span */
+    _Atomic uint64_t head;       /* Spans ever written */
+    const char* thread_name;
+} TraceRing;
+
+typedef struct {
+    const char* name;
+    uint64_t start_ns;           /* 0 when tracing was off at the start */
+    int arg;
+} TraceSpan;
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+/* Record the enclosing block as one span; it ends on any exit from the block */
+#define TRACE_SCOPE_ARG(name, arg) \
+    TraceSpan TRACE_CONCAT(trace_span_, __LINE__) __attribute__((cleanup(trace_end))) = trace_begin(name, arg)
+#define TRACE_SCOPE(name) TRACE_SCOPE_ARG(name, TRACE_NO_ARG)
+
+atomic_int trace_enabled = 0;
+char trace_path[256];
+uint64_t trace_origin_ns;
+TraceRing trace_rings[TRACE_MAX_THREADS];
+atomic_int trace_ring_count = 0;
+_Thread_local TraceRing* trace_local_ring = NULL;
+_Thread_local const char* trace_local_name = NULL;
+/* Set from SIGUSR1 to write the trace without stopping */
+volatile sig_atomic_t trace_dump_requested = 0;
+
 /* Color pairs */
 enum {
     COLOR_DEFAULT = 1,
@@ -204,6 +1057,8 @@ void duplicate_combatant(GameState* state);
 
 /* New Feature Prototypes */
 void log_action(GameState* state, const char* format, ...);
+void log_event(GameState* state, const Combatant* c, HistoryKind kind, int amount, const char* format, ...);
+void log_event_v(GameState* state, const Combatant* c, HistoryKind kind, int amount, const char* format, va_list args);
 void export_log(GameState* state);
 void save_undo_state(GameState* state);
 void undo_last_action(GameState* state);
@@ -218,21 +1073,508 @@ void draw_message_queue(GameState* state);
 void clear_old_messages(GameState* state);
 int get_index_by_id(GameState* state, int id);
 int parse_int_safe(const char* str, int* out);
+int build_home_path(char* path, size_t size, const char* file_name);
+
+/* State Lifecycle Prototypes */
+void init_state(GameState* state);
+void cleanup_state(GameState* state);
+int ensure_combatant_capacity(GameState* state, int needed);
+
+/* Core Mutation Prototypes (no prompts - shared by key handlers and batch mode) */
+int insert_combatant(GameState* state, Combatant* c);
+void remove_combatant_at(GameState* state, int idx);
+int apply_hp_change(GameState* state, Combatant* c, int change, int is_critical);
+int apply_group_hp_change(GameState* state, int change);
+void set_condition(GameState* state, Combatant* c, int cond, int active);
+int set_condition_duration(GameState* state, Combatant* c, int cond, int duration);
+int set_condition_expiry(GameState* state, Combatant* c, int cond, int duration, ExpiryTiming timing, int anchor_id);
+void set_initiative(GameState* state, int idx, int value);
+int duplicate_at(GameState* state, int idx, int num_copies);
+int save_state_to_path(GameState* state, const char* path);
+int write_save_records(GameState* state, FILE* f);
+int write_combatant_record(GameState* state, FILE* f, const Combatant* c, const MobUnit* units, const ArchiveEntry* archived);
+int load_state_from_path(GameState* state, const char* path);
+int export_log_to_path(GameState* state, const char* path);
+
+/* Name Index Prototypes */
+int split_numbered_name(const char* name, char* base, int* suffix);
+unsigned int name_index_hash(const char* key);
+NameIndexEntry* name_index_slot(NameIndex* index, const char* base);
+int name_index_grow(NameIndex* index);
+void name_index_note(GameState* state, const char* name);
+void name_index_raise(GameState* state, const char* base, int highest);
+void name_index_clear(GameState* state);
+int name_index_highest(GameState* state, const char* base);
+void name_index_rebuild(GameState* state);
+void name_index_free(GameState* state);
+void insert_sorted_batch(GameState* state, Combatant* batch, int batch_count);
+
+/* Archive Prototypes */
+int combatant_is_dead(const Combatant* c);
+int archive_push(GameState* state, const Combatant* c, ArchiveReason reason);
+int archive_sweep_dead(GameState* state);
+void archive_trim(GameState* state);
+int archive_restore(GameState* state, int slot, int revive_hp);
+int archive_find(GameState* state, const char* token);
+int archive_live_count(GameState* state);
+int archive_nth_live(GameState* state, int n);
+void archive_rollback(GameState* state, int count, int unit_count, int epoch);
+void archive_free(GameState* state);
+void open_archive_menu(GameState* state);
+void draw_archive_menu(GameState* state);
+int handle_archive_menu_input(GameState* state, int ch);
+
+/* Effect Registry Prototypes */
+int effect_ctz64(uint64_t bits);
+int effect_test(const GameState* state, const Combatant* c, int effect);
+int effect_assign(GameState* state, Combatant* c, int effect, int on);
+int effect_next(const GameState* state, const Combatant* c, int from);
+void init_effect_registry(GameState* state);
+void free_effect_registry(GameState* state);
+int register_effect(GameState* state, const char* name);
+const char* effect_name(GameState* state, int effect);
+int find_effect_by_name(GameState* state, const char* name);
+int load_effects_config(GameState* state, const char* path);
+EffectTimer* find_effect_timer(const GameState* state, const Combatant* c, int effect);
+int add_effect_timer(GameState* state, Combatant* c, int effect, int expires, ExpiryTiming timing, int anchor_id);
+void clear_effect_timer(GameState* state, Combatant* c, int effect);
+
+/* Effect Store Prototypes */
+int effect_word_alloc(EffectStore* store);
+int effect_timer_alloc(EffectStore* store);
+void effect_release(GameState* state, Combatant* c);
+int effect_clone(GameState* state, Combatant* c);
+int effect_store_copy(EffectStore* dst, const EffectStore* src);
+void effect_store_clear(EffectStore* store);
+void effect_store_reclaim(GameState* state);
+void effect_store_free(EffectStore* store);
+
+/* Expiry Scheduler Prototypes */
+int expiry_event_before(const ExpiryEvent* a, const ExpiryEvent* b);
+int expiry_heap_push(ExpiryHeap* h, const ExpiryEvent* ev);
+void expiry_heap_pop(ExpiryHeap* h);
+ExpiryAnchor* scheduler_anchor(ExpiryScheduler* sched, int anchor_id, int create);
+int scheduler_push(GameState* state, const ExpiryEvent* ev);
+void scheduler_pop(GameState* state);
+void scheduler_rebuild(GameState* state);
+void scheduler_free(GameState* state);
+int expire_condition(GameState* state, ExpiryEvent* ev);
+void process_turn_expiries(GameState* state, int anchor_id, ExpiryTiming timing);
+int condition_rounds_left(GameState* state, const Combatant* c, int cond);
+int format_condition_timer(GameState* state, const Combatant* c, int cond, char* buf, size_t size);
+
+/* Hot Field Prototypes */
+int hot_reserve(HotFields* hot, int needed);
+void hot_free(HotFields* hot);
+int hot_sync(GameState* state);
+void hot_classify_hp(HotFields* hot);
+int hot_query_enemies_below(const HotFields* hot, int percent, int* out);
+int hot_query_dying_players(const HotFields* hot, int* out);
+
+/* HP Kernel Prototypes */
+void hp_kernel_range(const int* hp, const int* max_hp, const int* delta, int* new_hp, int start, int n, HpKernelMasks* masks);
+void hp_kernel_scalar(const int* hp, const int* max_hp, const int* delta, int* new_hp, int n, HpKernelMasks* masks);
+#ifdef HP_KERNEL_X86
+void hp_kernel_sse2(const int* hp, const int* max_hp, const int* delta, int* new_hp, int n, HpKernelMasks* masks);
+void hp_kernel_avx2(const int* hp, const int* max_hp, const int* delta, int* new_hp, int n, HpKernelMasks* masks);
+#endif
+HpKernelFn hp_kernel_select(const char** name);
+
+/* Turn Skip Prototypes */
+int combatant_can_act(GameState* state, const Combatant* c);
+void eligible_rebuild(GameState* state);
+void eligible_update(GameState* state, const Combatant* c);
+int eligible_next(GameState* state, int from);
+int eligible_prev(GameState* state, int from);
+void eligible_free(GameState* state);
+int scheduler_has_due(GameState* state);
+int advance_to_actor(GameState* state, int from);
+void set_skip_policy(GameState* state, int policy);
+void format_skip_policy(int policy, char* buf, size_t size);
+void edit_skip_policy(GameState* state);
+
+/* Mob Prototypes */
+int insert_mob(GameState* state, Combatant* c, int size, int unit_max_hp);
+int mob_alloc_units(GameState* state, int size, int unit_max_hp);
+void mob_free_units(GameState* state, Combatant* c);
+void mob_sync_hp(GameState* state, Combatant* c);
+int mob_alive_count(GameState* state, const Combatant* c);
+void mob_histogram(GameState* state, const Combatant* c, int buckets[MOB_HIST_BUCKETS]);
+int apply_mob_hp_change(GameState* state, Combatant* c, MobTarget target, int unit, int change);
+void set_unit_condition(GameState* state, Combatant* c, int unit, int cond, int active);
+int parse_mob_field(GameState* state, Combatant* c, const char* spec);
+void parse_timers_field(const char* spec, int timing[NUM_CONDITIONS], int anchor[NUM_CONDITIONS]);
+int parse_effects_field(GameState* state, Combatant* c, const char* spec);
+void load_state_reset(GameState* state);
+void load_state_finish(GameState* state, const char* path, long bytes, uint64_t start_ns);
+void load_state_adopt(GameState* state, GameState* scratch);
+
+/* JSON Save Prototypes */
+int save_path_is_json(const char* path);
+void json_writer_init(JsonWriter* w, FILE* f, int pretty_depth);
+void json_flush(JsonWriter* w);
+void json_put(JsonWriter* w, const char* s, size_t n);
+void json_value_prefix(JsonWriter* w);
+void json_begin(JsonWriter* w, char open);
+void json_end(JsonWriter* w, char close);
+void json_key(JsonWriter* w, const char* key);
+void json_int(JsonWriter* w, long long value);
+void json_bool(JsonWriter* w, int value);
+void json_string(JsonWriter* w, const char* s);
+int write_save_json(GameState* state, FILE* f);
+void write_combatant_json(GameState* state, JsonWriter* w, const Combatant* c, const MobUnit* units,
+    const ArchiveEntry* archived);
+void json_fail(JsonReader* r, const char* what);
+void json_skip_ws(JsonReader* r);
+int json_consume(JsonReader* r, char c);
+int json_expect(JsonReader* r, char c);
+int json_read_string(JsonReader* r, char* out, size_t size);
+int json_read_int(JsonReader* r, int* out);
+int json_read_long(JsonReader* r, long long* out);
+int json_read_bool(JsonReader* r, int* out);
+int json_skip_value(JsonReader* r, int depth);
+int json_object_next(JsonReader* r, char* key, size_t size, int* first);
+int json_array_next(JsonReader* r, int* first);
+int load_state_json(GameState* state, const char* path, FILE* f, uint64_t start_ns);
+int read_combatant_json(GameState* state, JsonReader* r, Combatant* c, int* archived_round, char* archived_kind);
+int read_effects_json(GameState* state, JsonReader* r, Combatant* c);
+int read_mob_json(GameState* state, JsonReader* r, Combatant* c);
+int read_unit_conditions_json(GameState* state, JsonReader* r, MobUnit* units, int size);
+void read_log_json(GameState* state, JsonReader* r);
+void edit_mob_hp(GameState* state, Combatant* c);
+void toggle_mob_expanded(GameState* state);
+int draw_mob_units(GameState* state, const Combatant* c, int y, int start_x, int width, int max_y);
+
+/* Multi-select Prototypes */
+void toggle_mark(GameState* state, int idx);
+int mark_range(GameState* state, int from_idx, int to_idx);
+int mark_matching(GameState* state, MarkFilter filter, const char* prefix);
+void clear_marks(GameState* state);
+int count_marked(GameState* state);
+void mark_combatants(GameState* state);
+void group_edit_hp(GameState* state);
+
+/* Command Prototypes */
+Command make_command(CommandType type, int target_id);
+void seed_commands(GameState* state, uint64_t seed);
+uint32_t next_command_seed(GameState* state);
+int roll_die(GameState* state, int sides);
+int command_needs_target(CommandType type);
+int command_takes_snapshot(CommandType type);
+int command_valid(GameState* state, const Command* cmd, int idx);
+int apply_command(GameState* state, Command* cmd);
+int journal_append(GameState* state, const Command* cmd);
+void journal_free(GameState* state);
+int format_command(GameState* state, const Command* cmd, char* buf, size_t size);
+const char* batch_quote(const char* text, char* out, size_t size);
+int journal_write(GameState* state, const char* path);
+
+/* Batch Mode Prototypes */
+int run_batch(const char* script_path, int show_stats);
+int execute_batch_command(GameState* state, char* line, int line_no);
+char* batch_next_token(char** cursor);
+int batch_find_target(GameState* state, const char* token);
+void batch_print_state(GameState* state, FILE* out);
+void batch_print_archive(GameState* state, FILE* out);
+
+/* Replay Prototypes */
+int run_replay(const char* path, int realtime, int headless, int show_stats);
+uint64_t state_hash(GameState* state);
+int replay_compare_double(const void* a, const void* b);
+
+/* Player View Prototypes */
+void view_shm_name(char* buf, size_t size);
+void view_open(GameState* state);
+void view_fill(GameState* state, ViewData* data);
+void view_publish(GameState* state);
+void view_close(GameState* state);
+ViewSnapshot* view_attach(void);
+int view_read(ViewSnapshot* shm, ViewData* out, uint64_t* seq);
+void draw_viewer(const ViewData* data);
+int run_viewer(const char* address);
+
+/* Broadcast Prototypes */
+int broadcast_address(const char* address, struct sockaddr_storage* addr, socklen_t* len);
+int unix_socket_reclaim(const char* who, const struct sockaddr_un* addr);
+Broadcaster* broadcast_start(const char* address);
+void broadcast_submit(Broadcaster* b, const ViewData* data);
+int broadcast_kick(Broadcaster* b);
+void broadcast_stop(Broadcaster* b);
+void* broadcast_thread(void* arg);
+void broadcast_accept(Broadcaster* b);
+void broadcast_take_snapshot(Broadcaster* b);
+void broadcast_send(Broadcaster* b, BroadcastClient* client, const BroadcastBuffer* frame);
+int broadcast_flush(Broadcaster* b, BroadcastClient* client);
+void broadcast_drop_client(Broadcaster* b, BroadcastClient* client);
+int broadcast_appendf(BroadcastBuffer* buf, const char* fmt, ...);
+void broadcast_encode_entry(BroadcastBuffer* buf, const ViewEntry* e);
+void broadcast_encode_keyframe(Broadcaster* b);
+void broadcast_encode_delta(Broadcaster* b, const ViewData* old, const ViewData* cur);
+int view_find_entry(const ViewData* data, int id);
+int view_parse_entry(const char* text, ViewEntry* e);
+int view_apply_line(ViewData* data, char* line, uint64_t* version, int* frame_state);
+int view_stream_connect(const struct sockaddr_storage* addr, socklen_t addr_len);
+int view_stream_poll(int fd, char* buf, size_t* len, size_t cap, ViewData* data, uint64_t* version, int* frame_state);
+
+/* Bestiary Prototypes */
+int bestiary_open(Bestiary* b, const char* path);
+int bestiary_open_default(GameState* state);
+void* bestiary_read(int fd, size_t size);
+int bestiary_build_index(Bestiary* b, const char* index_path, const struct stat* st);
+int bestiary_compare_entries(const void* a, const void* b);
+int bestiary_prefix_cmp(const Bestiary* b, int i, const char* prefix, size_t length);
+int bestiary_search(const Bestiary* b, const char* prefix, int* first);
+int bestiary_find(const Bestiary* b, const char* name);
+int bestiary_entry(const Bestiary* b, int i, BestiaryEntry* out);
+void bestiary_close(Bestiary* b);
+int parse_dice(const char* text, DiceSpec* dice);
+int roll_dice(GameState* state, const DiceSpec* dice);
+void format_dice(const DiceSpec* dice, char* buf, size_t size);
+int get_input_line(GameState* state, const char* prompt, char* buffer, int max_len, int complete);
+int get_input_int_default(GameState* state, const char* prompt, int* value, int min_val, int max_val, int fallback);
+int get_input_hp(GameState* state, const char* label, const BestiaryEntry* entry, int* value, int max_val);
+void apply_bestiary_conditions(GameState* state, const BestiaryEntry* entry, int id);
+void batch_print_bestiary(GameState* state, const char* prefix, FILE* out);
+
+/* Roster Import Prototypes */
+void import_roster(GameState* state);
+int import_roster_from_path(GameState* state, const char* path);
+int import_split_row(char* line, char delim, char** fields, int max_fields);
+int import_header_column(const char* field);
+int import_parse_row(GameState* state, char** fields, int field_count, const int* columns, Combatant* c,
+    char* error, size_t error_size);
+
+/* Library Prototypes */
+int library_path(char* path, size_t size, const char* file_name);
+int library_read_index(Library* lib);
+int library_rebuild_index(Library* lib);
+int library_write_index(const Library* lib);
+int library_find(const Library* lib, const char* name);
+int library_save(GameState* state, const char* name);
+int library_load(GameState* state, const char* name);
+int library_delete(GameState* state, const char* name);
+void library_free(Library* lib);
+void open_library_menu(GameState* state);
+void draw_library_menu(GameState* state);
+int handle_library_menu_input(GameState* state, int ch);
+void batch_print_library(GameState* state, FILE* out);
+
+/* Autosave Prototypes */
+Autosaver* autosave_start(GameState* state, const char* path, int interval_s, int changes);
+void* autosave_grow(void* buf, int* capacity, int needed, size_t size);
+int autosave_snapshot(GameState* dst, GameState* src);
+void autosave_publish(Autosaver* a, GameState* state);
+void autosave_tick(Autosaver* a, GameState* state);
+void autosave_stop(Autosaver* a, GameState* state);
+void* autosave_thread(void* arg);
+
+/* Campaign History Prototypes */
+History* history_start(const char* path);
+HistoryRow* history_reserve(History* h);
+void history_note(History* h, const CombatLogEntry* entry, const Combatant* c, HistoryKind kind, int amount, int step);
+void history_snapshot(History* h, GameState* state);
+void history_tick(History* h, GameState* state);
+void history_stop(History* h);
+void* history_thread(void* arg);
+int history_write_batch(History* h, const HistoryRow* rows, int count);
+
+/* Server Mode Prototypes */
+int run_server(const char* socket_path);
+int run_client(const char* table, const char* socket_path);
+int server_socket_path(char* path, size_t size, const char* requested);
+int server_valid_table_name(const char* name);
+ServerTable* server_find_table(Server* server, const char* name, int create);
+int server_drop_table(Server* server, const char* name);
+void server_free_tables(Server* server);
+int server_append(ServerClient* client, const char* data, size_t len);
+int server_append_lines(ServerClient* client, char tag, const char* body, size_t len);
+void server_handle_line(Server* server, ServerClient* client, char* line);
+void server_handle_admin(Server* server, ServerClient* client, char* line);
+int server_client_service(Server* server, ServerClient* client);
+
+/* Stats Prototypes */
+void stats_open_terminal_counter(GameState* state);
+long long stats_thread_written(GameState* state);
+int stats_memory(GameState* state, StatsRow* rows);
+void stats_format_bytes(char* buf, size_t size, double bytes);
+int stats_format_lines(GameState* state, char lines[][STATS_LINE_LENGTH]);
+void stats_print(GameState* state, FILE* out);
+void draw_stats_overlay(GameState* state);
+
+/* Trace Prototypes */
+uint64_t trace_now_ns(void);
+int trace_start(const char* path);
+void trace_thread_name(const char* name);
+TraceSpan trace_begin(const char* name, int arg);
+void trace_end(TraceSpan* span);
+TraceRing* trace_ring(void);
+int trace_dump(const char* path);
+void trace_dump_at_exit(void);
+void trace_signal_handler(int sig);
+int trace_poll_dump(void);
+
+#ifndef INITIATIVE_NO_MAIN
+int main(int argc, char** argv) {
+    const char* broadcast_address_arg = NULL;
+    const char* record_path = NULL;
+    const char* history_path_arg = NULL;
+    int history_enabled = 0;
+    int autosave_interval = AUTOSAVE_INTERVAL_S;
+    int autosave_changes = AUTOSAVE_CHANGES;
+    /* --trace and --stats apply to several modes, so they are taken before any mode starts */
+    int show_stats = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) show_stats = 1;
+        if (strcmp(argv[i], "--trace") != 0) continue;
+        if (i + 1 >= argc || !trace_start(argv[i + 1])) {
+            fprintf(stderr, "Usage: %s --trace <trace.json>\n", argv[0]);
+            return 2;
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) continue;
+        if (strcmp(argv[i], "--batch") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: %s --batch <script|->\n", argv[0]);
+                return 2;
+            }
+            return run_batch(argv[i + 1], show_stats);
+        }
+        if (strcmp(argv[i], "--replay") == 0) {
+            int realtime = 0;
+            int headless = !isatty(STDOUT_FILENO);
+            int ok = (i + 1 < argc);
+            for (int j = i + 2; ok && j < argc; j++) {
+                if (strcmp(argv[j], "--headless") == 0) headless = 1;
+                else if (strcmp(argv[j], "--stats") == 0) continue;
+                else if (strcmp(argv[j], "--trace") == 0 && j + 1 < argc) j++;
+                else if (strcmp(argv[j], "--speed") == 0 && j + 1 < argc && strcmp(argv[j + 1], "max") == 0) j++;
+                else if (strcmp(argv[j], "--speed") == 0 && j + 1 < argc && strcmp(argv[j + 1], "realtime") == 0) realtime = ++j;
+                else ok = 0;
+            }
+            if (!ok) {
+                fprintf(stderr, "Usage: %s --replay <journal|-> [--speed max|realtime] [--headless]\n", argv[0]);
+                return 2;
+            }
+            return run_replay(argv[i + 1], realtime, headless, show_stats);
+        }
+        if (strcmp(argv[i], "--record") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: %s --record <journal path>\n", argv[0]);
+                return 2;
+            }
+            record_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--serve") == 0) {
+            return run_server(i + 1 < argc ? argv[i + 1] : NULL);
+        }
+        if (strcmp(argv[i], "--client") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: %s --client <table> [socket]\n", argv[0]);
+                return 2;
+            }
+            return run_client(argv[i + 1], i + 2 < argc ? argv[i + 2] : NULL);
+        }
+        if (strcmp(argv[i], "--viewer") == 0) {
+            return run_viewer(i + 1 < argc ? argv[i + 1] : NULL);
+        }
+        if (strcmp(argv[i], "--autosave") == 0 || strcmp(argv[i], "--autosave-changes") == 0) {
+            char* end = NULL;
+            long value = i + 1 < argc ? strtol(argv[i + 1], &end, 10) : -1;
+            if (!end || *end != '\0' || value < 0 || value > INT_MAX) {
+                fprintf(stderr, "Usage: %s --autosave <seconds, 0 = off> --autosave-changes <commands, 0 = time only>\n", argv[0]);
+                return 2;
+            }
+            if (strcmp(argv[i], "--autosave") == 0) autosave_interval = (int)value;
+            else autosave_changes = (int)value;
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--broadcast") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Usage: %s --broadcast <port|socket path>\n", argv[0]);
+                return 2;
+            }
+            broadcast_address_arg = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--history") == 0) {
+            history_enabled = 1;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) history_path_arg = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            printf("Usage: %s [--batch <script|-> | --replay <journal|-> [--speed max|realtime] [--headless] |\n"
+                   "        --serve [socket] | --client <table> [socket] | --viewer [address]]\n"
+                   "       [--broadcast <address>] [--record <journal path>] [--trace <trace.json>] [--stats]\n"
+                   "       [--autosave <seconds>] [--autosave-changes <commands>] [--history [database]]\n", argv[0]);
+            return 0;
+        }
+        fprintf(stderr, "Unknown option: %s\n", argv[i]);
+        return 2;
+    }
+
+    GameState state;
+    init_state(&state);
+    seed_commands(&state, (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32));
+    if (record_path) {
+        state.record = fopen(record_path, "w");
+        if (!state.record) {
+            fprintf(stderr, "Cannot record to %s: %s\n", record_path, strerror(errno));
+            cleanup_state(&state);
+            return 1;
+        }
+        fprintf(state.record, "# initiative session - replay with --replay\n");
+    }
+
+    /* Custom effects are optional - a missing file just means built-ins only.
+     * Loading them is journaled so a replay sees the same registry. */
+    Command effects = make_command(CMD_EFFECTS_FILE, -1);
+    if (build_home_path(effects.file.path, sizeof(effects.file.path), EFFECTS_FILE_NAME) &&
+        access(effects.file.path, R_OK) == 0) {
+        apply_command(&state, &effects);
+    }
+    /* Also optional; it only prefills prompts, so nothing about it is journaled */
+    bestiary_open_default(&state);
+    view_open(&state);
+    if (broadcast_address_arg) {
+        state.broadcast = broadcast_start(broadcast_address_arg);
+        if (!state.broadcast) {
+            view_close(&state);
+            if (state.record) fclose(state.record);
+            cleanup_state(&state);
+            return 1;
+        }
+    }
+
+    if (history_enabled) {
+        char history_path[COMMAND_PATH_LENGTH];
+        if (!history_path_arg && !build_home_path(history_path, sizeof(history_path), HISTORY_FILE_NAME)) {
+            fprintf(stderr, "History path too long\n");
+        } else {
+            state.history = history_start(history_path_arg ? history_path_arg : history_path);
+        }
+        if (!state.history) {
+            view_close(&state);
+            broadcast_stop(state.broadcast);
+            if (state.record) fclose(state.record);
+            cleanup_state(&state);
+            return 1;
+        }
+    }
 
-int main(void) {
-    GameState state = {0};
-    state.round = 1;
-    state.next_id = 1;
-    state.current_turn_id = -1;
-    state.selected_id = -1;
-    state.message_queue_count = 0;
-    state.mode = MODE_COMBAT;
-    state.condition_menu_cursor = 0;
-    state.condition_menu_target_id = -1;
-    state.scroll_offset = 0;
-    init_log(&state);
-    srand((unsigned int)time(NULL));
+    Autosaver* autosave = NULL;
+    char autosave_path[COMMAND_PATH_LENGTH];
+    if (autosave_interval > 0 && build_home_path(autosave_path, sizeof(autosave_path), AUTOSAVE_FILE_NAME)) {
+        autosave = autosave_start(&state, autosave_path, autosave_interval, autosave_changes);
+    }
 
+    stats_open_terminal_counter(&state);
     initscr();
     cbreak();
     noecho();
@@ -249,13 +1591,30 @@ int main(void) {
     int running = 1;
 
     while (running) {
+        TRACE_SCOPE("main_loop");
+        int dumped = trace_poll_dump();
+        if (dumped != 0) {
+            state.stats.io_rebase = 1;
+            char msg[320];
+            if (dumped < 0) snprintf(msg, sizeof(msg), "Trace: cannot write %s", trace_path);
+            else snprintf(msg, sizeof(msg), "Trace: %d spans written to %s", dumped, trace_path);
+            show_message(&state, msg, dumped < 0);
+        }
         clear_old_messages(&state);
+        view_publish(&state);
         draw_ui(&state);
+        if (broadcast_kick(state.broadcast)) state.stats.io_rebase = 1;
+        autosave_tick(autosave, &state);
+        history_tick(state.history, &state);
 
         /* Periodic timeout to check message expiration without blocking */
-        timeout(1000);
-        int ch = getch();
-        timeout(-1);
+        int ch;
+        {
+            TRACE_SCOPE("wait_input");
+            timeout(1000);
+            ch = getch();
+            timeout(-1);
+        }
 
         if (ch == ERR) {
             /* Timeout occurred - check if messages expired and redraw if needed */
@@ -267,6 +1626,7 @@ int main(void) {
             continue;
         }
 
+        TRACE_SCOPE_ARG("key", ch);
         if (state.mode == MODE_CONDITIONS) {
             /* ESC closes menu immediately, bypassing handler */
             if (ch == 27) {
@@ -276,34 +1636,44 @@ int main(void) {
             }
             handle_condition_menu_input(&state, ch);
             continue;
-        } else if (state.mode == MODE_HELP) {
+        } else if (state.mode == MODE_ARCHIVE) {
+            handle_archive_menu_input(&state, ch);
+            continue;
+        } else if (state.mode == MODE_LIBRARY) {
+            handle_library_menu_input(&state, ch);
+            continue;
+        } else if (state.mode == MODE_HELP || state.mode == MODE_STATS) {
             state.mode = MODE_COMBAT;
             continue;
         }
         switch (tolower(ch)) {
             case 'q': running = 0; break;
-            case 'a': save_undo_state(&state); add_combatant(&state); break;
-            case 'd': if (state.count > 0) { save_undo_state(&state); remove_combatant(&state); } break;
-            case 'h':
-                if (state.count > 0) {
-                    save_undo_state(&state);
-                    edit_hp(&state);
-                }
-                break;
+            case 'a': add_combatant(&state); break;
+            case 'd': if (state.count > 0) remove_combatant(&state); break;
+            case 'h': if (state.count > 0) edit_hp(&state); break;
             case '?':
                 state.mode = MODE_HELP;
                 break;
-            case 'r': if (state.count > 0) { save_undo_state(&state); reroll_initiative(&state); } break;
+            case 'r': if (state.count > 0) reroll_initiative(&state); break;
             case 'c': if (state.count > 0) toggle_condition(&state); break;
-            case 'n': if (state.count > 0) { save_undo_state(&state); next_turn(&state); } break;
-            case 'p': if (state.count > 0) { save_undo_state(&state); prev_turn(&state); } break;
+            case 'n': if (state.count > 0) { Command cmd = make_command(CMD_NEXT_TURN, -1); apply_command(&state, &cmd); } break;
+            case 'p': if (state.count > 0) { Command cmd = make_command(CMD_PREV_TURN, -1); apply_command(&state, &cmd); } break;
             case 's': save_state(&state); break;
             case 'l': load_state(&state); break;
             case 'e': if (state.log_count > 0) export_log(&state); break;
-            case 'z': undo_last_action(&state); break;
-            case 'x': if (state.count > 0) { save_undo_state(&state); roll_death_save(&state, NULL); } break;
-            case 't': if (state.count > 0) { save_undo_state(&state); stabilize_combatant(&state); } break;
-            case 'u': if (state.count > 0) { save_undo_state(&state); duplicate_combatant(&state); } break;
+            case 'z': { Command cmd = make_command(CMD_UNDO, -1); apply_command(&state, &cmd); } break;
+            case 'x': if (state.count > 0) { Command cmd = make_command(CMD_DEATH_SAVE, state.selected_id); apply_command(&state, &cmd); } break;
+            case 't': if (state.count > 0) { Command cmd = make_command(CMD_STABILIZE, state.selected_id); apply_command(&state, &cmd); } break;
+            case 'u': if (state.count > 0) duplicate_combatant(&state); break;
+            case 'm': if (state.count > 0) { Command cmd = make_command(CMD_TOGGLE_MARK, state.selected_id); apply_command(&state, &cmd); } break;
+            case 'f': if (state.count > 0) mark_combatants(&state); break;
+            case 'g': if (state.count > 0) group_edit_hp(&state); break;
+            case 'o': if (state.count > 0) toggle_mob_expanded(&state); break;
+            case 'v': open_archive_menu(&state); break;
+            case 'b': open_library_menu(&state); break;
+            case 'y': import_roster(&state); break;
+            case 'w': edit_skip_policy(&state); break;
+            case 'i': state.mode = MODE_STATS; break;
             case KEY_UP:
             case 'k':
                 if (state.count > 0) move_selection(&state, -1);
@@ -315,10 +1685,18 @@ int main(void) {
         }
     }
 
-    cleanup_log(&state);
+    view_close(&state);
+    broadcast_stop(state.broadcast);
+    autosave_stop(autosave, &state);
+    history_stop(state.history);
+    state.history = NULL;
+    if (state.record) fclose(state.record);
     endwin();
+    if (show_stats) stats_print(&state, stderr);
+    cleanup_state(&state);
     return 0;
 }
+#endif /* INITIATIVE_NO_MAIN */
 
 void init_colors(void) {
     init_pair(COLOR_DEFAULT, COLOR_WHITE, COLOR_BLACK);
@@ -339,6 +1717,94 @@ void init_colors(void) {
     init_pair(COLOR_MSG_ERROR, COLOR_WHITE, COLOR_RED);
 }
 
+ /* --- State Functions --- */
+
+void init_state(GameState* state) {
+    memset(state, 0, sizeof(*state));
+    state->round = 1;
+    state->next_id = 1;
+    state->current_turn_id = -1;
+    state->selected_id = -1;
+    state->message_queue_count = 0;
+    state->mode = MODE_COMBAT;
+    state->condition_menu_cursor = 0;
+    state->condition_menu_target_id = -1;
+    state->condition_menu_target_unit = -1;
+    state->scroll_offset = 0;
+    state->out = stdout;
+    state->err = stderr;
+    snprintf(state->save_file_name, sizeof(state->save_file_name), "%s", SAVE_FILE_NAME);
+    snprintf(state->journal_file_name, sizeof(state->journal_file_name), "%s", JOURNAL_FILE_NAME);
+    clock_gettime(CLOCK_MONOTONIC, &state->session_start);
+    state->stats.io_fd = -1;
+    state->stats.terminal_bytes = -1;
+    state->stats.io_last = -1;
+    ensure_combatant_capacity(state, INITIAL_COMBATANT_CAPACITY);
+    init_effect_registry(state);
+    init_log(state);
+}
+
+void cleanup_state(GameState* state) {
+    for (int i = 0; i < MAX_UNDO_STACK; i++) {
+        free(state->undo_stack[i].combatants);
+        state->undo_stack[i].combatants = NULL;
+        state->undo_stack[i].capacity = 0;
+        free(state->undo_stack[i].mob_units);
+        state->undo_stack[i].mob_units = NULL;
+        state->undo_stack[i].mob_unit_capacity = 0;
+        effect_store_free(&state->undo_stack[i].effects);
+    }
+    state->undo_count = 0;
+    if (state->stats.io_fd >= 0) close(state->stats.io_fd);
+    state->stats.io_fd = -1;
+
+    free(state->combatants);
+    state->combatants = NULL;
+    state->capacity = 0;
+    state->count = 0;
+
+    free(state->mob_units);
+    state->mob_units = NULL;
+    state->mob_unit_capacity = 0;
+    state->mob_unit_count = 0;
+
+    name_index_free(state);
+    scheduler_free(state);
+    free_effect_registry(state);
+    effect_store_free(&state->effect_store);
+    hot_free(&state->hot);
+    free(state->visual_map);
+    state->visual_map = NULL;
+    state->visual_map_capacity = 0;
+    archive_free(state);
+    eligible_free(state);
+    journal_free(state);
+    library_free(&state->library);
+    bestiary_close(&state->bestiary);
+    cleanup_log(state);
+}
+
+/**
+ * Grow the combatant array so it can hold at least `needed` entries.
+ *
+ * @return 1 on success, 0 if the limit is exceeded or allocation fails
+ */
+int ensure_combatant_capacity(GameState* state, int needed) {
+    if (needed <= state->capacity) return 1;
+    if (needed > MAX_COMBATANTS) return 0;
+
+    int new_capacity = state->capacity > 0 ? state->capacity : INITIAL_COMBATANT_CAPACITY;
+    while (new_capacity < needed) new_capacity *= 2;
+    if (new_capacity > MAX_COMBATANTS) new_capacity = MAX_COMBATANTS;
+
+    Combatant* grown = (Combatant*)realloc(state->combatants, (size_t)new_capacity * sizeof(Combatant));
+    if (!grown) return 0;
+
+    state->combatants = grown;
+    state->capacity = new_capacity;
+    return 1;
+}
+
  /* --- Logging Functions --- */
 
 void init_log(GameState* state) {
@@ -361,7 +1827,35 @@ void cleanup_log(GameState* state) {
 }
 
 void log_action(GameState* state, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_event_v(state, NULL, HISTORY_NOTE, 0, format, args);
+    va_end(args);
+}
+
+/**
+ * Log an event about `c` that the campaign history can query by kind and
+ * amount (damage dealt, healing, conditions, deaths, turns).
+ */
+void log_event(GameState* state, const Combatant* c, HistoryKind kind, int amount, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_event_v(state, c, kind, amount, format, args);
+    va_end(args);
+}
+
+void log_event_v(GameState* state, const Combatant* c, HistoryKind kind, int amount, const char* format, va_list args) {
+    TRACE_SCOPE("log_action");
     if (!state->combat_log) return;
+    if (state->suppress_feedback) {
+        /* Group operations log one summary line, but the history still wants every hit */
+        if (state->history && kind != HISTORY_NOTE) {
+            CombatLogEntry entry = {state->round, state->current_turn_id, time(NULL), ""};
+            vsnprintf(entry.message, sizeof(entry.message), format, args);
+            history_note(state->history, &entry, c, kind, amount, state->undo_step);
+        }
+        return;
+    }
 
     if (state->log_count >= state->log_capacity) {
         int new_capacity = state->log_capacity * 2;
@@ -371,19 +1865,19 @@ void log_action(GameState* state, const char* format, ...) {
 
         state->combat_log = new_log;
         state->log_capacity = new_capacity;
+        state->stats.log_reallocs++;
     }
 
     CombatLogEntry* entry = &state->combat_log[state->log_count];
     entry->round = state->round;
     entry->turn_id = state->current_turn_id;
     entry->timestamp = time(NULL);
-
-    va_list args;
-    va_start(args, format);
     vsnprintf(entry->message, sizeof(entry->message), format, args);
-    va_end(args);
 
     state->log_count++;
+    state->stats.log_entries++;
+    PROBE3(log_action, state->round, state->current_turn_id, (uintptr_t)entry->message);
+    if (state->history) history_note(state->history, entry, c, kind, amount, state->undo_step);
 }
 
 /**
@@ -391,21 +1885,31 @@ void log_action(GameState* state, const char* format, ...) {
  * Appends to existing file to preserve session history.
  */
 void export_log(GameState* state) {
+    TRACE_SCOPE("export_log");
     if (!state || state->log_count == 0) {
         show_message(state, "No log entries to export!", 1);
         return;
     }
 
     char path[256];
-    const char* home = getenv("HOME");
-    if (home) {
-        int ret = snprintf(path, sizeof(path), "%s/%s", home, LOG_EXPORT_FILE_NAME);
-        if (ret < 0 || ret >= (int)sizeof(path)) {
-            show_message(state, "Error: Path too long for log file!", 1);
-            return;
-        }
-    } else {
-        snprintf(path, sizeof(path), "%s", LOG_EXPORT_FILE_NAME);
+    if (!build_home_path(path, sizeof(path), LOG_EXPORT_FILE_NAME)) {
+        show_message(state, "Error: Path too long for log file!", 1);
+        return;
+    }
+
+    export_log_to_path(state, path);
+}
+
+/**
+ * Append the combat log to `path` and clear it.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int export_log_to_path(GameState* state, const char* path) {
+    state->stats.io_rebase = 1;
+    if (state->log_count == 0) {
+        show_message(state, "No log entries to export!", 1);
+        return 0;
     }
 
     FILE* f = fopen(path, "a");
@@ -422,7 +1926,7 @@ void export_log(GameState* state) {
         }
         snprintf(err_msg, sizeof(err_msg), "Log export failed! Cannot open: %s", path_display);
         show_message(state, err_msg, 1);
-        return;
+        return 0;
     }
 
     time_t t = time(NULL);
@@ -444,28 +1948,58 @@ void export_log(GameState* state) {
 
     state->log_count = 0;
     show_message(state, "Log Exported and Cleared!", 0);
+    return 1;
 }
 
  /* --- Undo Functions --- */
 
 void save_undo_state(GameState* state) {
-    /* Circular buffer: drop oldest when full */
+    /* Circular buffer: drop oldest when full, recycling its buffer */
     if (state->undo_count >= MAX_UNDO_STACK) {
+        UndoState oldest = state->undo_stack[0];
         memmove(&state->undo_stack[0], &state->undo_stack[1], (MAX_UNDO_STACK - 1) * sizeof(UndoState));
+        state->undo_stack[MAX_UNDO_STACK - 1] = oldest;
         state->undo_count = MAX_UNDO_STACK - 1;
     }
 
     UndoState* current_undo = &state->undo_stack[state->undo_count];
+    if (current_undo->capacity < state->count) {
+        Combatant* grown = (Combatant*)realloc(current_undo->combatants, (size_t)state->capacity * sizeof(Combatant));
+        if (!grown) return; /* Allocation failed - skip snapshot rather than crash */
+        current_undo->combatants = grown;
+        current_undo->capacity = state->capacity;
+    }
+    if (current_undo->mob_unit_capacity < state->mob_unit_count) {
+        MobUnit* grown = (MobUnit*)realloc(current_undo->mob_units, (size_t)state->mob_unit_capacity * sizeof(MobUnit));
+        if (!grown) return;
+        current_undo->mob_units = grown;
+        current_undo->mob_unit_capacity = state->mob_unit_capacity;
+    }
+    if (!effect_store_copy(&current_undo->effects, &state->effect_store)) return;
     memcpy(current_undo->combatants, state->combatants, (size_t)state->count * sizeof(Combatant));
     current_undo->count = state->count;
+    if (state->mob_unit_count > 0) {
+        memcpy(current_undo->mob_units, state->mob_units, (size_t)state->mob_unit_count * sizeof(MobUnit));
+    }
+    current_undo->mob_unit_count = state->mob_unit_count;
+    state->stats.undo_snapshots++;
+    state->stats.undo_bytes += (long long)state->count * (long long)sizeof(Combatant) +
+                               (long long)state->mob_unit_count * (long long)sizeof(MobUnit) +
+                               (long long)state->effect_store.word_count * (long long)sizeof(EffectWord) +
+                               (long long)state->effect_store.timer_count * (long long)sizeof(EffectTimer);
     current_undo->current_turn_id = state->current_turn_id;
     current_undo->selected_id = state->selected_id;
     current_undo->round = state->round;
+    current_undo->archive_count = state->archive_count;
+    current_undo->archive_unit_count = state->archive_unit_count;
+    current_undo->archive_epoch = state->archive_epoch;
+    current_undo->step = ++state->undo_step;
 
     state->undo_count++;
 }
 
 void undo_last_action(GameState* state) {
+    TRACE_SCOPE("undo_last_action");
     if (state->undo_count == 0) {
         show_message(state, "Nothing to undo!", 1);
         return;
@@ -474,1496 +2008,10415 @@ void undo_last_action(GameState* state) {
     state->undo_count--;
     UndoState* prev_state = &state->undo_stack[state->undo_count];
 
+    if (!ensure_combatant_capacity(state, prev_state->count)) {
+        state->undo_count++;
+        show_message(state, "Undo failed! Out of memory.", 1);
+        return;
+    }
+    if (prev_state->mob_unit_count > state->mob_unit_capacity) {
+        MobUnit* grown = (MobUnit*)realloc(state->mob_units, (size_t)prev_state->mob_unit_capacity * sizeof(MobUnit));
+        if (!grown) {
+            state->undo_count++;
+            show_message(state, "Undo failed! Out of memory.", 1);
+            return;
+        }
+        state->mob_units = grown;
+        state->mob_unit_capacity = prev_state->mob_unit_capacity;
+    }
+    if (!effect_store_copy(&state->effect_store, &prev_state->effects)) {
+        state->undo_count++;
+        show_message(state, "Undo failed! Out of memory.", 1);
+        return;
+    }
     state->count = prev_state->count;
     memcpy(state->combatants, prev_state->combatants, (size_t)state->count * sizeof(Combatant));
+    if (prev_state->mob_unit_count > 0) {
+        memcpy(state->mob_units, prev_state->mob_units, (size_t)prev_state->mob_unit_count * sizeof(MobUnit));
+    }
+    state->mob_unit_count = prev_state->mob_unit_count;
     state->current_turn_id = prev_state->current_turn_id;
     state->selected_id = prev_state->selected_id;
     state->round = prev_state->round;
+    archive_rollback(state, prev_state->archive_count, prev_state->archive_unit_count, prev_state->archive_epoch);
+    effect_store_reclaim(state);
+    name_index_rebuild(state);
+    eligible_rebuild(state);
+    scheduler_rebuild(state);
 
-    log_action(state, "Action UNDONE. Reverted to start of Round %d.", state->round);
+    log_event(state, NULL, HISTORY_UNDONE, prev_state->step, "Action UNDONE. Reverted to start of Round %d.", state->round);
 
     show_message(state, "Undo successful!", 0);
 }
 
- /* --- TUI/Core Functions --- */
+ /* --- Command Functions --- */
 
-void draw_ui(GameState* state) {
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
-    /* erase() is faster than clear() - doesn't force full screen refresh */
-    erase();
+/*
+ * Mutations are event-sourced: key handlers, batch scripts and server tables
+ * only build Command records, and apply_command() is the single reducer that
+ * changes the state. Each applied command is appended to the journal with
+ * the seed its dice came from, so writing the journal out as a batch script
+ * and running it again rebuilds the same encounter roll for roll.
+ */
 
-    clear_old_messages(state);
+Command make_command(CommandType type, int target_id) {
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = type;
+    cmd.target_id = target_id;
+    return cmd;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
-    mvhline(0, 0, ' ', cols);
-    mvprintw(0, 1, "D&D INITIATIVE TRACKER | Round: %d", state->round);
-    mvhline(1, 0, ' ', cols);
-    mvprintw(1, 1, "Keys: A(dd) D(el) H(eal) C(ond) N(ext) P(rev) R(eroll) U(dup) X(death) T(stabilize)");
-    mvhline(2, 0, ' ', cols);
-    mvprintw(2, 1, "      E(xport) Z(undo) S(ave) L(oad) ?(help) Q(uit)");
-    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
-
-    int split_y = rows / 2;
-    int list_height = split_y - 5;
-
-    mvhline(3, 0, ACS_HLINE, cols);
-    attron(A_BOLD);
-    mvprintw(3, 2, "[ PLAYERS ]");
-    attroff(A_BOLD);
-    draw_filtered_list(state, 4, 0, cols, list_height, TYPE_PLAYER);
-
-    attron(COLOR_PAIR(COLOR_SEPARATOR));
-    mvhline(split_y, 0, ACS_HLINE, cols);
-    attroff(COLOR_PAIR(COLOR_SEPARATOR));
+/**
+ * Restart the sequence of command seeds (batch `seed <n>`).
+ */
+void seed_commands(GameState* state, uint64_t seed) {
+    state->seed_source = seed;
+}
 
-    attron(A_BOLD);
-    mvprintw(split_y, 2, "[ ENEMIES ]");
-    attroff(A_BOLD);
+/**
+ * Draw the seed for a new command (splitmix64 over the session seed).
+ *
+ * @return A non-zero seed
+ */
+uint32_t next_command_seed(GameState* state) {
+    state->seed_source += 0x9E3779B97F4A7C15ull;
+    uint64_t z = state->seed_source;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    uint32_t seed = (uint32_t)(z >> 32);
+    return seed ? seed : 1;
+}
 
-    draw_filtered_list(state, split_y + 1, 0, cols, rows - split_y - 1, TYPE_ENEMY);
+/**
+ * Roll 1d`sides` from the current command's dice state (xorshift32).
+ */
+int roll_die(GameState* state, int sides) {
+    uint32_t x = state->rng;
+    if (x == 0) x = next_command_seed(state); /* Core function called outside a command */
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state->rng = x;
+    return (int)(x % (uint32_t)sides) + 1;
+}
 
-    if (state->mode == MODE_CONDITIONS) {
-        draw_condition_menu(state);
-    } else if (state->mode == MODE_HELP) {
-        draw_help_menu(state);
+/**
+ * @return 1 if the command acts on a combatant in the roster
+ */
+int command_needs_target(CommandType type) {
+    switch (type) {
+        case CMD_HP: case CMD_MOB_HP: case CMD_CONDITION: case CMD_UNIT_CONDITION:
+        case CMD_EXPIRY: case CMD_INITIATIVE: case CMD_DUPLICATE: case CMD_REMOVE:
+        case CMD_DEATH_SAVE: case CMD_STABILIZE: case CMD_TOGGLE_MARK: case CMD_MARK:
+            return 1;
+        default:
+            return 0;
     }
-
-    draw_message_queue(state);
-
-    refresh();
 }
 
-void draw_filtered_list(GameState* state, int start_y, int start_x, int width, int height, CombatantType type) {
-    if (state->count == 0) return;
-
-    /* Column Headers */
-    attron(A_UNDERLINE);
-    mvprintw(start_y, start_x + 2, "%-20s %4s %4s %8s %12s %s", "Name", "Init", "Dex", "HP", "Death Saves", "Conditions");
-    attroff(A_UNDERLINE);
-
-    int type_count = 0;
-    int selected_visual_index = -1;
-    int active_visual_index = -1;
-
-    int visual_map[MAX_COMBATANTS];
-
-    for (int i = 0; i < state->count; i++) {
-        if (state->combatants[i].type == type) {
-            visual_map[type_count] = i;
-            if (state->combatants[i].id == state->selected_id) selected_visual_index = type_count;
-            if (state->combatants[i].id == state->current_turn_id) active_visual_index = type_count;
-            type_count++;
-        }
+/**
+ * @return 1 if the command gets its own undo step (marks, settings and
+ *         undo itself do not)
+ */
+int command_takes_snapshot(CommandType type) {
+    switch (type) {
+        case CMD_TOGGLE_MARK: case CMD_MARK: case CMD_MARK_WHERE: case CMD_CLEAR_MARKS:
+        case CMD_UNDO: case CMD_SKIP_POLICY: case CMD_EFFECT: case CMD_EFFECTS_FILE: case CMD_LOAD:
+            return 0;
+        default:
+            return 1;
     }
+}
 
-    if (type_count == 0) {
-        mvprintw(start_y + 2, start_x + 2, "(None)");
-        return;
+/**
+ * Check what a command can be refused on before it takes an undo step or a
+ * journal line. The core functions keep their own checks; this only turns
+ * the predictable refusals away early.
+ *
+ * @param idx Index of the resolved target, -1 if the command has none
+ * @return 1 if the command may be applied, 0 if refused (message shown)
+ */
+int command_valid(GameState* state, const Command* cmd, int idx) {
+    const Combatant* c = (idx != -1) ? &state->combatants[idx] : NULL;
+    switch (cmd->type) {
+        case CMD_ADD:
+        case CMD_ADD_MOB:
+            if (cmd->type == CMD_ADD_MOB && (cmd->add.mob_size < 1 || cmd->add.mob_size > MAX_MOB_UNITS ||
+                    cmd->add.unit_hp < 1 || cmd->add.unit_hp > MAX_MOB_UNIT_HP)) {
+                show_message(state, "Invalid mob size or unit HP!", 1);
+                return 0;
+            }
+            if (cmd->type == CMD_ADD && cmd->add.max_hp < 1) {
+                show_message(state, "Max HP must be at least 1!", 1);
+                return 0;
+            }
+            if (state->count >= MAX_COMBATANTS) {
+                show_message(state, "List full! Maximum combatants reached.", 1);
+                return 0;
+            }
+            return 1;
+        case CMD_MOB_HP:
+            if (c->mob_size == 0) {
+                show_message(state, "Selected combatant is not a mob!", 1);
+                return 0;
+            }
+            return 1;
+        case CMD_EXPIRY:
+            return cmd->expiry.cond >= 0 && cmd->expiry.cond < state->registry.count;
+        case CMD_DUPLICATE:
+            if (cmd->duplicate.copies < 1) return 0;
+            if (cmd->duplicate.copies > MAX_COMBATANTS - state->count) {
+                show_message(state, "List full! Cannot duplicate.", 1);
+                return 0;
+            }
+            return 1;
+        case CMD_GROUP_HP:
+            if (count_marked(state) == 0) {
+                show_message(state, "No combatants marked! Use 'm' or 'f' first.", 1);
+                return 0;
+            }
+            return 1;
+        case CMD_UNDO:
+            if (state->undo_count == 0) {
+                show_message(state, "Nothing to undo!", 1);
+                return 0;
+            }
+            return 1;
+        case CMD_RESTORE: {
+            char token[16];
+            snprintf(token, sizeof(token), "#%d", cmd->target_id);
+            if (archive_find(state, token) == -1) {
+                show_message(state, "Not in the archive!", 1);
+                return 0;
+            }
+            return 1;
+        }
+        default:
+            return 1;
     }
+}
 
-    int list_display_h = height - 1;
-    int scroll_offset = 0;
-
-    if (selected_visual_index != -1) {
-        if (selected_visual_index >= list_display_h) {
-            scroll_offset = selected_visual_index - list_display_h + 1;
+/**
+ * The reducer: apply one command and append it to the journal.
+ *
+ * A command without a seed draws the next one from the session, and the dice
+ * are reseeded from it, so replaying the journal rolls the same numbers.
+ * The undo snapshot is taken here, making each undo step exactly one command.
+ * Commands are validated first, so a refused command leaves no undo step and
+ * no journal line. Refusals only the core function can see (out of memory)
+ * are still journaled; replay refuses them the same way.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int apply_command(GameState* state, Command* cmd) {
+    TRACE_SCOPE_ARG("apply_command", (int)cmd->type);
+    int idx = -1;
+    if (command_needs_target(cmd->type)) {
+        idx = get_index_by_id(state, cmd->target_id);
+        if (idx == -1) {
+            show_message(state, "No combatant selected!", 1);
+            return 0;
         }
-    } else {
-        if (active_visual_index != -1 && active_visual_index >= list_display_h) {
-            scroll_offset = active_visual_index - list_display_h + 1;
+        state->selected_id = cmd->target_id;
+    }
+    if (!command_valid(state, cmd, idx)) return 0;
+
+    if (cmd->seed == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        cmd->seed = next_command_seed(state);
+        cmd->elapsed_ms = (long long)(now.tv_sec - state->session_start.tv_sec) * 1000 +
+                          (now.tv_nsec - state->session_start.tv_nsec) / 1000000;
+    }
+    state->rng = cmd->seed;
+    if (command_takes_snapshot(cmd->type)) save_undo_state(state);
+    journal_append(state, cmd);
+    if (state->record) {
+        char line[COMMAND_PATH_LENGTH + 64];
+        if (format_command(state, cmd, line, sizeof(line))) {
+            fprintf(state->record, "%s\n", line);
+            fflush(state->record);  /* A crashed session is still replayable */
+            state->stats.io_rebase = 1;
         }
     }
 
-    int y = start_y + 1;
-    for (int v = scroll_offset; v < type_count && y < start_y + height; v++) {
-        int real_idx = visual_map[v];
-        Combatant* c = &state->combatants[real_idx];
-
-        int row_color = COLOR_DEFAULT;
-        int attrs = 0;
-
-        if (c->id == state->selected_id) {
-            row_color = COLOR_SELECTED_ROW;
+    Combatant* c = (idx != -1) ? &state->combatants[idx] : NULL;
+    switch (cmd->type) {
+        case CMD_ADD:
+        case CMD_ADD_MOB: {
+            Combatant added = {0};
+            memcpy(added.name, cmd->add.name, NAME_LENGTH);
+            added.name[NAME_LENGTH - 1] = '\0';
+            added.type = (cmd->add.type == TYPE_PLAYER) ? TYPE_PLAYER : TYPE_ENEMY;
+            added.initiative = cmd->add.initiative;
+            added.dex = cmd->add.dex;
+            if (cmd->type == CMD_ADD_MOB) return insert_mob(state, &added, cmd->add.mob_size, cmd->add.unit_hp);
+            if (cmd->add.max_hp < 1) return 0;
+            added.max_hp = cmd->add.max_hp;
+            return insert_combatant(state, &added);
         }
-
-        if (c->id == state->current_turn_id) {
-            attrs = A_BOLD;
-            mvprintw(y, start_x, ">");
-            if (c->id == state->selected_id) row_color = COLOR_ACTIVE_ROW;
+        case CMD_HP:
+            apply_hp_change(state, c, cmd->hp.change, cmd->hp.is_critical);
+            return 1;
+        case CMD_MOB_HP:
+            apply_mob_hp_change(state, c, cmd->mob_hp.target, cmd->mob_hp.unit, cmd->mob_hp.change);
+            return 1;
+        case CMD_CONDITION:
+            set_condition(state, c, cmd->condition.cond, cmd->condition.active);
+            return 1;
+        case CMD_UNIT_CONDITION:
+            set_unit_condition(state, c, cmd->condition.unit, cmd->condition.cond, cmd->condition.active);
+            return 1;
+        case CMD_EXPIRY:
+            return set_condition_expiry(state, c, cmd->expiry.cond, cmd->expiry.duration, cmd->expiry.timing,
+                cmd->expiry.anchor_id);
+        case CMD_INITIATIVE:
+            set_initiative(state, idx, cmd->initiative.value);
+            return 1;
+        case CMD_DUPLICATE:
+            return duplicate_at(state, idx, cmd->duplicate.copies);
+        case CMD_REMOVE:
+            remove_combatant_at(state, idx);
+            return 1;
+        case CMD_DEATH_SAVE:
+            roll_death_save(state, c);
+            return 1;
+        case CMD_STABILIZE:
+            stabilize_combatant(state);
+            return 1;
+        case CMD_TOGGLE_MARK:
+            toggle_mark(state, idx);
+            return 1;
+        case CMD_MARK:
+            state->mark_anchor_id = cmd->target_id;
+            mark_range(state, idx, get_index_by_id(state, cmd->mark.to_id));
+            return 1;
+        case CMD_MARK_WHERE:
+            cmd->mark_where.prefix[NAME_LENGTH - 1] = '\0';
+            mark_matching(state, cmd->mark_where.filter, cmd->mark_where.prefix);
+            return 1;
+        case CMD_CLEAR_MARKS:
+            clear_marks(state);
+            return 1;
+        case CMD_GROUP_HP:
+            apply_group_hp_change(state, cmd->group.change);
+            return 1;
+        case CMD_NEXT_TURN:
+            next_turn(state);
+            return 1;
+        case CMD_PREV_TURN:
+            prev_turn(state);
+            return 1;
+        case CMD_UNDO: {
+            int before = state->undo_count;
+            undo_last_action(state);
+            return state->undo_count < before;
         }
-
-        attron(COLOR_PAIR(row_color) | (unsigned int)attrs);
-        mvprintw(y, start_x + 2, "%-20s %4d %4d", c->name, c->initiative, c->dex);
-        attroff(COLOR_PAIR(row_color) | (unsigned int)attrs);
-
-        /* Color coding: Good > Hurt > Critical > Unconscious/Dead */
-        int hp_color = COLOR_HP_GOOD;
-
-        if (c->hp <= 0 || c->is_dead) {
-            /* 5e rule: enemies die at 0 HP, players go unconscious */
-            if (c->type == TYPE_ENEMY || c->is_dead) hp_color = COLOR_DEAD;
-            else hp_color = COLOR_HP_UNCONSCIOUS;
+        case CMD_SKIP_POLICY:
+            set_skip_policy(state, cmd->skip.policy);
+            return 1;
+        case CMD_RESTORE: {
+            char token[16];
+            snprintf(token, sizeof(token), "#%d", cmd->target_id);
+            return archive_restore(state, archive_find(state, token), cmd->restore.revive_hp);
         }
-        else if (c->hp <= c->max_hp / 4) hp_color = COLOR_HP_CRITICAL;
-        else if (c->hp <= c->max_hp / 2) hp_color = COLOR_HP_HURT;
+        case CMD_EFFECT:
+            cmd->effect.name[EFFECT_NAME_LENGTH - 1] = '\0';
+            return register_effect(state, cmd->effect.name) != -1;
+        case CMD_EFFECTS_FILE:
+            cmd->file.path[COMMAND_PATH_LENGTH - 1] = '\0';
+            return load_effects_config(state, cmd->file.path) == 0;
+        case CMD_LOAD:
+            cmd->file.path[COMMAND_PATH_LENGTH - 1] = '\0';
+            return load_state_from_path(state, cmd->file.path);
+        case CMD_IMPORT:
+            cmd->file.path[COMMAND_PATH_LENGTH - 1] = '\0';
+            return import_roster_from_path(state, cmd->file.path);
+    }
+    return 0;
+}
 
-        attron(COLOR_PAIR(hp_color));
-        if (c->is_dead) {
-            mvprintw(y, start_x + 33, "%s", " DEAD  ");
-        } else if (c->hp <= 0 && c->type == TYPE_PLAYER) {
-            mvprintw(y, start_x + 33, "%s", " DOWN  ");
-        } else if (c->hp <= 0 && c->type == TYPE_ENEMY) {
-            mvprintw(y, start_x + 33, "%s", " DEAD  ");
-        } else {
-            mvprintw(y, start_x + 33, "%3d/%3d", c->hp, c->max_hp);
-        }
-        attroff(COLOR_PAIR(hp_color));
+/**
+ * Append a copy of `cmd` to the journal.
+ *
+ * @return 1 on success, 0 if the journal could not grow (the command is
+ *         still applied, it just cannot be replayed)
+ */
+int journal_append(GameState* state, const Command* cmd) {
+    if (state->journal_count >= state->journal_capacity) {
+        int new_capacity = state->journal_capacity > 0 ? state->journal_capacity * 2 : INITIAL_JOURNAL_CAPACITY;
+        Command* grown = (Command*)realloc(state->journal, (size_t)new_capacity * sizeof(Command));
+        if (!grown) return 0;
+        state->journal = grown;
+        state->journal_capacity = new_capacity;
+    }
+    state->journal[state->journal_count++] = *cmd;
+    return 1;
+}
 
-        /* Death Saves Display (only for players at 0 HP) */
-        if (c->type == TYPE_PLAYER && c->hp <= 0 && !c->is_dead) {
-            if (c->is_stable) {
-                mvprintw(y, start_x + 42, "STABLE");
+void journal_free(GameState* state) {
+    free(state->journal);
+    state->journal = NULL;
+    state->journal_count = 0;
+    state->journal_capacity = 0;
+}
+
+/**
+ * Write a command as the batch line that reproduces it, prefixed with its
+ * seed and issue time in ms: `@1f3a9c07+5120 damage #4 7`. Combatants are
+ * always named by id.
+ *
+ * @return Length written, or 0 if it did not fit
+ */
+int format_command(GameState* state, const Command* cmd, char* buf, size_t size) {
+    int prefix = snprintf(buf, size, "@%08x+%lld ", (unsigned int)cmd->seed, cmd->elapsed_ms);
+    if (prefix < 0 || (size_t)prefix >= size) return 0;
+    char* p = buf + prefix;
+    size_t left = size - (size_t)prefix;
+    int id = cmd->target_id;
+    int n = 0;
+    char quoted[2 * COMMAND_PATH_LENGTH + 3];
+
+    switch (cmd->type) {
+        case CMD_ADD:
+            n = snprintf(p, left, "add %s %s %d %d %d", cmd->add.type == TYPE_PLAYER ? "player" : "enemy",
+                batch_quote(cmd->add.name, quoted, sizeof(quoted)), cmd->add.initiative, cmd->add.dex,
+                cmd->add.max_hp);
+            break;
+        case CMD_ADD_MOB:
+            n = snprintf(p, left, "addmob %s %d %d %d %d", batch_quote(cmd->add.name, quoted, sizeof(quoted)),
+                cmd->add.initiative, cmd->add.dex, cmd->add.unit_hp, cmd->add.mob_size);
+            break;
+        case CMD_HP:
+            n = snprintf(p, left, "hp #%d %d%s", id, cmd->hp.change, cmd->hp.is_critical ? " crit" : "");
+            break;
+        case CMD_MOB_HP: {
+            const char* targets[] = {"focus", "spread", "all"};
+            if (cmd->mob_hp.target == MOB_TARGET_UNIT) {
+                n = snprintf(p, left, "mobhp #%d %d %d", id, cmd->mob_hp.unit + 1, cmd->mob_hp.change);
             } else {
-                char ds_str[16];
-                snprintf(ds_str, sizeof(ds_str), "S:%d F:%d", c->death_save_successes, c->death_save_failures);
-                mvprintw(y, start_x + 42, "%-12s", ds_str);
+                n = snprintf(p, left, "mobhp #%d %s %d", id, targets[cmd->mob_hp.target], cmd->mob_hp.change);
             }
-        } else if (c->is_dead) {
-            attron(COLOR_PAIR(COLOR_DEAD));
-            mvprintw(y, start_x + 42, "DEAD");
-            attroff(COLOR_PAIR(COLOR_DEAD));
-        } else {
-            mvprintw(y, start_x + 42, "            ");
+            break;
         }
-
-        /* Build condition string with bounds checking to prevent overflow */
-        char cond_str[128] = "";
-        size_t cond_str_len = 0;
-        for (int j = 0; j < NUM_CONDITIONS; j++) {
-            if (c->conditions & (1 << j)) {
-                char temp[32];
-                int temp_len;
-                if (c->condition_duration[j] > 0)
-                    temp_len = snprintf(temp, sizeof(temp), "%s(%d) ", get_condition_name(j), c->condition_duration[j]);
-                else
-                    temp_len = snprintf(temp, sizeof(temp), "%s ", get_condition_name(j));
-
-                if (cond_str_len + (size_t)temp_len < sizeof(cond_str) - 1) {
-                    strncat(cond_str, temp, sizeof(cond_str) - cond_str_len - 1);
-                    cond_str_len += (size_t)temp_len;
-                } else {
-                    break; /* Buffer full - truncate gracefully */
-                }
+        case CMD_CONDITION:
+            n = snprintf(p, left, "condition #%d \"%s\" %s", id, effect_name(state, cmd->condition.cond),
+                cmd->condition.active ? "on" : "off");
+            break;
+        case CMD_UNIT_CONDITION:
+            n = snprintf(p, left, "unitcond #%d %d \"%s\" %s", id, cmd->condition.unit + 1,
+                effect_name(state, cmd->condition.cond), cmd->condition.active ? "on" : "off");
+            break;
+        case CMD_EXPIRY: {
+            const char* name = effect_name(state, cmd->expiry.cond);
+            if (cmd->expiry.timing == EXPIRE_ROUND_START) {
+                n = snprintf(p, left, "duration #%d \"%s\" %d", id, name, cmd->expiry.duration);
+            } else {
+                n = snprintf(p, left, "duration #%d \"%s\" %d %s #%d", id, name, cmd->expiry.duration,
+                    cmd->expiry.timing == EXPIRE_TURN_START ? "start" : "end", cmd->expiry.anchor_id);
             }
+            break;
         }
-        int remaining_w = width - 55;
-        if (remaining_w > 0)
-            mvprintw(y, start_x + 54, "%.*s", remaining_w, cond_str);
-
-        y++;
-    }
-
-    if (type_count > list_display_h && scroll_offset + list_display_h < type_count) {
-        int indicator_y = start_y + height - 1;
-        attron(A_BOLD);
-        mvprintw(indicator_y, start_x + 2, "(%d more \u2193)", type_count - (scroll_offset + list_display_h));
-        attroff(A_BOLD);
+        case CMD_INITIATIVE: n = snprintf(p, left, "init #%d %d", id, cmd->initiative.value); break;
+        case CMD_DUPLICATE: n = snprintf(p, left, "dup #%d %d", id, cmd->duplicate.copies); break;
+        case CMD_REMOVE: n = snprintf(p, left, "remove #%d", id); break;
+        case CMD_DEATH_SAVE: n = snprintf(p, left, "deathsave #%d", id); break;
+        case CMD_STABILIZE: n = snprintf(p, left, "stabilize #%d", id); break;
+        case CMD_TOGGLE_MARK: n = snprintf(p, left, "togglemark #%d", id); break;
+        case CMD_MARK: n = snprintf(p, left, "mark #%d #%d", id, cmd->mark.to_id); break;
+        case CMD_MARK_WHERE:
+            if (cmd->mark_where.filter == MARK_PLAYERS) n = snprintf(p, left, "markwhere players");
+            else if (cmd->mark_where.filter == MARK_ENEMIES) n = snprintf(p, left, "markwhere enemies");
+            else n = snprintf(p, left, "markwhere prefix %s", batch_quote(cmd->mark_where.prefix, quoted, sizeof(quoted)));
+            break;
+        case CMD_CLEAR_MARKS: n = snprintf(p, left, "clearmarks"); break;
+        case CMD_GROUP_HP: n = snprintf(p, left, "group %d", cmd->group.change); break;
+        case CMD_NEXT_TURN: n = snprintf(p, left, "next"); break;
+        case CMD_PREV_TURN: n = snprintf(p, left, "prev"); break;
+        case CMD_UNDO: n = snprintf(p, left, "undo"); break;
+        case CMD_SKIP_POLICY:
+            n = snprintf(p, left, "skip%s%s%s%s", cmd->skip.policy ? "" : " none",
+                (cmd->skip.policy & SKIP_DEAD) ? " dead" : "", (cmd->skip.policy & SKIP_STABLE) ? " stable" : "",
+                (cmd->skip.policy & SKIP_INCAPACITATED) ? " incapacitated" : "");
+            break;
+        case CMD_RESTORE:
+            if (cmd->restore.revive_hp > 0) n = snprintf(p, left, "restore #%d %d", id, cmd->restore.revive_hp);
+            else n = snprintf(p, left, "restore #%d", id);
+            break;
+        case CMD_EFFECT: n = snprintf(p, left, "effect %s", batch_quote(cmd->effect.name, quoted, sizeof(quoted))); break;
+        case CMD_EFFECTS_FILE: n = snprintf(p, left, "effects %s", batch_quote(cmd->file.path, quoted, sizeof(quoted))); break;
+        case CMD_LOAD: n = snprintf(p, left, "load %s", batch_quote(cmd->file.path, quoted, sizeof(quoted))); break;
+        case CMD_IMPORT: n = snprintf(p, left, "import %s", batch_quote(cmd->file.path, quoted, sizeof(quoted))); break;
     }
+    if (n < 0 || (size_t)n >= left) return 0;
+    return prefix + n;
 }
 
 /**
- * Open condition menu for selected combatant.
- * Switches to MODE_CONDITIONS for interactive editing.
+ * Wrap `text` in double quotes for a batch line, escaping `"` and `\` so
+ * batch_next_token reads it back unchanged.
+ *
+ * @return `out` (cut short if it does not fit)
  */
-void toggle_condition(GameState* state) {
-    if (state->count == 0) return;
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) {
-        show_message(state, "No combatant selected!", 1);
-        return;
+const char* batch_quote(const char* text, char* out, size_t size) {
+    size_t n = 0;
+    if (size < 3) return "\"\"";
+    out[n++] = '"';
+    for (; *text && n + 3 < size; text++) {
+        if (*text == '"' || *text == '\\') out[n++] = '\\';
+        out[n++] = *text;
     }
-
-    save_undo_state(state);
-    state->mode = MODE_CONDITIONS;
-    state->condition_menu_cursor = 0;
-    state->condition_menu_target_id = state->selected_id;
+    out[n++] = '"';
+    out[n] = '\0';
+    return out;
 }
 
 /**
- * Draw the condition sub-menu overlay.
+ * Write the journal to `path` as a batch script; `--batch path` replays it.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
  */
-void draw_condition_menu(GameState* state) {
-    int idx = get_index_by_id(state, state->condition_menu_target_id);
-    if (idx == -1) {
-        state->mode = MODE_COMBAT;
-        return;
+int journal_write(GameState* state, const char* path) {
+    TRACE_SCOPE("journal_write");
+    state->stats.io_rebase = 1;
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        show_message(state, "Journal write failed! Cannot open file.", 1);
+        return 0;
     }
 
-    Combatant* c = &state->combatants[idx];
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
+    fprintf(f, "# initiative command journal: %d commands\n", state->journal_count);
+    char line[COMMAND_PATH_LENGTH + 64];
+    for (int i = 0; i < state->journal_count; i++) {
+        if (format_command(state, &state->journal[i], line, sizeof(line))) fprintf(f, "%s\n", line);
+    }
 
-    int menu_height = NUM_CONDITIONS + 6;
-    int menu_width = 60;
-    int start_y = (rows - menu_height) / 2;
-    int start_x = (cols - menu_width) / 2;
-    if (start_y < 0) start_y = 0;
-    if (start_x < 0) start_x = 0;
+    if (fclose(f) != 0) {
+        show_message(state, "Journal write failed!", 1);
+        return 0;
+    }
+    return 1;
+}
 
-    /* Draw overlay background */
-    attron(COLOR_PAIR(COLOR_HEADER));
-    for (int y = start_y; y < start_y + menu_height && y < rows; y++) {
-        for (int x = start_x; x < start_x + menu_width && x < cols; x++) {
-            mvaddch(y, x, ' ');
+ /* --- Name Index Functions --- */
+
+/**
+ * Split "Goblin 12" into base "Goblin" and suffix 12.
+ * Only a single space followed by a positive number counts as a suffix,
+ * matching the names duplicate_at() generates.
+ *
+ * @param base Receives the base name (NAME_LENGTH bytes)
+ * @param suffix Receives the suffix, or 0 if the name has none
+ * @return 1 if the name has a numeric suffix, 0 otherwise
+ */
+int split_numbered_name(const char* name, char* base, int* suffix) {
+    int len = (int)strlen(name);
+    int digits_start = len;
+    while (digits_start > 0 && isdigit((unsigned char)name[digits_start - 1])) digits_start--;
+
+    *suffix = 0;
+    if (digits_start < len && digits_start >= 2 && name[digits_start - 1] == ' ') {
+        char* endptr;
+        errno = 0;
+        long parsed = strtol(name + digits_start, &endptr, 10);
+        if (errno == 0 && *endptr == '\0' && parsed > 0 && parsed <= INT_MAX) {
+            memcpy(base, name, (size_t)(digits_start - 1));
+            base[digits_start - 1] = '\0';
+            *suffix = (int)parsed;
+            return 1;
         }
     }
-    attroff(COLOR_PAIR(COLOR_HEADER));
 
-    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
-    mvprintw(start_y, start_x + 2, "Conditions for: %s", c->name);
-    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
-
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvhline(start_y + 1, start_x, ACS_HLINE, menu_width);
+    strncpy(base, name, NAME_LENGTH - 1);
+    base[NAME_LENGTH - 1] = '\0';
+    return 0;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER) | A_DIM);
-    mvprintw(start_y + 2, start_x + 2, "UP/DOWN: Navigate | ENTER: Toggle | 'd': Duration");
-    attroff(COLOR_PAIR(COLOR_HEADER) | A_DIM);
+/* FNV-1a */
+unsigned int name_index_hash(const char* key) {
+    unsigned int h = 2166136261u;
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvhline(start_y + 3, start_x, ACS_HLINE, menu_width);
+/**
+ * Find the slot for `base`: either its entry or the empty slot where it belongs.
+ */
+NameIndexEntry* name_index_slot(NameIndex* index, const char* base) {
+    unsigned int mask = (unsigned int)index->capacity - 1;
+    unsigned int i = name_index_hash(base) & mask;
+    while (index->slots[i].used && strcmp(index->slots[i].base, base) != 0) {
+        i = (i + 1) & mask;
+    }
+    return &index->slots[i];
+}
 
-    for (int i = 0; i < NUM_CONDITIONS; i++) {
-        int is_active = c->conditions & (1 << i);
-        int is_selected = (i == state->condition_menu_cursor);
-        int y = start_y + 4 + i;
+int name_index_grow(NameIndex* index) {
+    int new_capacity = index->capacity > 0 ? index->capacity * 2 : NAME_INDEX_INITIAL_CAPACITY;
+    NameIndexEntry* new_slots = (NameIndexEntry*)calloc((size_t)new_capacity, sizeof(NameIndexEntry));
+    if (!new_slots) return 0;
 
-        int pair = is_selected ? COLOR_MENU_SEL : COLOR_MENU_NORM;
-        attron(COLOR_PAIR(pair));
-        if (is_selected) attron(A_BOLD);
+    NameIndex grown = {new_slots, new_capacity, index->count};
+    for (int i = 0; i < index->capacity; i++) {
+        if (index->slots[i].used) *name_index_slot(&grown, index->slots[i].base) = index->slots[i];
+    }
 
-        mvprintw(y, start_x + 2, "[%c] %-20s", is_active ? 'X' : ' ', get_condition_name(i));
+    free(index->slots);
+    *index = grown;
+    return 1;
+}
 
-        if (is_active && c->condition_duration[i] > 0) {
-            printw(" (%d rounds)", c->condition_duration[i]);
-        }
+/**
+ * Record a combatant name in the index (on add, rename and load).
+ * Removal deliberately leaves the high-water mark in place, so a removed
+ * "Goblin 3" is never reissued while its log entries still refer to it.
+ * Undo keeps the marks too, and saves store them.
+ */
+void name_index_note(GameState* state, const char* name) {
+    char base[NAME_LENGTH];
+    int suffix;
+    split_numbered_name(name, base, &suffix);
+    name_index_raise(state, base, suffix);
+}
 
-        if (is_selected) attroff(A_BOLD);
-        attroff(COLOR_PAIR(pair));
+/**
+ * Raise the high-water mark of `base` to at least `highest`.
+ */
+void name_index_raise(GameState* state, const char* base, int highest) {
+    NameIndex* index = &state->name_index;
+
+    /* Keep the load factor under 3/4 */
+    if ((index->count + 1) * 4 > index->capacity * 3 && !name_index_grow(index)) return;
+
+    NameIndexEntry* entry = name_index_slot(index, base);
+    if (!entry->used) {
+        memcpy(entry->base, base, NAME_LENGTH);
+        entry->highest = 0;
+        entry->used = 1;
+        index->count++;
     }
+    if (highest > entry->highest) entry->highest = highest;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvhline(start_y + menu_height - 2, start_x, ACS_HLINE, menu_width);
-    mvprintw(start_y + menu_height - 1, start_x + (menu_width - 20) / 2, "ESC or 'q' to close");
-    attroff(COLOR_PAIR(COLOR_HEADER));
+/**
+ * @return Highest suffix in use for `base`, or 0 if there is none
+ */
+int name_index_highest(GameState* state, const char* base) {
+    if (state->name_index.capacity == 0) return 0;
+    NameIndexEntry* entry = name_index_slot(&state->name_index, base);
+    return entry->used ? entry->highest : 0;
 }
 
 /**
- * Handle input in condition menu mode.
+ * Note every name of the current roster (after load and undo). Marks are only
+ * raised, so numbers handed out before an undo stay taken. Archived names
+ * count too, so a restored combatant never clashes with a new duplicate.
  */
-int handle_condition_menu_input(GameState* state, int ch) {
-    int idx = get_index_by_id(state, state->condition_menu_target_id);
-    if (idx == -1) {
-        state->mode = MODE_COMBAT;
-        return 1;
+void name_index_rebuild(GameState* state) {
+    for (int i = 0; i < state->count; i++) {
+        name_index_note(state, state->combatants[i].name);
     }
+    for (int i = 0; i < state->archive_count; i++) {
+        if (!state->archive[i].restored_epoch) name_index_note(state, state->archive[i].combatant.name);
+    }
+}
 
-    Combatant* c = &state->combatants[idx];
+/* Drop every mark (before a load brings in its own) */
+void name_index_clear(GameState* state) {
+    NameIndex* index = &state->name_index;
+    if (index->slots) memset(index->slots, 0, (size_t)index->capacity * sizeof(NameIndexEntry));
+    index->count = 0;
+}
 
-    switch (ch) {
-        case KEY_UP:
-        case 'k':
-            state->condition_menu_cursor = (state->condition_menu_cursor - 1 + NUM_CONDITIONS) % NUM_CONDITIONS;
-            return 1;
-        case KEY_DOWN:
-        case 'j':
-            state->condition_menu_cursor = (state->condition_menu_cursor + 1) % NUM_CONDITIONS;
-            return 1;
-        case '\n':
-        case '\r':
-        case ' ':
-            {
-                int cursor = state->condition_menu_cursor;
-                int was_active = c->conditions & (1 << cursor);
-                c->conditions ^= (1 << cursor);
-
-                if (!was_active && (c->conditions & (1 << cursor))) {
-                    log_action(state, "%s: %s applied.", c->name, get_condition_name(cursor));
-                } else if (was_active && !(c->conditions & (1 << cursor))) {
-                    c->condition_duration[cursor] = 0;
-                    log_action(state, "%s: %s removed.", c->name, get_condition_name(cursor));
-                }
-            }
-            return 1;
-        case 'd':
-        case 'D':
-            {
-                int cursor = state->condition_menu_cursor;
-                if (c->conditions & (1 << cursor)) {
-                    int dur;
-                    if (get_input_int(state, "Duration (rounds, 0=permanent): ", &dur, 0, INT_MAX)) {
-                        c->condition_duration[cursor] = dur;
-                        log_action(state, "%s: %s duration set to %d.", c->name, get_condition_name(cursor), dur);
-                    }
-                } else {
-                    show_message(state, "Enable condition first!", 1);
-                }
-            }
-            return 1;
-        case 'q':
-        case 'Q':
-        case 27: /* ESC */
-            state->mode = MODE_COMBAT;
-            show_message(state, "Condition menu closed.", 0);
-            return 1;
-        default:
-            return 0;
-    }
+void name_index_free(GameState* state) {
+    free(state->name_index.slots);
+    state->name_index.slots = NULL;
+    state->name_index.capacity = 0;
+    state->name_index.count = 0;
 }
 
+ /* --- Archive Functions --- */
+
 /**
- * Draw help menu overlay.
+ * @return 1 if `c` is out of the fight: dead, or an enemy at 0 HP
  */
-void draw_help_menu(GameState* state) {
-    (void)state;
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
+int combatant_is_dead(const Combatant* c) {
+    return c->is_dead || (c->type == TYPE_ENEMY && c->hp <= 0);
+}
 
-    int h_height = 28;
-    int h_width = 75;
-    int h_start_y = (rows - h_height) / 2;
-    int h_start_x = (cols - h_width) / 2;
-    if (h_start_y < 0) h_start_y = 0;
-    if (h_start_x < 0) h_start_x = 0;
+/**
+ * Copy `c` (and its mob units) onto the end of the archive.
+ * The caller removes it from the roster.
+ *
+ * @return 1 on success, 0 on allocation failure
+ */
+int archive_push(GameState* state, const Combatant* c, ArchiveReason reason) {
+    if (state->archive_count >= state->archive_capacity) {
+        int new_capacity = state->archive_capacity > 0 ? state->archive_capacity * 2 : 16;
+        ArchiveEntry* grown = (ArchiveEntry*)realloc(state->archive, (size_t)new_capacity * sizeof(ArchiveEntry));
+        if (!grown) return 0;
+        state->archive = grown;
+        state->archive_capacity = new_capacity;
+    }
+    if (c->mob_size > 0 && state->archive_unit_count + c->mob_size > state->archive_unit_capacity) {
+        int new_capacity = state->archive_unit_capacity > 0 ? state->archive_unit_capacity : 64;
+        while (new_capacity < state->archive_unit_count + c->mob_size) new_capacity *= 2;
+        MobUnit* grown = (MobUnit*)realloc(state->archive_units, (size_t)new_capacity * sizeof(MobUnit));
+        if (!grown) return 0;
+        state->archive_units = grown;
+        state->archive_unit_capacity = new_capacity;
+    }
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    for (int y = h_start_y; y < h_start_y + h_height && y < rows; y++) {
-        for (int x = h_start_x; x < h_start_x + h_width && x < cols; x++) {
-            mvaddch(y, x, ' ');
-        }
+    ArchiveEntry* entry = &state->archive[state->archive_count++];
+    entry->combatant = *c;
+    entry->combatant.is_marked = 0;
+    entry->combatant.is_expanded = 0;
+    entry->round = state->round;
+    entry->reason = reason;
+    entry->restored_epoch = 0;
+
+    if (c->mob_size > 0) {
+        memcpy(&state->archive_units[state->archive_unit_count], &state->mob_units[c->mob_first],
+            (size_t)c->mob_size * sizeof(MobUnit));
+        entry->combatant.mob_first = state->archive_unit_count;
+        state->archive_unit_count += c->mob_size;
     }
-    attroff(COLOR_PAIR(COLOR_HEADER));
+    return 1;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
-    mvprintw(h_start_y, h_start_x + (h_width - 12) / 2, "HELP & COMMANDS");
-    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+/**
+ * Move every dead combatant out of the roster in one pass.
+ * Anyone the archive cannot take (out of memory) simply stays put.
+ *
+ * @return Number of combatants archived
+ */
+int archive_sweep_dead(GameState* state) {
+    archive_trim(state);
+    int first_new = state->archive_count;
+    for (int i = 0; i < state->count; i++) {
+        Combatant* c = &state->combatants[i];
+        if (!combatant_is_dead(c) || !archive_push(state, c, ARCHIVE_DEAD)) continue;
+        log_action(state, "%s archived (dead).", c->name);
+        mob_free_units(state, c);
+    }
+    int archived = state->archive_count - first_new;
+    if (archived == 0) return 0;
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvhline(h_start_y + 1, h_start_x, ACS_HLINE, h_width);
+    /* New entries were appended in roster order, so one merge walk drops them */
+    int next = first_new;
+    int kept = 0;
+    for (int i = 0; i < state->count; i++) {
+        if (next < state->archive_count && state->combatants[i].id == state->archive[next].combatant.id) {
+            next++;
+            continue;
+        }
+        state->combatants[kept++] = state->combatants[i];
+    }
+    state->count = kept;
+    eligible_rebuild(state);
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    int y = h_start_y + 3;
-    mvprintw(y++, h_start_x + 2, "Navigation:");
-    mvprintw(y++, h_start_x + 4, "UP/DOWN or k/j : Move selection");
-    mvprintw(y++, h_start_x + 4, "ENTER : Set selected as current turn");
-    y++;
-    mvprintw(y++, h_start_x + 2, "Combat Commands:");
-    mvprintw(y++, h_start_x + 4, "A : Add combatant");
-    mvprintw(y++, h_start_x + 4, "D : Delete selected combatant");
-    mvprintw(y++, h_start_x + 4, "H : Edit HP (damage/heal)");
-    mvprintw(y++, h_start_x + 4, "C : Toggle conditions (interactive menu)");
-    mvprintw(y++, h_start_x + 4, "N : Next turn (auto death saves)");
-    mvprintw(y++, h_start_x + 4, "P : Previous turn");
-    mvprintw(y++, h_start_x + 4, "R : Reroll initiative");
-    mvprintw(y++, h_start_x + 4, "U : Duplicate selected combatant");
-    mvprintw(y++, h_start_x + 4, "X : Manual death save roll");
-    mvprintw(y++, h_start_x + 4, "T : Stabilize combatant");
-    y++;
-    mvprintw(y++, h_start_x + 2, "Other:");
-    mvprintw(y++, h_start_x + 4, "Z : Undo last action");
-    mvprintw(y++, h_start_x + 4, "E : Export combat log");
-    mvprintw(y++, h_start_x + 4, "S : Save game");
-    mvprintw(y++, h_start_x + 4, "L : Load game");
-    mvprintw(y++, h_start_x + 4, "Q : Quit");
-    attroff(COLOR_PAIR(COLOR_HEADER));
+    if (get_index_by_id(state, state->current_turn_id) == -1) {
+        state->current_turn_id = (state->count > 0) ? state->combatants[0].id : -1;
+    }
+    if (get_index_by_id(state, state->selected_id) == -1) {
+        state->selected_id = state->current_turn_id;
+    }
+    return archived;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvhline(h_start_y + h_height - 2, h_start_x, ACS_HLINE, h_width);
-    mvprintw(h_start_y + h_height - 1, h_start_x + (h_width - 20) / 2, "Press any key to close");
-    attroff(COLOR_PAIR(COLOR_HEADER));
+/**
+ * Bring the archive back to 3/4 of ARCHIVE_LIMIT once it reaches the limit,
+ * dropping restored entries first and then the longest-archived. Entries an
+ * undo snapshot still refers to are kept, so the archive can run over the
+ * limit for a few steps. Called before the archive grows.
+ */
+void archive_trim(GameState* state) {
+    if (state->archive_count < ARCHIVE_LIMIT) return;
+
+    /* Undo truncates back to the smallest snapshot count and clears restore stamps newer than its epoch */
+    int reach = state->archive_count;
+    int epoch = state->archive_epoch;
+    for (int i = 0; i < state->undo_count; i++) {
+        if (state->undo_stack[i].archive_count < reach) reach = state->undo_stack[i].archive_count;
+        if (state->undo_stack[i].archive_epoch < epoch) epoch = state->undo_stack[i].archive_epoch;
+    }
 
-    /* Safety check: clear overflow if content exceeds menu height */
-    if (y > h_start_y + h_height - 2) {
-        for (int clear_y = h_start_y + h_height - 2; clear_y < h_start_y + h_height; clear_y++) {
-            if (clear_y < rows) {
-                move(clear_y, h_start_x);
-                clrtoeol();
+    int excess = state->archive_count - ARCHIVE_LIMIT * 3 / 4;
+    for (int i = 0; i < reach; i++) {
+        int restored = state->archive[i].restored_epoch;
+        if (restored && restored <= epoch) excess--;
+    }
+    int live_drops = excess > 0 ? excess : 0;
+
+    int kept = 0, units = 0, dropped = 0, dropped_units = 0;
+    for (int i = 0; i < state->archive_count; i++) {
+        ArchiveEntry* entry = &state->archive[i];
+        int drop = 0;
+        if (i < reach) {
+            if (entry->restored_epoch) {
+                drop = entry->restored_epoch <= epoch;
+            } else if (live_drops > 0) {
+                drop = 1;
+                live_drops--;
             }
         }
+        if (drop) {
+            dropped++;
+            dropped_units += entry->combatant.mob_size;
+            effect_release(state, &entry->combatant);
+            continue;
+        }
+        if (entry->combatant.mob_size > 0) {
+            memmove(&state->archive_units[units], &state->archive_units[entry->combatant.mob_first],
+                (size_t)entry->combatant.mob_size * sizeof(MobUnit));
+            entry->combatant.mob_first = units;
+            units += entry->combatant.mob_size;
+        }
+        state->archive[kept++] = *entry;
     }
-}
+    state->archive_count = kept;
+    state->archive_unit_count = units;
 
+    /* Everything dropped sat below every snapshot's counts */
+    for (int i = 0; i < state->undo_count; i++) {
+        state->undo_stack[i].archive_count -= dropped;
+        state->undo_stack[i].archive_unit_count -= dropped_units;
+    }
+}
 
 /**
- * Add a new combatant to the initiative tracker.
- * Validates all inputs and ensures data integrity.
+ * Bring an archived combatant back into the initiative order.
+ *
+ * @param slot Index into state->archive
+ * @param revive_hp If positive, the combatant returns alive with this much HP
+ *                  (capped at max; for mobs, every dead unit gets it). Otherwise
+ *                  it returns exactly as it was archived.
+ * @return 1 on success, 0 on failure (message already shown)
  */
-void add_combatant(GameState* state) {
-    if (!state) return;
-
-    if (state->count >= MAX_COMBATANTS) {
+int archive_restore(GameState* state, int slot, int revive_hp) {
+    if (slot < 0 || slot >= state->archive_count || state->archive[slot].restored_epoch) return 0;
+    if (!ensure_combatant_capacity(state, state->count + 1)) {
         show_message(state, "List full! Maximum combatants reached.", 1);
-        return;
+        return 0;
     }
 
-    Combatant c = {0};
-    int type_char = get_input_char("Type? (P)layer / (E)nemy: ", "pePE");
-    if (type_char == 0) return; /* User cancelled */
-
-    c.type = (tolower(type_char) == 'p') ? TYPE_PLAYER : TYPE_ENEMY;
-
-    if (!get_input_string("Name: ", c.name, NAME_LENGTH)) return;
-
-    /* Trim trailing whitespace and validate non-empty */
-    int name_len = (int)strlen(c.name);
-    while (name_len > 0 && isspace((unsigned char)c.name[name_len - 1])) {
-        c.name[--name_len] = '\0';
-    }
-    if (name_len == 0) {
-        show_message(state, "Name cannot be empty!", 1);
-        return;
+    /* The entry stays behind for undo, so the restored copy gets its own effect entries */
+    Combatant c = state->archive[slot].combatant;
+    if (!effect_clone(state, &c)) {
+        effect_release(state, &c);
+        show_message(state, "Restore failed! Out of memory.", 1);
+        return 0;
     }
-
-    if (!get_input_int(state, "Initiative: ", &c.initiative, INT_MIN, INT_MAX)) return;
-    /* Warn on unusual values (likely input errors) */
-    if (c.initiative < -10 || c.initiative > 50) {
-        show_message(state, "Warning: Initiative seems unusual. Continuing anyway.", 1);
+    if (c.mob_size > 0) {
+        int first = mob_alloc_units(state, c.mob_size, c.mob_unit_max_hp);
+        if (first == -1) {
+            effect_release(state, &c);
+            show_message(state, "Restore failed! Out of memory.", 1);
+            return 0;
+        }
+        memcpy(&state->mob_units[first], &state->archive_units[c.mob_first], (size_t)c.mob_size * sizeof(MobUnit));
+        c.mob_first = first;
     }
 
-    if (!get_input_int(state, "Dexterity (Tiebreaker): ", &c.dex, INT_MIN, INT_MAX)) return;
-    if (c.dex < -10 || c.dex > 20) {
-        show_message(state, "Warning: Dex modifier seems unusual. Continuing anyway.", 1);
+    if (revive_hp > 0) {
+        if (c.mob_size > 0) {
+            MobUnit* units = &state->mob_units[c.mob_first];
+            uint16_t unit_hp = (uint16_t)(revive_hp < c.mob_unit_max_hp ? revive_hp : c.mob_unit_max_hp);
+            for (int u = 0; u < c.mob_size; u++) {
+                if (units[u].hp == 0) units[u].hp = unit_hp;
+            }
+            mob_sync_hp(state, &c);
+        } else {
+            c.hp = (revive_hp < c.max_hp) ? revive_hp : c.max_hp;
+        }
+        c.is_dead = 0;
+        reset_death_saves(&c);
+        effect_assign(state, &c, UNCONSCIOUS_INDEX, 0);
     }
 
-    int max_hp;
-    if (!get_input_int(state, "Max HP: ", &max_hp, 1, INT_MAX)) return;
-
-    if (max_hp > 10000) {
-        show_message(state, "Warning: Max HP seems unusually high. Continuing anyway.", 1);
+    insert_sorted_batch(state, &c, 1);
+    for (int j = c.timer_first; j; j = state->effect_store.timers[j].next) {
+        const EffectTimer* t = &state->effect_store.timers[j];
+        ExpiryEvent ev = { t->expires, t->timing, c.id, t->anchor_id, t->effect };
+        scheduler_push(state, &ev);
     }
+    name_index_note(state, c.name);
+    state->selected_id = c.id;
+    if (state->current_turn_id == -1) state->current_turn_id = c.id;
+    state->archive[slot].restored_epoch = ++state->archive_epoch;
 
-    c.max_hp = max_hp;
-    c.hp = c.max_hp;
-    c.death_save_successes = 0;
-    c.death_save_failures = 0;
-    c.is_stable = 0;
-    c.is_dead = 0;
-
-    if (state->next_id == INT_MAX) {
-        state->next_id = 1;
+    char msg[128];
+    if (revive_hp > 0) {
+        snprintf(msg, sizeof(msg), "%s revived with %d HP.", c.name, c.hp);
+        log_action(state, "%s returned from the archive with %d HP.", c.name, c.hp);
+    } else {
+        snprintf(msg, sizeof(msg), "%s restored.", c.name);
+        log_action(state, "%s restored from the archive.", c.name);
     }
-    c.id = state->next_id++;
+    show_message(state, msg, 0);
+    return 1;
+}
 
-    state->combatants[state->count++] = c;
-    state->selected_id = c.id;
-    if (state->count == 1) state->current_turn_id = c.id;
+/**
+ * Resolve "#<id>" or an exact name against the live archive, newest first.
+ *
+ * @return Archive slot, or -1 if not found
+ */
+int archive_find(GameState* state, const char* token) {
+    if (!token) return -1;
 
-    sort_combatants(state);
+    int id = 0;
+    int by_id = (token[0] == '#');
+    if (by_id && !parse_int_safe(token + 1, &id)) return -1;
 
-    /* Round 1 edge case: ensure turn starts with highest initiative */
-    if (state->round == 1 && state->count > 0) {
-        state->current_turn_id = state->combatants[0].id;
+    for (int i = state->archive_count - 1; i >= 0; i--) {
+        const ArchiveEntry* entry = &state->archive[i];
+        if (entry->restored_epoch) continue;
+        if (by_id ? entry->combatant.id == id : strcmp(entry->combatant.name, token) == 0) return i;
     }
+    return -1;
+}
 
-    log_action(state, "Added %s: Init %d, HP %d.", c.name, c.initiative, c.max_hp);
+int archive_live_count(GameState* state) {
+    int live = 0;
+    for (int i = 0; i < state->archive_count; i++) {
+        if (!state->archive[i].restored_epoch) live++;
+    }
+    return live;
 }
 
 /**
- * Duplicates the selected combatant.
- *
- * Logic:
- * - Prompts user for the number of copies to create.
- * - Naming: Finds the base name (e.g., "Goblin" from "Goblin 5")
- * renames the original to "BaseName 1", and names copies sequentially
- * ("BaseName 2", "BaseName 3", etc.), ensuring no name collisions.
- * - Initiative: Rerolls initiative for each duplicate (1d20 + Dex Modifier).
- * - State: Duplicates are considered "fresh spawns" (Max HP, no conditions,
- * no death saves).
- *
- * @param state Pointer to the current GameState.
+ * @return Slot of the n-th live entry counting from the newest, or -1
  */
-void duplicate_combatant(GameState* state) {
-    if (state->count == 0) return;
+int archive_nth_live(GameState* state, int n) {
+    for (int i = state->archive_count - 1; i >= 0; i--) {
+        if (state->archive[i].restored_epoch) continue;
+        if (n-- == 0) return i;
+    }
+    return -1;
+}
 
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) {
-        show_message(state, "No combatant selected!", 1);
-        return;
+/**
+ * Return the archive to an undo snapshot: drop entries added since and
+ * un-stamp entries restored since.
+ */
+void archive_rollback(GameState* state, int count, int unit_count, int epoch) {
+    if (count < state->archive_count) state->archive_count = count;
+    if (unit_count < state->archive_unit_count) state->archive_unit_count = unit_count;
+    for (int i = 0; i < state->archive_count; i++) {
+        if (state->archive[i].restored_epoch > epoch) state->archive[i].restored_epoch = 0;
     }
+    state->archive_epoch = epoch;
+}
 
-    int max_copies = MAX_COMBATANTS - state->count;
-    if (max_copies <= 0) {
-        show_message(state, "List full! Cannot duplicate.", 1);
+void archive_free(GameState* state) {
+    free(state->archive);
+    state->archive = NULL;
+    state->archive_count = 0;
+    state->archive_capacity = 0;
+    free(state->archive_units);
+    state->archive_units = NULL;
+    state->archive_unit_count = 0;
+    state->archive_unit_capacity = 0;
+    state->archive_epoch = 0;
+}
+
+void open_archive_menu(GameState* state) {
+    TRACE_SCOPE("open_archive_menu");
+    if (archive_live_count(state) == 0) {
+        show_message(state, "Archive is empty!", 1);
         return;
     }
+    state->mode = MODE_ARCHIVE;
+    state->archive_cursor = 0;
+}
 
-    Combatant* source = &state->combatants[idx];
-
-    int num_copies;
-    if (!get_input_int(state, "Number of duplicates: ", &num_copies, 1, max_copies)) {
+/**
+ * Draw the archive overlay, newest entries first.
+ */
+void draw_archive_menu(GameState* state) {
+    int live = archive_live_count(state);
+    if (live == 0) {
+        state->mode = MODE_COMBAT;
         return;
     }
+    if (state->archive_cursor >= live) state->archive_cursor = live - 1;
 
-    /* Reserve space for suffix to prevent truncation warnings */
-    const int max_suffix_len = 12;
-    const int max_base_len = NAME_LENGTH - max_suffix_len;
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
 
-    char base_name[NAME_LENGTH];
-    /* Strip trailing numbers to avoid "Goblin 1 1" scenarios */
-    int len = (int)strlen(source->name);
-    int trailing_num_start = len;
+    int visible = live;
+    if (visible > rows - 6) visible = rows - 6;
+    if (visible < 1) visible = 1;
+    int top = state->archive_cursor - visible + 1;
+    if (top < 0) top = 0;
 
-    while (trailing_num_start > 0 && isdigit((unsigned char)source->name[trailing_num_start - 1])) {
-        trailing_num_start--;
-    }
+    int menu_height = visible + 6;
+    int menu_width = 64;
+    int start_y = (rows - menu_height) / 2;
+    int start_x = (cols - menu_width) / 2;
+    if (start_y < 0) start_y = 0;
+    if (start_x < 0) start_x = 0;
 
-    if (trailing_num_start < len) {
-        int base_end = trailing_num_start;
-        if (base_end > 0 && isspace((unsigned char)source->name[base_end - 1])) {
-            base_end--;
+    attron(COLOR_PAIR(COLOR_HEADER));
+    for (int y = start_y; y < start_y + menu_height && y < rows; y++) {
+        for (int x = start_x; x < start_x + menu_width && x < cols; x++) {
+            mvaddch(y, x, ' ');
         }
-        strncpy(base_name, source->name, (size_t)base_end);
-        base_name[base_end] = '\0';
-    } else {
-        strncpy(base_name, source->name, NAME_LENGTH);
-        base_name[NAME_LENGTH - 1] = '\0';
-    }
-
-    int base_len = (int)strlen(base_name);
-    while (base_len > 0 && isspace((unsigned char)base_name[base_len - 1])) {
-        base_name[--base_len] = '\0';
-    }
-
-    if (base_len > max_base_len) {
-        base_name[max_base_len] = '\0';
-        base_len = max_base_len;
     }
+    attroff(COLOR_PAIR(COLOR_HEADER));
 
-    /* Find highest existing number to avoid duplicates */
-    int highest_num = 0;
-    int base_name_len = (int)strlen(base_name);
-    int original_has_number = 0;
-
-    for (int i = 0; i < state->count; i++) {
-        const char* existing_name = state->combatants[i].name;
-        int existing_len = (int)strlen(existing_name);
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    mvprintw(start_y, start_x + 2, "Archive (%d)", live);
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
 
-        if (existing_len > base_name_len &&
-            strncmp(existing_name, base_name, (size_t)base_name_len) == 0) {
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + 1, start_x, ACS_HLINE, menu_width);
 
-            if (existing_name[base_name_len] == ' ') {
-                const char* num_start = existing_name + base_name_len + 1;
-                char* endptr;
-                long parsed_num = strtol(num_start, &endptr, 10);
+    attron(COLOR_PAIR(COLOR_HEADER) | A_DIM);
+    mvprintw(start_y + 2, start_x + 2, "UP/DOWN: Navigate | ENTER: Restore (asks HP if dead)");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_DIM);
 
-                if (endptr != num_start && *endptr == '\0' && parsed_num > 0 && parsed_num <= INT_MAX) {
-                    int num = (int)parsed_num;
-                    if (num > highest_num) {
-                        highest_num = num;
-                    }
-                    if (i == idx) {
-                        original_has_number = 1;
-                    }
-                }
-            }
-        }
-    }
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + 3, start_x, ACS_HLINE, menu_width);
 
-    int start_num;
-    if (!original_has_number) {
-        snprintf(source->name, NAME_LENGTH, "%.*s 1", max_base_len, base_name);
-        start_num = (highest_num > 0) ? highest_num + 1 : 2;
-    } else {
-        start_num = highest_num + 1;
+    for (int i = top; i < top + visible && i < live; i++) {
+        const ArchiveEntry* entry = &state->archive[archive_nth_live(state, i)];
+        const Combatant* c = &entry->combatant;
+        int is_selected = (i == state->archive_cursor);
+        int pair = is_selected ? COLOR_MENU_SEL : COLOR_MENU_NORM;
+        attron(COLOR_PAIR(pair));
+        if (is_selected) attron(A_BOLD);
+        mvprintw(start_y + 4 + (i - top), start_x + 2, "%-20s %c %5d/%-5d R%-4d %s",
+            c->name, c->type == TYPE_PLAYER ? 'P' : 'E', c->hp, c->max_hp, entry->round,
+            entry->reason == ARCHIVE_DEAD ? "dead" : "removed");
+        if (is_selected) attroff(A_BOLD);
+        attroff(COLOR_PAIR(pair));
     }
 
-    for (int i = 0; i < num_copies; i++) {
-        if (state->count >= MAX_COMBATANTS) break;
-
-        Combatant c = *source;
-
-        if (state->next_id == INT_MAX) {
-            state->next_id = 1;
-        }
-        c.id = state->next_id++;
-
-        snprintf(c.name, NAME_LENGTH, "%.*s %d", max_base_len, base_name, start_num + i);
-        c.initiative = (rand() % 20) + 1 + c.dex;
-
-        /* Reset to fresh spawn state */
-        c.hp = c.max_hp;
-        c.conditions = 0;
-        memset(c.condition_duration, 0, sizeof(c.condition_duration));
-        c.death_save_successes = 0;
-        c.death_save_failures = 0;
-        c.is_stable = 0;
-        c.is_dead = 0;
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + menu_height - 2, start_x, ACS_HLINE, menu_width);
+    mvprintw(start_y + menu_height - 1, start_x + (menu_width - 20) / 2, "ESC or 'q' to close");
+    attroff(COLOR_PAIR(COLOR_HEADER));
+}
 
-        state->combatants[state->count++] = c;
+/**
+ * Handle input in archive mode.
+ */
+int handle_archive_menu_input(GameState* state, int ch) {
+    TRACE_SCOPE("handle_archive_menu_input");
+    int live = archive_live_count(state);
+    if (live == 0) {
+        state->mode = MODE_COMBAT;
+        return 1;
     }
 
-    sort_combatants(state);
-
-    if (state->count > 0) {
-        state->selected_id = state->combatants[state->count - 1].id;
+    switch (ch) {
+        case KEY_UP:
+        case 'k':
+            state->archive_cursor = (state->archive_cursor - 1 + live) % live;
+            return 1;
+        case KEY_DOWN:
+        case 'j':
+            state->archive_cursor = (state->archive_cursor + 1) % live;
+            return 1;
+        case '\n':
+        case '\r':
+        case ' ':
+            {
+                int slot = archive_nth_live(state, state->archive_cursor);
+                if (slot == -1) return 1;
+                const Combatant* c = &state->archive[slot].combatant;
+                int revive_hp = 0;
+                /* Revivify is 1 HP, Raise Dead/Resurrection up to full */
+                if (combatant_is_dead(c)) {
+                    char prompt[64];
+                    snprintf(prompt, sizeof(prompt), "Revive %s with HP (1-%d): ", c->name,
+                        c->mob_size > 0 ? c->mob_unit_max_hp : c->max_hp);
+                    if (!get_input_int(state, prompt, &revive_hp, 1, INT_MAX)) return 1;
+                }
+                Command cmd = make_command(CMD_RESTORE, c->id);
+                cmd.restore.revive_hp = revive_hp;
+                if (apply_command(state, &cmd)) state->mode = MODE_COMBAT;
+            }
+            return 1;
+        case 'q':
+        case 'Q':
+        case 27: /* ESC */
+            state->mode = MODE_COMBAT;
+            return 1;
+        default:
+            return 0;
     }
-
-    log_action(state, "Created %d duplicates of %s.", num_copies, base_name);
-    show_message(state, "Duplicates created.", 0);
 }
 
-void remove_combatant(GameState* state) {
-    if (state->count == 0) return;
+ /* --- Mob Functions --- */
 
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) return;
+/**
+ * Add a mob: one initiative entry backed by `size` units of `unit_max_hp`.
+ * The entry's max_hp/hp hold the pool totals, so HP colouring and the
+ * "dead at 0 HP" rules work on the mob as a whole.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int insert_mob(GameState* state, Combatant* c, int size, int unit_max_hp) {
+    if (size < 1 || size > MAX_MOB_UNITS || unit_max_hp < 1 || unit_max_hp > MAX_MOB_UNIT_HP) {
+        show_message(state, "Invalid mob size or unit HP!", 1);
+        return 0;
+    }
 
-    char prompt[128];
-    snprintf(prompt, sizeof(prompt), "Delete %s? (y/n): ", state->combatants[idx].name);
-    if (!get_input_confirm(prompt)) {
-        return;
+    int first = mob_alloc_units(state, size, unit_max_hp);
+    if (first == -1) {
+        show_message(state, "Mob creation failed! Out of memory.", 1);
+        return 0;
     }
 
-    log_action(state, "Removed %s.", state->combatants[idx].name);
+    c->type = TYPE_ENEMY;
+    c->mob_size = size;
+    c->mob_first = first;
+    c->mob_unit_max_hp = unit_max_hp;
+    c->max_hp = size * unit_max_hp;
 
-    if (state->current_turn_id == state->selected_id) {
-        int next_idx = (idx + 1) % state->count;
-        state->current_turn_id = (state->count > 1) ? state->combatants[next_idx].id : -1;
+    if (!insert_combatant(state, c)) {
+        state->mob_unit_count -= size; /* Units were appended last - just drop them */
+        return 0;
     }
+    return 1;
+}
 
-    for (int i = idx; i < state->count - 1; i++) {
-        state->combatants[i] = state->combatants[i + 1];
+/**
+ * Append `size` fresh units to the shared pool.
+ *
+ * @return Index of the first unit, or -1 on allocation failure
+ */
+int mob_alloc_units(GameState* state, int size, int unit_max_hp) {
+    int needed = state->mob_unit_count + size;
+    if (needed > state->mob_unit_capacity) {
+        int new_capacity = state->mob_unit_capacity > 0 ? state->mob_unit_capacity : 64;
+        while (new_capacity < needed) new_capacity *= 2;
+        MobUnit* grown = (MobUnit*)realloc(state->mob_units, (size_t)new_capacity * sizeof(MobUnit));
+        if (!grown) return -1;
+        state->mob_units = grown;
+        state->mob_unit_capacity = new_capacity;
     }
-    state->count--;
 
-    if (state->count > 0) {
-        if (idx >= state->count) idx = state->count - 1;
-        state->selected_id = state->combatants[idx].id;
-    } else {
-        state->selected_id = -1;
-        state->current_turn_id = -1;
-        state->round = 1;
+    int first = state->mob_unit_count;
+    for (int i = first; i < needed; i++) {
+        state->mob_units[i].hp = (uint16_t)unit_max_hp;
+        state->mob_units[i].conditions = 0;
     }
+    state->mob_unit_count = needed;
+    return first;
 }
 
 /**
- * Edit HP for selected combatant with damage/healing.
- * Handles death saves, instant death, and unconscious state.
+ * Release a mob's units, compacting the pool and re-pointing later mobs.
  */
-void edit_hp(GameState* state) {
-    if (!state) return;
+void mob_free_units(GameState* state, Combatant* c) {
+    if (c->mob_size <= 0) return;
 
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) {
-        show_message(state, "No combatant selected!", 1);
-        return;
+    int first = c->mob_first;
+    int size = c->mob_size;
+    memmove(&state->mob_units[first], &state->mob_units[first + size],
+        (size_t)(state->mob_unit_count - first - size) * sizeof(MobUnit));
+    state->mob_unit_count -= size;
+
+    for (int i = 0; i < state->count; i++) {
+        Combatant* other = &state->combatants[i];
+        if (other->mob_size > 0 && other->mob_first > first) other->mob_first -= size;
     }
+    c->mob_size = 0;
+}
 
-    Combatant* c = &state->combatants[idx];
-    char prompt[64];
-    snprintf(prompt, sizeof(prompt), "%s (%d/%d) Change (+/-): ", c->name, c->hp, c->max_hp);
+/**
+ * Recompute a mob's pooled HP from its units.
+ */
+void mob_sync_hp(GameState* state, Combatant* c) {
+    int total = 0;
+    const MobUnit* units = &state->mob_units[c->mob_first];
+    for (int i = 0; i < c->mob_size; i++) total += units[i].hp;
+    c->hp = total;
+}
 
-    int change;
-    if (get_input_int(state, prompt, &change, INT_MIN, INT_MAX)) {
+int mob_alive_count(GameState* state, const Combatant* c) {
+    int alive = 0;
+    const MobUnit* units = &state->mob_units[c->mob_first];
+    for (int i = 0; i < c->mob_size; i++) {
+        if (units[i].hp > 0) alive++;
+    }
+    return alive;
+}
 
-        int old_hp = c->hp;
-        int damage = (change < 0) ? -change : 0;
+/**
+ * Count units per HP band: dead, <=25%, <=50%, <=75%, >75%.
+ */
+void mob_histogram(GameState* state, const Combatant* c, int buckets[MOB_HIST_BUCKETS]) {
+    memset(buckets, 0, MOB_HIST_BUCKETS * sizeof(int));
+    const MobUnit* units = &state->mob_units[c->mob_first];
+    int max_hp = c->mob_unit_max_hp;
+
+    for (int i = 0; i < c->mob_size; i++) {
+        int hp = units[i].hp;
+        if (hp == 0) buckets[0]++;
+        else if (hp * 4 <= max_hp) buckets[1]++;
+        else if (hp * 2 <= max_hp) buckets[2]++;
+        else if (hp * 4 <= max_hp * 3) buckets[3]++;
+        else buckets[4]++;
+    }
+}
 
-        /* 5e instant death rule: remaining damage >= max HP */
-        if (damage > 0 && c->hp > 0 && (c->hp - damage) <= 0) {
-            int remaining_damage = damage - c->hp;
-            if (remaining_damage >= c->max_hp) {
-                c->hp = 0;
-                c->is_dead = 1;
-                c->conditions |= COND_UNCONSCIOUS;
-                reset_death_saves(c);
-                show_message(state, "INSTANT DEATH!", 1);
-                log_action(state, "%s died instantly (damage >= max HP).", c->name);
-                return;
-            }
+/**
+ * Apply an HP change to a mob's units. Units are enemies: they die at
+ * 0 HP and healing cannot bring them back.
+ *
+ * @param unit Unit index, only used with MOB_TARGET_UNIT
+ * @return HP_RESULT_DIED if the last unit fell, otherwise 0
+ */
+int apply_mob_hp_change(GameState* state, Combatant* c, MobTarget target, int unit, int change) {
+    MobUnit* units = &state->mob_units[c->mob_first];
+    int unit_max = c->mob_unit_max_hp;
+    int alive_before = mob_alive_count(state, c);
+    int was_alive = c->hp > 0;
+    int old_hp = c->hp;
+    int touched = 0;  /* Units whose HP actually changed */
+
+    if (target == MOB_TARGET_UNIT) {
+        if (unit < 0 || unit >= c->mob_size) return 0;
+        long long hp = (long long)units[unit].hp + change;
+        if (units[unit].hp > 0) {
+            uint16_t before = units[unit].hp;
+            units[unit].hp = (uint16_t)(hp < 0 ? 0 : (hp > unit_max ? unit_max : hp));
+            touched = units[unit].hp != before;
         }
-
-        c->hp += change;
-        if (c->hp > c->max_hp) c->hp = c->max_hp;
-        if (c->hp < 0) c->hp = 0;
-
-        /* 5e rule: damage at 0 HP causes death save failures */
-        if (damage > 0 && old_hp <= 0 && c->type == TYPE_PLAYER && !c->is_dead) {
-            /* Critical hits within 5 feet cause 2 failures */
-            int is_crit = 0;
-            if (c->hp == 0) {
-                char crit_prompt[128];
-                snprintf(crit_prompt, sizeof(crit_prompt), "Critical hit? (y/n): ");
-                is_crit = get_input_confirm(crit_prompt);
+    } else if (target == MOB_TARGET_FOCUS) {
+        /* Damage spills from one unit to the next, like a single big creature */
+        long long remaining = change < 0 ? -(long long)change : change;
+        for (int i = 0; i < c->mob_size && remaining > 0; i++) {
+            int hp = units[i].hp;
+            if (hp == 0) continue;
+            long long step;
+            if (change < 0) {
+                step = remaining < hp ? remaining : hp;
+                units[i].hp = (uint16_t)(hp - step);
+            } else {
+                step = remaining < unit_max - hp ? remaining : unit_max - hp;
+                units[i].hp = (uint16_t)(hp + step);
             }
-            handle_damage_at_zero_hp(state, c, damage, is_crit);
+            remaining -= step;
+            if (step > 0) touched++;
         }
-
-        if (change > 0) {
-            log_action(state, "%s healed %d HP (%d/%d).", c->name, change, c->hp, c->max_hp);
-        } else if (change < 0) {
-            log_action(state, "%s took %d damage (%d/%d).", c->name, damage, c->hp, c->max_hp);
+    } else {
+        int living = alive_before > 0 ? alive_before : 1;
+        long long share = change;
+        long long extra = 0;
+        if (target == MOB_TARGET_SPREAD) {
+            share = change / living;
+            extra = change % living; /* Same sign as change; given to the first units */
         }
-
-        /* 5e rule: players go unconscious at 0 HP, not dead */
-        if (c->type == TYPE_PLAYER) {
-            if (c->hp == 0 && old_hp > 0) {
-                if (!(c->conditions & COND_UNCONSCIOUS)) {
-                    c->conditions |= COND_UNCONSCIOUS;
-                    reset_death_saves(c);
-                    show_message(state, "Player is DOWN! (Unconscious applied)", 1);
-                    log_action(state, "%s is UNCONSCIOUS.", c->name);
-                }
-            } else if (c->hp > 0 && old_hp <= 0) {
-                if (c->conditions & COND_UNCONSCIOUS) {
-                    c->conditions &= (uint16_t)~COND_UNCONSCIOUS;
-                    reset_death_saves(c);
-                    c->is_stable = 0;
-                    c->is_dead = 0;
-                    show_message(state, "Player is UP! (Unconscious removed)", 0);
-                    log_action(state, "%s is no longer unconscious.", c->name);
-                }
-            }
+        for (int i = 0; i < c->mob_size; i++) {
+            if (units[i].hp == 0) continue;
+            long long delta = share;
+            if (extra > 0) { delta++; extra--; }
+            else if (extra < 0) { delta--; extra++; }
+            long long hp = (long long)units[i].hp + delta;
+            uint16_t before = units[i].hp;
+            units[i].hp = (uint16_t)(hp < 0 ? 0 : (hp > unit_max ? unit_max : hp));
+            if (units[i].hp != before) touched++;
         }
     }
-}
-
-void reroll_initiative(GameState* state) {
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) return;
 
-    int val;
-    if (get_input_int(state, "New Init: ", &val, INT_MIN, INT_MAX)) {
-        int old_init = state->combatants[idx].initiative;
-        state->combatants[idx].initiative = val;
-        sort_combatants(state);
-
-        /* Round 1 edge case: ensure turn starts with highest initiative */
-        if (state->round == 1 && state->count > 0) {
-            state->current_turn_id = state->combatants[0].id;
-        }
+    mob_sync_hp(state, c);
+    eligible_update(state, c);
+    int alive_after = mob_alive_count(state, c);
+    int fallen = alive_before - alive_after;
+
+    /* The pooled HP moved by exactly what the units took, clamping included */
+    int amount = old_hp > c->hp ? old_hp - c->hp : c->hp - old_hp;
+    if (change < 0) {
+        log_event(state, c, HISTORY_DAMAGE, amount,
+            "%s took %d damage across %d unit%s, %d fell (%d/%d alive).",
+            c->name, amount, touched, touched == 1 ? "" : "s", fallen, alive_after, c->mob_size);
+    } else if (change > 0) {
+        log_event(state, c, HISTORY_HEAL, amount,
+            "%s healed %d HP across %d unit%s (%d/%d alive).", c->name, amount, touched, touched == 1 ? "" : "s",
+            alive_after, c->mob_size);
+    }
 
-        log_action(state, "%s rerolled initiative from %d to %d.", state->combatants[idx].name, old_init, val);
+    if (was_alive && c->hp == 0) {
+        show_message(state, "Mob destroyed!", 1);
+        log_event(state, c, HISTORY_DEATH, 0, "%s has been wiped out.", c->name);
+        return HP_RESULT_DIED;
     }
+    return 0;
 }
 
-void next_turn(GameState* state) {
-    if (state->count == 0) return;
-
-    int idx = get_index_by_id(state, state->current_turn_id);
-    if (idx == -1) idx = 0;
-    else idx++;
-
-    if (idx >= state->count) {
-        idx = 0;
-        state->round++;
-        decrement_condition_durations(state);
-        log_action(state, "--- START OF ROUND %d ---", state->round);
+/**
+ * Apply or remove a condition on a single mob unit.
+ */
+void set_unit_condition(GameState* state, Combatant* c, int unit, int cond, int active) {
+    if (unit < 0 || unit >= c->mob_size || cond < 0 || cond >= NUM_CONDITIONS) return;
+
+    MobUnit* u = &state->mob_units[c->mob_first + unit];
+    uint16_t bit = (uint16_t)(1 << cond);
+    int was_active = (u->conditions & bit) != 0;
+
+    if (active && !was_active) {
+        u->conditions |= bit;
+        log_action(state, "%s #%d: %s applied.", c->name, unit + 1, get_condition_name(cond));
+    } else if (!active && was_active) {
+        u->conditions &= (uint16_t)~bit;
+        log_action(state, "%s #%d: %s removed.", c->name, unit + 1, get_condition_name(cond));
     }
+}
 
-    state->current_turn_id = state->combatants[idx].id;
-    state->selected_id = state->current_turn_id;
+/**
+ * Prompt for how to distribute an HP change across a mob ('H' on a mob).
+ */
+void edit_mob_hp(GameState* state, Combatant* c) {
+    TRACE_SCOPE("edit_mob_hp");
+    int mode = get_input_char("Mob: (F)ocus (S)pread (A)ll units (U)nit #: ", "fsauFSAU");
+    if (mode == 0) return;
+
+    Command cmd = make_command(CMD_MOB_HP, c->id);
+    cmd.mob_hp.unit = -1;
+    switch (tolower(mode)) {
+        case 's': cmd.mob_hp.target = MOB_TARGET_SPREAD; break;
+        case 'a': cmd.mob_hp.target = MOB_TARGET_ALL; break;
+        case 'u': {
+            cmd.mob_hp.target = MOB_TARGET_UNIT;
+            if (!get_input_int(state, "Unit #: ", &cmd.mob_hp.unit, 1, c->mob_size)) return;
+            cmd.mob_hp.unit--;
+            break;
+        }
+        default: cmd.mob_hp.target = MOB_TARGET_FOCUS; break;
+    }
 
-    Combatant* c = &state->combatants[idx];
-    log_action(state, "%s's turn.", c->name);
+    char prompt[96];
+    snprintf(prompt, sizeof(prompt), "%s (%d/%d alive) Change (+/-): ",
+        c->name, mob_alive_count(state, c), c->mob_size);
 
-    /* 5e rule: death saves rolled at start of turn when at 0 HP */
-    if (c->type == TYPE_PLAYER && c->hp <= 0 && !c->is_stable && !c->is_dead) {
-        roll_death_save(state, c);
+    if (get_input_int(state, prompt, &cmd.mob_hp.change, INT_MIN, INT_MAX)) {
+        apply_command(state, &cmd);
     }
 }
 
-void prev_turn(GameState* state) {
-    if (state->count == 0) return;
-
-    int idx = get_index_by_id(state, state->current_turn_id);
-    if (idx == -1) idx = 0;
-    else idx--;
+/**
+ * Expand or collapse the selected mob's unit list ('O' key).
+ */
+void toggle_mob_expanded(GameState* state) {
+    TRACE_SCOPE("toggle_mob_expanded");
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) return;
 
-    if (idx < 0) {
-        idx = state->count - 1;
-        if (state->round > 1) {
-            state->round--;
-            log_action(state, "--- END OF ROUND %d (Revert) ---", state->round);
-        }
+    Combatant* c = &state->combatants[idx];
+    if (c->mob_size == 0) {
+        show_message(state, "Selected combatant is not a mob!", 1);
+        return;
     }
-
-    state->current_turn_id = state->combatants[idx].id;
-    state->selected_id = state->current_turn_id;
-    log_action(state, "Turn reverted to %s.", state->combatants[idx].name);
+    c->is_expanded = !c->is_expanded;
 }
 
-void decrement_condition_durations(GameState* state) {
-    for (int i = 0; i < state->count; i++) {
-        for (int j = 0; j < NUM_CONDITIONS; j++) {
-            if (state->combatants[i].condition_duration[j] > 0) {
-                state->combatants[i].condition_duration[j]--;
-                if (state->combatants[i].condition_duration[j] == 0) {
-                    state->combatants[i].conditions &= (uint16_t)~(1 << j);
-                    log_action(state, "%s: %s duration ended.", state->combatants[i].name, get_condition_name(j));
-                }
+/**
+ * Draw an expanded mob's units, several per line, below its row.
+ *
+ * @return Number of screen lines used
+ */
+int draw_mob_units(GameState* state, const Combatant* c, int y, int start_x, int width, int max_y) {
+    const int cell_w = 14;
+    int per_line = (width - 6) / cell_w;
+    if (per_line < 1) per_line = 1;
+
+    const MobUnit* units = &state->mob_units[c->mob_first];
+    int lines = 0;
+    for (int i = 0; i < c->mob_size && y + lines < max_y; i += per_line, lines++) {
+        for (int k = 0; k < per_line && i + k < c->mob_size; k++) {
+            const MobUnit* u = &units[i + k];
+            int x = start_x + 4 + k * cell_w;
+            if (u->hp == 0) {
+                attron(COLOR_PAIR(COLOR_DEAD));
+                mvprintw(y + lines, x, "#%-3d DEAD", i + k + 1);
+                attroff(COLOR_PAIR(COLOR_DEAD));
+            } else {
+                int pair = COLOR_HP_GOOD;
+                if (u->hp * 4 <= c->mob_unit_max_hp) pair = COLOR_HP_CRITICAL;
+                else if (u->hp * 2 <= c->mob_unit_max_hp) pair = COLOR_HP_HURT;
+                attron(COLOR_PAIR(pair));
+                mvprintw(y + lines, x, "#%-3d %3d%c", i + k + 1, u->hp, u->conditions ? '*' : ' ');
+                attroff(COLOR_PAIR(pair));
             }
         }
     }
+    return lines;
 }
 
-void save_state(GameState* state) {
-    char path[256];
-    const char* home = getenv("HOME");
-    if (home) {
-        int ret = snprintf(path, sizeof(path), "%s/%s", home, SAVE_FILE_NAME);
-        if (ret < 0 || ret >= (int)sizeof(path)) {
-            show_message(state, "Error: Path too long for save file!", 1);
-            return;
-        }
-    } else {
-        snprintf(path, sizeof(path), "%s", SAVE_FILE_NAME);
-    }
+ /* --- TUI/Core Functions --- */
 
-    FILE* f = fopen(path, "w");
-    if (!f) {
-        char err_msg[256];
-        char path_display[200];
-        size_t path_len = strlen(path);
-        if (path_len >= sizeof(path_display)) {
-            /* Show last part of path if too long */
-            snprintf(path_display, sizeof(path_display), "...%s", path + (path_len - (sizeof(path_display) - 4)));
-        } else {
-            strncpy(path_display, path, sizeof(path_display) - 1);
-            path_display[sizeof(path_display) - 1] = '\0';
-        }
-        snprintf(err_msg, sizeof(err_msg), "Save failed! Cannot open file: %s", path_display);
-        show_message(state, err_msg, 1);
-        return;
+void draw_ui(GameState* state) {
+    TRACE_SCOPE("draw_ui");
+    uint64_t probe_start = PROBE_CLOCK(draw_ui);
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    /* erase() is faster than clear() - doesn't force full screen refresh */
+    erase();
+
+    clear_old_messages(state);
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    mvhline(0, 0, ' ', cols);
+    mvprintw(0, 1, "D&D INITIATIVE TRACKER | Round: %d", state->round);
+    if (state->skip_policy) {
+        char policy[48];
+        format_skip_policy(state->skip_policy, policy, sizeof(policy));
+        printw(" | Skip: %s", policy);
     }
+    mvhline(1, 0, ' ', cols);
+    mvprintw(1, 1, "Keys: A(dd) D(el) H(eal) C(ond) N(ext) P(rev) R(eroll) U(dup) X(death) T(stabilize)");
+    mvhline(2, 0, ' ', cols);
+    mvprintw(2, 1, "      M(ark) F(ilter marks) G(roup HP) O(pen mob) V(archive) W(skip) E(xport) Z(undo) S(ave) L(oad) ?(help) Q(uit)");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
 
-    fprintf(f, "%d|%d|%d|%d|%d\n",
-        state->round, state->next_id, state->count, state->current_turn_id, state->selected_id);
+    int split_y = rows / 2;
+    int list_height = split_y - 5;
 
-    for (int i = 0; i < state->count; i++) {
-        Combatant* c = &state->combatants[i];
-        int ret = fprintf(f, "%d|%s|%d|%d|%d|%d|%d|%d|%d|%d|%d|%d",
-            c->id, c->name, c->type, c->initiative, c->dex, c->max_hp, c->hp, c->conditions,
-            c->death_save_successes, c->death_save_failures, c->is_stable, c->is_dead);
+    mvhline(3, 0, ACS_HLINE, cols);
+    attron(A_BOLD);
+    mvprintw(3, 2, "[ PLAYERS ]");
+    attroff(A_BOLD);
+    draw_filtered_list(state, 4, 0, cols, list_height, TYPE_PLAYER);
 
-        if (ret < 0) {
-            fclose(f);
-            show_message(state, "Save failed! Write error occurred.", 1);
-            return;
-        }
+    attron(COLOR_PAIR(COLOR_SEPARATOR));
+    mvhline(split_y, 0, ACS_HLINE, cols);
+    attroff(COLOR_PAIR(COLOR_SEPARATOR));
 
-        for(int j=0; j<NUM_CONDITIONS; j++) {
-            ret = fprintf(f, "|%d", c->condition_duration[j]);
-            if (ret < 0) {
-                fclose(f);
-                show_message(state, "Save failed! Write error occurred.", 1);
-                return;
-            }
-        }
-        ret = fprintf(f, "\n");
-        if (ret < 0) {
-            fclose(f);
-            show_message(state, "Save failed! Write error occurred.", 1);
-            return;
-        }
-    }
+    attron(A_BOLD);
+    mvprintw(split_y, 2, "[ ENEMIES ]");
+    attroff(A_BOLD);
 
-    if (fclose(f) != 0) {
-        show_message(state, "Save failed! Error closing file.", 1);
-        return;
-    }
-    show_message(state, "Game Saved.", 0);
-}
+    draw_filtered_list(state, split_y + 1, 0, cols, rows - split_y - 1, TYPE_ENEMY);
 
-void load_state(GameState* state) {
-    if (state->count > 0 && !get_input_confirm("Loading will wipe current state. Are you sure? (y/n): ")) {
-        return;
+    if (state->mode == MODE_CONDITIONS) {
+        draw_condition_menu(state);
+    } else if (state->mode == MODE_ARCHIVE) {
+        draw_archive_menu(state);
+    } else if (state->mode == MODE_LIBRARY) {
+        draw_library_menu(state);
+    } else if (state->mode == MODE_HELP) {
+        draw_help_menu(state);
+    } else if (state->mode == MODE_STATS) {
+        draw_stats_overlay(state);
     }
 
-    /* Standard load logic */
-    char path[256];
-    const char* home = getenv("HOME");
-    if (home) snprintf(path, sizeof(path), "%s/%s", home, SAVE_FILE_NAME);
-    else snprintf(path, sizeof(path), "%s", SAVE_FILE_NAME);
+    draw_message_queue(state);
 
-    FILE* f = fopen(path, "r");
-    if (!f) {
-        char err_msg[256];
-        char path_display[200];
-        size_t path_len = strlen(path);
-        if (path_len >= sizeof(path_display)) {
-            /* Show last part of path if too long */
-            snprintf(path_display, sizeof(path_display), "...%s", path + (path_len - (sizeof(path_display) - 4)));
-        } else {
-            strncpy(path_display, path, sizeof(path_display) - 1);
-            path_display[sizeof(path_display) - 1] = '\0';
+    /* One sample per frame: everything written since the last one is refresh()'s,
+     * unless something else was written in between and the count must restart */
+    if (state->stats.io_rebase || state->stats.io_last < 0) {
+        state->stats.io_last = stats_thread_written(state);
+        state->stats.io_rebase = 0;
+    }
+    refresh();
+    state->stats.redraws++;
+    if (state->stats.io_last >= 0) {
+        long long after = stats_thread_written(state);
+        if (after >= state->stats.io_last) {
+            if (state->stats.terminal_bytes < 0) state->stats.terminal_bytes = 0;
+            state->stats.terminal_bytes += after - state->stats.io_last;
         }
-        snprintf(err_msg, sizeof(err_msg), "Load failed! Cannot open file: %s", path_display);
-        show_message(state, err_msg, 1);
-        return;
+        state->stats.io_last = after;
     }
+    /* A tracer that attached mid-frame sees the next frame instead */
+    if (probe_start) PROBE2(draw_ui, state->stats.redraws, PROBE_CLOCK(draw_ui) - probe_start);
+}
 
-     /* Clear state before loading to prevent partial data */
-    state->log_count = 0;
-    state->undo_count = 0;
+void draw_filtered_list(GameState* state, int start_y, int start_x, int width, int height, CombatantType type) {
+    if (state->count == 0) return;
 
-    memset(state->combatants, 0, sizeof(state->combatants));
+    /* Column Headers */
+    attron(A_UNDERLINE);
+    mvprintw(start_y, start_x + 2, "%-20s %4s %4s %8s %12s %s", "Name", "Init", "Dex", "HP", "Death Saves", "Conditions");
+    attroff(A_UNDERLINE);
 
-    char line[1024];
-    if (fgets(line, sizeof(line), f)) {
-        int parsed = sscanf(line, "%d|%d|%d|%d|%d",
-            &state->round, &state->next_id, &state->count, &state->current_turn_id, &state->selected_id);
-        if (parsed != 5) {
-            fclose(f);
-            show_message(state, "Load failed! Invalid save file format.", 1);
-            return;
-        }
-        if (state->count < 0 || state->count > MAX_COMBATANTS) {
-            fclose(f);
-            show_message(state, "Load failed! Invalid combatant count in save file.", 1);
-            return;
+    int type_count = 0;
+    int selected_visual_index = -1;
+    int active_visual_index = -1;
+
+    if (state->count > state->visual_map_capacity) {
+        int* grown = (int*)realloc(state->visual_map, (size_t)state->capacity * sizeof(int));
+        if (!grown) return;
+        state->visual_map = grown;
+        state->visual_map_capacity = state->capacity;
+    }
+    int* visual_map = state->visual_map;
+
+    for (int i = 0; i < state->count; i++) {
+        if (state->combatants[i].type == type) {
+            visual_map[type_count] = i;
+            if (state->combatants[i].id == state->selected_id) selected_visual_index = type_count;
+            if (state->combatants[i].id == state->current_turn_id) active_visual_index = type_count;
+            type_count++;
         }
-        if (state->round < 1) state->round = 1;
-    } else {
-        fclose(f);
-        show_message(state, "Load failed! Empty or corrupted save file.", 1);
+    }
+
+    if (type_count == 0) {
+        mvprintw(start_y + 2, start_x + 2, "(None)");
         return;
     }
 
-    int idx = 0;
-    while (fgets(line, sizeof(line), f) && idx < MAX_COMBATANTS) {
-        Combatant* c = &state->combatants[idx];
+    int list_display_h = height - 1;
+    int scroll_offset = 0;
 
-        /* Parse required fields - skip entire entry if any fail */
-        char* token = strtok(line, "|");
-        if (!token || !parse_int_safe(token, &c->id)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid ID).", 1);
-            continue;
+    if (selected_visual_index != -1) {
+        if (selected_visual_index >= list_display_h) {
+            scroll_offset = selected_visual_index - list_display_h + 1;
         }
-
-        token = strtok(NULL, "|");
-        if (!token) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (missing name).", 1);
-            continue;
+    } else {
+        if (active_visual_index != -1 && active_visual_index >= list_display_h) {
+            scroll_offset = active_visual_index - list_display_h + 1;
         }
-        strncpy(c->name, token, NAME_LENGTH);
-        c->name[NAME_LENGTH-1] = '\0';
+    }
 
-        token = strtok(NULL, "|");
-        int type_val;
-        if (!token || !parse_int_safe(token, &type_val)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid type).", 1);
-            continue;
-        }
-        c->type = (CombatantType)type_val;
+    int y = start_y + 1;
+    for (int v = scroll_offset; v < type_count && y < start_y + height; v++) {
+        int real_idx = visual_map[v];
+        Combatant* c = &state->combatants[real_idx];
 
-        token = strtok(NULL, "|");
-        if (!token || !parse_int_safe(token, &c->initiative)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid initiative).", 1);
-            continue;
-        }
+        int row_color = COLOR_DEFAULT;
+        int attrs = 0;
 
-        token = strtok(NULL, "|");
-        if (!token || !parse_int_safe(token, &c->dex)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid dex).", 1);
-            continue;
+        if (c->id == state->selected_id) {
+            row_color = COLOR_SELECTED_ROW;
         }
 
-        token = strtok(NULL, "|");
-        if (!token || !parse_int_safe(token, &c->max_hp)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid max_hp).", 1);
-            continue;
+        if (c->id == state->current_turn_id) {
+            attrs = A_BOLD;
+            mvprintw(y, start_x, ">");
+            if (c->id == state->selected_id) row_color = COLOR_ACTIVE_ROW;
         }
 
-        token = strtok(NULL, "|");
-        if (!token || !parse_int_safe(token, &c->hp)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid hp).", 1);
-            continue;
+        if (c->is_marked) {
+            mvprintw(y, start_x + 1, "*");
         }
 
-        token = strtok(NULL, "|");
-        int conditions_val;
-        if (!token || !parse_int_safe(token, &conditions_val)) {
-            show_message(state, "Load warning: Skipping malformed combatant entry (invalid conditions).", 1);
-            continue;
+        attron(COLOR_PAIR(row_color) | (unsigned int)attrs);
+        mvprintw(y, start_x + 2, "%-20s %4d %4d", c->name, c->initiative, c->dex);
+        attroff(COLOR_PAIR(row_color) | (unsigned int)attrs);
+
+        /* Color coding: Good > Hurt > Critical > Unconscious/Dead */
+        int hp_color = COLOR_HP_GOOD;
+
+        if (c->hp <= 0 || c->is_dead) {
+            /* 5e rule: enemies die at 0 HP, players go unconscious */
+            if (c->type == TYPE_ENEMY || c->is_dead) hp_color = COLOR_DEAD;
+            else hp_color = COLOR_HP_UNCONSCIOUS;
         }
-        c->conditions = (uint16_t)conditions_val;
+        else if (c->hp <= c->max_hp / 4) hp_color = COLOR_HP_CRITICAL;
+        else if (c->hp <= c->max_hp / 2) hp_color = COLOR_HP_HURT;
 
-        /* Backward compatibility: death save fields may be missing in old saves */
-        token = strtok(NULL, "|");
-        if (token) {
-            if (!parse_int_safe(token, &c->death_save_successes)) {
-                c->death_save_successes = 0;  /* Default on parse failure */
-            }
+        attron(COLOR_PAIR(hp_color));
+        if (c->is_dead) {
+            mvprintw(y, start_x + 33, "%s", " DEAD  ");
+        } else if (c->hp <= 0 && c->type == TYPE_PLAYER) {
+            mvprintw(y, start_x + 33, "%s", " DOWN  ");
+        } else if (c->hp <= 0 && c->type == TYPE_ENEMY) {
+            mvprintw(y, start_x + 33, "%s", " DEAD  ");
+        } else if (c->mob_size > 0) {
+            /* Mobs show units alive rather than pooled HP */
+            mvprintw(y, start_x + 33, "%3d/%3d", mob_alive_count(state, c), c->mob_size);
         } else {
-            c->death_save_successes = 0;
+            mvprintw(y, start_x + 33, "%3d/%3d", c->hp, c->max_hp);
         }
+        attroff(COLOR_PAIR(hp_color));
 
-        token = strtok(NULL, "|");
-        if (token) {
-            if (!parse_int_safe(token, &c->death_save_failures)) {
-                c->death_save_failures = 0;  /* Default on parse failure */
+        /* Death Saves Display (only for players at 0 HP) */
+        if (c->mob_size > 0) {
+            mvprintw(y, start_x + 42, "%-12s", c->is_expanded ? "MOB [-]" : "MOB [+]");
+        } else if (c->type == TYPE_PLAYER && c->hp <= 0 && !c->is_dead) {
+            if (c->is_stable) {
+                mvprintw(y, start_x + 42, "STABLE");
+            } else {
+                char ds_str[16];
+                snprintf(ds_str, sizeof(ds_str), "S:%d F:%d", c->death_save_successes, c->death_save_failures);
+                mvprintw(y, start_x + 42, "%-12s", ds_str);
             }
+        } else if (c->is_dead) {
+            attron(COLOR_PAIR(COLOR_DEAD));
+            mvprintw(y, start_x + 42, "DEAD");
+            attroff(COLOR_PAIR(COLOR_DEAD));
         } else {
-            c->death_save_failures = 0;
+            mvprintw(y, start_x + 42, "            ");
         }
 
-        token = strtok(NULL, "|");
-        if (token) {
-            if (!parse_int_safe(token, &c->is_stable)) {
-                c->is_stable = 0;  /* Default on parse failure */
+        /* Build condition string with bounds checking to prevent overflow */
+        char cond_str[128] = "";
+        size_t cond_str_len = 0;
+        if (c->mob_size > 0) {
+            /* HP histogram: dead, <=25%, <=50%, <=75%, >75% */
+            int buckets[MOB_HIST_BUCKETS];
+            mob_histogram(state, c, buckets);
+            int hist_len = snprintf(cond_str, sizeof(cond_str), "[x%d .%d :%d =%d #%d] ",
+                buckets[0], buckets[1], buckets[2], buckets[3], buckets[4]);
+            if (hist_len > 0 && (size_t)hist_len < sizeof(cond_str)) cond_str_len = (size_t)hist_len;
+        }
+        for (int j = effect_next(state, c, 0); j != -1; j = effect_next(state, c, j + 1)) {
+            char temp[48];
+            char timer[16];
+            int temp_len;
+            if (format_condition_timer(state, c, j, timer, sizeof(timer)))
+                temp_len = snprintf(temp, sizeof(temp), "%s(%s) ", effect_name(state, j), timer);
+            else
+                temp_len = snprintf(temp, sizeof(temp), "%s ", effect_name(state, j));
+
+            if (cond_str_len + (size_t)temp_len < sizeof(cond_str) - 1) {
+                strncat(cond_str, temp, sizeof(cond_str) - cond_str_len - 1);
+                cond_str_len += (size_t)temp_len;
+            } else {
+                break; /* Buffer full - truncate gracefully */
             }
-        } else {
-            c->is_stable = 0;
         }
+        int remaining_w = width - 55;
+        if (remaining_w > 0)
+            mvprintw(y, start_x + 54, "%.*s", remaining_w, cond_str);
 
-        token = strtok(NULL, "|");
-        if (token) {
-            if (!parse_int_safe(token, &c->is_dead)) {
-                c->is_dead = 0;  /* Default on parse failure */
-            }
-        } else {
-            c->is_dead = 0;
+        y++;
+
+        if (c->mob_size > 0 && c->is_expanded) {
+            y += draw_mob_units(state, c, y, start_x, width, start_y + height);
         }
+    }
+
+    if (type_count > list_display_h && scroll_offset + list_display_h < type_count) {
+        int indicator_y = start_y + height - 1;
+        attron(A_BOLD);
+        mvprintw(indicator_y, start_x + 2, "(%d more \u2193)", type_count - (scroll_offset + list_display_h));
+        attroff(A_BOLD);
+    }
+}
+
+/**
+ * Open condition menu for selected combatant.
+ * Switches to MODE_CONDITIONS for interactive editing.
+ */
+void toggle_condition(GameState* state) {
+    TRACE_SCOPE("toggle_condition");
+    if (state->count == 0) return;
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) {
+        show_message(state, "No combatant selected!", 1);
+        return;
+    }
+
+    /* Mobs: conditions can target the whole mob or a single unit */
+    int unit = -1;
+    Combatant* c = &state->combatants[idx];
+    if (c->mob_size > 0) {
+        int choice = get_input_char("Conditions for: (W)hole mob / (U)nit #: ", "wuWU");
+        if (choice == 0) return;
+        if (tolower(choice) == 'u') {
+            if (!get_input_int(state, "Unit #: ", &unit, 1, c->mob_size)) return;
+            unit--;
+        }
+    }
+
+    state->mode = MODE_CONDITIONS;
+    state->condition_menu_cursor = 0;
+    state->condition_menu_target_id = state->selected_id;
+    state->condition_menu_target_unit = unit;
+}
+
+/**
+ * Draw the condition sub-menu overlay.
+ */
+void draw_condition_menu(GameState* state) {
+    int idx = get_index_by_id(state, state->condition_menu_target_id);
+    if (idx == -1) {
+        state->mode = MODE_COMBAT;
+        return;
+    }
+
+    Combatant* c = &state->combatants[idx];
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    /* Whole-combatant menus list every registered effect; mob units only the built-ins */
+    int unit = state->condition_menu_target_unit;
+    if (c->mob_size == 0 || unit < 0 || unit >= c->mob_size) unit = -1;
+    int items = (unit == -1) ? state->registry.count : NUM_CONDITIONS;
+    int visible = items;
+    if (visible > rows - 6) visible = rows - 6;
+    if (visible < 1) visible = 1;
+    int top = state->condition_menu_cursor - visible + 1;
+    if (top < 0) top = 0;
+
+    int menu_height = visible + 6;
+    int menu_width = 64;
+    int start_y = (rows - menu_height) / 2;
+    int start_x = (cols - menu_width) / 2;
+    if (start_y < 0) start_y = 0;
+    if (start_x < 0) start_x = 0;
+
+    /* Draw overlay background */
+    attron(COLOR_PAIR(COLOR_HEADER));
+    for (int y = start_y; y < start_y + menu_height && y < rows; y++) {
+        for (int x = start_x; x < start_x + menu_width && x < cols; x++) {
+            mvaddch(y, x, ' ');
+        }
+    }
+    attroff(COLOR_PAIR(COLOR_HEADER));
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    uint16_t unit_bits = 0;
+    if (unit >= 0) {
+        unit_bits = state->mob_units[c->mob_first + unit].conditions;
+        mvprintw(start_y, start_x + 2, "Conditions for: %s #%d", c->name, unit + 1);
+    } else {
+        mvprintw(start_y, start_x + 2, "Conditions for: %s", c->name);
+    }
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + 1, start_x, ACS_HLINE, menu_width);
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_DIM);
+    mvprintw(start_y + 2, start_x + 2, "UP/DOWN: Navigate | ENTER: Toggle | 'd': Duration | 'a': New");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_DIM);
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + 3, start_x, ACS_HLINE, menu_width);
+
+    for (int i = top; i < top + visible && i < items; i++) {
+        int is_active = (unit >= 0) ? (unit_bits & (1 << i)) != 0 : effect_test(state, c, i);
+        int is_selected = (i == state->condition_menu_cursor);
+        int y = start_y + 4 + (i - top);
+
+        int pair = is_selected ? COLOR_MENU_SEL : COLOR_MENU_NORM;
+        attron(COLOR_PAIR(pair));
+        if (is_selected) attron(A_BOLD);
+
+        mvprintw(y, start_x + 2, "[%c] %-20s", is_active ? 'X' : ' ', effect_name(state, i));
+
+        const EffectTimer* t = (unit == -1 && is_active) ? find_effect_timer(state, c, i) : NULL;
+        if (t) {
+            int left = condition_rounds_left(state, c, i);
+            int anchor_idx = get_index_by_id(state, t->anchor_id);
+            if (t->timing != EXPIRE_ROUND_START && anchor_idx != -1) {
+                printw(" (%s of %s's turn, %d rounds)",
+                    t->timing == EXPIRE_TURN_START ? "start" : "end",
+                    state->combatants[anchor_idx].name, left);
+            } else {
+                printw(" (%d rounds)", left);
+            }
+        }
+
+        if (is_selected) attroff(A_BOLD);
+        attroff(COLOR_PAIR(pair));
+    }
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + menu_height - 2, start_x, ACS_HLINE, menu_width);
+    mvprintw(start_y + menu_height - 1, start_x + (menu_width - 20) / 2, "ESC or 'q' to close");
+    attroff(COLOR_PAIR(COLOR_HEADER));
+}
+
+/**
+ * Handle input in condition menu mode.
+ */
+int handle_condition_menu_input(GameState* state, int ch) {
+    TRACE_SCOPE("handle_condition_menu_input");
+    int idx = get_index_by_id(state, state->condition_menu_target_id);
+    if (idx == -1) {
+        state->mode = MODE_COMBAT;
+        return 1;
+    }
+
+    Combatant* c = &state->combatants[idx];
+    int items = (state->condition_menu_target_unit >= 0) ? NUM_CONDITIONS : state->registry.count;
+
+    switch (ch) {
+        case KEY_UP:
+        case 'k':
+            state->condition_menu_cursor = (state->condition_menu_cursor - 1 + items) % items;
+            return 1;
+        case KEY_DOWN:
+        case 'j':
+            state->condition_menu_cursor = (state->condition_menu_cursor + 1) % items;
+            return 1;
+        case '\n':
+        case '\r':
+        case ' ':
+            {
+                Command cmd = make_command(CMD_CONDITION, c->id);
+                cmd.condition.cond = state->condition_menu_cursor;
+                cmd.condition.unit = state->condition_menu_target_unit;
+                if (c->mob_size > 0 && cmd.condition.unit >= 0 && cmd.condition.unit < c->mob_size) {
+                    uint16_t bits = state->mob_units[c->mob_first + cmd.condition.unit].conditions;
+                    cmd.type = CMD_UNIT_CONDITION;
+                    cmd.condition.active = !(bits & (1 << cmd.condition.cond));
+                } else {
+                    cmd.condition.unit = -1;
+                    cmd.condition.active = !effect_test(state, c, cmd.condition.cond);
+                }
+                apply_command(state, &cmd);
+            }
+            return 1;
+        case 'd':
+        case 'D':
+            {
+                int cursor = state->condition_menu_cursor;
+                if (state->condition_menu_target_unit >= 0) {
+                    show_message(state, "Durations apply to the whole mob!", 1);
+                } else if (effect_test(state, c, cursor)) {
+                    int dur;
+                    if (get_input_int(state, "Duration (rounds, 0=permanent): ", &dur, 0, INT_MAX)) {
+                        /* Turn timings are anchored to whoever's turn it currently is */
+                        int timing = 'R';
+                        if (dur > 0 && get_index_by_id(state, state->current_turn_id) != -1) {
+                            timing = get_input_char("Ends at: (R)ound start, (S)tart or (E)nd of current turn? ", "RrSsEe");
+                        }
+                        Command cmd = make_command(CMD_EXPIRY, c->id);
+                        cmd.expiry.cond = cursor;
+                        cmd.expiry.duration = dur;
+                        cmd.expiry.timing = EXPIRE_ROUND_START;
+                        cmd.expiry.anchor_id = -1;
+                        if (toupper(timing) == 'S' || toupper(timing) == 'E') {
+                            cmd.expiry.timing = (toupper(timing) == 'S') ? EXPIRE_TURN_START : EXPIRE_TURN_END;
+                            cmd.expiry.anchor_id = state->current_turn_id;
+                        }
+                        apply_command(state, &cmd);
+                    }
+                } else {
+                    show_message(state, "Enable condition first!", 1);
+                }
+            }
+            return 1;
+        case 'a':
+        case 'A':
+            {
+                if (state->condition_menu_target_unit >= 0) {
+                    show_message(state, "Custom effects apply to the whole mob!", 1);
+                    return 1;
+                }
+                Command cmd = make_command(CMD_EFFECT, -1);
+                if (get_input_string("New effect name: ", cmd.effect.name, EFFECT_NAME_LENGTH)) {
+                    if (!apply_command(state, &cmd)) {
+                        show_message(state, "Invalid name or effect list full!", 1);
+                    } else {
+                        state->condition_menu_cursor = find_effect_by_name(state, cmd.effect.name);
+                    }
+                }
+            }
+            return 1;
+        case 'q':
+        case 'Q':
+        case 27: /* ESC */
+            state->mode = MODE_COMBAT;
+            show_message(state, "Condition menu closed.", 0);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Apply or remove a condition on a combatant.
+ * Removing a condition also clears its duration.
+ */
+void set_condition(GameState* state, Combatant* c, int cond, int active) {
+    if (cond < 0 || cond >= state->registry.count) return;
+
+    int was_active = effect_test(state, c, cond);
+
+    if (active && !was_active) {
+        if (!effect_assign(state, c, cond, 1)) {
+            show_message(state, "Condition not applied! Out of memory.", 1);
+            return;
+        }
+        log_event(state, c, HISTORY_CONDITION, 1, "%s: %s applied.", c->name, effect_name(state, cond));
+    } else if (!active && was_active) {
+        effect_assign(state, c, cond, 0);
+        clear_effect_timer(state, c, cond);  /* Any queued expiry is now stale */
+        log_event(state, c, HISTORY_CONDITION, 0, "%s: %s removed.", c->name, effect_name(state, cond));
+    }
+    eligible_update(state, c);
+}
+
+int set_condition_duration(GameState* state, Combatant* c, int cond, int duration) {
+    return set_condition_expiry(state, c, cond, duration, EXPIRE_ROUND_START, -1);
+}
+
+/**
+ * Set when an active condition runs out and queue its expiry.
+ *
+ * EXPIRE_ROUND_START: ends when round (current + duration) starts.
+ * EXPIRE_TURN_START/END: ends at the start/end of the anchor's duration-th
+ * upcoming turn, so "1, end of turn" on the anchor's own turn means this turn.
+ * Falls back to a round expiry if the anchor is not in the encounter.
+ *
+ * @param duration Rounds, 0 = permanent
+ * @return 1 on success, 0 if refused (message shown)
+ */
+int set_condition_expiry(GameState* state, Combatant* c, int cond, int duration, ExpiryTiming timing, int anchor_id) {
+    if (cond < 0 || cond >= state->registry.count) return 0;
+    if (duration < 0) duration = 0;
+
+    int anchor_idx = get_index_by_id(state, anchor_id);
+    if (timing != EXPIRE_ROUND_START && anchor_idx == -1) timing = EXPIRE_ROUND_START;
+
+    int expires = 0;
+    if (duration > 0) {
+        /* Avoid overflow on huge durations - INT_MAX means "effectively never" */
+        expires = (duration > INT_MAX - state->round) ? INT_MAX : state->round + duration;
+        if (timing != EXPIRE_ROUND_START) {
+            /* If the anchor's turn (or its end) is still ahead this round, it counts as the first */
+            int current_idx = get_index_by_id(state, state->current_turn_id);
+            if (anchor_idx > current_idx || (anchor_idx == current_idx && timing == EXPIRE_TURN_END)) {
+                if (expires != INT_MAX) expires--;
+            }
+        }
+    }
+
+    if (expires == 0) {
+        clear_effect_timer(state, c, cond);
+    } else {
+        if (!add_effect_timer(state, c, cond, expires, timing, anchor_id)) {
+            show_message(state, "Duration not set! Out of memory.", 1);
+            return 0;
+        }
+        ExpiryEvent ev = { expires, (int)timing, c->id, (timing == EXPIRE_ROUND_START) ? -1 : anchor_id, cond };
+        if (!scheduler_push(state, &ev)) {
+            show_message(state, "Warning: Out of memory, duration will not expire!", 1);
+        }
+    }
+
+    if (timing == EXPIRE_ROUND_START || expires == 0) {
+        log_action(state, "%s: %s duration set to %d.", c->name, effect_name(state, cond), duration);
+    } else {
+        log_action(state, "%s: %s lasts %d round(s), ends at %s of %s's turn.", c->name, effect_name(state, cond),
+            duration, timing == EXPIRE_TURN_START ? "start" : "end", state->combatants[anchor_idx].name);
+    }
+    return 1;
+}
+
+/**
+ * Draw help menu overlay.
+ */
+void draw_help_menu(GameState* state) {
+    (void)state;
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    int h_height = 36;
+    int h_width = 75;
+    int h_start_y = (rows - h_height) / 2;
+    int h_start_x = (cols - h_width) / 2;
+    if (h_start_y < 0) h_start_y = 0;
+    if (h_start_x < 0) h_start_x = 0;
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    for (int y = h_start_y; y < h_start_y + h_height && y < rows; y++) {
+        for (int x = h_start_x; x < h_start_x + h_width && x < cols; x++) {
+            mvaddch(y, x, ' ');
+        }
+    }
+    attroff(COLOR_PAIR(COLOR_HEADER));
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    mvprintw(h_start_y, h_start_x + (h_width - 12) / 2, "HELP & COMMANDS");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(h_start_y + 1, h_start_x, ACS_HLINE, h_width);
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    int y = h_start_y + 3;
+    mvprintw(y++, h_start_x + 2, "Navigation:");
+    mvprintw(y++, h_start_x + 4, "UP/DOWN or k/j : Move selection");
+    mvprintw(y++, h_start_x + 4, "ENTER : Set selected as current turn");
+    y++;
+    mvprintw(y++, h_start_x + 2, "Combat Commands:");
+    mvprintw(y++, h_start_x + 4, "A : Add combatant");
+    mvprintw(y++, h_start_x + 4, "D : Delete selected combatant");
+    mvprintw(y++, h_start_x + 4, "H : Edit HP (damage/heal)");
+    mvprintw(y++, h_start_x + 4, "C : Toggle conditions (interactive menu)");
+    mvprintw(y++, h_start_x + 4, "N : Next turn (auto death saves, honours skip policy)");
+    mvprintw(y++, h_start_x + 4, "P : Previous turn");
+    mvprintw(y++, h_start_x + 4, "R : Reroll initiative");
+    mvprintw(y++, h_start_x + 4, "U : Duplicate selected combatant");
+    mvprintw(y++, h_start_x + 4, "X : Manual death save roll");
+    mvprintw(y++, h_start_x + 4, "T : Stabilize combatant");
+    mvprintw(y++, h_start_x + 4, "M : Mark/unmark selected for group actions");
+    mvprintw(y++, h_start_x + 4, "F : Mark by type, name prefix or range / clear");
+    mvprintw(y++, h_start_x + 4, "G : Group HP change on all marked (one undo step)");
+    mvprintw(y++, h_start_x + 4, "O : Expand/collapse selected mob's units");
+    y++;
+    mvprintw(y++, h_start_x + 2, "Other:");
+    mvprintw(y++, h_start_x + 4, "V : Archive - restore removed, revive the dead");
+    mvprintw(y++, h_start_x + 4, "W : Toggle skipping dead / stable / incapacitated");
+    mvprintw(y++, h_start_x + 4, "Z : Undo last action");
+    mvprintw(y++, h_start_x + 4, "E : Export combat log");
+    mvprintw(y++, h_start_x + 4, "I : Session stats and memory use");
+    mvprintw(y++, h_start_x + 4, "S : Save game");
+    mvprintw(y++, h_start_x + 4, "L : Load game");
+    mvprintw(y++, h_start_x + 4, "B : Save library - named encounters");
+    mvprintw(y++, h_start_x + 4, "Y : Import a CSV/TSV roster");
+    mvprintw(y++, h_start_x + 4, "Q : Quit");
+    attroff(COLOR_PAIR(COLOR_HEADER));
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(h_start_y + h_height - 2, h_start_x, ACS_HLINE, h_width);
+    mvprintw(h_start_y + h_height - 1, h_start_x + (h_width - 20) / 2, "Press any key to close");
+    attroff(COLOR_PAIR(COLOR_HEADER));
+
+    /* Safety check: clear overflow if content exceeds menu height */
+    if (y > h_start_y + h_height - 2) {
+        for (int clear_y = h_start_y + h_height - 2; clear_y < h_start_y + h_height; clear_y++) {
+            if (clear_y < rows) {
+                move(clear_y, h_start_x);
+                clrtoeol();
+            }
+        }
+    }
+}
+
+
+/**
+ * Add a new combatant to the initiative tracker.
+ * Validates all inputs and ensures data integrity.
+ */
+void add_combatant(GameState* state) {
+    TRACE_SCOPE("add_combatant");
+    if (!state) return;
+
+    if (state->count >= MAX_COMBATANTS) {
+        show_message(state, "List full! Maximum combatants reached.", 1);
+        return;
+    }
+
+    Command cmd = make_command(CMD_ADD, -1);
+    int type_char = get_input_char("Type? (P)layer / (E)nemy / (M)ob: ", "pemPEM");
+    if (type_char == 0) return; /* User cancelled */
+
+    cmd.add.type = (tolower(type_char) == 'p') ? TYPE_PLAYER : TYPE_ENEMY;
+    if (tolower(type_char) == 'm') cmd.type = CMD_ADD_MOB;
+
+    char* name = cmd.add.name;
+    if (state->bestiary.count > 0) {
+        if (get_input_line(state, "Name (TAB completes from bestiary): ", name, NAME_LENGTH, 1) <= 0) return;
+    } else if (!get_input_string("Name: ", name, NAME_LENGTH)) {
+        return;
+    }
+
+    /* Trim trailing whitespace and validate non-empty */
+    int name_len = (int)strlen(name);
+    while (name_len > 0 && isspace((unsigned char)name[name_len - 1])) {
+        name[--name_len] = '\0';
+    }
+    if (name_len == 0) {
+        show_message(state, "Name cannot be empty!", 1);
+        return;
+    }
+
+    /* A bestiary match prefills every prompt below; ENTER accepts the default */
+    BestiaryEntry entry;
+    int known = bestiary_entry(&state->bestiary, bestiary_find(&state->bestiary, name), &entry);
+    if (known) {
+        char prompt[64];
+        snprintf(prompt, sizeof(prompt), "Initiative (Enter = roll d20%+d): ", entry.dex);
+        if (!get_input_int_default(state, prompt, &cmd.add.initiative, INT_MIN, INT_MAX, INT_MIN)) return;
+        /* Rolled outside the command, so the journal records the result */
+        if (cmd.add.initiative == INT_MIN) cmd.add.initiative = roll_die(state, 20) + entry.dex;
+    } else if (!get_input_int(state, "Initiative: ", &cmd.add.initiative, INT_MIN, INT_MAX)) {
+        return;
+    }
+    /* Warn on unusual values (likely input errors) */
+    if (cmd.add.initiative < -10 || cmd.add.initiative > 50) {
+        show_message(state, "Warning: Initiative seems unusual. Continuing anyway.", 1);
+    }
+
+    if (known) {
+        char prompt[64];
+        snprintf(prompt, sizeof(prompt), "Dexterity (Tiebreaker, Enter = %+d): ", entry.dex);
+        if (!get_input_int_default(state, prompt, &cmd.add.dex, INT_MIN, INT_MAX, entry.dex)) return;
+    } else if (!get_input_int(state, "Dexterity (Tiebreaker): ", &cmd.add.dex, INT_MIN, INT_MAX)) {
+        return;
+    }
+    if (cmd.add.dex < -10 || cmd.add.dex > 20) {
+        show_message(state, "Warning: Dex modifier seems unusual. Continuing anyway.", 1);
+    }
+
+    if (cmd.type == CMD_ADD_MOB) {
+        if (known) {
+            if (!get_input_hp(state, "HP per unit", &entry, &cmd.add.unit_hp, MAX_MOB_UNIT_HP)) return;
+        } else if (!get_input_int(state, "HP per unit: ", &cmd.add.unit_hp, 1, MAX_MOB_UNIT_HP)) {
+            return;
+        }
+        if (!get_input_int(state, "Number of units: ", &cmd.add.mob_size, 1, MAX_MOB_UNITS)) return;
+        if (apply_command(state, &cmd) && known) apply_bestiary_conditions(state, &entry, state->selected_id);
+        return;
+    }
+
+    if (known) {
+        if (!get_input_hp(state, "Max HP", &entry, &cmd.add.max_hp, INT_MAX)) return;
+    } else if (!get_input_int(state, "Max HP: ", &cmd.add.max_hp, 1, INT_MAX)) {
+        return;
+    }
+
+    if (cmd.add.max_hp > 10000) {
+        show_message(state, "Warning: Max HP seems unusually high. Continuing anyway.", 1);
+    }
+
+    if (apply_command(state, &cmd) && known) apply_bestiary_conditions(state, &entry, state->selected_id);
+}
+
+/**
+ * Insert a fully-specified combatant at full HP with a fresh ID.
+ * The new combatant becomes the selection; the list is re-sorted.
+ *
+ * @return 1 on success, 0 if the list is full
+ */
+int insert_combatant(GameState* state, Combatant* c) {
+    if (!ensure_combatant_capacity(state, state->count + 1)) {
+        show_message(state, "List full! Maximum combatants reached.", 1);
+        return 0;
+    }
+
+    c->hp = c->max_hp;
+    c->death_save_successes = 0;
+    c->death_save_failures = 0;
+    c->is_stable = 0;
+    c->is_dead = 0;
+
+    if (state->next_id == INT_MAX) {
+        state->next_id = 1;
+    }
+    c->id = state->next_id++;
+
+    state->combatants[state->count++] = *c;
+    name_index_note(state, c->name);
+    state->selected_id = c->id;
+    if (state->count == 1) state->current_turn_id = c->id;
+
+    sort_combatants(state);
+
+    /* Round 1 edge case: ensure turn starts with highest initiative */
+    if (state->round == 1 && state->count > 0) {
+        state->current_turn_id = state->combatants[0].id;
+    }
+
+    log_action(state, "Added %s: Init %d, HP %d.", c->name, c->initiative, c->max_hp);
+    return 1;
+}
+
+/**
+ * Duplicates the selected combatant.
+ * Prompts for the number of copies and delegates to duplicate_at().
+ *
+ * @param state Pointer to the current GameState.
+ */
+void duplicate_combatant(GameState* state) {
+    TRACE_SCOPE("duplicate_combatant");
+    if (state->count == 0) return;
+
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) {
+        show_message(state, "No combatant selected!", 1);
+        return;
+    }
+
+    int max_copies = MAX_COMBATANTS - state->count;
+    if (max_copies <= 0) {
+        show_message(state, "List full! Cannot duplicate.", 1);
+        return;
+    }
+
+    Command cmd = make_command(CMD_DUPLICATE, state->selected_id);
+    if (!get_input_int(state, "Number of duplicates: ", &cmd.duplicate.copies, 1, max_copies)) {
+        return;
+    }
+
+    if (apply_command(state, &cmd)) {
+        show_message(state, "Duplicates created.", 0);
+    }
+}
+
+/**
+ * Create copies of the combatant at `idx`.
+ *
+ * Logic:
+ * - Naming: Finds the base name (e.g., "Goblin" from "Goblin 5"),
+ * numbers the original if needed ("BaseName 1") and names copies
+ * sequentially after the highest suffix in the name index, ensuring no
+ * name collisions.
+ * - Initiative: Rerolls initiative for each duplicate (1d20 + Dex Modifier).
+ * - State: Duplicates are considered "fresh spawns" (Max HP, no conditions,
+ * no death saves).
+ * - Ordering: Copies are merged into the sorted roster in one batch.
+ *
+ * @return 1 on success, 0 if there is no room for the copies
+ */
+int duplicate_at(GameState* state, int idx, int num_copies) {
+    if (idx < 0 || idx >= state->count || num_copies < 1) return 0;
+
+    if (num_copies > MAX_COMBATANTS - state->count ||
+        !ensure_combatant_capacity(state, state->count + num_copies)) {
+        show_message(state, "List full! Cannot duplicate.", 1);
+        return 0;
+    }
+
+    Combatant* source = &state->combatants[idx];
+
+    /* Reserve space for the suffix: a space, up to 11 characters of an int and the terminator */
+    const int max_suffix_len = 13;
+    const int max_base_len = NAME_LENGTH - max_suffix_len;
+
+    char base_name[NAME_LENGTH];
+    /* Strip trailing numbers to avoid "Goblin 1 1" scenarios */
+    int len = (int)strlen(source->name);
+    int trailing_num_start = len;
+
+    while (trailing_num_start > 0 && isdigit((unsigned char)source->name[trailing_num_start - 1])) {
+        trailing_num_start--;
+    }
+
+    if (trailing_num_start < len) {
+        int base_end = trailing_num_start;
+        if (base_end > 0 && isspace((unsigned char)source->name[base_end - 1])) {
+            base_end--;
+        }
+        strncpy(base_name, source->name, (size_t)base_end);
+        base_name[base_end] = '\0';
+    } else {
+        strncpy(base_name, source->name, NAME_LENGTH);
+        base_name[NAME_LENGTH - 1] = '\0';
+    }
+
+    int base_len = (int)strlen(base_name);
+    while (base_len > 0 && isspace((unsigned char)base_name[base_len - 1])) {
+        base_name[--base_len] = '\0';
+    }
+
+    if (base_len > max_base_len) {
+        base_name[max_base_len] = '\0';
+        base_len = max_base_len;
+    }
+
+    /* Highest existing number comes from the name index - no roster scan */
+    char source_base[NAME_LENGTH];
+    int source_num;
+    int original_has_number = split_numbered_name(source->name, source_base, &source_num) &&
+                              strcmp(source_base, base_name) == 0;
+    int highest_num = name_index_highest(state, base_name);
+    if (highest_num > INT_MAX - num_copies - 1) {
+        show_message(state, "Cannot duplicate! Numbering would overflow.", 1);
+        return 0;
+    }
+
+    int start_num;
+    if (!original_has_number) {
+        /* Number the original too, after any "BaseName N" already in play */
+        int original_num = highest_num + 1;
+        snprintf(source->name, NAME_LENGTH, "%.*s %d", max_base_len, base_name, original_num);
+        name_index_note(state, source->name);
+        start_num = original_num + 1;
+    } else {
+        start_num = highest_num + 1;
+    }
+
+    Combatant* batch = (Combatant*)malloc((size_t)num_copies * sizeof(Combatant));
+    if (!batch) {
+        show_message(state, "Duplicate failed! Out of memory.", 1);
+        return 0;
+    }
+
+    for (int i = 0; i < num_copies; i++) {
+        Combatant c = *source;
+
+        if (state->next_id == INT_MAX) {
+            state->next_id = 1;
+        }
+        c.id = state->next_id++;
+
+        snprintf(c.name, NAME_LENGTH, "%.*s %d", max_base_len, base_name, start_num + i);
+        c.initiative = roll_die(state, 20) + c.dex;
+
+        /* Reset to fresh spawn state */
+        c.hp = c.max_hp;
+        c.effects = 0;
+        c.word_first = 0;  /* The source keeps its pooled entries */
+        c.timer_first = 0;
+        c.death_save_successes = 0;
+        c.death_save_failures = 0;
+        c.is_stable = 0;
+        c.is_dead = 0;
+        c.is_marked = 0;
+
+        /* Each mob copy gets its own fresh units */
+        if (c.mob_size > 0) {
+            c.mob_first = mob_alloc_units(state, c.mob_size, c.mob_unit_max_hp);
+            if (c.mob_first == -1) {
+                state->mob_unit_count -= i * c.mob_size;
+                free(batch);
+                show_message(state, "Duplicate failed! Out of memory.", 1);
+                return 0;
+            }
+            c.is_expanded = 0;
+        }
+
+        batch[i] = c;
+    }
+
+    /* Copies are numbered consecutively, so only the last one raises the mark */
+    name_index_note(state, batch[num_copies - 1].name);
+    int last_id = batch[num_copies - 1].id;
+    insert_sorted_batch(state, batch, num_copies);
+    free(batch);
+
+    state->selected_id = last_id;
+
+    log_action(state, "Created %d duplicates of %s.", num_copies, base_name);
+    return 1;
+}
+
+void remove_combatant(GameState* state) {
+    TRACE_SCOPE("remove_combatant");
+    if (state->count == 0) return;
+
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) return;
+
+    char prompt[128];
+    snprintf(prompt, sizeof(prompt), "Delete %s? (y/n): ", state->combatants[idx].name);
+    if (!get_input_confirm(prompt)) {
+        return;
+    }
+
+    Command cmd = make_command(CMD_REMOVE, state->combatants[idx].id);
+    apply_command(state, &cmd);
+}
+
+/**
+ * Remove the combatant at `idx`, passing the turn on if it was theirs.
+ * Selection moves to the entry that takes its place.
+ */
+void remove_combatant_at(GameState* state, int idx) {
+    if (idx < 0 || idx >= state->count) return;
+
+    log_action(state, "Removed %s.", state->combatants[idx].name);
+    archive_trim(state);
+    if (!archive_push(state, &state->combatants[idx], ARCHIVE_REMOVED)) {
+        show_message(state, "Archive out of memory - removal cannot be restored.", 1);
+        effect_release(state, &state->combatants[idx]);
+    }
+    mob_free_units(state, &state->combatants[idx]);
+
+    if (state->current_turn_id == state->combatants[idx].id) {
+        int next_idx = (idx + 1) % state->count;
+        state->current_turn_id = (state->count > 1) ? state->combatants[next_idx].id : -1;
+    }
+
+    for (int i = idx; i < state->count - 1; i++) {
+        state->combatants[i] = state->combatants[i + 1];
+    }
+    state->count--;
+    eligible_rebuild(state);
+
+    if (state->count > 0) {
+        if (idx >= state->count) idx = state->count - 1;
+        state->selected_id = state->combatants[idx].id;
+    } else {
+        state->selected_id = -1;
+        state->current_turn_id = -1;
+        state->round = 1;
+    }
+}
+
+/**
+ * Edit HP for selected combatant with damage/healing.
+ * Prompts for the change (and critical hits at 0 HP), then applies it.
+ */
+void edit_hp(GameState* state) {
+    TRACE_SCOPE("edit_hp");
+    if (!state) return;
+
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) {
+        show_message(state, "No combatant selected!", 1);
+        return;
+    }
+
+    Combatant* c = &state->combatants[idx];
+    if (c->mob_size > 0) {
+        edit_mob_hp(state, c);
+        return;
+    }
+
+    char prompt[64];
+    snprintf(prompt, sizeof(prompt), "%s (%d/%d) Change (+/-): ", c->name, c->hp, c->max_hp);
+
+    Command cmd = make_command(CMD_HP, c->id);
+    if (get_input_int(state, prompt, &cmd.hp.change, INT_MIN, INT_MAX)) {
+        /* Critical hits within 5 feet cause 2 failures */
+        if (cmd.hp.change < 0 && c->hp <= 0 && c->type == TYPE_PLAYER && !c->is_dead) {
+            char crit_prompt[128];
+            snprintf(crit_prompt, sizeof(crit_prompt), "Critical hit? (y/n): ");
+            cmd.hp.is_critical = get_input_confirm(crit_prompt);
+        }
+        apply_command(state, &cmd);
+    }
+}
+
+/**
+ * Apply a damage (negative) or healing (positive) change to a combatant.
+ * Handles death saves, instant death, and unconscious state.
+ *
+ * @param is_critical Only consulted when a player already at 0 HP takes damage
+ * @return HP_RESULT_* flags describing state transitions
+ */
+int apply_hp_change(GameState* state, Combatant* c, int change, int is_critical) {
+    if (c->mob_size > 0) {
+        return apply_mob_hp_change(state, c, MOB_TARGET_FOCUS, -1, change);
+    }
+
+    int old_hp = c->hp;
+    int was_dead = c->is_dead;
+    int result = 0;
+    /* Guard against INT_MIN negation overflow */
+    int damage = (change < 0) ? (change == INT_MIN ? INT_MAX : -change) : 0;
+
+    /* 5e instant death rule: remaining damage >= max HP */
+    if (damage > 0 && c->hp > 0 && (c->hp - damage) <= 0) {
+        int remaining_damage = damage - c->hp;
+        if (remaining_damage >= c->max_hp) {
+            c->hp = 0;
+            c->is_dead = 1;
+            effect_assign(state, c, UNCONSCIOUS_INDEX, 1);
+            reset_death_saves(c);
+            eligible_update(state, c);
+            show_message(state, "INSTANT DEATH!", 1);
+            /* Logged as damage so the history's damage totals include the killing blow */
+            log_event(state, c, HISTORY_DAMAGE, damage, "%s died instantly (damage >= max HP).", c->name);
+            PROBE4(hp_change, c->id, change, c->hp, was_dead ? 0 : HP_RESULT_DIED);
+            return was_dead ? 0 : HP_RESULT_DIED;
+        }
+    }
+
+    /* Clamp in 64-bit so extreme inputs cannot overflow */
+    long long new_hp = (long long)c->hp + change;
+    if (new_hp > c->max_hp) new_hp = c->max_hp;
+    if (new_hp < 0) new_hp = 0;
+    c->hp = (int)new_hp;
+
+    /* 5e rule: damage at 0 HP causes death save failures */
+    if (damage > 0 && old_hp <= 0 && c->type == TYPE_PLAYER && !c->is_dead) {
+        handle_damage_at_zero_hp(state, c, damage, is_critical);
+    }
+
+    if (change > 0) {
+        log_event(state, c, HISTORY_HEAL, change, "%s healed %d HP (%d/%d).", c->name, change, c->hp, c->max_hp);
+    } else if (change < 0) {
+        log_event(state, c, HISTORY_DAMAGE, damage, "%s took %d damage (%d/%d).", c->name, damage, c->hp, c->max_hp);
+    }
+
+    /* 5e rule: players go unconscious at 0 HP, not dead */
+    if (c->type == TYPE_PLAYER) {
+        if (c->hp == 0 && old_hp > 0) {
+            if (!effect_test(state, c, UNCONSCIOUS_INDEX)) {
+                effect_assign(state, c, UNCONSCIOUS_INDEX, 1);
+                reset_death_saves(c);
+                show_message(state, "Player is DOWN! (Unconscious applied)", 1);
+                log_action(state, "%s is UNCONSCIOUS.", c->name);
+            }
+            result |= HP_RESULT_DOWNED;
+        } else if (c->hp > 0 && old_hp <= 0) {
+            if (effect_test(state, c, UNCONSCIOUS_INDEX)) {
+                effect_assign(state, c, UNCONSCIOUS_INDEX, 0);
+                reset_death_saves(c);
+                c->is_stable = 0;
+                c->is_dead = 0;
+                show_message(state, "Player is UP! (Unconscious removed)", 0);
+                log_action(state, "%s is no longer unconscious.", c->name);
+            }
+            result |= HP_RESULT_REVIVED;
+        }
+    }
+
+    if ((c->is_dead && !was_dead) || (c->type == TYPE_ENEMY && c->hp == 0 && old_hp > 0)) {
+        result |= HP_RESULT_DIED;
+    }
+    eligible_update(state, c);
+    PROBE4(hp_change, c->id, change, c->hp, result);
+    return result;
+}
+
+/**
+ * Apply the same HP change to every marked combatant in one pass.
+ * Plain combatants are updated by the bulk HP kernel; only those it flags
+ * (downed, revived, hit at 0 HP) go through the full apply_hp_change rules.
+ * The per-target log lines and messages are replaced by one aggregated entry.
+ * Callers take a single undo snapshot beforehand.
+ *
+ * @return Number of combatants affected
+ */
+int apply_group_hp_change(GameState* state, int change) {
+    int targets = 0, downed = 0, died = 0, revived = 0;
+
+    /* Scratch for the kernel: gathered indexes, hp, max_hp, delta, new hp, 4 mask sets */
+    int n = 0;
+    int words = (state->count + 63) / 64;
+    int* scratch = NULL;
+    uint64_t* mask_words = NULL;
+    if (change >= -HP_KERNEL_LIMIT && change <= HP_KERNEL_LIMIT && state->count > 0) {
+        scratch = (int*)malloc((size_t)state->count * 5 * sizeof(int));
+        mask_words = (uint64_t*)calloc((size_t)words * 4, sizeof(uint64_t));
+        if (!scratch || !mask_words) {
+            free(scratch);
+            free(mask_words);
+            scratch = NULL;
+            mask_words = NULL;
+        }
+    }
+    int* gathered = scratch;
+    int* hp = scratch ? scratch + state->count : NULL;
+    int* max_hp = scratch ? scratch + state->count * 2 : NULL;
+    int* delta = scratch ? scratch + state->count * 3 : NULL;
+    int* new_hp = scratch ? scratch + state->count * 4 : NULL;
+
+    state->suppress_feedback++;
+    for (int i = 0; i < state->count; i++) {
+        Combatant* c = &state->combatants[i];
+        if (!c->is_marked) continue;
+
+        if (c->mob_size == 0 && scratch && c->max_hp <= HP_KERNEL_LIMIT &&
+            c->hp >= -HP_KERNEL_LIMIT && c->hp <= HP_KERNEL_LIMIT) {
+            gathered[n] = i;
+            hp[n] = c->hp;
+            max_hp[n] = c->max_hp;
+            delta[n] = change;
+            n++;
+            continue;
+        }
+
+        /* Area effects hit every unit of a mob */
+        int result = (c->mob_size > 0)
+            ? apply_mob_hp_change(state, c, MOB_TARGET_ALL, -1, change)
+            : apply_hp_change(state, c, change, 0);
+        targets++;
+        if (result & HP_RESULT_DOWNED) downed++;
+        if (result & HP_RESULT_DIED) died++;
+        if (result & HP_RESULT_REVIVED) revived++;
+    }
+
+    if (n > 0) {
+        HpKernelMasks masks = { mask_words, mask_words + words, mask_words + words * 2, mask_words + words * 3 };
+        hp_kernel_select(NULL)(hp, max_hp, delta, new_hp, n, &masks);
+
+        for (int w = 0; w * 64 < n; w++) {
+            /* Instant deaths are always downed too */
+            uint64_t flagged = masks.downed[w] | masks.revived[w] | masks.hit_at_zero[w];
+
+            /* Unflagged: the clamped HP is the whole story (nobody crossed 0 HP,
+             * so eligibility to act is unchanged too) */
+            int end = (w + 1) * 64 < n ? (w + 1) * 64 : n;
+            for (int j = w * 64; j < end; j++) {
+                if (!(flagged & ((uint64_t)1 << (j % 64)))) {
+                    Combatant* c = &state->combatants[gathered[j]];
+                    c->hp = new_hp[j];
+                    targets++;
+                    /* Feedback is still suppressed, so this reaches only the campaign history */
+                    if (state->history && change != 0) {
+                        log_event(state, c, change < 0 ? HISTORY_DAMAGE : HISTORY_HEAL, change < 0 ? -change : change,
+                            change < 0 ? "%s took %d damage (%d/%d)." : "%s healed %d HP (%d/%d).",
+                            c->name, change < 0 ? -change : change, c->hp, c->max_hp);
+                    }
+                }
+            }
+
+            /* Flagged: state transitions need the full rules */
+            while (flagged) {
+                int j = w * 64 + effect_ctz64(flagged);
+                flagged &= flagged - 1;
+                int result = apply_hp_change(state, &state->combatants[gathered[j]], change, 0);
+                targets++;
+                if (result & HP_RESULT_DOWNED) downed++;
+                if (result & HP_RESULT_DIED) died++;
+                if (result & HP_RESULT_REVIVED) revived++;
+            }
+        }
+    }
+    state->suppress_feedback--;
+    free(scratch);
+    free(mask_words);
+
+    if (targets == 0) return 0;
+
+    char msg[128];
+    if (change < 0) {
+        snprintf(msg, sizeof(msg), "Group damage: %d targets took %d (%d down, %d dead).",
+            targets, change == INT_MIN ? INT_MAX : -change, downed, died);
+    } else {
+        snprintf(msg, sizeof(msg), "Group heal: %d targets healed %d (%d revived).",
+            targets, change, revived);
+    }
+    log_action(state, "%s", msg);
+    show_message(state, msg, died > 0 || downed > 0);
+    return targets;
+}
+
+/* --- Multi-select Functions --- */
+
+void toggle_mark(GameState* state, int idx) {
+    if (idx < 0 || idx >= state->count) return;
+
+    Combatant* c = &state->combatants[idx];
+    c->is_marked = !c->is_marked;
+    state->mark_anchor_id = c->id;
+}
+
+/**
+ * Mark every combatant between two list positions (inclusive, either order).
+ *
+ * @return Number of combatants marked
+ */
+int mark_range(GameState* state, int from_idx, int to_idx) {
+    if (from_idx < 0 || to_idx < 0 || from_idx >= state->count || to_idx >= state->count) return 0;
+    if (from_idx > to_idx) {
+        int tmp = from_idx;
+        from_idx = to_idx;
+        to_idx = tmp;
+    }
+
+    for (int i = from_idx; i <= to_idx; i++) {
+        state->combatants[i].is_marked = 1;
+    }
+    return to_idx - from_idx + 1;
+}
+
+/**
+ * Mark all combatants of a type, or whose name starts with `prefix`.
+ *
+ * @return Number of combatants newly or already marked by this filter
+ */
+int mark_matching(GameState* state, MarkFilter filter, const char* prefix) {
+    size_t prefix_len = prefix ? strlen(prefix) : 0;
+    int matched = 0;
+
+    for (int i = 0; i < state->count; i++) {
+        Combatant* c = &state->combatants[i];
+        int match;
+        switch (filter) {
+            case MARK_PLAYERS: match = (c->type == TYPE_PLAYER); break;
+            case MARK_ENEMIES: match = (c->type == TYPE_ENEMY); break;
+            default: match = (prefix_len > 0 && strncmp(c->name, prefix, prefix_len) == 0); break;
+        }
+        if (match) {
+            c->is_marked = 1;
+            matched++;
+        }
+    }
+    return matched;
+}
+
+void clear_marks(GameState* state) {
+    for (int i = 0; i < state->count; i++) {
+        state->combatants[i].is_marked = 0;
+    }
+}
+
+int count_marked(GameState* state) {
+    int marked = 0;
+    for (int i = 0; i < state->count; i++) {
+        if (state->combatants[i].is_marked) marked++;
+    }
+    return marked;
+}
+
+/**
+ * Prompt for a marking filter ('f' key).
+ */
+void mark_combatants(GameState* state) {
+    TRACE_SCOPE("mark_combatants");
+    int choice = get_input_char("Mark: (P)layers (E)nemies (N)ame prefix (R)ange to selection (C)lear: ", "pencrPENCR");
+    if (choice == 0) return;
+
+    char msg[64];
+    Command cmd = make_command(CMD_MARK_WHERE, -1);
+
+    switch (tolower(choice)) {
+        case 'p': cmd.mark_where.filter = MARK_PLAYERS; break;
+        case 'e': cmd.mark_where.filter = MARK_ENEMIES; break;
+        case 'n':
+            cmd.mark_where.filter = MARK_PREFIX;
+            if (!get_input_string("Name prefix: ", cmd.mark_where.prefix, NAME_LENGTH)) return;
+            break;
+        case 'r':
+            if (get_index_by_id(state, state->mark_anchor_id) == -1) {
+                show_message(state, "Mark a combatant with 'm' first to anchor the range.", 1);
+                return;
+            }
+            cmd = make_command(CMD_MARK, state->mark_anchor_id);
+            cmd.mark.to_id = state->selected_id;
+            break;
+        default:
+            cmd = make_command(CMD_CLEAR_MARKS, -1);
+            apply_command(state, &cmd);
+            show_message(state, "Marks cleared.", 0);
+            return;
+    }
+
+    int before = count_marked(state);
+    apply_command(state, &cmd);
+    int marked = count_marked(state);
+    snprintf(msg, sizeof(msg), "%d newly marked, %d marked in total.", marked - before, marked);
+    show_message(state, msg, 0);
+}
+
+/**
+ * Prompt for one HP change and apply it to every marked combatant ('G' key).
+ */
+void group_edit_hp(GameState* state) {
+    TRACE_SCOPE("group_edit_hp");
+    int marked = count_marked(state);
+    if (marked == 0) {
+        show_message(state, "No combatants marked! Use 'm' or 'f' first.", 1);
+        return;
+    }
+
+    char prompt[64];
+    snprintf(prompt, sizeof(prompt), "Group change for %d marked (+/-): ", marked);
+
+    Command cmd = make_command(CMD_GROUP_HP, -1);
+    if (get_input_int(state, prompt, &cmd.group.change, INT_MIN, INT_MAX)) {
+        apply_command(state, &cmd);
+    }
+}
+
+void reroll_initiative(GameState* state) {
+    TRACE_SCOPE("reroll_initiative");
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) return;
+
+    Command cmd = make_command(CMD_INITIATIVE, state->selected_id);
+    if (get_input_int(state, "New Init: ", &cmd.initiative.value, INT_MIN, INT_MAX)) {
+        apply_command(state, &cmd);
+    }
+}
+
+void set_initiative(GameState* state, int idx, int value) {
+    if (idx < 0 || idx >= state->count) return;
+
+    Combatant* c = &state->combatants[idx];
+    int old_init = c->initiative;
+    /* Copy the name first - sorting moves the entry */
+    char name[NAME_LENGTH];
+    memcpy(name, c->name, NAME_LENGTH);
+
+    c->initiative = value;
+    sort_combatants(state);
+
+    /* Round 1 edge case: ensure turn starts with highest initiative */
+    if (state->round == 1 && state->count > 0) {
+        state->current_turn_id = state->combatants[0].id;
+    }
+
+    log_action(state, "%s rerolled initiative from %d to %d.", name, old_init, value);
+}
+
+ /* --- Turn Skip Functions --- */
+
+/**
+ * @return 1 if `c` gets a turn under the current skip policy
+ */
+int combatant_can_act(GameState* state, const Combatant* c) {
+    int policy = state->skip_policy;
+    if (combatant_is_dead(c)) return !(policy & SKIP_DEAD);
+    if (c->type == TYPE_PLAYER && c->hp <= 0) {
+        if (c->is_stable) return !(policy & SKIP_STABLE);
+        return 1;  /* Dying players always get their turn - it is when they roll death saves */
+    }
+    if ((policy & SKIP_INCAPACITATED) && (c->effects & INCAPACITATING_CONDITIONS)) return 0;
+    return 1;
+}
+
+/**
+ * Recompute the whole bitmap. Called whenever entries move (sort, insert,
+ * remove, archive, undo, load). On allocation failure the bitmap is dropped
+ * and everyone counts as eligible.
+ */
+void eligible_rebuild(GameState* state) {
+    int words = (state->count + 63) / 64;
+    if (words > state->eligible_capacity) {
+        int new_capacity = (state->capacity + 63) / 64;
+        if (new_capacity < words) new_capacity = words;
+        uint64_t* grown = (uint64_t*)realloc(state->eligible, (size_t)new_capacity * sizeof(uint64_t));
+        if (!grown) {
+            eligible_free(state);
+            return;
+        }
+        state->eligible = grown;
+        state->eligible_capacity = new_capacity;
+    }
+    if (!state->eligible) return;
+
+    memset(state->eligible, 0, (size_t)state->eligible_capacity * sizeof(uint64_t));
+    for (int i = 0; i < state->count; i++) {
+        if (combatant_can_act(state, &state->combatants[i])) {
+            state->eligible[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+}
+
+/**
+ * Refresh one combatant's bit after its HP, death saves or conditions changed.
+ * Copies outside the roster are ignored.
+ */
+void eligible_update(GameState* state, const Combatant* c) {
+    if (!state->eligible || c < state->combatants || c >= state->combatants + state->count) return;
+
+    int i = (int)(c - state->combatants);
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    if (combatant_can_act(state, c)) state->eligible[i / 64] |= bit;
+    else state->eligible[i / 64] &= ~bit;
+}
+
+/**
+ * Find-next-set-bit: first eligible index at or after `from`.
+ *
+ * @return Roster index, or -1 if none
+ */
+int eligible_next(GameState* state, int from) {
+    if (from < 0) from = 0;
+    if (from >= state->count) return -1;
+    if (!state->eligible) return from;
+
+    int words = (state->count + 63) / 64;
+    int w = from / 64;
+    uint64_t bits = state->eligible[w] & (~(uint64_t)0 << (from % 64));
+    while (!bits) {
+        if (++w >= words) return -1;
+        bits = state->eligible[w];
+    }
+    int i = w * 64 + effect_ctz64(bits);
+    return i < state->count ? i : -1;
+}
+
+/**
+ * Find-previous-set-bit: last eligible index at or before `from`.
+ *
+ * @return Roster index, or -1 if none
+ */
+int eligible_prev(GameState* state, int from) {
+    if (from >= state->count) from = state->count - 1;
+    if (from < 0) return -1;
+    if (!state->eligible) return from;
+
+    int w = from / 64;
+    uint64_t bits = state->eligible[w] & (~(uint64_t)0 >> (63 - from % 64));
+    while (!bits) {
+        if (--w < 0) return -1;
+        bits = state->eligible[w];
+    }
+    /* Highest set bit */
+#if defined(__GNUC__) || defined(__clang__)
+    return w * 64 + 63 - __builtin_clzll(bits);
+#else
+    int top = 63;
+    while (!(bits & ((uint64_t)1 << top))) top--;
+    return w * 64 + top;
+#endif
+}
+
+void eligible_free(GameState* state) {
+    free(state->eligible);
+    state->eligible = NULL;
+    state->eligible_capacity = 0;
+}
+
+/**
+ * @return 1 if any expiry (possibly stale) is due this round or earlier
+ */
+int scheduler_has_due(GameState* state) {
+    return state->expiry.rounds.count > 0 && state->expiry.rounds.heap[0].round <= state->round;
+}
+
+/**
+ * Find who acts next at or after `from` this round. Skipped combatants'
+ * turns still pass: their start/end-of-turn expiries fire, and anyone an
+ * expiry frees up (e.g. stunned until the start of their turn) gets to act.
+ * With nothing due in the scheduler this is a single bit scan.
+ *
+ * @return Roster index of the next actor, or -1 if nobody is left this round
+ */
+int advance_to_actor(GameState* state, int from) {
+    int next = eligible_next(state, from);
+    for (int k = from; k < state->count && k != next; k++) {
+        if (!scheduler_has_due(state)) break;
+
+        int id = state->combatants[k].id;
+        process_turn_expiries(state, id, EXPIRE_TURN_START);
+        if (eligible_next(state, k) == k) return k;
+        process_turn_expiries(state, id, EXPIRE_TURN_END);
+        next = eligible_next(state, k + 1);
+    }
+    return next;
+}
+
+void set_skip_policy(GameState* state, int policy) {
+    state->skip_policy = policy & (SKIP_DEAD | SKIP_STABLE | SKIP_INCAPACITATED);
+    eligible_rebuild(state);
+}
+
+/**
+ * Describe a policy as "dead+stable", or "none".
+ */
+void format_skip_policy(int policy, char* buf, size_t size) {
+    snprintf(buf, size, "%s%s%s%s",
+        (policy & SKIP_DEAD) ? "dead+" : "",
+        (policy & SKIP_STABLE) ? "stable+" : "",
+        (policy & SKIP_INCAPACITATED) ? "incapacitated+" : "",
+        policy ? "" : "none");
+    size_t len = strlen(buf);
+    if (len > 0 && buf[len - 1] == '+') buf[len - 1] = '\0';
+}
+
+/**
+ * Toggle one skip policy from the keyboard.
+ */
+void edit_skip_policy(GameState* state) {
+    TRACE_SCOPE("edit_skip_policy");
+    int choice = get_input_char("Skip turns of: (D)ead / (S)table / (I)ncapacitated? ", "dsiDSI");
+    if (choice == 0) return;
+
+    int bit = SKIP_DEAD;
+    if (tolower(choice) == 's') bit = SKIP_STABLE;
+    else if (tolower(choice) == 'i') bit = SKIP_INCAPACITATED;
+    Command cmd = make_command(CMD_SKIP_POLICY, -1);
+    cmd.skip.policy = state->skip_policy ^ bit;
+    apply_command(state, &cmd);
+
+    char policy[48];
+    char msg[64];
+    format_skip_policy(state->skip_policy, policy, sizeof(policy));
+    snprintf(msg, sizeof(msg), "Skipping: %s", policy);
+    show_message(state, msg, 0);
+}
+
+/**
+ * Advance to the next combatant who gets a turn under the skip policy.
+ * If the policy would skip everyone, turns step one by one as usual.
+ */
+void next_turn(GameState* state) {
+    if (state->count == 0) return;
+
+    int idx = get_index_by_id(state, state->current_turn_id);
+    int any_eligible = (eligible_next(state, 0) != -1);
+    if (idx == -1) {
+        idx = any_eligible ? eligible_next(state, 0) : 0;
+    } else {
+        process_turn_expiries(state, state->current_turn_id, EXPIRE_TURN_END);
+        idx = any_eligible ? advance_to_actor(state, idx + 1) : idx + 1;
+        if (idx == -1) idx = state->count;
+    }
+
+    if (idx >= state->count) {
+        state->round++;
+        log_action(state, "--- START OF ROUND %d ---", state->round);
+        decrement_condition_durations(state);
+        /* The fallen stay on screen for the rest of their round, then go cold */
+        archive_sweep_dead(state);
+        history_snapshot(state->history, state);
+        if (state->count == 0) return;
+        idx = (eligible_next(state, 0) != -1) ? advance_to_actor(state, 0) : 0;
+        if (idx == -1) idx = 0;
+    }
+
+    state->current_turn_id = state->combatants[idx].id;
+    state->selected_id = state->current_turn_id;
+
+    Combatant* c = &state->combatants[idx];
+    PROBE2(next_turn, state->round, c->id);
+    log_event(state, c, HISTORY_TURN, 0, "%s's turn.", c->name);
+    process_turn_expiries(state, c->id, EXPIRE_TURN_START);
+
+    /* 5e rule: death saves rolled at start of turn when at 0 HP */
+    if (c->type == TYPE_PLAYER && c->hp <= 0 && !c->is_stable && !c->is_dead) {
+        roll_death_save(state, c);
+    }
+}
+
+/**
+ * Step back to the previous combatant who gets a turn under the skip policy.
+ * Expiries are keyed by absolute round, so moving the
+ * round counter back is enough to make pending durations read one round
+ * longer again; conditions that already expired are only restored by undo.
+ */
+void prev_turn(GameState* state) {
+    if (state->count == 0) return;
+
+    int idx = get_index_by_id(state, state->current_turn_id);
+    int any_eligible = (eligible_next(state, 0) != -1);
+    if (idx == -1) idx = 0;
+    else idx = any_eligible ? eligible_prev(state, idx - 1) : idx - 1;
+
+    if (idx < 0) {
+        idx = any_eligible ? eligible_prev(state, state->count - 1) : state->count - 1;
+        if (state->round > 1) {
+            state->round--;
+            log_action(state, "--- END OF ROUND %d (Revert) ---", state->round);
+        }
+    }
+
+    state->current_turn_id = state->combatants[idx].id;
+    state->selected_id = state->current_turn_id;
+    log_action(state, "Turn reverted to %s.", state->combatants[idx].name);
+}
+
+/**
+ * Expire everything due at the start of the current round.
+ * Only the heap root is inspected, so the cost is O(expiring log n) rather than
+ * a scan of every combatant. Turn-anchored expiries from earlier rounds whose
+ * turn never came (anchor removed or skipped) are flushed here as well.
+ */
+void decrement_condition_durations(GameState* state) {
+    ExpiryHeap* rounds = &state->expiry.rounds;
+    while (rounds->count > 0) {
+        ExpiryEvent ev = rounds->heap[0];
+        if (ev.round > state->round || (ev.round == state->round && ev.timing != EXPIRE_ROUND_START)) break;
+        scheduler_pop(state);
+        expire_condition(state, &ev);
+    }
+}
+
+ /* --- Hot Field Functions --- */
+
+/**
+ * Make room for `needed` entries. Contents are not preserved - the mirror is
+ * always rebuilt in full by hot_sync().
+ *
+ * @return 1 on success, 0 on allocation failure (mirror left empty)
+ */
+int hot_reserve(HotFields* hot, int needed) {
+    if (needed <= hot->capacity) return 1;
+
+    int new_capacity = hot->capacity > 0 ? hot->capacity : INITIAL_COMBATANT_CAPACITY;
+    while (new_capacity < needed) new_capacity *= 2;
+
+    hot_free(hot);
+    size_t n = (size_t)new_capacity;
+    hot->id = (int*)malloc(n * sizeof(int));
+    hot->hp = (int*)malloc(n * sizeof(int));
+    hot->max_hp = (int*)malloc(n * sizeof(int));
+    hot->initiative = (int*)malloc(n * sizeof(int));
+    hot->conditions = (uint64_t*)malloc(n * sizeof(uint64_t));
+    hot->flags = (uint8_t*)malloc(n);
+    hot->hp_band = (uint8_t*)malloc(n);
+    if (!hot->id || !hot->hp || !hot->max_hp || !hot->initiative || !hot->conditions ||
+        !hot->flags || !hot->hp_band) {
+        hot_free(hot);
+        return 0;
+    }
+    hot->capacity = new_capacity;
+    return 1;
+}
+
+void hot_free(HotFields* hot) {
+    free(hot->id);
+    free(hot->hp);
+    free(hot->max_hp);
+    free(hot->initiative);
+    free(hot->conditions);
+    free(hot->flags);
+    free(hot->hp_band);
+    memset(hot, 0, sizeof(*hot));
+}
+
+/**
+ * Rebuild the SoA copy from the combatant array: one strided pass over the
+ * records, after which every bulk query is a dense linear pass. Callers sync
+ * right before querying; nothing else keeps it current.
+ *
+ * @return 1 on success, 0 if the mirror could not be allocated (hot->count is 0)
+ */
+int hot_sync(GameState* state) {
+    HotFields* hot = &state->hot;
+    hot->count = 0;
+    if (!hot_reserve(hot, state->count)) return 0;
+
+    for (int i = 0; i < state->count; i++) {
+        const Combatant* c = &state->combatants[i];
+        hot->id[i] = c->id;
+        hot->hp[i] = c->hp;
+        hot->max_hp[i] = c->max_hp;
+        hot->initiative[i] = c->initiative;
+        hot->conditions[i] = c->effects;
+        hot->flags[i] = (uint8_t)((c->type == TYPE_PLAYER ? HOT_PLAYER : 0) |
+                                  (c->is_dead ? HOT_DEAD : 0) |
+                                  (c->is_stable ? HOT_STABLE : 0) |
+                                  (c->is_marked ? HOT_MARKED : 0) |
+                                  (c->mob_size > 0 ? HOT_MOB : 0));
+    }
+    hot->count = state->count;
+    hot_classify_hp(hot);
+    return 1;
+}
+
+/**
+ * Compute each entry's HpBand. Branch-free so the compiler can vectorize it.
+ */
+void hot_classify_hp(HotFields* hot) {
+    const int* hp = hot->hp;
+    const int* max_hp = hot->max_hp;
+    const uint8_t* flags = hot->flags;
+    uint8_t* band = hot->hp_band;
+
+    for (int i = 0; i < hot->count; i++) {
+        int down = hp[i] <= 0;
+        int dead = ((flags[i] & HOT_DEAD) != 0) | (down & ((flags[i] & HOT_PLAYER) == 0));
+        int critical = hp[i] <= max_hp[i] / 4;
+        int hurt = hp[i] <= max_hp[i] / 2;
+        int alive_band = critical ? HP_BAND_CRITICAL : (hurt ? HP_BAND_HURT : HP_BAND_GOOD);
+        band[i] = (uint8_t)(dead ? HP_BAND_DEAD : (down ? HP_BAND_UNCONSCIOUS : alive_band));
+    }
+}
+
+/**
+ * Find living enemies below `percent` of their max HP.
+ *
+ * @param out Receives matching indexes (room for hot->count), or NULL to only count
+ * @return Number of matches
+ */
+int hot_query_enemies_below(const HotFields* hot, int percent, int* out) {
+    const int* hp = hot->hp;
+    const int* max_hp = hot->max_hp;
+    const uint8_t* flags = hot->flags;
+    int n = 0;
+
+    for (int i = 0; i < hot->count; i++) {
+        int match = ((flags[i] & (HOT_PLAYER | HOT_DEAD)) == 0) & (hp[i] > 0) &
+                    ((long long)hp[i] * 100 < (long long)max_hp[i] * percent);
+        if (out) out[n] = i;  /* Branch-free compaction: overwritten unless it matched */
+        n += match;
+    }
+    return n;
+}
+
+/**
+ * Find players at 0 HP who are neither stable nor dead (rolling death saves).
+ *
+ * @param out Receives matching indexes (room for hot->count), or NULL to only count
+ * @return Number of matches
+ */
+int hot_query_dying_players(const HotFields* hot, int* out) {
+    const int* hp = hot->hp;
+    const uint8_t* flags = hot->flags;
+    int n = 0;
+
+    for (int i = 0; i < hot->count; i++) {
+        int match = ((flags[i] & (HOT_PLAYER | HOT_DEAD | HOT_STABLE)) == HOT_PLAYER) & (hp[i] <= 0);
+        if (out) out[n] = i;
+        n += match;
+    }
+    return n;
+}
+
+ /* --- HP Kernel Functions --- */
+
+/**
+ * Scalar kernel body for elements [start, n). Also finishes the SIMD kernels' tails.
+ */
+void hp_kernel_range(const int* hp, const int* max_hp, const int* delta, int* new_hp, int start, int n, HpKernelMasks* masks) {
+    for (int i = start; i < n; i++) {
+        int sum = hp[i] + delta[i];
+        int clamped = sum > max_hp[i] ? max_hp[i] : sum;
+        if (clamped < 0) clamped = 0;
+        new_hp[i] = clamped;
+
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        int w = i / 64;
+        if (hp[i] > 0 && clamped == 0) masks->downed[w] |= bit;
+        if (hp[i] > 0 && delta[i] < 0 && sum <= -max_hp[i]) masks->instant[w] |= bit;
+        if (hp[i] <= 0 && clamped > 0) masks->revived[w] |= bit;
+        if (hp[i] <= 0 && delta[i] < 0) masks->hit_at_zero[w] |= bit;
+    }
+}
+
+void hp_kernel_scalar(const int* hp, const int* max_hp, const int* delta, int* new_hp, int n, HpKernelMasks* masks) {
+    hp_kernel_range(hp, max_hp, delta, new_hp, 0, n, masks);
+}
+
+#ifdef HP_KERNEL_X86
+/**
+ * SSE2 kernel, 4 elements per step. SSE2 has no 32-bit min/max, so the clamp
+ * is done with compare-and-select.
+ */
+__attribute__((target("sse2")))
+void hp_kernel_sse2(const int* hp, const int* max_hp, const int* delta, int* new_hp, int n, HpKernelMasks* masks) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(const void*)(hp + i));
+        __m128i m = _mm_loadu_si128((const __m128i*)(const void*)(max_hp + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(const void*)(delta + i));
+
+        __m128i sum = _mm_add_epi32(h, d);
+        __m128i over = _mm_cmpgt_epi32(sum, m);
+        __m128i clamped = _mm_or_si128(_mm_and_si128(over, m), _mm_andnot_si128(over, sum));
+        clamped = _mm_and_si128(clamped, _mm_cmpgt_epi32(clamped, zero));
+        _mm_storeu_si128((__m128i*)(void*)(new_hp + i), clamped);
+
+        __m128i was_up = _mm_cmpgt_epi32(h, zero);
+        __m128i damaged = _mm_cmpgt_epi32(zero, d);
+        __m128i above_neg_max = _mm_cmpgt_epi32(sum, _mm_sub_epi32(zero, m));
+
+        __m128i downed = _mm_and_si128(was_up, _mm_cmpeq_epi32(clamped, zero));
+        __m128i instant = _mm_andnot_si128(above_neg_max, _mm_and_si128(was_up, damaged));
+        __m128i revived = _mm_andnot_si128(was_up, _mm_cmpgt_epi32(clamped, zero));
+        __m128i hit = _mm_andnot_si128(was_up, damaged);
+
+        int w = i / 64;
+        int shift = i % 64;
+        masks->downed[w] |= (uint64_t)(unsigned int)_mm_movemask_ps(_mm_castsi128_ps(downed)) << shift;
+        masks->instant[w] |= (uint64_t)(unsigned int)_mm_movemask_ps(_mm_castsi128_ps(instant)) << shift;
+        masks->revived[w] |= (uint64_t)(unsigned int)_mm_movemask_ps(_mm_castsi128_ps(revived)) << shift;
+        masks->hit_at_zero[w] |= (uint64_t)(unsigned int)_mm_movemask_ps(_mm_castsi128_ps(hit)) << shift;
+    }
+    hp_kernel_range(hp, max_hp, delta, new_hp, i, n, masks);
+}
+
+/**
+ * AVX2 kernel, 8 elements per step.
+ */
+__attribute__((target("avx2")))
+void hp_kernel_avx2(const int* hp, const int* max_hp, const int* delta, int* new_hp, int n, HpKernelMasks* masks) {
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i h = _mm256_loadu_si256((const __m256i*)(const void*)(hp + i));
+        __m256i m = _mm256_loadu_si256((const __m256i*)(const void*)(max_hp + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(const void*)(delta + i));
+
+        __m256i sum = _mm256_add_epi32(h, d);
+        __m256i clamped = _mm256_max_epi32(_mm256_min_epi32(sum, m), zero);
+        _mm256_storeu_si256((__m256i*)(void*)(new_hp + i), clamped);
+
+        __m256i was_up = _mm256_cmpgt_epi32(h, zero);
+        __m256i damaged = _mm256_cmpgt_epi32(zero, d);
+        __m256i above_neg_max = _mm256_cmpgt_epi32(sum, _mm256_sub_epi32(zero, m));
+
+        __m256i downed = _mm256_and_si256(was_up, _mm256_cmpeq_epi32(clamped, zero));
+        __m256i instant = _mm256_andnot_si256(above_neg_max, _mm256_and_si256(was_up, damaged));
+        __m256i revived = _mm256_andnot_si256(was_up, _mm256_cmpgt_epi32(clamped, zero));
+        __m256i hit = _mm256_andnot_si256(was_up, damaged);
+
+        int w = i / 64;
+        int shift = i % 64;
+        masks->downed[w] |= (uint64_t)(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(downed)) << shift;
+        masks->instant[w] |= (uint64_t)(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(instant)) << shift;
+        masks->revived[w] |= (uint64_t)(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(revived)) << shift;
+        masks->hit_at_zero[w] |= (uint64_t)(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) << shift;
+    }
+    hp_kernel_range(hp, max_hp, delta, new_hp, i, n, masks);
+}
+#endif /* HP_KERNEL_X86 */
+
+/**
+ * Pick the widest kernel this CPU supports, once. INITIATIVE_SIMD=scalar|sse2|avx2
+ * caps the choice (for testing and benchmarks).
+ *
+ * @param name Receives the kernel name if non-NULL
+ */
+HpKernelFn hp_kernel_select(const char** name) {
+    static HpKernelFn chosen = NULL;
+    static const char* chosen_name = "scalar";
+
+    if (!chosen) {
+        chosen = hp_kernel_scalar;
+#ifdef HP_KERNEL_X86
+        const char* force = getenv("INITIATIVE_SIMD");
+        int level = 2;
+        if (force) level = (strcmp(force, "avx2") == 0) ? 2 : (strcmp(force, "sse2") == 0) ? 1 : 0;
+
+        __builtin_cpu_init();
+        if (level >= 2 && __builtin_cpu_supports("avx2")) {
+            chosen = hp_kernel_avx2;
+            chosen_name = "avx2";
+        } else if (level >= 1 && __builtin_cpu_supports("sse2")) {
+            chosen = hp_kernel_sse2;
+            chosen_name = "sse2";
+        }
+#endif
+    }
+
+    if (name) *name = chosen_name;
+    return chosen;
+}
+
+ /* --- Effect Registry Functions --- */
+
+/**
+ * Index of the lowest set bit. `bits` must be non-zero.
+ */
+int effect_ctz64(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+int effect_test(const GameState* state, const Combatant* c, int effect) {
+    if (effect < 0 || effect >= MAX_EFFECTS) return 0;
+    if (effect < 64) return (c->effects & ((uint64_t)1 << effect)) != 0;
+    for (int w = c->word_first; w; w = state->effect_store.words[w].next) {
+        const EffectWord* word = &state->effect_store.words[w];
+        if (word->block == effect / 64) return (word->bits & ((uint64_t)1 << (effect % 64))) != 0;
+        if (word->block > effect / 64) break;
+    }
+    return 0;
+}
+
+/**
+ * Set or clear one effect bit. Past the inline word this takes a pooled
+ * word for the block, returned to the pool once the block is empty again.
+ *
+ * @return 1 on success, 0 on allocation failure
+ */
+int effect_assign(GameState* state, Combatant* c, int effect, int on) {
+    if (effect < 0 || effect >= MAX_EFFECTS) return 1;
+    uint64_t bit = (uint64_t)1 << (effect % 64);
+    if (effect < 64) {
+        if (on) c->effects |= bit;
+        else c->effects &= ~bit;
+        return 1;
+    }
+
+    EffectStore* store = &state->effect_store;
+    int block = effect / 64;
+    int prev = 0;
+    int w = c->word_first;
+    while (w && store->words[w].block < block) {
+        prev = w;
+        w = store->words[w].next;
+    }
+    if (w && store->words[w].block == block) {
+        EffectWord* word = &store->words[w];
+        if (on) word->bits |= bit;
+        else word->bits &= ~bit;
+        if (word->bits == 0) {
+            if (prev) store->words[prev].next = word->next;
+            else c->word_first = word->next;
+            word->next = store->word_free;
+            store->word_free = w;
+        }
+        return 1;
+    }
+    if (!on) return 1;
+
+    int added = effect_word_alloc(store);
+    if (!added) return 0;
+    store->words[added].bits = bit;
+    store->words[added].block = block;
+    store->words[added].next = w;
+    if (prev) store->words[prev].next = added;
+    else c->word_first = added;
+    return 1;
+}
+
+/**
+ * Find the next active effect at or after `from`, skipping empty words whole.
+ * Iterate with: for (e = effect_next(s, c, 0); e != -1; e = effect_next(s, c, e + 1))
+ *
+ * @return Effect index, or -1 if none remain
+ */
+int effect_next(const GameState* state, const Combatant* c, int from) {
+    if (from < 0) from = 0;
+    if (from < 64) {
+        uint64_t bits = c->effects & (~(uint64_t)0 << from);
+        if (bits) return effect_ctz64(bits);
+        from = 64;
+    }
+    for (int w = c->word_first; w; w = state->effect_store.words[w].next) {
+        const EffectWord* word = &state->effect_store.words[w];
+        if (word->block < from / 64) continue;
+        uint64_t bits = word->bits;
+        if (word->block == from / 64) bits &= ~(uint64_t)0 << (from % 64);
+        if (bits) return word->block * 64 + effect_ctz64(bits);
+    }
+    return -1;
+}
+
+/**
+ * Register the built-in conditions. They always occupy indexes 0..NUM_CONDITIONS-1
+ * so the Condition masks and saved condition bits keep their meaning.
+ */
+void init_effect_registry(GameState* state) {
+    state->registry.names = NULL;
+    state->registry.count = 0;
+    state->registry.capacity = 0;
+    for (int i = 0; i < NUM_CONDITIONS; i++) {
+        register_effect(state, condition_data[i].name);
+    }
+}
+
+void free_effect_registry(GameState* state) {
+    free(state->registry.names);
+    state->registry.names = NULL;
+    state->registry.count = 0;
+    state->registry.capacity = 0;
+}
+
+/**
+ * Add a custom effect, or find it if already registered (case-insensitive).
+ * Names may not contain characters used as save file separators.
+ *
+ * @return Effect index, or -1 if the name is invalid or the registry is full
+ */
+int register_effect(GameState* state, const char* name) {
+    while (isspace((unsigned char)*name)) name++;
+    size_t len = strlen(name);
+    while (len > 0 && isspace((unsigned char)name[len - 1])) len--;
+    if (len == 0 || len >= EFFECT_NAME_LENGTH) return -1;
+
+    char clean[EFFECT_NAME_LENGTH];
+    memcpy(clean, name, len);
+    clean[len] = '\0';
+    if (strpbrk(clean, "|:,=\"")) return -1;
+
+    int existing = find_effect_by_name(state, clean);
+    if (existing != -1) return existing;
+
+    EffectRegistry* reg = &state->registry;
+    if (reg->count >= MAX_EFFECTS) return -1;
+    if (reg->count >= reg->capacity) {
+        int new_capacity = reg->capacity > 0 ? reg->capacity * 2 : 32;
+        if (new_capacity > MAX_EFFECTS) new_capacity = MAX_EFFECTS;
+        char (*grown)[EFFECT_NAME_LENGTH] = realloc(reg->names, (size_t)new_capacity * EFFECT_NAME_LENGTH);
+        if (!grown) return -1;
+        reg->names = grown;
+        reg->capacity = new_capacity;
+    }
+
+    memcpy(reg->names[reg->count], clean, len + 1);
+    return reg->count++;
+}
+
+/**
+ * Get an effect's display name safely.
+ *
+ * @return Effect name, or "Unknown" if the index is not registered
+ */
+const char* effect_name(GameState* state, int effect) {
+    if (effect >= 0 && effect < state->registry.count) {
+        return state->registry.names[effect];
+    }
+    return "Unknown";
+}
+
+/**
+ * Look up an effect index by its display name (case-insensitive).
+ *
+ * @return Effect index, or -1 if no effect matches
+ */
+int find_effect_by_name(GameState* state, const char* name) {
+    for (int i = 0; i < state->registry.count; i++) {
+        const char* a = state->registry.names[i];
+        const char* b = name;
+        while (*a && *b && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') return i;
+    }
+    return -1;
+}
+
+/**
+ * Register custom effects from a config file: one name per line, blank lines
+ * and lines starting with '#' ignored.
+ *
+ * @return Number of lines that could not be registered, or -1 if the file cannot be opened
+ */
+int load_effects_config(GameState* state, const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    char line[128];
+    int rejected = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+        if (register_effect(state, p) == -1) rejected++;
+    }
+    fclose(f);
+
+    if (rejected > 0) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "Effects config: %d invalid entr%s skipped.", rejected, rejected == 1 ? "y" : "ies");
+        show_message(state, msg, 1);
+    }
+    return rejected;
+}
+
+/**
+ * The pointer is only good until the next timer is added anywhere.
+ *
+ * @return Duration entry of `effect`, or NULL if the effect has no duration
+ */
+EffectTimer* find_effect_timer(const GameState* state, const Combatant* c, int effect) {
+    for (int t = c->timer_first; t; t = state->effect_store.timers[t].next) {
+        if (state->effect_store.timers[t].effect == effect) return &state->effect_store.timers[t];
+    }
+    return NULL;
+}
+
+/**
+ * Set (or replace) the duration entry for `effect`. New entries go last,
+ * so timers keep the order they were set in. Does not queue an expiry.
+ *
+ * @return 1 on success, 0 on allocation failure
+ */
+int add_effect_timer(GameState* state, Combatant* c, int effect, int expires, ExpiryTiming timing, int anchor_id) {
+    EffectStore* store = &state->effect_store;
+    int last = 0;
+    int slot = c->timer_first;
+    while (slot && store->timers[slot].effect != effect) {
+        last = slot;
+        slot = store->timers[slot].next;
+    }
+    if (!slot) {
+        slot = effect_timer_alloc(store);
+        if (!slot) return 0;
+        store->timers[slot].next = 0;
+        if (last) store->timers[last].next = slot;
+        else c->timer_first = slot;
+    }
+
+    EffectTimer* t = &store->timers[slot];
+    t->effect = effect;
+    t->expires = expires;
+    t->timing = (int)timing;
+    t->anchor_id = (timing == EXPIRE_ROUND_START) ? -1 : anchor_id;
+    return 1;
+}
+
+void clear_effect_timer(GameState* state, Combatant* c, int effect) {
+    EffectStore* store = &state->effect_store;
+    int prev = 0;
+    for (int t = c->timer_first; t; prev = t, t = store->timers[t].next) {
+        if (store->timers[t].effect != effect) continue;
+        if (prev) store->timers[prev].next = store->timers[t].next;
+        else c->timer_first = store->timers[t].next;
+        store->timers[t].next = store->timer_free;
+        store->timer_free = t;
+        return;
+    }
+}
+
+ /* --- Effect Store Functions --- */
+
+/**
+ * Take a word from the free list, or grow the pool.
+ *
+ * @return Entry index, or 0 on allocation failure
+ */
+int effect_word_alloc(EffectStore* store) {
+    if (store->word_free) {
+        int w = store->word_free;
+        store->word_free = store->words[w].next;
+        return w;
+    }
+    if (store->word_count == 0) store->word_count = 1;  /* Entry 0 means "none" */
+    if (store->word_count >= store->word_capacity) {
+        int new_capacity = store->word_capacity > 0 ? store->word_capacity * 2 : INITIAL_COMBATANT_CAPACITY;
+        EffectWord* grown = (EffectWord*)realloc(store->words, (size_t)new_capacity * sizeof(EffectWord));
+        if (!grown) return 0;
+        store->words = grown;
+        store->word_capacity = new_capacity;
+    }
+    return store->word_count++;
+}
+
+/**
+ * Take a timer from the free list, or grow the pool.
+ *
+ * @return Entry index, or 0 on allocation failure
+ */
+int effect_timer_alloc(EffectStore* store) {
+    if (store->timer_free) {
+        int t = store->timer_free;
+        store->timer_free = store->timers[t].next;
+        return t;
+    }
+    if (store->timer_count == 0) store->timer_count = 1;
+    if (store->timer_count >= store->timer_capacity) {
+        int new_capacity = store->timer_capacity > 0 ? store->timer_capacity * 2 : INITIAL_COMBATANT_CAPACITY;
+        EffectTimer* grown = (EffectTimer*)realloc(store->timers, (size_t)new_capacity * sizeof(EffectTimer));
+        if (!grown) return 0;
+        store->timers = grown;
+        store->timer_capacity = new_capacity;
+    }
+    return store->timer_count++;
+}
+
+/**
+ * Clear every effect and duration of `c`, returning its entries to the pool.
+ * Only for a combatant that is being dropped or reset - not for one whose
+ * entries are shared with another copy.
+ */
+void effect_release(GameState* state, Combatant* c) {
+    EffectStore* store = &state->effect_store;
+    while (c->word_first) {
+        int w = c->word_first;
+        c->word_first = store->words[w].next;
+        store->words[w].next = store->word_free;
+        store->word_free = w;
+    }
+    while (c->timer_first) {
+        int t = c->timer_first;
+        c->timer_first = store->timers[t].next;
+        store->timers[t].next = store->timer_free;
+        store->timer_free = t;
+    }
+    c->effects = 0;
+}
+
+/**
+ * Give `c` its own copies of the pooled entries it points at, so the
+ * original (an archive entry, say) keeps its chains untouched.
+ *
+ * @return 1 on success, 0 on allocation failure (c then has no pooled effects)
+ */
+int effect_clone(GameState* state, Combatant* c) {
+    EffectStore* store = &state->effect_store;
+    int words = c->word_first, timers = c->timer_first;
+    c->word_first = 0;
+    c->timer_first = 0;
+
+    int last = 0;
+    for (int w = words; w; w = store->words[w].next) {
+        int copy = effect_word_alloc(store);
+        if (!copy) return 0;
+        store->words[copy] = store->words[w];
+        store->words[copy].next = 0;
+        if (last) store->words[last].next = copy;
+        else c->word_first = copy;
+        last = copy;
+    }
+    last = 0;
+    for (int t = timers; t; t = store->timers[t].next) {
+        int copy = effect_timer_alloc(store);
+        if (!copy) return 0;
+        store->timers[copy] = store->timers[t];
+        store->timers[copy].next = 0;
+        if (last) store->timers[last].next = copy;
+        else c->timer_first = copy;
+        last = copy;
+    }
+    return 1;
+}
+
+/**
+ * Make `dst` an exact copy of `src`, reusing its buffers when they are big enough.
+ *
+ * @return 1 on success, 0 on allocation failure (dst unchanged)
+ */
+int effect_store_copy(EffectStore* dst, const EffectStore* src) {
+    if (dst->word_capacity < src->word_count) {
+        EffectWord* grown = (EffectWord*)realloc(dst->words, (size_t)src->word_capacity * sizeof(EffectWord));
+        if (!grown) return 0;
+        dst->words = grown;
+        dst->word_capacity = src->word_capacity;
+    }
+    if (dst->timer_capacity < src->timer_count) {
+        EffectTimer* grown = (EffectTimer*)realloc(dst->timers, (size_t)src->timer_capacity * sizeof(EffectTimer));
+        if (!grown) return 0;
+        dst->timers = grown;
+        dst->timer_capacity = src->timer_capacity;
+    }
+    if (src->word_count > 0) memcpy(dst->words, src->words, (size_t)src->word_count * sizeof(EffectWord));
+    if (src->timer_count > 0) memcpy(dst->timers, src->timers, (size_t)src->timer_count * sizeof(EffectTimer));
+    dst->word_count = src->word_count;
+    dst->word_free = src->word_free;
+    dst->timer_count = src->timer_count;
+    dst->timer_free = src->timer_free;
+    return 1;
+}
+
+/* Drop every entry, keeping the buffers - for when the roster and archive are emptied */
+void effect_store_clear(EffectStore* store) {
+    store->word_count = 0;
+    store->word_free = 0;
+    store->timer_count = 0;
+    store->timer_free = 0;
+}
+
+/**
+ * Rebuild the free lists from what the roster and archive still point at.
+ * Undo brings back a pool that may hold chains of archive entries trimmed
+ * since, and a load may leave chains of skipped lines behind.
+ */
+void effect_store_reclaim(GameState* state) {
+    EffectStore* store = &state->effect_store;
+    size_t words = store->word_count > 0 ? (size_t)store->word_count : 1;
+    size_t timers = store->timer_count > 0 ? (size_t)store->timer_count : 1;
+    unsigned char* used = (unsigned char*)calloc(words + timers, 1);
+    if (!used) return;  /* Unreachable entries just stay allocated */
+
+    for (int i = 0; i < state->count + state->archive_count; i++) {
+        const Combatant* c = i < state->count ? &state->combatants[i] : &state->archive[i - state->count].combatant;
+        for (int w = c->word_first; w; w = store->words[w].next) used[w] = 1;
+        for (int t = c->timer_first; t; t = store->timers[t].next) used[words + (size_t)t] = 1;
+    }
+
+    store->word_free = 0;
+    for (int w = store->word_count - 1; w > 0; w--) {
+        if (used[w]) continue;
+        store->words[w].next = store->word_free;
+        store->word_free = w;
+    }
+    store->timer_free = 0;
+    for (int t = store->timer_count - 1; t > 0; t--) {
+        if (used[words + (size_t)t]) continue;
+        store->timers[t].next = store->timer_free;
+        store->timer_free = t;
+    }
+    free(used);
+}
+
+void effect_store_free(EffectStore* store) {
+    free(store->words);
+    free(store->timers);
+    memset(store, 0, sizeof(*store));
+}
+
+ /* --- Expiry Scheduler Functions --- */
+
+/**
+ * Heap order: earlier round first, then round-start before turn expiries.
+ */
+int expiry_event_before(const ExpiryEvent* a, const ExpiryEvent* b) {
+    if (a->round != b->round) return a->round < b->round;
+    return a->timing < b->timing;
+}
+
+int expiry_heap_push(ExpiryHeap* h, const ExpiryEvent* ev) {
+    if (h->count >= h->capacity) {
+        int new_capacity = h->capacity > 0 ? h->capacity * 2 : INITIAL_COMBATANT_CAPACITY;
+        ExpiryEvent* grown = (ExpiryEvent*)realloc(h->heap, (size_t)new_capacity * sizeof(ExpiryEvent));
+        if (!grown) return 0;
+        h->heap = grown;
+        h->capacity = new_capacity;
+    }
+
+    /* Sift up */
+    int i = h->count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!expiry_event_before(ev, &h->heap[parent])) break;
+        h->heap[i] = h->heap[parent];
+        i = parent;
+    }
+    h->heap[i] = *ev;
+    return 1;
+}
+
+void expiry_heap_pop(ExpiryHeap* h) {
+    if (h->count == 0) return;
+
+    ExpiryEvent last = h->heap[--h->count];
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count && expiry_event_before(&h->heap[child + 1], &h->heap[child])) child++;
+        if (!expiry_event_before(&h->heap[child], &last)) break;
+        h->heap[i] = h->heap[child];
+        i = child;
+    }
+    if (h->count > 0) h->heap[i] = last;
+}
+
+/**
+ * Find the turn queues of `anchor_id`, adding an empty pair if `create` is set.
+ *
+ * @return The anchor's queues, or NULL if it has none (or out of memory)
+ */
+ExpiryAnchor* scheduler_anchor(ExpiryScheduler* sched, int anchor_id, int create) {
+    if (anchor_id <= 0) return NULL;
+    if (create && (sched->anchor_count + 1) * 4 > sched->anchor_capacity * 3) {
+        /* Keep the load factor under 3/4 */
+        int new_capacity = sched->anchor_capacity > 0 ? sched->anchor_capacity * 2 : EXPIRY_ANCHOR_INITIAL_CAPACITY;
+        ExpiryAnchor* slots = (ExpiryAnchor*)calloc((size_t)new_capacity, sizeof(ExpiryAnchor));
+        if (!slots) return NULL;
+        unsigned int mask = (unsigned int)new_capacity - 1;
+        for (int i = 0; i < sched->anchor_capacity; i++) {
+            if (sched->anchors[i].anchor_id == 0) continue;
+            unsigned int j = ((unsigned int)sched->anchors[i].anchor_id * 2654435761u) & mask;
+            while (slots[j].anchor_id != 0) j = (j + 1) & mask;
+            slots[j] = sched->anchors[i];
+        }
+        free(sched->anchors);
+        sched->anchors = slots;
+        sched->anchor_capacity = new_capacity;
+    }
+    if (sched->anchor_capacity == 0) return NULL;
+
+    unsigned int mask = (unsigned int)sched->anchor_capacity - 1;
+    unsigned int i = ((unsigned int)anchor_id * 2654435761u) & mask;
+    while (sched->anchors[i].anchor_id != 0) {
+        if (sched->anchors[i].anchor_id == anchor_id) return &sched->anchors[i];
+        i = (i + 1) & mask;
+    }
+    if (!create) return NULL;
+    sched->anchors[i].anchor_id = anchor_id;
+    sched->anchor_count++;
+    return &sched->anchors[i];
+}
+
+/**
+ * Queue an expiry; turn expiries are queued under their anchor as well.
+ * A timer that never runs out is not queued.
+ *
+ * @return 1 on success, 0 on allocation failure
+ */
+int scheduler_push(GameState* state, const ExpiryEvent* ev) {
+    ExpiryScheduler* sched = &state->expiry;
+    if (ev->round == INT_MAX) return 1;
+    if (ev->timing != EXPIRE_ROUND_START) {
+        ExpiryAnchor* anchor = scheduler_anchor(sched, ev->anchor_id, 1);
+        if (!anchor || !expiry_heap_push(&anchor->turn[ev->timing - EXPIRE_TURN_START], ev)) return 0;
+    }
+    return expiry_heap_push(&sched->rounds, ev);
+}
+
+/**
+ * Remove the earliest expiry. A turn expiry left over from an earlier round
+ * (its turn never came) also drops everything that old from its anchor's
+ * queues - the `rounds` copies are what expire them.
+ */
+void scheduler_pop(GameState* state) {
+    ExpiryScheduler* sched = &state->expiry;
+    if (sched->rounds.count == 0) return;
+
+    ExpiryEvent ev = sched->rounds.heap[0];
+    expiry_heap_pop(&sched->rounds);
+    if (ev.timing == EXPIRE_ROUND_START || ev.round >= state->round) return;
+    ExpiryAnchor* anchor = scheduler_anchor(sched, ev.anchor_id, 0);
+    if (!anchor) return;
+    for (int t = 0; t < 2; t++) {
+        ExpiryHeap* q = &anchor->turn[t];
+        while (q->count > 0 && q->heap[0].round < state->round) expiry_heap_pop(q);
+    }
+}
+
+/**
+ * Re-queue every timed condition. Used after the combatant array is replaced
+ * wholesale (undo, load), which also drops any stale entries.
+ */
+void scheduler_rebuild(GameState* state) {
+    ExpiryScheduler* sched = &state->expiry;
+    sched->rounds.count = 0;
+    for (int i = 0; i < sched->anchor_capacity; i++) {
+        sched->anchors[i].turn[0].count = 0;
+        sched->anchors[i].turn[1].count = 0;
+    }
+    for (int i = 0; i < state->count; i++) {
+        Combatant* c = &state->combatants[i];
+        for (int j = c->timer_first; j; j = state->effect_store.timers[j].next) {
+            const EffectTimer* t = &state->effect_store.timers[j];
+            ExpiryEvent ev = { t->expires, t->timing, c->id, t->anchor_id, t->effect };
+            if (!scheduler_push(state, &ev)) return;
+        }
+    }
+}
+
+void scheduler_free(GameState* state) {
+    ExpiryScheduler* sched = &state->expiry;
+    free(sched->rounds.heap);
+    for (int i = 0; i < sched->anchor_capacity; i++) {
+        free(sched->anchors[i].turn[0].heap);
+        free(sched->anchors[i].turn[1].heap);
+    }
+    free(sched->anchors);
+    memset(sched, 0, sizeof(*sched));
+}
+
+/**
+ * Apply a dequeued expiry if it still describes the combatant's condition.
+ * Entries left behind by removed combatants or changed durations are ignored.
+ *
+ * @return 1 if a condition was removed
+ */
+int expire_condition(GameState* state, ExpiryEvent* ev) {
+    int cond = ev->effect;
+    ev->effect = -1;
+    if (cond < 0) return 0;
+
+    int idx = get_index_by_id(state, ev->target_id);
+    if (idx == -1) return 0;
+
+    Combatant* c = &state->combatants[idx];
+    const EffectTimer* t = find_effect_timer(state, c, cond);
+    if (!t || !effect_test(state, c, cond)) return 0;
+    if (t->expires != ev->round || t->timing != ev->timing || t->anchor_id != ev->anchor_id) return 0;
+
+    effect_assign(state, c, cond, 0);
+    clear_effect_timer(state, c, cond);
+    eligible_update(state, c);
+    log_event(state, c, HISTORY_CONDITION, 0, "%s: %s duration ended.", c->name, effect_name(state, cond));
+    return 1;
+}
+
+/**
+ * Expire conditions tied to the start or end of `anchor_id`'s turn. Only the
+ * anchor's own queue is popped, so the cost is O(expiring log k) for its k
+ * pending expiries. The `rounds` copies become stale and are dropped when
+ * they reach its root.
+ */
+void process_turn_expiries(GameState* state, int anchor_id, ExpiryTiming timing) {
+    ExpiryAnchor* anchor = scheduler_anchor(&state->expiry, anchor_id, 0);
+    if (!anchor || timing == EXPIRE_ROUND_START) return;
+    ExpiryHeap* q = &anchor->turn[timing - EXPIRE_TURN_START];
+    while (q->count > 0 && q->heap[0].round <= state->round) {
+        ExpiryEvent ev = q->heap[0];
+        expiry_heap_pop(q);
+        expire_condition(state, &ev);
+    }
+}
+
+/**
+ * Rounds until a timed condition expires (0 = later this round).
+ */
+int condition_rounds_left(GameState* state, const Combatant* c, int cond) {
+    const EffectTimer* t = find_effect_timer(state, c, cond);
+    if (!t) return 0;
+    int left = t->expires - state->round;
+    return left > 0 ? left : 0;
+}
+
+/**
+ * Short timer label for list views: "3" for round expiries, "1s"/"0e" for
+ * start/end-of-turn expiries.
+ *
+ * @return 1 if the condition is timed and `buf` was filled, 0 if permanent
+ */
+int format_condition_timer(GameState* state, const Combatant* c, int cond, char* buf, size_t size) {
+    const EffectTimer* t = find_effect_timer(state, c, cond);
+    if (!t) return 0;
+
+    int left = condition_rounds_left(state, c, cond);
+    switch (t->timing) {
+        case EXPIRE_TURN_START: snprintf(buf, size, "%ds", left); break;
+        case EXPIRE_TURN_END:   snprintf(buf, size, "%de", left); break;
+        default:                snprintf(buf, size, "%d", left); break;
+    }
+    return 1;
+}
+
+void save_state(GameState* state) {
+    TRACE_SCOPE("save_state");
+    char path[256];
+    if (!build_home_path(path, sizeof(path), state->save_file_name)) {
+        show_message(state, "Error: Path too long for save file!", 1);
+        return;
+    }
+
+    /* The journal beside the save lets the session be replayed roll for roll */
+    if (save_state_to_path(state, path) && build_home_path(path, sizeof(path), state->journal_file_name)) {
+        journal_write(state, path);
+    }
+}
+
+/**
+ * Write the full game state to `path` in the pipe-delimited save format,
+ * or as JSON if `path` ends in ".json".
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int save_state_to_path(GameState* state, const char* path) {
+    TRACE_SCOPE("save_state_to_path");
+    state->stats.io_rebase = 1;
+    uint64_t start_ns = trace_now_ns();
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        char err_msg[256];
+        char path_display[200];
+        size_t path_len = strlen(path);
+        if (path_len >= sizeof(path_display)) {
+            /* Show last part of path if too long */
+            snprintf(path_display, sizeof(path_display), "...%s", path + (path_len - (sizeof(path_display) - 4)));
+        } else {
+            strncpy(path_display, path, sizeof(path_display) - 1);
+            path_display[sizeof(path_display) - 1] = '\0';
+        }
+        snprintf(err_msg, sizeof(err_msg), "Save failed! Cannot open file: %s", path_display);
+        show_message(state, err_msg, 1);
+        return 0;
+    }
+
+    if (!(save_path_is_json(path) ? write_save_json(state, f) : write_save_records(state, f))) {
+        fclose(f);
+        show_message(state, "Save failed! Write error occurred.", 1);
+        return 0;
+    }
+
+    long bytes = ftell(f);
+    if (fclose(f) != 0) {
+        show_message(state, "Save failed! Error closing file.", 1);
+        return 0;
+    }
+    uint64_t elapsed_ns = trace_now_ns() - start_ns;
+    state->stats.saves++;
+    state->stats.save_bytes += bytes;
+    state->stats.save_ns += elapsed_ns;
+    PROBE3(save_state, (uintptr_t)path, bytes, elapsed_ns);
+    show_message(state, "Game Saved.", 0);
+    return 1;
+}
+
+/**
+ * Write the header line, the roster, the archive and the numbering marks.
+ * Touches nothing but `f`, so the autosave thread can run it on a snapshot.
+ *
+ * @return 1 on success, 0 on a write error
+ */
+int write_save_records(GameState* state, FILE* f) {
+    if (fprintf(f, "%d|%d|%d|%d|%d|%d\n",
+            state->round, state->next_id, state->count, state->current_turn_id, state->selected_id,
+            state->skip_policy) < 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < state->count; i++) {
+        if (!write_combatant_record(state, f, &state->combatants[i], state->mob_units, NULL)) return 0;
+    }
+
+    /* Archived combatants follow the roster, tagged archived=<round>:<d|r> */
+    for (int i = 0; i < state->archive_count; i++) {
+        const ArchiveEntry* entry = &state->archive[i];
+        if (entry->restored_epoch) continue;
+        if (!write_combatant_record(state, f, &entry->combatant, state->archive_units, entry)) return 0;
+    }
+
+    /* Numbering high-water marks, base name last: suffix|<highest>|<base> */
+    for (int i = 0; i < state->name_index.capacity; i++) {
+        const NameIndexEntry* entry = &state->name_index.slots[i];
+        if (!entry->used || entry->highest <= 0) continue;
+        if (fprintf(f, "suffix|%d|%s\n", entry->highest, entry->base) < 0) return 0;
+    }
+    return 1;
+}
+
+/**
+ * Write one combatant as a save file line.
+ *
+ * @param units Unit pool that c->mob_first indexes (roster or archive)
+ * @param archived Archive entry to tag the line with, or NULL for the roster
+ * @return 1 on success, 0 on a write error
+ */
+int write_combatant_record(GameState* state, FILE* f, const Combatant* c, const MobUnit* units, const ArchiveEntry* archived) {
+    /* The conditions column keeps the built-in bits; custom effects go in effects= */
+    int builtin_bits = (int)(c->effects & (((uint64_t)1 << NUM_CONDITIONS) - 1));
+    int ret = fprintf(f, "%d|%s|%d|%d|%d|%d|%d|%d|%d|%d|%d|%d",
+        c->id, c->name, c->type, c->initiative, c->dex, c->max_hp, c->hp, builtin_bits,
+        c->death_save_successes, c->death_save_failures, c->is_stable, c->is_dead);
+
+    /* Durations are saved as rounds remaining so older saves stay compatible */
+    for (int j = 0; j < NUM_CONDITIONS && ret >= 0; j++) {
+        ret = fprintf(f, "|%d", condition_rounds_left(state, c, j));
+    }
+
+    /* Mob units: mob=<size>:<unit max>:<hp,hp,...>:<unit=conditions,...> */
+    if (c->mob_size > 0 && ret >= 0) {
+        const MobUnit* mob = &units[c->mob_first];
+        ret = fprintf(f, "|mob=%d:%d:", c->mob_size, c->mob_unit_max_hp);
+        for (int u = 0; u < c->mob_size && ret >= 0; u++) {
+            ret = fprintf(f, u == 0 ? "%d" : ",%d", mob[u].hp);
+        }
+        if (ret >= 0) ret = fprintf(f, ":");
+        int first_cond = 1;
+        for (int u = 0; u < c->mob_size && ret >= 0; u++) {
+            if (mob[u].conditions == 0) continue;
+            ret = fprintf(f, first_cond ? "%d=%d" : ",%d=%d", u, mob[u].conditions);
+            first_cond = 0;
+        }
+    }
+
+    /* Turn-anchored built-in timers: timers=<cond>:<s|e>:<anchor id>,... */
+    int first_timer = 1;
+    for (int j = c->timer_first; j && ret >= 0; j = state->effect_store.timers[j].next) {
+        const EffectTimer* t = &state->effect_store.timers[j];
+        if (t->effect >= NUM_CONDITIONS || t->timing == EXPIRE_ROUND_START) continue;
+        ret = fprintf(f, "%s%d:%c:%d", first_timer ? "|timers=" : ",", t->effect,
+            t->timing == EXPIRE_TURN_START ? 's' : 'e', t->anchor_id);
+        first_timer = 0;
+    }
+
+    /* Custom effects by name, since registry indexes depend on the config:
+     * effects=<name>:<rounds left>[:<s|e>:<anchor id>],... */
+    int first_effect = 1;
+    for (int e = effect_next(state, c, NUM_CONDITIONS); e != -1 && ret >= 0; e = effect_next(state, c, e + 1)) {
+        ret = fprintf(f, "%s%s:%d", first_effect ? "|effects=" : ",", effect_name(state, e),
+            condition_rounds_left(state, c, e));
+        const EffectTimer* t = find_effect_timer(state, c, e);
+        if (ret >= 0 && t && t->timing != EXPIRE_ROUND_START) {
+            ret = fprintf(f, ":%c:%d", t->timing == EXPIRE_TURN_START ? 's' : 'e', t->anchor_id);
+        }
+        first_effect = 0;
+    }
+
+    if (archived && ret >= 0) {
+        ret = fprintf(f, "|archived=%d:%c", archived->round, archived->reason == ARCHIVE_DEAD ? 'd' : 'r');
+    }
+    if (ret >= 0) ret = fprintf(f, "\n");
+    return ret >= 0;
+}
+
+void load_state(GameState* state) {
+    TRACE_SCOPE("load_state");
+    if (state->count > 0 && !get_input_confirm("Loading will wipe current state. Are you sure? (y/n): ")) {
+        return;
+    }
+
+    Command cmd = make_command(CMD_LOAD, -1);
+    if (!build_home_path(cmd.file.path, sizeof(cmd.file.path), state->save_file_name)) {
+        show_message(state, "Error: Path too long for save file!", 1);
+        return;
+    }
+
+    apply_command(state, &cmd);
+}
+
+/**
+ * Replace the current game state with the contents of `path`.
+ * The undo stack and log are reset on success.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int load_state_from_path(GameState* state, const char* path) {
+    TRACE_SCOPE("load_state_from_path");
+    uint64_t start_ns = trace_now_ns();
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        char err_msg[256];
+        char path_display[200];
+        size_t path_len = strlen(path);
+        if (path_len >= sizeof(path_display)) {
+            /* Show last part of path if too long */
+            snprintf(path_display, sizeof(path_display), "...%s", path + (path_len - (sizeof(path_display) - 4)));
+        } else {
+            strncpy(path_display, path, sizeof(path_display) - 1);
+            path_display[sizeof(path_display) - 1] = '\0';
+        }
+        snprintf(err_msg, sizeof(err_msg), "Load failed! Cannot open file: %s", path_display);
+        show_message(state, err_msg, 1);
+        return 0;
+    }
+
+    /* JSON saves are recognised by content, so a renamed one still loads */
+    int lead = fgetc(f);
+    while (lead == ' ' || lead == '\t' || lead == '\n' || lead == '\r') lead = fgetc(f);
+    if (lead == '{') return load_state_json(state, path, f, start_ns);
+    rewind(f);
+
+    /* getline: mob unit lists can make lines arbitrarily long */
+    char* line = NULL;
+    size_t line_cap = 0;
+    int round, next_id, count, current_turn_id, selected_id;
+    int skip_policy = state->skip_policy;  /* Older saves keep the current policy */
+    if (getline(&line, &line_cap, f) != -1) {
+        int parsed = sscanf(line, "%d|%d|%d|%d|%d|%d",
+            &round, &next_id, &count, &current_turn_id, &selected_id, &skip_policy);
+        if (parsed < 5) {
+            free(line);
+            fclose(f);
+            show_message(state, "Load failed! Invalid save file format.", 1);
+            return 0;
+        }
+        if (count < 0 || count > MAX_COMBATANTS || !ensure_combatant_capacity(state, count)) {
+            free(line);
+            fclose(f);
+            show_message(state, "Load failed! Invalid combatant count in save file.", 1);
+            return 0;
+        }
+    } else {
+        free(line);
+        fclose(f);
+        show_message(state, "Load failed! Empty or corrupted save file.", 1);
+        return 0;
+    }
+
+    /* Clear state before loading to prevent partial data */
+    load_state_reset(state);
+    state->round = (round < 1) ? 1 : round;
+    state->next_id = next_id;
+    state->current_turn_id = current_turn_id;
+    state->selected_id = selected_id;
+    state->skip_policy = skip_policy & (SKIP_DEAD | SKIP_STABLE | SKIP_INCAPACITATED);
+
+    int idx = 0;
+    while (getline(&line, &line_cap, f) != -1 && idx < MAX_COMBATANTS) {
+        if (strncmp(line, "suffix|", 7) == 0) {
+            char* base = strchr(line + 7, '|');
+            int highest;
+            if (base && parse_int_safe(strtok(line + 7, "|"), &highest)) {
+                base[strcspn(base + 1, "\r\n") + 1] = '\0';
+                name_index_raise(state, base + 1, highest);
+            }
+            continue;
+        }
+        if (!ensure_combatant_capacity(state, idx + 1)) break;
+        Combatant* c = &state->combatants[idx];
+        memset(c, 0, sizeof(*c));
+
+        /* Parse required fields - skip entire entry if any fail */
+        char* token = strtok(line, "|");
+        if (!token || !parse_int_safe(token, &c->id)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid ID).", 1);
+            continue;
+        }
+
+        token = strtok(NULL, "|");
+        if (!token) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (missing name).", 1);
+            continue;
+        }
+        strncpy(c->name, token, NAME_LENGTH);
+        c->name[NAME_LENGTH-1] = '\0';
+
+        token = strtok(NULL, "|");
+        int type_val;
+        if (!token || !parse_int_safe(token, &type_val)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid type).", 1);
+            continue;
+        }
+        c->type = (CombatantType)type_val;
+
+        token = strtok(NULL, "|");
+        if (!token || !parse_int_safe(token, &c->initiative)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid initiative).", 1);
+            continue;
+        }
+
+        token = strtok(NULL, "|");
+        if (!token || !parse_int_safe(token, &c->dex)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid dex).", 1);
+            continue;
+        }
+
+        token = strtok(NULL, "|");
+        if (!token || !parse_int_safe(token, &c->max_hp)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid max_hp).", 1);
+            continue;
+        }
+
+        token = strtok(NULL, "|");
+        if (!token || !parse_int_safe(token, &c->hp)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid hp).", 1);
+            continue;
+        }
+
+        token = strtok(NULL, "|");
+        int conditions_val;
+        if (!token || !parse_int_safe(token, &conditions_val)) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid conditions).", 1);
+            continue;
+        }
+        c->effects = (uint64_t)(unsigned int)conditions_val & (((uint64_t)1 << NUM_CONDITIONS) - 1);
+
+        /* Backward compatibility: death save fields may be missing in old saves */
+        token = strtok(NULL, "|");
+        if (token) {
+            if (!parse_int_safe(token, &c->death_save_successes)) {
+                c->death_save_successes = 0;  /* Default on parse failure */
+            }
+        } else {
+            c->death_save_successes = 0;
+        }
+
+        token = strtok(NULL, "|");
+        if (token) {
+            if (!parse_int_safe(token, &c->death_save_failures)) {
+                c->death_save_failures = 0;  /* Default on parse failure */
+            }
+        } else {
+            c->death_save_failures = 0;
+        }
+
+        token = strtok(NULL, "|");
+        if (token) {
+            if (!parse_int_safe(token, &c->is_stable)) {
+                c->is_stable = 0;  /* Default on parse failure */
+            }
+        } else {
+            c->is_stable = 0;
+        }
+
+        token = strtok(NULL, "|");
+        if (token) {
+            if (!parse_int_safe(token, &c->is_dead)) {
+                c->is_dead = 0;  /* Default on parse failure */
+            }
+        } else {
+            c->is_dead = 0;
+        }
+
+        /* Durations are stored as rounds remaining */
+        int remaining[NUM_CONDITIONS] = {0};
+        for(int j=0; j<NUM_CONDITIONS; j++) {
+            token = strtok(NULL, "|");
+            if (!token) break;
+            if (!parse_int_safe(token, &remaining[j]) || remaining[j] < 0) {
+                remaining[j] = 0;  /* Default on parse failure */
+            }
+        }
+
+        /* Optional trailing fields */
+        int timing[NUM_CONDITIONS] = {0};
+        int anchor[NUM_CONDITIONS];
+        for (int j = 0; j < NUM_CONDITIONS; j++) anchor[j] = -1;
+        int malformed_mob = 0;
+        int archived_round = 0;
+        char archived_kind = 0;
+        while ((token = strtok(NULL, "|\r\n")) != NULL) {
+            if (strncmp(token, "mob=", 4) == 0) {
+                if (!parse_mob_field(state, c, token + 4)) {
+                    malformed_mob = 1;
+                    break;
+                }
+            } else if (strncmp(token, "timers=", 7) == 0) {
+                parse_timers_field(token + 7, timing, anchor);
+            } else if (strncmp(token, "effects=", 8) == 0) {
+                if (!parse_effects_field(state, c, token + 8)) {
+                    show_message(state, "Load warning: Some custom effects could not be restored.", 1);
+                }
+            } else if (strncmp(token, "archived=", 9) == 0) {
+                if (sscanf(token + 9, "%d:%c", &archived_round, &archived_kind) != 2) archived_kind = 'r';
+            }
+        }
+        if (malformed_mob) {
+            show_message(state, "Load warning: Skipping malformed combatant entry (invalid mob units).", 1);
+            continue;
+        }
+
+        for (int j = 0; j < NUM_CONDITIONS; j++) {
+            /* A turn timer may legitimately have 0 rounds left (ends later this round) */
+            if (!effect_test(state, c, j) || (remaining[j] == 0 && timing[j] == EXPIRE_ROUND_START)) continue;
+            int expires = (remaining[j] > INT_MAX - state->round) ? INT_MAX : state->round + remaining[j];
+            if (!add_effect_timer(state, c, j, expires, (ExpiryTiming)timing[j], anchor[j])) {
+                show_message(state, "Load warning: Out of memory, some durations were dropped.", 1);
+            }
+        }
+
+        if (archived_kind) {
+            if (archive_push(state, c, archived_kind == 'd' ? ARCHIVE_DEAD : ARCHIVE_REMOVED)) {
+                state->archive[state->archive_count - 1].round = archived_round;
+            } else {
+                show_message(state, "Load warning: Archive out of memory, archived entry dropped.", 1);
+            }
+            state->mob_unit_count -= c->mob_size; /* Units were appended last - just drop them */
+            continue;
+        }
+
+        idx++;
+    }
+    state->count = idx;
+    free(line);
+
+    long bytes = ftell(f);
+    if (fclose(f) != 0) {
+        show_message(state, "Load warning: Error closing file.", 1);
+    }
+    load_state_finish(state, path, bytes, start_ns);
+    return 1;
+}
+
+/* Empty the roster, archive, log and undo stack ahead of a load */
+void load_state_reset(GameState* state) {
+    state->log_count = 0;
+    state->undo_count = 0;
+    state->count = 0;
+    state->mob_unit_count = 0;
+    state->archive_count = 0;
+    state->archive_unit_count = 0;
+    state->archive_epoch = 0;
+    effect_store_clear(&state->effect_store);
+    name_index_clear(state);
+}
+
+/* Rebuild everything derived from the loaded roster and account for the load */
+void load_state_finish(GameState* state, const char* path, long bytes, uint64_t start_ns) {
+    /* Recalculate next_id to prevent collisions from corrupt/manually edited save files */
+    int max_id = 0;
+    for (int i = 0; i < state->count; i++) {
+        if (state->combatants[i].id > max_id) {
+            max_id = state->combatants[i].id;
+        }
+    }
+    for (int i = 0; i < state->archive_count; i++) {
+        if (state->archive[i].combatant.id > max_id) {
+            max_id = state->archive[i].combatant.id;
+        }
+    }
+    state->next_id = max_id + 1;
+    if (state->next_id <= 0 || state->next_id == INT_MAX) {
+        state->next_id = 1;  /* Fallback to 1 if overflow or invalid */
+    }
+
+    sort_combatants(state);
+    name_index_rebuild(state);
+    effect_store_reclaim(state);
+    scheduler_rebuild(state);
+    state->message_queue_count = 0;
+
+    log_action(state, "Game Loaded from save file. Round set to %d.", state->round);
+    uint64_t elapsed_ns = trace_now_ns() - start_ns;
+    state->stats.loads++;
+    state->stats.load_bytes += bytes;
+    state->stats.load_ns += elapsed_ns;
+    PROBE3(load_state, (uintptr_t)path, bytes, elapsed_ns);
+    show_message(state, "Game Loaded.", 0);
+}
+
+/**
+ * Take the roster, archive, log and effect registry of a fully read save.
+ * The current ones move into `scratch` for the caller to free, and any
+ * warnings the readers queued there are shown here.
+ */
+void load_state_adopt(GameState* state, GameState* scratch) {
+    load_state_reset(state);
+
+    Combatant* combatants = state->combatants;
+    int capacity = state->capacity;
+    state->combatants = scratch->combatants;
+    state->capacity = scratch->capacity;
+    state->count = scratch->count;
+    scratch->combatants = combatants;
+    scratch->capacity = capacity;
+
+    MobUnit* units = state->mob_units;
+    int unit_capacity = state->mob_unit_capacity;
+    state->mob_units = scratch->mob_units;
+    state->mob_unit_capacity = scratch->mob_unit_capacity;
+    state->mob_unit_count = scratch->mob_unit_count;
+    scratch->mob_units = units;
+    scratch->mob_unit_capacity = unit_capacity;
+
+    ArchiveEntry* archive = state->archive;
+    int archive_capacity = state->archive_capacity;
+    state->archive = scratch->archive;
+    state->archive_capacity = scratch->archive_capacity;
+    state->archive_count = scratch->archive_count;
+    scratch->archive = archive;
+    scratch->archive_capacity = archive_capacity;
+
+    units = state->archive_units;
+    unit_capacity = state->archive_unit_capacity;
+    state->archive_units = scratch->archive_units;
+    state->archive_unit_capacity = scratch->archive_unit_capacity;
+    state->archive_unit_count = scratch->archive_unit_count;
+    scratch->archive_units = units;
+    scratch->archive_unit_capacity = unit_capacity;
+
+    CombatLogEntry* log = state->combat_log;
+    int log_capacity = state->log_capacity;
+    state->combat_log = scratch->combat_log;
+    state->log_capacity = scratch->log_capacity;
+    state->log_count = scratch->log_count;
+    scratch->combat_log = log;
+    scratch->log_capacity = log_capacity;
+
+    EffectRegistry registry = state->registry;
+    state->registry = scratch->registry;
+    scratch->registry = registry;
+
+    EffectStore store = state->effect_store;
+    state->effect_store = scratch->effect_store;
+    scratch->effect_store = store;
+
+    NameIndex names = state->name_index;
+    state->name_index = scratch->name_index;
+    scratch->name_index = names;
+
+    state->next_id = scratch->next_id;
+    state->current_turn_id = scratch->current_turn_id;
+    state->selected_id = scratch->selected_id;
+    state->stats.log_reallocs += scratch->stats.log_reallocs;
+    for (int i = 0; i < scratch->message_queue_count; i++) {
+        show_message(state, scratch->message_queue[i].text, scratch->message_queue[i].is_error);
+    }
+}
+
+/**
+ * Parse a saved mob field ("<size>:<unit max>:<hp,...>:<unit=conditions,...>")
+ * and allocate the units for `c`.
+ *
+ * @return 1 on success, 0 if the field is malformed
+ */
+int parse_mob_field(GameState* state, Combatant* c, const char* spec) {
+    char* end;
+    long size = strtol(spec, &end, 10);
+    if (*end != ':' || size < 1 || size > MAX_MOB_UNITS) return 0;
+    long unit_max = strtol(end + 1, &end, 10);
+    if (*end != ':' || unit_max < 1 || unit_max > MAX_MOB_UNIT_HP) return 0;
+
+    int first = mob_alloc_units(state, (int)size, (int)unit_max);
+    if (first == -1) return 0;
+    MobUnit* units = &state->mob_units[first];
+
+    const char* p = end + 1;
+    for (int u = 0; u < size; u++) {
+        long hp = strtol(p, &end, 10);
+        if (end == p || hp < 0 || hp > unit_max) {
+            state->mob_unit_count = first;
+            return 0;
+        }
+        units[u].hp = (uint16_t)hp;
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    /* Optional sparse per-unit conditions */
+    if (*p == ':') {
+        p++;
+        while (*p && isdigit((unsigned char)*p)) {
+            long u = strtol(p, &end, 10);
+            if (*end != '=' || u < 0 || u >= size) break;
+            long bits = strtol(end + 1, &end, 10);
+            units[u].conditions = (uint16_t)bits;
+            p = (*end == ',') ? end + 1 : end;
+        }
+    }
+
+    c->type = TYPE_ENEMY;
+    c->mob_size = (int)size;
+    c->mob_first = first;
+    c->mob_unit_max_hp = (int)unit_max;
+    c->max_hp = (int)size * (int)unit_max;
+    mob_sync_hp(state, c);
+    return 1;
+}
+
+/**
+ * Parse a saved turn-timer field ("<cond>:<s|e>:<anchor id>,...") into
+ * per-condition timing/anchor arrays. Malformed entries are skipped.
+ */
+void parse_timers_field(const char* spec, int timing[NUM_CONDITIONS], int anchor[NUM_CONDITIONS]) {
+    const char* p = spec;
+    char* end;
+    while (*p) {
+        long cond = strtol(p, &end, 10);
+        if (end == p || *end != ':' || cond < 0 || cond >= NUM_CONDITIONS) break;
+        char kind = end[1];
+        if ((kind != 's' && kind != 'e') || end[2] != ':') break;
+        p = end + 3;
+        long anchor_id = strtol(p, &end, 10);
+        if (end == p) break;
+
+        timing[cond] = (kind == 's') ? EXPIRE_TURN_START : EXPIRE_TURN_END;
+        anchor[cond] = (int)anchor_id;
+        if (*end != ',') break;
+        p = end + 1;
+    }
+}
+
+/**
+ * Parse a saved custom effect field ("<name>:<rounds left>[:<s|e>:<anchor id>],...").
+ * Effects missing from the current config are registered on the fly.
+ *
+ * @return 1 if every entry was restored, 0 otherwise
+ */
+int parse_effects_field(GameState* state, Combatant* c, const char* spec) {
+    const char* p = spec;
+    char* end;
+    while (*p) {
+        const char* colon = strchr(p, ':');
+        if (!colon || colon == p || colon - p >= EFFECT_NAME_LENGTH) return 0;
+        char name[EFFECT_NAME_LENGTH];
+        memcpy(name, p, (size_t)(colon - p));
+        name[colon - p] = '\0';
+
+        long left = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || left < 0) return 0;
+
+        ExpiryTiming timing = EXPIRE_ROUND_START;
+        long anchor_id = -1;
+        if (*end == ':' && (end[1] == 's' || end[1] == 'e') && end[2] == ':') {
+            timing = (end[1] == 's') ? EXPIRE_TURN_START : EXPIRE_TURN_END;
+            const char* anchor_str = end + 3;
+            anchor_id = strtol(anchor_str, &end, 10);
+            if (end == anchor_str) return 0;
+        }
+
+        int effect = register_effect(state, name);
+        if (effect == -1) return 0;
+        if (!effect_assign(state, c, effect, 1)) return 0;
+        if (left > 0 || timing != EXPIRE_ROUND_START) {
+            int expires = (left > INT_MAX - state->round) ? INT_MAX : state->round + (int)left;
+            if (!add_effect_timer(state, c, effect, expires, timing, (int)anchor_id)) return 0;
+        }
+
+        if (*end != ',') break;
+        p = end + 1;
+    }
+    return 1;
+}
+
+ /* --- JSON Save Functions --- */
+
+/*
+ * JSON saves hold the same state as the text format plus the combat log,
+ * with every field named and names escaped, so any character round-trips:
+ *
+ *   {
+ *   "format":"initiative-save",
+ *   "version":1,
+ *   "round":3, "next_id":9, "current_turn_id":2, "selected_id":2, "skip_policy":0,
+ *   "combatants":[
+ *   {"id":1,"name":"Thorin","type":"player","initiative":17,"dex":1,"max_hp":44,"hp":30,
+ *    "death_saves":{"successes":0,"failures":0},"stable":false,"dead":false,
+ *    "effects":[{"name":"Blessed","rounds":2,"timing":"turn_end","anchor_id":4}],
+ *    "mob":{"unit_max_hp":7,"hp":[7,0,3],"unit_conditions":{"2":["Prone"]}}}
+ *   ],
+ *   "archive":[ ...combatants with "archived":{"round":2,"reason":"dead"} ],
+ *   "log":[{"round":1,"turn_id":1,"time":1700000000,"message":"..."}]
+ *   }
+ *
+ * "rounds" is rounds remaining, as in the text format. Keys may come in any
+ * order and unknown keys are skipped.
+ */
+
+int save_path_is_json(const char* path) {
+    size_t len = strlen(path);
+    return len >= 5 && strcasecmp(path + len - 5, ".json") == 0;
+}
+
+void json_writer_init(JsonWriter* w, FILE* f, int pretty_depth) {
+    w->f = f;
+    w->len = 0;
+    w->error = 0;
+    w->depth = 0;
+    w->pretty_depth = pretty_depth;
+    w->after_key = 0;
+    w->first[0] = 1;
+}
+
+void json_flush(JsonWriter* w) {
+    if (w->len > 0 && fwrite(w->buf, 1, w->len, w->f) != w->len) w->error = 1;
+    w->len = 0;
+}
+
+void json_put(JsonWriter* w, const char* s, size_t n) {
+    if (w->len + n > sizeof(w->buf)) {
+        json_flush(w);
+        if (n > sizeof(w->buf)) {
+            if (fwrite(s, 1, n, w->f) != n) w->error = 1;
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+/* The comma (and line break) owed before the next value at this depth */
+void json_value_prefix(JsonWriter* w) {
+    if (w->after_key) {
+        w->after_key = 0;
+        return;
+    }
+    if (!w->first[w->depth]) json_put(w, ",", 1);
+    w->first[w->depth] = 0;
+    if (w->depth > 0 && w->depth <= w->pretty_depth) json_put(w, "\n", 1);
+}
+
+void json_begin(JsonWriter* w, char open) {
+    json_value_prefix(w);
+    json_put(w, &open, 1);
+    if (w->depth < JSON_MAX_DEPTH - 1) w->depth++;
+    w->first[w->depth] = 1;
+}
+
+void json_end(JsonWriter* w, char close) {
+    if (w->depth <= w->pretty_depth && !w->first[w->depth]) json_put(w, "\n", 1);
+    if (w->depth > 0) w->depth--;
+    json_put(w, &close, 1);
+}
+
+void json_key(JsonWriter* w, const char* key) {
+    json_value_prefix(w);
+    w->after_key = 1;  /* The key itself takes no prefix */
+    json_string(w, key);
+    json_put(w, ":", 1);
+    w->after_key = 1;
+}
+
+void json_int(JsonWriter* w, long long value) {
+    char digits[24];
+    int n = sizeof(digits);
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[--n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+    if (value < 0) digits[--n] = '-';
+    json_value_prefix(w);
+    json_put(w, digits + n, sizeof(digits) - (size_t)n);
+}
+
+void json_bool(JsonWriter* w, int value) {
+    json_value_prefix(w);
+    json_put(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+/* Quotes, backslashes and control characters are escaped; UTF-8 passes through */
+void json_string(JsonWriter* w, const char* s) {
+    json_value_prefix(w);
+    json_put(w, "\"", 1);
+    const char* run = s;
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') continue;
+        json_put(w, run, (size_t)(s - run));
+        char esc[8];
+        switch (ch) {
+            case '"':  json_put(w, "\\\"", 2); break;
+            case '\\': json_put(w, "\\\\", 2); break;
+            case '\n': json_put(w, "\\n", 2); break;
+            case '\t': json_put(w, "\\t", 2); break;
+            case '\r': json_put(w, "\\r", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", ch);
+                json_put(w, esc, 6);
+                break;
+        }
+        run = s + 1;
+    }
+    json_put(w, run, (size_t)(s - run));
+    json_put(w, "\"", 1);
+}
+
+/**
+ * Write the full state as JSON. Like write_save_records, touches nothing
+ * but `f`, so it is safe on an autosave snapshot.
+ *
+ * @return 1 on success, 0 on a write error
+ */
+int write_save_json(GameState* state, FILE* f) {
+    JsonWriter* w = (JsonWriter*)malloc(sizeof(JsonWriter));  /* Too big for the autosave thread's stack */
+    if (!w) return 0;
+    json_writer_init(w, f, 2);
+    json_begin(w, '{');
+    json_key(w, "format");
+    json_string(w, SAVE_JSON_FORMAT);
+    json_key(w, "version");
+    json_int(w, SAVE_JSON_VERSION);
+    json_key(w, "round");
+    json_int(w, state->round);
+    json_key(w, "next_id");
+    json_int(w, state->next_id);
+    json_key(w, "current_turn_id");
+    json_int(w, state->current_turn_id);
+    json_key(w, "selected_id");
+    json_int(w, state->selected_id);
+    json_key(w, "skip_policy");
+    json_int(w, state->skip_policy);
+
+    json_key(w, "combatants");
+    json_begin(w, '[');
+    for (int i = 0; i < state->count; i++) {
+        write_combatant_json(state, w, &state->combatants[i], state->mob_units, NULL);
+    }
+    json_end(w, ']');
+
+    json_key(w, "archive");
+    json_begin(w, '[');
+    for (int i = 0; i < state->archive_count; i++) {
+        const ArchiveEntry* entry = &state->archive[i];
+        if (entry->restored_epoch) continue;
+        write_combatant_json(state, w, &entry->combatant, state->archive_units, entry);
+    }
+    json_end(w, ']');
+
+    json_key(w, "name_suffixes");
+    json_begin(w, '[');
+    for (int i = 0; i < state->name_index.capacity; i++) {
+        const NameIndexEntry* entry = &state->name_index.slots[i];
+        if (!entry->used || entry->highest <= 0) continue;
+        json_begin(w, '{');
+        json_key(w, "base");
+        json_string(w, entry->base);
+        json_key(w, "highest");
+        json_int(w, entry->highest);
+        json_end(w, '}');
+    }
+    json_end(w, ']');
+
+    json_key(w, "log");
+    json_begin(w, '[');
+    for (int i = 0; i < state->log_count; i++) {
+        const CombatLogEntry* entry = &state->combat_log[i];
+        json_begin(w, '{');
+        json_key(w, "round");
+        json_int(w, entry->round);
+        json_key(w, "turn_id");
+        json_int(w, entry->turn_id);
+        json_key(w, "time");
+        json_int(w, (long long)entry->timestamp);
+        json_key(w, "message");
+        json_string(w, entry->message);
+        json_end(w, '}');
+    }
+    json_end(w, ']');
+    json_end(w, '}');
+    json_put(w, "\n", 1);
+    json_flush(w);
+    int ok = !w->error;
+    free(w);
+    return ok;
+}
+
+/**
+ * Write one combatant object.
+ *
+ * @param units Unit pool that c->mob_first indexes (roster or archive)
+ * @param archived Archive entry to tag it with, or NULL for the roster
+ */
+void write_combatant_json(GameState* state, JsonWriter* w, const Combatant* c, const MobUnit* units,
+    const ArchiveEntry* archived) {
+    json_begin(w, '{');
+    json_key(w, "id");
+    json_int(w, c->id);
+    json_key(w, "name");
+    json_string(w, c->name);
+    json_key(w, "type");
+    json_string(w, c->type == TYPE_PLAYER ? "player" : "enemy");
+    json_key(w, "initiative");
+    json_int(w, c->initiative);
+    json_key(w, "dex");
+    json_int(w, c->dex);
+    json_key(w, "max_hp");
+    json_int(w, c->max_hp);
+    json_key(w, "hp");
+    json_int(w, c->hp);
+    json_key(w, "death_saves");
+    json_begin(w, '{');
+    json_key(w, "successes");
+    json_int(w, c->death_save_successes);
+    json_key(w, "failures");
+    json_int(w, c->death_save_failures);
+    json_end(w, '}');
+    json_key(w, "stable");
+    json_bool(w, c->is_stable);
+    json_key(w, "dead");
+    json_bool(w, c->is_dead);
+
+    /* Built-in conditions and custom effects alike, by name */
+    json_key(w, "effects");
+    json_begin(w, '[');
+    for (int e = effect_next(state, c, 0); e != -1; e = effect_next(state, c, e + 1)) {
+        json_begin(w, '{');
+        json_key(w, "name");
+        json_string(w, effect_name(state, e));
+        const EffectTimer* t = find_effect_timer(state, c, e);
+        if (t) {
+            json_key(w, "rounds");
+            json_int(w, condition_rounds_left(state, c, e));
+            if (t->timing != EXPIRE_ROUND_START) {
+                json_key(w, "timing");
+                json_string(w, t->timing == EXPIRE_TURN_START ? "turn_start" : "turn_end");
+                json_key(w, "anchor_id");
+                json_int(w, t->anchor_id);
+            }
+        }
+        json_end(w, '}');
+    }
+    json_end(w, ']');
+
+    if (c->mob_size > 0) {
+        const MobUnit* mob = &units[c->mob_first];
+        json_key(w, "mob");
+        json_begin(w, '{');
+        json_key(w, "unit_max_hp");
+        json_int(w, c->mob_unit_max_hp);
+        json_key(w, "hp");
+        json_begin(w, '[');
+        for (int u = 0; u < c->mob_size; u++) json_int(w, mob[u].hp);
+        json_end(w, ']');
+        json_key(w, "unit_conditions");
+        json_begin(w, '{');
+        for (int u = 0; u < c->mob_size; u++) {
+            if (mob[u].conditions == 0) continue;
+            char unit[16];
+            snprintf(unit, sizeof(unit), "%d", u);
+            json_key(w, unit);
+            json_begin(w, '[');
+            for (int j = 0; j < NUM_CONDITIONS; j++) {
+                if (mob[u].conditions & (1u << j)) json_string(w, effect_name(state, j));
+            }
+            json_end(w, ']');
+        }
+        json_end(w, '}');
+        json_end(w, '}');
+    }
+
+    if (archived) {
+        json_key(w, "archived");
+        json_begin(w, '{');
+        json_key(w, "round");
+        json_int(w, archived->round);
+        json_key(w, "reason");
+        json_string(w, archived->reason == ARCHIVE_DEAD ? "dead" : "removed");
+        json_end(w, '}');
+    }
+    json_end(w, '}');
+}
+
+/* Record the first error and stop: every later read sees the end of input */
+void json_fail(JsonReader* r, const char* what) {
+    if (!r->error) {
+        r->error = 1;
+        snprintf(r->message, sizeof(r->message), "%s at byte %ld", what, (long)(r->p - r->start));
+    }
+    r->p = r->end;
+}
+
+void json_skip_ws(JsonReader* r) {
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\n' || *r->p == '\r' || *r->p == '\t')) r->p++;
+}
+
+/**
+ * @return 1 and step past `c` if it is the next token, 0 otherwise
+ */
+int json_consume(JsonReader* r, char c) {
+    json_skip_ws(r);
+    if (r->p < r->end && *r->p == c) {
+        r->p++;
+        return 1;
+    }
+    return 0;
+}
+
+int json_expect(JsonReader* r, char c) {
+    if (json_consume(r, c)) return 1;
+    char what[24];
+    snprintf(what, sizeof(what), "expected '%c'", c);
+    json_fail(r, what);
+    return 0;
+}
+
+/**
+ * Read a string, unescaping it into `out` (truncated to fit; NULL skips it).
+ *
+ * @return Unescaped length, or -1 on error
+ */
+int json_read_string(JsonReader* r, char* out, size_t size) {
+    json_skip_ws(r);
+    if (r->p >= r->end || *r->p != '"') {
+        json_fail(r, "expected a string");
+        return -1;
+    }
+    r->p++;
+    size_t n = 0;
+    for (;;) {
+        /* Plain characters up to the next quote, escape or control character */
+        const char* run = r->p;
+        while (r->p < r->end && *r->p != '"' && *r->p != '\\' && (unsigned char)*r->p >= 0x20) r->p++;
+        size_t run_len = (size_t)(r->p - run);
+        if (out && n + 1 < size) {
+            size_t take = run_len < size - 1 - n ? run_len : size - 1 - n;
+            memcpy(out + n, run, take);
+        }
+        n += run_len;
+        if (r->p >= r->end || (unsigned char)*r->p < 0x20) {
+            json_fail(r, "unterminated string");
+            return -1;
+        }
+        if (*r->p == '"') break;
+
+        r->p++;  /* Backslash */
+        char utf8[4];
+        size_t utf8_len = 1;
+        switch (r->p < r->end ? *r->p : 0) {
+            case '"': utf8[0] = '"'; break;
+            case '\\': utf8[0] = '\\'; break;
+            case '/': utf8[0] = '/'; break;
+            case 'b': utf8[0] = '\b'; break;
+            case 'f': utf8[0] = '\f'; break;
+            case 'n': utf8[0] = '\n'; break;
+            case 'r': utf8[0] = '\r'; break;
+            case 't': utf8[0] = '\t'; break;
+            case 'u': {
+                unsigned int code = 0;
+                for (int k = 1; k <= 4; k++) {
+                    char h = r->p + k < r->end ? r->p[k] : 0;
+                    int digit = isdigit((unsigned char)h) ? h - '0' :
+                                (h >= 'a' && h <= 'f') ? h - 'a' + 10 : (h >= 'A' && h <= 'F') ? h - 'A' + 10 : -1;
+                    if (digit < 0) {
+                        json_fail(r, "bad \\u escape");
+                        return -1;
+                    }
+                    code = code * 16 + (unsigned int)digit;
+                }
+                r->p += 4;
+                /* Surrogate halves are not paired up - they come out as U+FFFD */
+                if (code >= 0xD800 && code <= 0xDFFF) code = 0xFFFD;
+                if (code < 0x80) {
+                    utf8[0] = (char)code;
+                } else if (code < 0x800) {
+                    utf8[0] = (char)(0xC0 | (code >> 6));
+                    utf8[1] = (char)(0x80 | (code & 0x3F));
+                    utf8_len = 2;
+                } else {
+                    utf8[0] = (char)(0xE0 | (code >> 12));
+                    utf8[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+                    utf8[2] = (char)(0x80 | (code & 0x3F));
+                    utf8_len = 3;
+                }
+                break;
+            }
+            default:
+                json_fail(r, "bad escape");
+                return -1;
+        }
+        r->p++;
+        if (out && n + utf8_len < size) memcpy(out + n, utf8, utf8_len);
+        n += utf8_len;
+    }
+    r->p++;  /* Closing quote */
+    if (out && size > 0) out[n < size ? n : size - 1] = '\0';
+    return n > INT_MAX ? INT_MAX : (int)n;
+}
+
+/**
+ * Read an integer that fits in a long long. Fractions and exponents are errors.
+ *
+ * @return 1 on success, 0 on error
+ */
+int json_read_long(JsonReader* r, long long* out) {
+    json_skip_ws(r);
+    int negative = r->p < r->end && *r->p == '-';
+    if (negative) r->p++;
+    if (r->p >= r->end || !isdigit((unsigned char)*r->p)) {
+        json_fail(r, "expected an integer");
+        return 0;
+    }
+    unsigned long long v = 0;
+    while (r->p < r->end && isdigit((unsigned char)*r->p)) {
+        unsigned int digit = (unsigned int)(*r->p++ - '0');
+        if (v > (ULLONG_MAX - digit) / 10) {
+            json_fail(r, "integer out of range");
+            return 0;
+        }
+        v = v * 10 + digit;
+    }
+    if (r->p < r->end && (*r->p == '.' || *r->p == 'e' || *r->p == 'E')) {
+        json_fail(r, "expected an integer");
+        return 0;
+    }
+    if (v > (unsigned long long)LLONG_MAX + (negative ? 1u : 0u)) {
+        json_fail(r, "integer out of range");
+        return 0;
+    }
+    *out = negative ? (long long)(0ULL - v) : (long long)v;
+    return 1;
+}
+
+int json_read_int(JsonReader* r, int* out) {
+    long long v;
+    if (!json_read_long(r, &v)) return 0;
+    if (v < INT_MIN || v > INT_MAX) {
+        json_fail(r, "integer out of range");
+        return 0;
+    }
+    *out = (int)v;
+    return 1;
+}
+
+int json_read_bool(JsonReader* r, int* out) {
+    json_skip_ws(r);
+    if (r->end - r->p >= 4 && memcmp(r->p, "true", 4) == 0) {
+        r->p += 4;
+        *out = 1;
+        return 1;
+    }
+    if (r->end - r->p >= 5 && memcmp(r->p, "false", 5) == 0) {
+        r->p += 5;
+        *out = 0;
+        return 1;
+    }
+    json_fail(r, "expected true or false");
+    return 0;
+}
+
+/**
+ * Step over one value of any type - how unknown keys are ignored.
+ *
+ * @return 1 on success, 0 on error
+ */
+int json_skip_value(JsonReader* r, int depth) {
+    if (depth > JSON_MAX_DEPTH) {
+        json_fail(r, "nested too deeply");
+        return 0;
+    }
+    json_skip_ws(r);
+    char c = r->p < r->end ? *r->p : 0;
+    if (c == '{') {
+        r->p++;
+        for (int first = 1; json_object_next(r, NULL, 0, &first);) {
+            if (!json_skip_value(r, depth + 1)) return 0;
+        }
+    } else if (c == '[') {
+        r->p++;
+        for (int first = 1; json_array_next(r, &first);) {
+            if (!json_skip_value(r, depth + 1)) return 0;
+        }
+    } else if (c == '"') {
+        json_read_string(r, NULL, 0);
+    } else if (c == '-' || isdigit((unsigned char)c)) {
+        while (r->p < r->end && (isdigit((unsigned char)*r->p) || strchr("+-.eE", *r->p))) r->p++;
+    } else if (r->end - r->p >= 4 && (memcmp(r->p, "true", 4) == 0 || memcmp(r->p, "null", 4) == 0)) {
+        r->p += 4;
+    } else if (r->end - r->p >= 5 && memcmp(r->p, "false", 5) == 0) {
+        r->p += 5;
+    } else {
+        json_fail(r, "unexpected character");
+    }
+    return !r->error;
+}
+
+/**
+ * Step to the next key of an object whose '{' has been read, leaving the
+ * reader at its value.
+ *
+ * @param first Set to 1 before the first call
+ * @return 1 with `key` filled, 0 at the closing '}' or on error
+ */
+int json_object_next(JsonReader* r, char* key, size_t size, int* first) {
+    if (json_consume(r, '}')) return 0;
+    if (!*first && !json_expect(r, ',')) return 0;
+    *first = 0;
+    if (json_read_string(r, key, size) < 0 || !json_expect(r, ':')) return 0;
+    return 1;
+}
+
+/**
+ * Step to the next element of an array whose '[' has been read.
+ *
+ * @param first Set to 1 before the first call
+ * @return 1 if an element follows, 0 at the closing ']' or on error
+ */
+int json_array_next(JsonReader* r, int* first) {
+    if (json_consume(r, ']')) return 0;
+    if (!*first && !json_expect(r, ',')) return 0;
+    *first = 0;
+    return !r->error;
+}
+
+/**
+ * Load a JSON save in one pass over the file. The save is parsed into a
+ * scratch state that replaces the encounter only once the whole file has
+ * been read, so a syntax error or truncation refuses the load.
+ *
+ * @param f Open save file; closed here
+ * @return 1 on success, 0 if the file is not a usable JSON save (state untouched)
+ */
+int load_state_json(GameState* state, const char* path, FILE* f, uint64_t start_ns) {
+    TRACE_SCOPE("load_state_json");
+    long size = (fseek(f, 0, SEEK_END) == 0) ? ftell(f) : -1;
+    char* text = size >= 0 ? (char*)malloc((size_t)size + 1) : NULL;
+    if (!text || fseek(f, 0, SEEK_SET) != 0 || fread(text, 1, (size_t)size, f) != (size_t)size) {
+        free(text);
+        fclose(f);
+        show_message(state, "Load failed! Cannot read JSON save file.", 1);
+        return 0;
+    }
+    fclose(f);
+    text[size] = '\0';
+
+    JsonReader r = {text, text, text + size, 0, ""};
+    char key[32], format[32] = "";
+    int first = 1;
+    /* The format must lead, so a stray JSON file is refused before anything is cleared */
+    if (!json_expect(&r, '{') || !json_object_next(&r, key, sizeof(key), &first) || strcmp(key, "format") != 0 ||
+        json_read_string(&r, format, sizeof(format)) < 0 || strcmp(format, SAVE_JSON_FORMAT) != 0) {
+        free(text);
+        show_message(state, "Load failed! Not an initiative JSON save file.", 1);
+        return 0;
+    }
+
+    /* Only what the readers touch is set up; everything else stays zeroed */
+    GameState* scratch = (GameState*)calloc(1, sizeof(GameState));
+    if (!scratch || !(scratch->registry.names = malloc((size_t)state->registry.capacity * EFFECT_NAME_LENGTH))) {
+        free(scratch);
+        free(text);
+        show_message(state, "Load failed! Out of memory.", 1);
+        return 0;
+    }
+    memcpy(scratch->registry.names, state->registry.names, (size_t)state->registry.count * EFFECT_NAME_LENGTH);
+    scratch->registry.count = state->registry.count;
+    scratch->registry.capacity = state->registry.capacity;
+    scratch->headless = state->headless;
+    scratch->out = state->out;
+    scratch->err = state->err;
+    scratch->stats.io_fd = -1;
+    scratch->next_id = 1;
+    init_log(scratch);
+
+    int round = 1, skip_policy = state->skip_policy;
+    while (json_object_next(&r, key, sizeof(key), &first)) {
+        if (strcmp(key, "version") == 0) {
+            int version;
+            if (json_read_int(&r, &version) && version > SAVE_JSON_VERSION) {
+                show_message(scratch, "Load warning: Save is from a newer version; unknown fields ignored.", 1);
+            }
+        } else if (strcmp(key, "round") == 0) {
+            json_read_int(&r, &round);
+        } else if (strcmp(key, "next_id") == 0) {
+            json_read_int(&r, &scratch->next_id);
+        } else if (strcmp(key, "current_turn_id") == 0) {
+            json_read_int(&r, &scratch->current_turn_id);
+        } else if (strcmp(key, "selected_id") == 0) {
+            json_read_int(&r, &scratch->selected_id);
+        } else if (strcmp(key, "skip_policy") == 0) {
+            json_read_int(&r, &skip_policy);
+        } else if (strcmp(key, "combatants") == 0 || strcmp(key, "archive") == 0) {
+            int archive = key[0] == 'a';
+            if (!json_expect(&r, '[')) break;
+            for (int first_item = 1; json_array_next(&r, &first_item);) {
+                if (!archive && (scratch->count >= MAX_COMBATANTS || !ensure_combatant_capacity(scratch, scratch->count + 1))) {
+                    json_fail(&r, "too many combatants");
+                    break;
+                }
+                Combatant parsed;
+                Combatant* c = archive ? &parsed : &scratch->combatants[scratch->count];
+                int archived_round = 0;
+                char archived_kind = 0;
+                if (!read_combatant_json(scratch, &r, c, &archived_round, &archived_kind)) continue;
+                if (!archived_kind) {
+                    if (archive) {
+                        archived_kind = 'r';
+                    } else {
+                        scratch->count++;
+                        continue;
+                    }
+                }
+                if (archive_push(scratch, c, archived_kind == 'd' ? ARCHIVE_DEAD : ARCHIVE_REMOVED)) {
+                    scratch->archive[scratch->archive_count - 1].round = archived_round;
+                } else {
+                    show_message(scratch, "Load warning: Archive out of memory, archived entry dropped.", 1);
+                }
+                scratch->mob_unit_count -= c->mob_size; /* Units were appended last - just drop them */
+            }
+        } else if (strcmp(key, "name_suffixes") == 0) {
+            if (!json_expect(&r, '[')) break;
+            for (int first_item = 1; json_array_next(&r, &first_item);) {
+                char base[NAME_LENGTH] = "";
+                int highest = 0;
+                if (!json_expect(&r, '{')) break;
+                for (int first_field = 1; json_object_next(&r, key, sizeof(key), &first_field);) {
+                    if (strcmp(key, "base") == 0) {
+                        json_read_string(&r, base, sizeof(base));
+                    } else if (strcmp(key, "highest") == 0) {
+                        json_read_int(&r, &highest);
+                    } else {
+                        json_skip_value(&r, 0);
+                    }
+                }
+                if (base[0]) name_index_raise(scratch, base, highest);
+            }
+        } else if (strcmp(key, "log") == 0) {
+            read_log_json(scratch, &r);
+        } else {
+            json_skip_value(&r, 0);
+        }
+    }
+    free(text);
+
+    if (r.error) {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "Load failed! JSON %s; encounter unchanged.", r.message);
+        cleanup_state(scratch);
+        free(scratch);
+        show_message(state, msg, 1);
+        return 0;
+    }
+    load_state_adopt(state, scratch);
+    cleanup_state(scratch);
+    free(scratch);
+
+    state->round = (round < 1) ? 1 : round;
+    state->skip_policy = skip_policy & (SKIP_DEAD | SKIP_STABLE | SKIP_INCAPACITATED);
+
+    /* Timers were read as rounds left; now that the round is known, make them absolute */
+    for (int i = 0; i < state->count + state->archive_count; i++) {
+        Combatant* c = i < state->count ? &state->combatants[i] : &state->archive[i - state->count].combatant;
+        for (int t = c->timer_first; t; t = state->effect_store.timers[t].next) {
+            int left = state->effect_store.timers[t].expires;
+            state->effect_store.timers[t].expires = (left > INT_MAX - state->round) ? INT_MAX : state->round + left;
+        }
+    }
+
+    load_state_finish(state, path, size, start_ns);
+    return 1;
+}
+
+/**
+ * Read one combatant object into `c`. Timers hold rounds left until
+ * load_state_json knows the round. Mob units are appended to the pool.
+ *
+ * @param archived_kind Set to 'd' or 'r' if the object has "archived"
+ * @return 1 on success, 0 if the entry is skipped (message shown) or on error
+ */
+int read_combatant_json(GameState* state, JsonReader* r, Combatant* c, int* archived_round, char* archived_kind) {
+    memset(c, 0, sizeof(*c));
+    c->type = TYPE_ENEMY;
+    int has_id = 0, has_name = 0, mob_ok = 1;
+    int units_before = state->mob_unit_count;
+    char key[32];
+    if (!json_expect(r, '{')) return 0;
+    for (int first = 1; json_object_next(r, key, sizeof(key), &first);) {
+        if (strcmp(key, "id") == 0) {
+            has_id = json_read_int(r, &c->id);
+        } else if (strcmp(key, "name") == 0) {
+            has_name = json_read_string(r, c->name, sizeof(c->name)) > 0;
+        } else if (strcmp(key, "type") == 0) {
+            char type[16];
+            json_read_string(r, type, sizeof(type));
+            c->type = strcmp(type, "player") == 0 ? TYPE_PLAYER : TYPE_ENEMY;
+        } else if (strcmp(key, "initiative") == 0) {
+            json_read_int(r, &c->initiative);
+        } else if (strcmp(key, "dex") == 0) {
+            json_read_int(r, &c->dex);
+        } else if (strcmp(key, "max_hp") == 0) {
+            json_read_int(r, &c->max_hp);
+        } else if (strcmp(key, "hp") == 0) {
+            json_read_int(r, &c->hp);
+        } else if (strcmp(key, "death_saves") == 0) {
+            if (!json_expect(r, '{')) break;
+            for (int first_save = 1; json_object_next(r, key, sizeof(key), &first_save);) {
+                if (strcmp(key, "successes") == 0) json_read_int(r, &c->death_save_successes);
+                else if (strcmp(key, "failures") == 0) json_read_int(r, &c->death_save_failures);
+                else json_skip_value(r, 0);
+            }
+        } else if (strcmp(key, "stable") == 0) {
+            json_read_bool(r, &c->is_stable);
+        } else if (strcmp(key, "dead") == 0) {
+            json_read_bool(r, &c->is_dead);
+        } else if (strcmp(key, "effects") == 0) {
+            if (!read_effects_json(state, r, c)) {
+                show_message(state, "Load warning: Some custom effects could not be restored.", 1);
+            }
+        } else if (strcmp(key, "mob") == 0) {
+            mob_ok = read_mob_json(state, r, c);
+        } else if (strcmp(key, "archived") == 0) {
+            if (!json_expect(r, '{')) break;
+            *archived_kind = 'r';
+            for (int first_archived = 1; json_object_next(r, key, sizeof(key), &first_archived);) {
+                if (strcmp(key, "round") == 0) {
+                    json_read_int(r, archived_round);
+                } else if (strcmp(key, "reason") == 0) {
+                    char reason[16];
+                    json_read_string(r, reason, sizeof(reason));
+                    *archived_kind = strcmp(reason, "dead") == 0 ? 'd' : 'r';
+                } else {
+                    json_skip_value(r, 0);
+                }
+            }
+        } else {
+            json_skip_value(r, 0);
+        }
+    }
+    if (r->error) {
+        state->mob_unit_count = units_before;
+        return 0;
+    }
+    if (!has_id || !has_name || !mob_ok) {
+        state->mob_unit_count = units_before;
+        show_message(state, !mob_ok ? "Load warning: Skipping malformed combatant entry (invalid mob units)." :
+                                      "Load warning: Skipping combatant entry without an id or name.", 1);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Read an effects array: set each effect, registering custom ones that are
+ * missing from the config, and add timers in the order the text loader
+ * does (custom effects first).
+ *
+ * @return 1 if every effect was restored, 0 otherwise
+ */
+int read_effects_json(GameState* state, JsonReader* r, Combatant* c) {
+    EffectTimer timed[MAX_EFFECTS];
+    int timed_count = 0, ok = 1;
+    char key[32];
+    if (!json_expect(r, '[')) return 0;
+    for (int first = 1; json_array_next(r, &first);) {
+        char name[EFFECT_NAME_LENGTH + 1] = "", timing[16] = "";
+        int rounds = 0, anchor_id = -1;
+        if (!json_expect(r, '{')) return 0;
+        for (int first_field = 1; json_object_next(r, key, sizeof(key), &first_field);) {
+            if (strcmp(key, "name") == 0) json_read_string(r, name, sizeof(name));
+            else if (strcmp(key, "rounds") == 0) json_read_int(r, &rounds);
+            else if (strcmp(key, "timing") == 0) json_read_string(r, timing, sizeof(timing));
+            else if (strcmp(key, "anchor_id") == 0) json_read_int(r, &anchor_id);
+            else json_skip_value(r, 0);
+        }
+        if (r->error) return 0;
+
+        int effect = find_effect_by_name(state, name);
+        if (effect == -1) effect = register_effect(state, name);
+        if (effect == -1) {
+            ok = 0;
+            continue;
+        }
+        if (!effect_assign(state, c, effect, 1)) {
+            ok = 0;
+            continue;
+        }
+        ExpiryTiming when = strcmp(timing, "turn_start") == 0 ? EXPIRE_TURN_START :
+                            strcmp(timing, "turn_end") == 0 ? EXPIRE_TURN_END : EXPIRE_ROUND_START;
+        if ((rounds > 0 || when != EXPIRE_ROUND_START) && timed_count < MAX_EFFECTS) {
+            EffectTimer* t = &timed[timed_count++];
+            t->effect = effect;
+            t->expires = rounds < 0 ? 0 : rounds;
+            t->timing = (int)when;
+            t->anchor_id = anchor_id;
+        }
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < timed_count; i++) {
+            if ((timed[i].effect >= NUM_CONDITIONS) != (pass == 0)) continue;
+            if (!add_effect_timer(state, c, timed[i].effect, timed[i].expires, (ExpiryTiming)timed[i].timing,
+                    timed[i].anchor_id)) {
+                ok = 0;
+            }
+        }
+    }
+    return ok && !r->error;
+}
+
+/**
+ * Read a mob object, appending its units to the pool. "unit_conditions"
+ * may come before "hp"; it is read once the units exist.
+ *
+ * @return 1 on success, 0 if the mob is malformed (caller drops the units)
+ */
+int read_mob_json(GameState* state, JsonReader* r, Combatant* c) {
+    int unit_max = 0, size = 0, first_unit = state->mob_unit_count, ok = 1;
+    const char* deferred = NULL;
+    char key[32];
+    if (!json_expect(r, '{')) return 0;
+    for (int first = 1; json_object_next(r, key, sizeof(key), &first);) {
+        if (strcmp(key, "unit_max_hp") == 0) {
+            json_read_int(r, &unit_max);
+        } else if (strcmp(key, "hp") == 0) {
+            if (!json_expect(r, '[')) return 0;
+            for (int first_hp = 1; json_array_next(r, &first_hp);) {
+                int hp;
+                if (!json_read_int(r, &hp)) return 0;
+                if (size >= MAX_MOB_UNITS || hp < 0 || hp > MAX_MOB_UNIT_HP || mob_alloc_units(state, 1, 1) == -1) {
+                    ok = 0;
+                    continue;
+                }
+                state->mob_units[first_unit + size++].hp = (uint16_t)hp;
+            }
+        } else if (strcmp(key, "unit_conditions") == 0) {
+            json_skip_ws(r);
+            deferred = r->p;
+            json_skip_value(r, 0);
+        } else {
+            json_skip_value(r, 0);
+        }
+    }
+    if (r->error || !ok || size < 1 || unit_max < 1 || unit_max > MAX_MOB_UNIT_HP) return 0;
+    for (int u = 0; u < size; u++) {
+        if (state->mob_units[first_unit + u].hp > unit_max) return 0;
+    }
+    if (deferred) {
+        JsonReader sub = *r;
+        sub.p = deferred;
+        if (!read_unit_conditions_json(state, &sub, &state->mob_units[first_unit], size)) {
+            show_message(state, "Load warning: Some mob unit conditions could not be restored.", 1);
+        }
+    }
+
+    c->type = TYPE_ENEMY;
+    c->mob_size = size;
+    c->mob_first = first_unit;
+    c->mob_unit_max_hp = unit_max;
+    c->max_hp = size * unit_max;
+    mob_sync_hp(state, c);
+    return 1;
+}
+
+/**
+ * Read {"<unit>":["Condition",...],...} - only built-in conditions apply to units.
+ *
+ * @return 1 if every entry applied, 0 otherwise
+ */
+int read_unit_conditions_json(GameState* state, JsonReader* r, MobUnit* units, int size) {
+    char key[16], name[EFFECT_NAME_LENGTH + 1];
+    int ok = 1;
+    if (!json_expect(r, '{')) return 0;
+    for (int first = 1; json_object_next(r, key, sizeof(key), &first);) {
+        int unit = 0;
+        if (!parse_int_safe(key, &unit) || unit < 0 || unit >= size) {
+            ok = 0;
+            json_skip_value(r, 0);
+            continue;
+        }
+        if (!json_expect(r, '[')) return 0;
+        for (int first_name = 1; json_array_next(r, &first_name);) {
+            if (json_read_string(r, name, sizeof(name)) < 0) return 0;
+            int cond = find_effect_by_name(state, name);
+            if (cond < 0 || cond >= NUM_CONDITIONS) {
+                ok = 0;
+                continue;
+            }
+            units[unit].conditions = (uint16_t)(units[unit].conditions | (1u << cond));
+        }
+    }
+    return ok && !r->error;
+}
+
+/* Append the saved log entries; a log that cannot grow keeps what fit */
+void read_log_json(GameState* state, JsonReader* r) {
+    char key[32];
+    if (!json_expect(r, '[')) return;
+    for (int first = 1; json_array_next(r, &first);) {
+        CombatLogEntry entry = {0};
+        long long timestamp = 0;
+        if (!json_expect(r, '{')) return;
+        for (int first_field = 1; json_object_next(r, key, sizeof(key), &first_field);) {
+            if (strcmp(key, "round") == 0) json_read_int(r, &entry.round);
+            else if (strcmp(key, "turn_id") == 0) json_read_int(r, &entry.turn_id);
+            else if (strcmp(key, "time") == 0) json_read_long(r, &timestamp);
+            else if (strcmp(key, "message") == 0) json_read_string(r, entry.message, sizeof(entry.message));
+            else json_skip_value(r, 0);
+        }
+        if (r->error || !state->combat_log) return;
+        entry.timestamp = (time_t)timestamp;
+        if (state->log_count >= state->log_capacity) {
+            int new_capacity = state->log_capacity > 0 ? state->log_capacity * 2 : 16;
+            CombatLogEntry* grown = (CombatLogEntry*)realloc(state->combat_log, (size_t)new_capacity * sizeof(CombatLogEntry));
+            if (!grown) continue;
+            state->combat_log = grown;
+            state->log_capacity = new_capacity;
+            state->stats.log_reallocs++;
+        }
+        state->combat_log[state->log_count++] = entry;
+    }
+}
+
+/* --- Death Save Functions --- */
+
+void reset_death_saves(Combatant* c) {
+    c->death_save_successes = 0;
+    c->death_save_failures = 0;
+    c->is_stable = 0;
+}
+
+/**
+ * Roll a death saving throw for a combatant.
+ *
+ * @param state Game state pointer
+ * @param c Combatant pointer. If NULL, uses the currently selected combatant (state->selected_id).
+ *          This allows convenient manual death saves via 'X' key without requiring selection.
+ *
+ * Rules implemented:
+ * - Natural 20: Regain 1 HP immediately
+ * - Natural 1: Two failures
+ * - 10-19: Success (counts toward 3 successes = stable)
+ * - 2-9: Failure (counts toward 3 failures = death)
+ * - Only works for players at 0 HP who are not stable or dead
+ */
+void roll_death_save(GameState* state, Combatant* c) {
+    /* Convenience: NULL uses selected combatant for manual 'X' key */
+    if (!c) {
+        int idx = get_index_by_id(state, state->selected_id);
+        if (idx == -1) return;
+        c = &state->combatants[idx];
+    }
+
+    if (c->type != TYPE_PLAYER) return;
+    if (c->hp > 0 || c->is_stable || c->is_dead) return;
+
+    int roll = roll_die(state, 20);
+
+    if (roll == 20) {
+        /* 5e rule: natural 20 = regain 1 HP immediately */
+        c->hp = 1;
+        effect_assign(state, c, UNCONSCIOUS_INDEX, 0);
+        reset_death_saves(c);
+        show_message(state, "NATURAL 20! Regained 1 HP!", 0);
+        log_action(state, "%s rolled a NATURAL 20 on death save! Regained 1 HP.", c->name);
+    } else if (roll == 1) {
+        /* 5e rule: natural 1 = two failures */
+        c->death_save_failures += 2;
+        log_action(state, "%s rolled a NATURAL 1 on death save (2 failures). Total: %d failures.",
+            c->name, c->death_save_failures);
+
+        if (c->death_save_failures >= 3) {
+            c->is_dead = 1;
+            show_message(state, "DEATH! (3 failures)", 1);
+            log_event(state, c, HISTORY_DEATH, 0, "%s has died (3 death save failures).", c->name);
+        }
+    } else if (roll >= 10) {
+        c->death_save_successes++;
+        log_action(state, "%s rolled %d on death save (SUCCESS). Total: %d successes.",
+            c->name, roll, c->death_save_successes);
+
+        if (c->death_save_successes >= 3) {
+            c->is_stable = 1;
+            show_message(state, "STABLE! (3 successes)", 0);
+            log_action(state, "%s is now STABLE (3 death save successes).", c->name);
+        }
+    } else {
+        c->death_save_failures++;
+        log_action(state, "%s rolled %d on death save (FAILURE). Total: %d failures.",
+            c->name, roll, c->death_save_failures);
+
+        if (c->death_save_failures >= 3) {
+            c->is_dead = 1;
+            show_message(state, "DEATH! (3 failures)", 1);
+            log_event(state, c, HISTORY_DEATH, 0, "%s has died (3 death save failures).", c->name);
+        }
+    }
+    eligible_update(state, c);
+    PROBE4(death_save, c->id, roll, c->death_save_successes, c->death_save_failures);
+}
+
+void handle_damage_at_zero_hp(GameState* state, Combatant* c, int damage, int is_critical) {
+    if (c->type != TYPE_PLAYER || c->hp > 0 || c->is_dead) return;
+
+    /* 5e rule: damage at 0 HP = 1 failure, critical = 2 failures */
+    if (is_critical) {
+        c->death_save_failures += 2;
+        log_action(state, "%s took %d CRITICAL damage at 0 HP (2 failures). Total: %d failures.",
+            c->name, damage, c->death_save_failures);
+    } else {
+        c->death_save_failures++;
+        log_action(state, "%s took %d damage at 0 HP (1 failure). Total: %d failures.",
+            c->name, damage, c->death_save_failures);
+    }
+
+    /* Damage breaks stability */
+    if (c->is_stable) {
+        c->is_stable = 0;
+        log_action(state, "%s is no longer stable due to damage.", c->name);
+    }
+
+    if (c->death_save_failures >= 3) {
+        c->is_dead = 1;
+        show_message(state, "DEATH! (3 failures from damage)", 1);
+        log_event(state, c, HISTORY_DEATH, 0, "%s has died (3 death save failures).", c->name);
+    }
+}
+
+void stabilize_combatant(GameState* state) {
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) return;
+
+    Combatant* c = &state->combatants[idx];
+
+    if (c->type != TYPE_PLAYER) {
+        show_message(state, "Only players can be stabilized!", 1);
+        return;
+    }
+
+    if (c->hp > 0) {
+        show_message(state, "Combatant is not at 0 HP!", 1);
+        return;
+    }
+
+    if (c->is_dead) {
+        show_message(state, "Combatant is already dead!", 1);
+        return;
+    }
+
+    if (c->is_stable) {
+        show_message(state, "Combatant is already stable!", 1);
+        return;
+    }
+
+    reset_death_saves(c);
+    c->is_stable = 1;
+    eligible_update(state, c);
+    show_message(state, "Combatant stabilized!", 0);
+    log_action(state, "%s has been stabilized (Spare the Dying/Medicine check/Healer's Kit).", c->name);
+}
+
+/* --- Helper Functions --- */
+
+void move_selection(GameState* state, int direction) {
+    TRACE_SCOPE("move_selection");
+    int idx = get_index_by_id(state, state->selected_id);
+    if (idx == -1) {
+        if (state->count > 0) state->selected_id = state->combatants[0].id;
+        return;
+    }
+
+    idx = (idx + direction + state->count) % state->count;
+    state->selected_id = state->combatants[idx].id;
+}
+
+void sort_combatants(GameState* state) {
+    TRACE_SCOPE("sort_combatants");
+    if (state->count > 1) {
+        long long before = combatant_comparisons;
+        qsort(state->combatants, (size_t)state->count, sizeof(Combatant), compare_combatants);
+        state->stats.sort_comparisons += combatant_comparisons - before;
+    }
+    state->stats.sorts++;
+    eligible_rebuild(state);
+}
+
+/**
+ * Insert many combatants into the already-sorted roster.
+ * Sorts only the batch, then merges from the back in place, so large
+ * spawns cost O(k log k + n) instead of re-sorting the whole list.
+ * Capacity for the batch must already be reserved.
+ */
+void insert_sorted_batch(GameState* state, Combatant* batch, int batch_count) {
+    TRACE_SCOPE("insert_sorted_batch");
+    if (batch_count <= 0) return;
+    long long before = combatant_comparisons;
+    qsort(batch, (size_t)batch_count, sizeof(Combatant), compare_combatants);
+
+    int i = state->count - 1;
+    int j = batch_count - 1;
+    int w = state->count + batch_count - 1;
+    while (j >= 0) {
+        if (i >= 0 && compare_combatants(&state->combatants[i], &batch[j]) > 0) {
+            state->combatants[w--] = state->combatants[i--];
+        } else {
+            state->combatants[w--] = batch[j--];
+        }
+    }
+    state->count += batch_count;
+    state->stats.sorts++;
+    state->stats.sort_comparisons += combatant_comparisons - before;
+    eligible_rebuild(state);
+}
+
+int compare_combatants(const void* a, const void* b) {
+    combatant_comparisons++;
+    const Combatant* ca = (const Combatant*)a;
+    const Combatant* cb = (const Combatant*)b;
+
+    if (cb->initiative != ca->initiative) {
+        return cb->initiative - ca->initiative;
+    }
+    if (cb->dex != ca->dex) {
+        return cb->dex - ca->dex;
+    }
+    return ca->id - cb->id;
+}
+
+int get_index_by_id(GameState* state, int id) {
+    for (int i = 0; i < state->count; i++) {
+        if (state->combatants[i].id == id) return i;
+    }
+    return -1;
+}
+
+/**
+ * Safely parse an integer from a string.
+ *
+ * @param str Input string to parse (must not be NULL)
+ * @param out Pointer to store parsed value (must not be NULL)
+ * @return 1 on success, 0 on failure (invalid format, overflow, etc.)
+ *
+ * NOTE: Accepts optional leading/trailing whitespace.
+ * Returns 0 for: NULL input, empty string, non-numeric characters,
+ * overflow/underflow beyond INT_MIN/INT_MAX.
+ */
+int parse_int_safe(const char* str, int* out) {
+    if (str == NULL || *str == '\0') return 0;
+
+    char* endptr;
+    errno = 0;  /* Reset errno before call */
+    long val = strtol(str, &endptr, 10);
+
+    /* Check for conversion errors */
+    if (endptr == str) return 0;  /* No digits parsed */
+
+    /* Skip trailing whitespace */
+    while (*endptr == ' ' || *endptr == '\t') endptr++;
+
+    /* Ensure entire string was consumed (except whitespace) */
+    if (*endptr != '\0' && *endptr != '\n' && *endptr != '\r') return 0;
+
+    /* Check for overflow/underflow */
+    if (errno == ERANGE || val > INT_MAX || val < INT_MIN) return 0;
+
+    *out = (int)val;
+    return 1;
+}
+
+/**
+ * Get condition name safely with bounds checking.
+ *
+ * @param index Condition index (0 to NUM_CONDITIONS-1)
+ * @return Condition name string, or "Unknown" if index is invalid
+ */
+const char* get_condition_name(int index) {
+    if (index >= 0 && index < NUM_CONDITIONS) {
+        return condition_data[index].name;
+    }
+    return "Unknown";
+}
+
+/**
+ * Build "$HOME/file_name", or just file_name when HOME is unset.
+ *
+ * @return 1 on success, 0 if the path does not fit in `size`
+ */
+int build_home_path(char* path, size_t size, const char* file_name) {
+    const char* home = getenv("HOME");
+    int ret;
+    if (home) ret = snprintf(path, size, "%s/%s", home, file_name);
+    else ret = snprintf(path, size, "%s", file_name);
+    return ret >= 0 && (size_t)ret < size;
+}
+
+/**
+ * Get string input from user with proper cursor management.
+ *
+ * @param prompt Prompt string to display
+ * @param buffer Buffer to store input (must be at least max_len bytes)
+ * @param max_len Maximum length including null terminator
+ * @return 1 on success (non-empty input), 0 on cancellation or empty input
+ */
+int get_input_string(const char* prompt, char* buffer, int max_len) {
+    if (!buffer || max_len < 1) return 0;
+
+    int rows, cols_unused;
+    getmaxyx(stdscr, rows, cols_unused);
+    (void)cols_unused;
+    int input_y = rows - 2;
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvprintw(input_y, 0, "%s", prompt);
+    clrtoeol();
+    attroff(COLOR_PAIR(COLOR_HEADER));
+
+    int prompt_len = (int)strlen(prompt);
+    move(input_y, prompt_len);
+
+    curs_set(1);
+    refresh();
+
+    int ret = 0;
+    noecho();
+    int ch = getch();
+
+    if (ch != 27 && ch != '\n' && ch != '\r') {
+        ungetch(ch);
+        echo();
+        if (getnstr(buffer, max_len - 1) != ERR && buffer[0] != '\0') {
+            ret = 1;
+        }
+    }
+
+    noecho();
+    curs_set(0);
+
+    move(input_y, 0);
+    clrtoeol();
+    refresh();
+
+    return ret;
+}
+
+/**
+ * Get integer input from user with validation and error feedback.
+ *
+ * @param state Game state for message display
+ * @param prompt Prompt string to display
+ * @param value Pointer to store parsed integer value
+ * @param min_val Minimum allowed value (INT_MIN if no limit)
+ * @param max_val Maximum allowed value (INT_MAX if no limit)
+ * @return 1 on success, 0 on cancellation or invalid input
+ */
+int get_input_int(GameState* state, const char* prompt, int* value, int min_val, int max_val) {
+    char buf[32];
+    int attempts = 0;
+    const int max_attempts = 3;
+
+    while (attempts < max_attempts) {
+        if (!get_input_string(prompt, buf, sizeof(buf))) {
+            return 0; /* User cancelled */
+        }
+
+        if (parse_int_safe(buf, value)) {
+            if (*value < min_val || *value > max_val) {
+                char err_msg[128];
+                snprintf(err_msg, sizeof(err_msg), "Value must be between %d and %d", min_val, max_val);
+                show_message(state, err_msg, 1);
+                attempts++;
+                continue;
+            }
+            return 1;
+        }
+
+        show_message(state, "Invalid number! Please enter a valid integer.", 1);
+        attempts++;
+    }
+
+    show_message(state, "Too many invalid attempts. Cancelled.", 1);
+    return 0;
+}
+
+int get_input_char(const char* prompt, const char* allowed) {
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvprintw(LINES-2, 0, "%s", prompt);
+    clrtoeol();
+    attroff(COLOR_PAIR(COLOR_HEADER));
+    while(1) {
+        int ch = getch();
+        if(ch == 27) return 0;
+        if(strchr(allowed, tolower(ch))) return ch;
+    }
+}
+
+int get_input_confirm(const char* prompt) {
+    int ch = get_input_char(prompt, "ynYN");
+    return (tolower(ch) == 'y');
+}
+
+void show_message(GameState* state, const char* msg, int is_error) {
+    if (!state) return;
+
+    if (state->suppress_feedback) return;
+
+    /* No screen in batch mode - surface errors on stderr instead */
+    if (state->headless) {
+        if (is_error) fprintf(state->err, "%s\n", msg);
+        return;
+    }
+
+    clear_old_messages(state);
+
+    /* Drop oldest message when queue is full (FIFO) */
+    if (state->message_queue_count >= MAX_MESSAGE_QUEUE) {
+        for (int i = 0; i < MAX_MESSAGE_QUEUE - 1; i++) {
+            state->message_queue[i] = state->message_queue[i + 1];
+        }
+        state->message_queue_count = MAX_MESSAGE_QUEUE - 1;
+    }
+
+    MessageQueueEntry* entry = &state->message_queue[state->message_queue_count];
+    strncpy(entry->text, msg, sizeof(entry->text) - 1);
+    entry->text[sizeof(entry->text) - 1] = '\0';
+    entry->is_error = is_error;
+    entry->timestamp = time(NULL);
+    state->message_queue_count++;
+}
+
+void clear_old_messages(GameState* state) {
+    if (!state) return;
+
+    time_t now = time(NULL);
+    int write_idx = 0;
+
+    for (int i = 0; i < state->message_queue_count; i++) {
+        double elapsed = difftime(now, state->message_queue[i].timestamp);
+        if (elapsed < MESSAGE_DISPLAY_DURATION_SECONDS) {
+            if (write_idx != i) {
+                state->message_queue[write_idx] = state->message_queue[i];
+            }
+            write_idx++;
+        }
+    }
+
+    state->message_queue_count = write_idx;
+}
+
+/**
+ * Draw message queue at the bottom of the screen.
+ * Uses a reserved area to prevent visual artifacts from clearing/redrawing.
+ */
+void draw_message_queue(GameState* state) {
+    if (!state || state->message_queue_count == 0) return;
+
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    /* Reserve bottom area to prevent message overlap with content */
+    int message_area_start = rows - MAX_MESSAGE_QUEUE - 1;
+    if (message_area_start < 0) message_area_start = 0;
+
+    /* Draw newest messages at bottom, older ones above */
+    int y = rows - 1;
+    for (int i = state->message_queue_count - 1; i >= 0 && y >= message_area_start; i--) {
+        MessageQueueEntry* entry = &state->message_queue[i];
+        int pair = entry->is_error ? COLOR_MSG_ERROR : COLOR_MSG_SUCCESS;
+
+        int text_len = (int)strlen(entry->text);
+        int x_start = cols / 2 - text_len / 2 - 1;
+        if (x_start < 0) x_start = 0;
+        if (x_start + text_len + 2 > cols) x_start = cols - text_len - 2;
+
+        move(y, 0);
+        clrtoeol();
+
+        attron(COLOR_PAIR(pair) | A_BOLD);
+        mvprintw(y, x_start, " %s ", entry->text);
+        attroff(COLOR_PAIR(pair) | A_BOLD);
+        y--;
+    }
+
+    while (y >= message_area_start && y >= 0) {
+        move(y, 0);
+        clrtoeol();
+        y--;
+    }
+}
+
+ /* --- Player View Functions --- */
+
+/* One segment per user, so two people on one machine never collide */
+void view_shm_name(char* buf, size_t size) {
+    snprintf(buf, size, "%s.%ld", VIEW_SHM_PREFIX, (long)getuid());
+}
+
+/**
+ * Create the shared-memory player view. Publishing is best effort: if the
+ * segment cannot be created, or another live tracker already owns it, the
+ * tracker simply runs without one.
+ */
+void view_open(GameState* state) {
+    view_shm_name(state->view_name, sizeof(state->view_name));
+    int fd = shm_open(state->view_name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return;
+
+    ViewSnapshot* shm = NULL;
+    if (ftruncate(fd, (off_t)sizeof(ViewSnapshot)) == 0) {
+        void* map = mmap(NULL, sizeof(ViewSnapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) shm = (ViewSnapshot*)map;
+    }
+    close(fd);
+    if (!shm) return;
+
+    /* A seqlock has one writer - leave a segment a running tracker still owns */
+    int owner = shm->data.writer_pid;
+    if (shm->magic == VIEW_MAGIC && owner > 0 && owner != (int)getpid() && kill((pid_t)owner, 0) == 0) {
+        munmap(shm, sizeof(ViewSnapshot));
+        return;
+    }
+
+    uint64_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+    atomic_store_explicit(&shm->seq, (seq | 1) + 2, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memset(&shm->data, 0, sizeof(shm->data));
+    shm->magic = VIEW_MAGIC;
+    shm->size = (uint32_t)sizeof(ViewSnapshot);
+    atomic_store_explicit(&shm->seq, (seq | 1) + 3, memory_order_release);
+    state->view = shm;
+}
+
+/**
+ * Build the player-safe snapshot. Large encounters publish the
+ * VIEW_MAX_ENTRIES combatants starting at the current turn.
+ */
+void view_fill(GameState* state, ViewData* data) {
+    memset(data, 0, sizeof(*data));
+    data->writer_pid = (int)getpid();
+    data->round = state->round;
+    data->total = state->count;
+
+    int n = state->count < VIEW_MAX_ENTRIES ? state->count : VIEW_MAX_ENTRIES;
+    int first = 0;
+    if (state->count > VIEW_MAX_ENTRIES) {
+        int current = get_index_by_id(state, state->current_turn_id);
+        if (current > 0) first = current;
+    }
+
+    for (int k = 0; k < n; k++) {
+        Combatant* c = &state->combatants[(first + k) % state->count];
+        ViewEntry* e = &data->entries[k];
+        memcpy(e->name, c->name, strnlen(c->name, NAME_LENGTH - 1));
+        e->id = c->id;
+        e->type = (uint8_t)c->type;
+        e->conditions = (uint32_t)(c->effects & VIEW_CONDITION_MASK);
+        if (c->id == state->current_turn_id) e->flags |= VIEW_CURRENT;
+        if (c->is_stable) e->flags |= VIEW_STABLE;
+        if (c->mob_size > 0) {
+            e->flags |= VIEW_MOB;
+            e->mob_alive = (uint16_t)mob_alive_count(state, c);
+        }
+
+        if (c->type == TYPE_PLAYER) {
+            e->hp = c->hp;
+            e->max_hp = c->max_hp;
+            e->death_successes = (uint8_t)c->death_save_successes;
+            e->death_failures = (uint8_t)c->death_save_failures;
+            if (c->is_dead) e->band = HP_BAND_DEAD;
+            else if (c->hp <= 0) e->band = HP_BAND_UNCONSCIOUS;
+            else if (c->hp <= c->max_hp / 4) e->band = HP_BAND_CRITICAL;
+            else if (c->hp <= c->max_hp / 2) e->band = HP_BAND_HURT;
+            else e->band = HP_BAND_GOOD;
+        } else {
+            /* Players may learn an enemy is bloodied, nothing finer */
+            if (c->is_dead || c->hp <= 0) e->band = HP_BAND_DEAD;
+            else if (c->hp <= c->max_hp / 2) e->band = HP_BAND_HURT;
+            else e->band = HP_BAND_GOOD;
+        }
+    }
+    data->count = n;
+}
+
+/**
+ * Publish the current state to the shared-memory view and the broadcast
+ * stream, if either changed. The tracker never waits on viewers: the
+ * shared-memory write is two counter stores around a copy, and the stream
+ * only gets a copy handed to its thread.
+ */
+void view_publish(GameState* state) {
+    TRACE_SCOPE("view_publish");
+    if (!state->view && !state->broadcast) return;
+    ViewData next;
+    view_fill(state, &next);
+    if (state->broadcast) broadcast_submit(state->broadcast, &next);
+    if (!state->view || memcmp(&next, &state->view->data, sizeof(next)) == 0) return;
+
+    ViewSnapshot* shm = state->view;
+    uint64_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+    atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&shm->data, &next, sizeof(next));
+    atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+}
+
+/* Tell viewers the tracker is gone, then remove the segment */
+void view_close(GameState* state) {
+    if (!state->view) return;
+    ViewSnapshot* shm = state->view;
+    uint64_t seq = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+    atomic_store_explicit(&shm->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    shm->data.writer_pid = 0;
+    atomic_store_explicit(&shm->seq, seq + 2, memory_order_release);
+
+    munmap(shm, sizeof(ViewSnapshot));
+    shm_unlink(state->view_name);
+    state->view = NULL;
+}
+
+/**
+ * Map the current user's player view read-only.
+ *
+ * @return The segment, or NULL if no compatible tracker is publishing
+ */
+ViewSnapshot* view_attach(void) {
+    char name[64];
+    view_shm_name(name, sizeof(name));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ViewSnapshot)) {
+        map = mmap(NULL, sizeof(ViewSnapshot), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    ViewSnapshot* shm = (ViewSnapshot*)map;
+    if (shm->magic != VIEW_MAGIC || shm->size != sizeof(ViewSnapshot)) {
+        munmap(map, sizeof(ViewSnapshot));
+        return NULL;
+    }
+    return shm;
+}
+
+/**
+ * Copy a consistent snapshot if one newer than *seq is available. Gives up
+ * after a few torn reads rather than spinning - the next poll will retry.
+ *
+ * @return 1 if `out` was updated
+ */
+int view_read(ViewSnapshot* shm, ViewData* out, uint64_t* seq) {
+    static ViewData scratch;
+    for (int attempt = 0; attempt < 16; attempt++) {
+        uint64_t before = atomic_load_explicit(&shm->seq, memory_order_acquire);
+        if (before == *seq) return 0;
+        if (before & 1) continue;
+        memcpy(&scratch, &shm->data, sizeof(scratch));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shm->seq, memory_order_relaxed) == before) {
+            memcpy(out, &scratch, sizeof(*out));
+            *seq = before;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Render the player view, or a waiting screen when `data` is NULL.
+ */
+void draw_viewer(const ViewData* data) {
+    erase();
+    int max_y = getmaxy(stdscr);
+    int max_x = getmaxx(stdscr);
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    mvhline(0, 0, ' ', max_x);
+    if (data) mvprintw(0, 1, "Initiative - Round %d", data->round);
+    else mvprintw(0, 1, "Initiative");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+
+    if (!data) {
+        mvprintw(2, 2, "Waiting for the tracker...  (q to quit)");
+        refresh();
+        return;
+    }
+
+    int y = 2;
+    for (int i = 0; i < data->count && y < max_y - 1; i++, y++) {
+        const ViewEntry* e = &data->entries[i];
+        int current = (e->flags & VIEW_CURRENT) != 0;
+        if (current) {
+            attron(COLOR_PAIR(COLOR_ACTIVE_ROW) | A_BOLD);
+            mvhline(y, 0, ' ', max_x);
+            mvprintw(y, 1, ">");
+        } else {
+            attron(COLOR_PAIR(e->type == TYPE_PLAYER ? COLOR_NAME_PLAYER : COLOR_NAME_ENEMY));
+        }
+        if (e->flags & VIEW_MOB) mvprintw(y, 3, "%-20s x%-4d", e->name, e->mob_alive);
+        else mvprintw(y, 3, "%-26s", e->name);
+        if (current) attroff(COLOR_PAIR(COLOR_ACTIVE_ROW) | A_BOLD);
+        else attroff(COLOR_PAIR(e->type == TYPE_PLAYER ? COLOR_NAME_PLAYER : COLOR_NAME_ENEMY));
+
+        static const int band_colors[] = {
+            COLOR_HP_GOOD, COLOR_HP_HURT, COLOR_HP_CRITICAL, COLOR_HP_UNCONSCIOUS, COLOR_DEAD
+        };
+        int color = band_colors[e->band <= HP_BAND_DEAD ? e->band : HP_BAND_GOOD];
+        attron(COLOR_PAIR(color));
+        if (e->type == TYPE_PLAYER && e->band == HP_BAND_UNCONSCIOUS) {
+            if (e->flags & VIEW_STABLE) mvprintw(y, 31, "%-14s", "Stable");
+            else mvprintw(y, 31, "Dying S:%d F:%d ", e->death_successes, e->death_failures);
+        } else if (e->type == TYPE_PLAYER && e->band != HP_BAND_DEAD) {
+            mvprintw(y, 31, "HP %4d/%-5d", e->hp, e->max_hp);
+        } else {
+            static const char* enemy_labels[] = { "Healthy", "Bloodied", "Bloodied", "Down", "Dead" };
+            mvprintw(y, 31, "%-14s", enemy_labels[e->band <= HP_BAND_DEAD ? e->band : 0]);
+        }
+        attroff(COLOR_PAIR(color));
+
+        int x = 46;
+        for (int j = 0; j < NUM_CONDITIONS && x < max_x - 1; j++) {
+            if (!(e->conditions & (1u << j))) continue;
+            const char* cond = get_condition_name(j);
+            mvprintw(y, x, "%.*s", max_x - 1 - x, cond);
+            x += (int)strlen(cond) + 1;
+        }
+    }
+    if (data->total > data->count && y < max_y) {
+        mvprintw(y, 3, "... %d more", data->total - data->count);
+    }
+    refresh();
+}
+
+/**
+ * Player-facing screen. Without an address it follows this machine's
+ * shared-memory view; with one it follows a --broadcast stream. Either way
+ * it reconnects when the tracker starts or restarts.
+ *
+ * @return Process exit status
+ */
+int run_viewer(const char* address) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (address && !broadcast_address(address, &addr, &addr_len)) {
+        fprintf(stderr, "viewer: invalid address '%s' (use a port or a socket path)\n", address);
+        return 2;
+    }
+
+    initscr();
+    cbreak();
+    noecho();
+    keypad(stdscr, TRUE);
+    curs_set(0);
+    timeout(VIEW_POLL_MS);
+    if (has_colors()) {
+        start_color();
+        init_colors();
+    }
+
+    static ViewData data;
+    static ViewData shown;
+    static char stream_buf[65536];
+    size_t stream_len = 0;
+    int stream_fd = -1;
+    int frame_state = 0;
+    uint64_t version = UINT64_MAX;
+    ViewSnapshot* shm = NULL;
+    uint64_t seq = 0;
+    int have = 0;
+    int dirty = 1;
+    for (;;) {
+        if (address) {
+            if (stream_fd < 0) {
+                stream_fd = view_stream_connect(&addr, addr_len);
+                stream_len = 0;
+                frame_state = 0;
+                version = UINT64_MAX;
+            }
+            int got = stream_fd < 0 ? 0 : view_stream_poll(stream_fd, stream_buf, &stream_len, sizeof(stream_buf),
+                                                           &data, &version, &frame_state);
+            if (got > 0) {
+                /* Show complete frames only - `data` is mid-update between them */
+                memcpy(&shown, &data, sizeof(shown));
+                have = 1;
+                dirty = 1;
+            } else if (got < 0) {
+                close(stream_fd);
+                stream_fd = -1;
+                have = 0;
+                dirty = 1;
+            }
+        } else if (!shm) {
+            shm = view_attach();
+            seq = 0;
+        }
+        if (shm) {
+            if (view_read(shm, &data, &seq)) {
+                have = 1;
+                dirty = 1;
+            }
+            /* writer_pid 0 means a clean exit; a dead pid means a crash */
+            if (have && (data.writer_pid == 0 || kill((pid_t)data.writer_pid, 0) != 0)) {
+                munmap(shm, sizeof(ViewSnapshot));
+                shm = NULL;
+                have = 0;
+                dirty = 1;
+            }
+        }
+        if (dirty) {
+            draw_viewer(have ? (address ? &shown : &data) : NULL);
+            dirty = 0;
+        }
+
+        int ch = getch();
+        if (ch == 'q' || ch == 'Q') break;
+        if (ch == KEY_RESIZE) dirty = 1;
+    }
+
+    if (shm) munmap(shm, sizeof(ViewSnapshot));
+    if (stream_fd >= 0) close(stream_fd);
+    endwin();
+    return 0;
+}
+
+/**
+ * Connect to a broadcast stream without blocking the viewer for long.
+ *
+ * @return Non-blocking socket, or -1 if nobody is broadcasting there
+ */
+int view_stream_connect(const struct sockaddr_storage* addr, socklen_t addr_len) {
+    int fd = socket(addr->ss_family, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (const struct sockaddr*)addr, addr_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * Read whatever the stream has and apply every complete line.
+ *
+ * @return 1 if at least one frame completed, 0 if not, -1 if the stream ended
+ */
+int view_stream_poll(int fd, char* buf, size_t* len, size_t cap, ViewData* data, uint64_t* version, int* frame_state) {
+    int completed = 0;
+    for (;;) {
+        ssize_t n = read(fd, buf + *len, cap - *len - 1);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return completed;
+            return -1;
+        }
+        *len += (size_t)n;
+
+        size_t start = 0;
+        for (size_t i = start; i < *len; i++) {
+            if (buf[i] != '\n') continue;
+            buf[i] = '\0';
+            if (view_apply_line(data, buf + start, version, frame_state)) completed = 1;
+            start = i + 1;
+        }
+        memmove(buf, buf + start, *len - start);
+        *len -= start;
+        if (*len == cap - 1) return -1; /* A line longer than the buffer is not our protocol */
+    }
+}
+
+ /* --- Broadcast Functions --- */
+
+/*
+ * Spectator stream: text frames, each ending with a "." line.
+ *
+ *   K <version> <round> <total> <count>   keyframe, then <count> lines
+ *   C <entry>                             in turn order
+ *   D <version> <round> <total>           delta against <version> - 1, then events:
+ *     H <id> <band> <hp> <max_hp> <flags> <mob_alive> <ds> <df>   HP and status
+ *     S <id> <conditions>                  standard conditions (hex bitmask)
+ *     T <id>                               turn moved (0: nobody)
+ *     A <entry>                            added
+ *     R <id>                               removed
+ *     N <id> <name>                        renamed
+ *     O <id>...                            new turn order
+ *
+ * <entry> is "<id> <P|E> <band> <hp> <max_hp> <flags> <conditions> <mob_alive>
+ * <ds> <df> <name>". Spectators get a keyframe on connect and every
+ * BROADCAST_KEYFRAME_INTERVAL frames; one that misses a version waits for
+ * the next keyframe. The content is the player-safe view from view_fill.
+ */
+
+/**
+ * Parse a broadcast address: a port number means TCP on 127.0.0.1 only,
+ * anything else is a Unix socket path.
+ *
+ * @return 1 on success
+ */
+int broadcast_address(const char* address, struct sockaddr_storage* addr, socklen_t* len) {
+    memset(addr, 0, sizeof(*addr));
+    int port = 0;
+    if (parse_int_safe(address, &port)) {
+        if (port < 1 || port > 65535) return 0;
+        struct sockaddr_in* in = (struct sockaddr_in*)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *len = (socklen_t)sizeof(*in);
+        return 1;
+    }
+    struct sockaddr_un* un = (struct sockaddr_un*)addr;
+    if (strlen(address) >= sizeof(un->sun_path)) return 0;
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, address, strlen(address) + 1);
+    *len = (socklen_t)sizeof(*un);
+    return 1;
+}
+
+/**
+ * Make way to bind a Unix socket at `addr`. A stale socket file left by a
+ * crashed process is removed; a live listener or anything that is not a
+ * socket is left alone and reported on stderr, prefixed with `who`.
+ *
+ * @return 1 if the path is free to bind
+ */
+int unix_socket_reclaim(const char* who, const struct sockaddr_un* addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0) return 1;
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s: %s exists and is not a socket\n", who, addr->sun_path);
+        return 0;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (const struct sockaddr*)addr, sizeof(*addr)) == 0) {
+        close(probe);
+        fprintf(stderr, "%s: something is already listening on %s\n", who, addr->sun_path);
+        return 0;
+    }
+    if (probe >= 0) close(probe);
+    unlink(addr->sun_path);
+    return 1;
+}
+
+int broadcast_appendf(BroadcastBuffer* buf, const char* fmt, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        size_t room = buf->cap - buf->len;
+        int n = vsnprintf(buf->data ? buf->data + buf->len : NULL, room, fmt, args);
+        va_end(args);
+        if (n < 0) return 0;
+        if ((size_t)n < room) {
+            buf->len += (size_t)n;
+            return 1;
+        }
+        size_t new_cap = buf->cap ? buf->cap * 2 : 4096;
+        while (new_cap - buf->len <= (size_t)n) new_cap *= 2;
+        char* grown = (char*)realloc(buf->data, new_cap);
+        if (!grown) return 0;
+        buf->data = grown;
+        buf->cap = new_cap;
+    }
+}
+
+void broadcast_encode_entry(BroadcastBuffer* buf, const ViewEntry* e) {
+    broadcast_appendf(buf, "%d %c %u %d %d %u %x %u %u %u %s\n", e->id, e->type == TYPE_PLAYER ? 'P' : 'E',
+        e->band, e->hp, e->max_hp, e->flags, e->conditions, e->mob_alive, e->death_successes,
+        e->death_failures, e->name);
+}
+
+/* Encode the keyframe for the current version unless it is already cached */
+void broadcast_encode_keyframe(Broadcaster* b) {
+    if (b->keyframe_version == b->version && b->keyframe.len > 0) return;
+    const ViewData* d = &b->published;
+    b->keyframe.len = 0;
+    broadcast_appendf(&b->keyframe, "K %llu %d %d %d\n", (unsigned long long)b->version, d->round, d->total, d->count);
+    for (int i = 0; i < d->count; i++) {
+        broadcast_appendf(&b->keyframe, "C ");
+        broadcast_encode_entry(&b->keyframe, &d->entries[i]);
+    }
+    broadcast_appendf(&b->keyframe, ".\n");
+    b->keyframe_version = b->version;
+}
+
+int view_find_entry(const ViewData* data, int id) {
+    for (int i = 0; i < data->count; i++) {
+        if (data->entries[i].id == id) return i;
+    }
+    return -1;
+}
+
+/**
+ * Encode the events that turn `old` into `cur`. Entries are matched by id;
+ * the common case of an unchanged order is compared position by position.
+ */
+void broadcast_encode_delta(Broadcaster* b, const ViewData* old, const ViewData* cur) {
+    BroadcastBuffer* buf = &b->delta;
+    buf->len = 0;
+    broadcast_appendf(buf, "D %llu %d %d\n", (unsigned long long)b->version, cur->round, cur->total);
+
+    int same_order = old->count == cur->count;
+    for (int i = 0; same_order && i < cur->count; i++) {
+        if (old->entries[i].id != cur->entries[i].id) same_order = 0;
+    }
+    if (!same_order) {
+        for (int i = 0; i < old->count; i++) {
+            if (view_find_entry(cur, old->entries[i].id) < 0) broadcast_appendf(buf, "R %d\n", old->entries[i].id);
+        }
+    }
+
+    int old_turn = 0, cur_turn = 0;
+    for (int i = 0; i < old->count; i++) {
+        if (old->entries[i].flags & VIEW_CURRENT) old_turn = old->entries[i].id;
+    }
+    for (int i = 0; i < cur->count; i++) {
+        const ViewEntry* e = &cur->entries[i];
+        if (e->flags & VIEW_CURRENT) cur_turn = e->id;
+        int j = same_order ? i : view_find_entry(old, e->id);
+        if (j < 0) {
+            broadcast_appendf(buf, "A ");
+            broadcast_encode_entry(buf, e);
+            continue;
+        }
+        const ViewEntry* o = &old->entries[j];
+        if (strcmp(o->name, e->name) != 0) broadcast_appendf(buf, "N %d %s\n", e->id, e->name);
+        if (o->band != e->band || o->hp != e->hp || o->max_hp != e->max_hp || o->mob_alive != e->mob_alive ||
+            ((o->flags ^ e->flags) & ~VIEW_CURRENT) || o->death_successes != e->death_successes ||
+            o->death_failures != e->death_failures) {
+            broadcast_appendf(buf, "H %d %u %d %d %u %u %u %u\n", e->id, e->band, e->hp, e->max_hp,
+                e->flags & ~VIEW_CURRENT, e->mob_alive, e->death_successes, e->death_failures);
+        }
+        if (o->conditions != e->conditions) broadcast_appendf(buf, "S %d %x\n", e->id, e->conditions);
+    }
+
+    if (!same_order) {
+        broadcast_appendf(buf, "O");
+        for (int i = 0; i < cur->count; i++) broadcast_appendf(buf, " %d", cur->entries[i].id);
+        broadcast_appendf(buf, "\n");
+    }
+    if (old_turn != cur_turn) broadcast_appendf(buf, "T %d\n", cur_turn);
+    broadcast_appendf(buf, ".\n");
+}
+
+#ifdef SERVER_EPOLL
+
+/**
+ * Start streaming the player view on `address` (see broadcast_address).
+ *
+ * @return The broadcaster, or NULL on error (reported on stderr)
+ */
+Broadcaster* broadcast_start(const char* address) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (!broadcast_address(address, &addr, &addr_len)) {
+        fprintf(stderr, "broadcast: invalid address '%s' (use a port or a socket path)\n", address);
+        return NULL;
+    }
+
+    if (addr.ss_family == AF_UNIX && !unix_socket_reclaim("broadcast", (struct sockaddr_un*)&addr)) return NULL;
+
+    Broadcaster* b = (Broadcaster*)calloc(1, sizeof(Broadcaster));
+    if (!b) return NULL;
+    b->listen_fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (addr.ss_family == AF_UNIX) {
+        /* broadcast_address checked the length, so sun_path is terminated and fits */
+        memcpy(b->unix_path, ((struct sockaddr_un*)&addr)->sun_path, sizeof(b->unix_path));
+    } else if (b->listen_fd >= 0) {
+        int one = 1;
+        setsockopt(b->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (b->listen_fd < 0 || bind(b->listen_fd, (struct sockaddr*)&addr, addr_len) != 0 ||
+        listen(b->listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "broadcast: cannot listen on %s: %s\n", address, strerror(errno));
+        if (b->listen_fd >= 0) close(b->listen_fd);
+        free(b);
+        return NULL;
+    }
+    fcntl(b->listen_fd, F_SETFL, fcntl(b->listen_fd, F_GETFL) | O_NONBLOCK);
+
+    b->epoll_fd = epoll_create1(0);
+    if (b->epoll_fd < 0 || pipe(b->wake_pipe) != 0) {
+        fprintf(stderr, "broadcast: %s\n", strerror(errno));
+        close(b->listen_fd);
+        if (b->epoll_fd >= 0) close(b->epoll_fd);
+        free(b);
+        return NULL;
+    }
+    fcntl(b->wake_pipe[0], F_SETFL, fcntl(b->wake_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(b->wake_pipe[1], F_SETFL, fcntl(b->wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &b->listen_fd;
+    epoll_ctl(b->epoll_fd, EPOLL_CTL_ADD, b->listen_fd, &ev);
+    ev.data.ptr = &b->wake_pipe[0];
+    epoll_ctl(b->epoll_fd, EPOLL_CTL_ADD, b->wake_pipe[0], &ev);
+
+    b->keyframe_version = UINT64_MAX;
+    atomic_init(&b->wake_pending, 0);
+    pthread_mutex_init(&b->lock, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if (pthread_create(&b->thread, NULL, broadcast_thread, b) != 0) {
+        fprintf(stderr, "broadcast: cannot start thread\n");
+        close(b->listen_fd);
+        close(b->epoll_fd);
+        close(b->wake_pipe[0]);
+        close(b->wake_pipe[1]);
+        pthread_mutex_destroy(&b->lock);
+        if (b->unix_path[0]) unlink(b->unix_path);
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+/**
+ * DM-thread side: hand a snapshot to the broadcaster if it changed. Costs
+ * one copy under an uncontended lock; snapshots handed over faster than
+ * the thread sends them are coalesced.
+ */
+void broadcast_submit(Broadcaster* b, const ViewData* data) {
+    if (b->has_submitted && memcmp(data, &b->submitted, sizeof(*data)) == 0) return;
+    memcpy(&b->submitted, data, sizeof(*data));
+    b->has_submitted = 1;
+
+    pthread_mutex_lock(&b->lock);
+    memcpy(&b->pending, data, sizeof(*data));
+    b->pending_seq++;
+    pthread_mutex_unlock(&b->lock);
+    b->wake_due = 1;
+}
+
+/**
+ * Wake the broadcaster for the snapshots submitted since the last kick.
+ * The TUI calls this just before it blocks for input: a woken thread can
+ * preempt its waker on a busy core, so fan-out waits until the DM loop is
+ * idle rather than landing in the middle of a key handler.
+ *
+ * @return 1 if it wrote to the wake pipe
+ */
+int broadcast_kick(Broadcaster* b) {
+    if (!b || !b->wake_due) return 0;
+    b->wake_due = 0;
+    if (atomic_exchange(&b->wake_pending, 1)) return 0;
+    char byte = 1;
+    ssize_t ignored = write(b->wake_pipe[1], &byte, 1);
+    (void)ignored;
+    return 1;
+}
+
+void broadcast_stop(Broadcaster* b) {
+    if (!b) return;
+    pthread_mutex_lock(&b->lock);
+    b->stop = 1;
+    pthread_mutex_unlock(&b->lock);
+    char byte = 1;
+    ssize_t ignored = write(b->wake_pipe[1], &byte, 1);
+    (void)ignored;
+    pthread_join(b->thread, NULL);
+
+    while (b->client_count > 0) broadcast_drop_client(b, b->clients[0]);
+    free(b->clients);
+    free(b->delta.data);
+    free(b->keyframe.data);
+    close(b->listen_fd);
+    close(b->epoll_fd);
+    close(b->wake_pipe[0]);
+    close(b->wake_pipe[1]);
+    pthread_mutex_destroy(&b->lock);
+    if (b->unix_path[0]) unlink(b->unix_path);
+    free(b);
+}
+
+void broadcast_accept(Broadcaster* b) {
+    for (;;) {
+        int fd = accept(b->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (b->unix_path[0] == '\0') {
+            /* Deltas are tiny; don't let Nagle hold them back */
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        if (b->client_count == b->client_capacity) {
+            int new_capacity = b->client_capacity ? b->client_capacity * 2 : 16;
+            BroadcastClient** grown = (BroadcastClient**)realloc(b->clients, (size_t)new_capacity * sizeof(BroadcastClient*));
+            if (!grown) {
+                close(fd);
+                continue;
+            }
+            b->clients = grown;
+            b->client_capacity = new_capacity;
+        }
+        BroadcastClient* client = (BroadcastClient*)calloc(1, sizeof(BroadcastClient));
+        if (!client) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        if (epoll_ctl(b->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(client);
+            continue;
+        }
+        b->clients[b->client_count++] = client;
+
+        broadcast_encode_keyframe(b);
+        b->keyframes++;
+        broadcast_send(b, client, &b->keyframe);
+    }
+}
+
+void broadcast_drop_client(Broadcaster* b, BroadcastClient* client) {
+    epoll_ctl(b->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    for (int i = 0; i < b->client_count; i++) {
+        if (b->clients[i] == client) {
+            b->clients[i] = b->clients[--b->client_count];
+            break;
+        }
+    }
+    free(client->out);
+    free(client);
+}
+
+/**
+ * @return 0 if the connection failed
+ */
+int broadcast_flush(Broadcaster* b, BroadcastClient* client) {
+    while (client->out_off < client->out_len) {
+        ssize_t n = send(client->fd, client->out + client->out_off, client->out_len - client->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return 0;
+            break;
+        }
+        client->out_off += (size_t)n;
+    }
+    int want_out = client->out_off < client->out_len;
+    if (!want_out) client->out_off = client->out_len = 0;
+    if (want_out != client->want_out) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = want_out ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.ptr = client;
+        if (epoll_ctl(b->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) != 0) return 0;
+        client->want_out = want_out;
+    }
+    return 1;
+}
+
+/**
+ * Queue a frame for one spectator. A spectator too far behind to catch up
+ * is dropped; reconnecting gets it a fresh keyframe.
+ */
+void broadcast_send(Broadcaster* b, BroadcastClient* client, const BroadcastBuffer* frame) {
+    size_t backlog = client->out_len - client->out_off;
+    if (backlog + frame->len > BROADCAST_MAX_PENDING) {
+        b->dropped++;
+        broadcast_drop_client(b, client);
+        return;
+    }
+    int was_idle = backlog == 0;
+    if (client->out_len + frame->len > client->out_cap) {
+        size_t new_cap = client->out_cap ? client->out_cap : 4096;
+        while (new_cap < client->out_len + frame->len) new_cap *= 2;
+        char* grown = (char*)realloc(client->out, new_cap);
+        if (!grown) {
+            broadcast_drop_client(b, client);
+            return;
+        }
+        client->out = grown;
+        client->out_cap = new_cap;
+    }
+    memcpy(client->out + client->out_len, frame->data, frame->len);
+    client->out_len += frame->len;
+    b->bytes_queued += (long long)frame->len;
+    /* A client already waiting on EPOLLOUT is flushed when writable */
+    if (was_idle && !broadcast_flush(b, client)) broadcast_drop_client(b, client);
+}
+
+/* Pick up the DM thread's latest snapshot and fan the frame out */
+void broadcast_take_snapshot(Broadcaster* b) {
+    TRACE_SCOPE("broadcast_take_snapshot");
+    pthread_mutex_lock(&b->lock);
+    int fresh = b->pending_seq != b->taken_seq;
+    if (fresh) {
+        memcpy(&b->incoming, &b->pending, sizeof(b->incoming));
+        b->taken_seq = b->pending_seq;
+    }
+    pthread_mutex_unlock(&b->lock);
+    if (!fresh || memcmp(&b->incoming, &b->published, sizeof(b->incoming)) == 0) return;
+
+    b->version++;
+    const BroadcastBuffer* frame;
+    if (++b->frames_since_keyframe >= BROADCAST_KEYFRAME_INTERVAL) {
+        memcpy(&b->published, &b->incoming, sizeof(b->published));
+        broadcast_encode_keyframe(b);
+        b->frames_since_keyframe = 0;
+        b->keyframes++;
+        frame = &b->keyframe;
+    } else {
+        broadcast_encode_delta(b, &b->published, &b->incoming);
+        memcpy(&b->published, &b->incoming, sizeof(b->published));
+        frame = &b->delta;
+    }
+    b->frames++;
+
+    /* Iterate backwards: broadcast_send may drop (swap-remove) the current client */
+    for (int i = b->client_count - 1; i >= 0; i--) {
+        if (i < b->client_count) broadcast_send(b, b->clients[i], frame);
+    }
+}
+
+void* broadcast_thread(void* arg) {
+    Broadcaster* b = (Broadcaster*)arg;
+    trace_thread_name("broadcast");
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(b->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        /* A new frame can drop any spectator, so it is sent only after every
+         * event in this batch - no later event may refer to a freed client */
+        int woken = 0;
+        for (int i = 0; i < n; i++) {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &b->listen_fd) {
+                broadcast_accept(b);
+            } else if (ptr == &b->wake_pipe[0]) {
+                woken = 1;
+            } else {
+                BroadcastClient* client = (BroadcastClient*)ptr;
+                int ok = 1;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    /* Spectators have nothing to say; input only signals a close */
+                    char discard[256];
+                    ssize_t got = read(client->fd, discard, sizeof(discard));
+                    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) ok = 0;
+                }
+                if (ok && (events[i].events & EPOLLOUT)) ok = broadcast_flush(b, client);
+                if (!ok) broadcast_drop_client(b, client);
+            }
+        }
+        if (woken) {
+            char drain[64];
+            while (read(b->wake_pipe[0], drain, sizeof(drain)) > 0) {}
+            atomic_store(&b->wake_pending, 0);
+            pthread_mutex_lock(&b->lock);
+            int stop = b->stop;
+            pthread_mutex_unlock(&b->lock);
+            if (stop) return NULL;
+            broadcast_take_snapshot(b);
+        }
+    }
+    return NULL;
+}
+
+#else
+
+Broadcaster* broadcast_start(const char* address) {
+    (void)address;
+    fprintf(stderr, "broadcast: needs epoll (Linux)\n");
+    return NULL;
+}
+
+void broadcast_submit(Broadcaster* b, const ViewData* data) {
+    (void)b;
+    (void)data;
+}
+
+int broadcast_kick(Broadcaster* b) {
+    (void)b;
+    return 0;
+}
+
+void broadcast_stop(Broadcaster* b) {
+    (void)b;
+}
+
+#endif /* SERVER_EPOLL */
+
+/**
+ * Parse "<id> <P|E> <band> <hp> <max_hp> <flags> <conditions> <mob_alive>
+ * <ds> <df> <name>".
+ *
+ * @return 1 on success
+ */
+int view_parse_entry(const char* text, ViewEntry* e) {
+    unsigned int band, flags, conditions, mob_alive, ds, df;
+    char type;
+    int name_at = 0;
+    memset(e, 0, sizeof(*e));
+    if (sscanf(text, "%d %c %u %d %d %u %x %u %u %u %n", &e->id, &type, &band, &e->hp, &e->max_hp,
+               &flags, &conditions, &mob_alive, &ds, &df, &name_at) < 10 || name_at == 0) return 0;
+    e->type = (uint8_t)(type == 'P' ? TYPE_PLAYER : TYPE_ENEMY);
+    e->band = (uint8_t)(band <= HP_BAND_DEAD ? band : HP_BAND_GOOD);
+    e->flags = (uint8_t)flags;
+    e->conditions = conditions & VIEW_CONDITION_MASK;
+    e->mob_alive = (uint16_t)mob_alive;
+    e->death_successes = (uint8_t)ds;
+    e->death_failures = (uint8_t)df;
+    snprintf(e->name, sizeof(e->name), "%s", text + name_at);
+    return 1;
+}
+
+/**
+ * Spectator side: apply one line of the stream to `data`.
+ *
+ * `frame_state` is 0 between frames, 1 inside a frame being applied and 2
+ * inside a frame being skipped (not yet synchronised, or a version gap).
+ *
+ * @return 1 when a frame was completed and `data` is ready to show
+ */
+int view_apply_line(ViewData* data, char* line, uint64_t* version, int* frame_state) {
+    unsigned long long v = 0;
+    int round = 0, total = 0, count = 0;
+    int id = 0;
+    char kind = line[0];
+    const char* rest = line[0] ? line + 1 : line;
+
+    if (kind == 'K') {
+        if (sscanf(rest, "%llu %d %d %d", &v, &round, &total, &count) != 4) return 0;
+        data->count = 0;
+        data->round = round;
+        data->total = total;
+        *version = v;
+        *frame_state = 1;
+        return 0;
+    }
+    if (kind == 'D') {
+        if (sscanf(rest, "%llu %d %d", &v, &round, &total) != 3) return 0;
+        int in_sync = *frame_state != 2 && *version != UINT64_MAX && v == *version + 1;
+        *frame_state = in_sync ? 1 : 2;
+        if (!in_sync) {
+            *version = UINT64_MAX; /* Wait for the next keyframe */
+            return 0;
+        }
+        *version = v;
+        data->round = round;
+        data->total = total;
+        return 0;
+    }
+    if (kind == '.') {
+        int applied = *frame_state == 1;
+        *frame_state = 0;
+        return applied;
+    }
+    if (*frame_state != 1) return 0;
+
+    ViewEntry entry;
+    int i;
+    switch (kind) {
+        case 'C':
+        case 'A':
+            if (data->count < VIEW_MAX_ENTRIES && view_parse_entry(rest, &entry)) data->entries[data->count++] = entry;
+            break;
+        case 'R':
+            if (sscanf(rest, "%d", &id) == 1 && (i = view_find_entry(data, id)) >= 0) {
+                memmove(&data->entries[i], &data->entries[i + 1], (size_t)(data->count - i - 1) * sizeof(ViewEntry));
+                data->count--;
+            }
+            break;
+        case 'H': {
+            unsigned int band, flags, mob_alive, ds, df;
+            int hp, max_hp;
+            if (sscanf(rest, "%d %u %d %d %u %u %u %u", &id, &band, &hp, &max_hp, &flags, &mob_alive, &ds, &df) == 8 &&
+                (i = view_find_entry(data, id)) >= 0) {
+                ViewEntry* e = &data->entries[i];
+                e->band = (uint8_t)(band <= HP_BAND_DEAD ? band : HP_BAND_GOOD);
+                e->hp = hp;
+                e->max_hp = max_hp;
+                e->flags = (uint8_t)((e->flags & VIEW_CURRENT) | (flags & ~(unsigned int)VIEW_CURRENT));
+                e->mob_alive = (uint16_t)mob_alive;
+                e->death_successes = (uint8_t)ds;
+                e->death_failures = (uint8_t)df;
+            }
+            break;
+        }
+        case 'S': {
+            unsigned int conditions;
+            if (sscanf(rest, "%d %x", &id, &conditions) == 2 && (i = view_find_entry(data, id)) >= 0) {
+                data->entries[i].conditions = conditions & VIEW_CONDITION_MASK;
+            }
+            break;
+        }
+        case 'N': {
+            int name_at = 0;
+            if (sscanf(rest, "%d %n", &id, &name_at) == 1 && name_at > 0 && (i = view_find_entry(data, id)) >= 0) {
+                snprintf(data->entries[i].name, sizeof(data->entries[i].name), "%s", rest + name_at);
+            }
+            break;
+        }
+        case 'T':
+            if (sscanf(rest, "%d", &id) == 1) {
+                for (i = 0; i < data->count; i++) {
+                    if (data->entries[i].id == id) data->entries[i].flags |= VIEW_CURRENT;
+                    else data->entries[i].flags &= (uint8_t)~VIEW_CURRENT;
+                }
+            }
+            break;
+        case 'O': {
+            static ViewEntry ordered[VIEW_MAX_ENTRIES];
+            int n = 0, consumed = 0;
+            const char* p = rest;
+            while (n < data->count && sscanf(p, "%d%n", &id, &consumed) == 1) {
+                p += consumed;
+                if ((i = view_find_entry(data, id)) >= 0) ordered[n++] = data->entries[i];
+            }
+            if (n == data->count) memcpy(data->entries, ordered, (size_t)n * sizeof(ViewEntry));
+            break;
+        }
+        default:
+            break;
+    }
+    return 0;
+}
+
+ /* --- Batch Mode --- */
+
+/**
+ * Run a command script without the TUI.
+ *
+ * Each line is one command, dispatched to the same core functions the key
+ * handlers use (including undo snapshots). Blank lines and lines starting
+ * with '#' are ignored. Errors are reported on stderr with line numbers and
+ * do not stop the script.
+ *
+ * @param script_path Path to the script, or "-" for stdin
+ * @return Process exit status: 0 if every command succeeded, 1 otherwise
+ */
+int run_batch(const char* script_path, int show_stats) {
+    FILE* f = (strcmp(script_path, "-") == 0) ? stdin : fopen(script_path, "r");
+    if (!f) {
+        fprintf(stderr, "batch: cannot open %s: %s\n", script_path, strerror(errno));
+        return 1;
+    }
+
+    GameState state;
+    init_state(&state);
+    state.headless = 1;
+    seed_commands(&state, (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char line[1024];
+    int line_no = 0;
+    int commands = 0;
+    int errors = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+
+        commands++;
+        if (!execute_batch_command(&state, p, line_no)) errors++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed_ms = (double)(end.tv_sec - start.tv_sec) * 1000.0 +
+                        (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+
+    if (f != stdin) fclose(f);
+    fprintf(stderr, "batch: %d commands, %d errors, %.3f ms\n", commands, errors, elapsed_ms);
+    if (show_stats) stats_print(&state, stderr);
+
+    cleanup_state(&state);
+    return errors > 0 ? 1 : 0;
+}
+
+/**
+ * Split off the next whitespace-delimited token, honouring "double quotes"
+ * so names containing spaces can be given. Inside quotes, \" and \\ stand
+ * for a literal quote and backslash; any other backslash is kept as is.
+ *
+ * @return Pointer to the token (terminated in place), or NULL at end of line
+ */
+char* batch_next_token(char** cursor) {
+    char* p = *cursor;
+    while (*p && isspace((unsigned char)*p)) p++;
+    if (*p == '\0') {
+        *cursor = p;
+        return NULL;
+    }
+
+    char* token;
+    if (*p == '"') {
+        token = ++p;
+        char* end = p;
+        while (*p && *p != '"') {
+            if (*p == '\\' && (p[1] == '"' || p[1] == '\\')) p++;
+            *end++ = *p++;
+        }
+        if (*p) p++;
+        *end = '\0';
+        *cursor = p;
+        return token;
+    } else {
+        token = p;
+        while (*p && !isspace((unsigned char)*p)) p++;
+    }
+
+    if (*p) *p++ = '\0';
+    *cursor = p;
+    return token;
+}
+
+/**
+ * Resolve a target token: "#<id>", "current", "selected", or an exact name.
+ *
+ * @return Index into state->combatants, or -1 if not found
+ */
+int batch_find_target(GameState* state, const char* token) {
+    if (!token) return -1;
+
+    if (token[0] == '#') {
+        int id;
+        if (!parse_int_safe(token + 1, &id)) return -1;
+        return get_index_by_id(state, id);
+    }
+    if (strcmp(token, "current") == 0) return get_index_by_id(state, state->current_turn_id);
+    if (strcmp(token, "selected") == 0) return get_index_by_id(state, state->selected_id);
+
+    for (int i = 0; i < state->count; i++) {
+        if (strcmp(state->combatants[i].name, token) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Execute one batch command. See README for the command reference.
+ *
+ * @return 1 on success, 0 on error (reported on state->err)
+ */
+int execute_batch_command(GameState* state, char* line, int line_no) {
+    TRACE_SCOPE("execute_batch_command");
+    char* cursor = line;
+    char* cmd = batch_next_token(&cursor);
+    if (!cmd) return 1;
+
+    /* Journal lines carry the seed their dice were rolled from, and when */
+    uint32_t seed = 0;
+    long long elapsed_ms = 0;
+    if (cmd[0] == '@') {
+        char* end = NULL;
+        unsigned long parsed = strtoul(cmd + 1, &end, 16);
+        if (*end == '+') elapsed_ms = strtoll(end + 1, &end, 10);
+        if (cmd[1] == '\0' || *end != '\0' || parsed == 0 || parsed > UINT32_MAX || elapsed_ms < 0) {
+            fprintf(state->err, "batch:%d: bad seed prefix '%s'\n", line_no, cmd);
+            return 0;
+        }
+        seed = (uint32_t)parsed;
+        cmd = batch_next_token(&cursor);
+        if (!cmd) return 1;
+    }
+
+    char* args[6] = {0};
+    int argc = 0;
+    while (argc < 6 && (args[argc] = batch_next_token(&cursor)) != NULL) argc++;
+
+    /* Commands that act on a combatant select it first, as the cursor would */
+    int idx = -1;
+    const char* targeted[] = {"damage", "heal", "hp", "condition", "duration", "init",
+                              "dup", "remove", "deathsave", "stabilize", "select", "mark",
+                              "mobhp", "unitcond", "togglemark"};
+    for (size_t i = 0; i < sizeof(targeted) / sizeof(targeted[0]); i++) {
+        if (strcmp(cmd, targeted[i]) == 0) {
+            idx = batch_find_target(state, args[0]);
+            if (idx == -1) {
+                fprintf(state->err, "batch:%d: %s: unknown combatant '%s'\n", line_no, cmd, args[0] ? args[0] : "");
+                return 0;
+            }
+            state->selected_id = state->combatants[idx].id;
+            break;
+        }
+    }
+
+    int value;
+    /* Mutations are built as commands and applied by the reducer */
+    Command command = make_command(CMD_ADD, idx != -1 ? state->combatants[idx].id : -1);
+    command.seed = seed;
+    command.elapsed_ms = elapsed_ms;
+
+    if (strcmp(cmd, "add") == 0) {
+        if (argc < 5 || (tolower((unsigned char)args[0][0]) != 'p' && tolower((unsigned char)args[0][0]) != 'e') ||
+            args[1][0] == '\0' || !parse_int_safe(args[2], &command.add.initiative) ||
+            !parse_int_safe(args[3], &command.add.dex) || !parse_int_safe(args[4], &command.add.max_hp) ||
+            command.add.max_hp < 1) {
+            fprintf(state->err, "batch:%d: usage: add <player|enemy> <name> <init> <dex> <max_hp>\n", line_no);
+            return 0;
+        }
+        command.add.type = (tolower((unsigned char)args[0][0]) == 'p') ? TYPE_PLAYER : TYPE_ENEMY;
+        strncpy(command.add.name, args[1], NAME_LENGTH - 1);
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "addmob") == 0) {
+        if (argc < 5 || args[0][0] == '\0' || !parse_int_safe(args[1], &command.add.initiative) ||
+            !parse_int_safe(args[2], &command.add.dex) || !parse_int_safe(args[3], &command.add.unit_hp) ||
+            !parse_int_safe(args[4], &command.add.mob_size)) {
+            fprintf(state->err, "batch:%d: usage: addmob <name> <init> <dex> <unit_hp> <units>\n", line_no);
+            return 0;
+        }
+        command.type = CMD_ADD_MOB;
+        command.add.type = TYPE_ENEMY;
+        strncpy(command.add.name, args[0], NAME_LENGTH - 1);
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "mobhp") == 0) {
+        Combatant* c = &state->combatants[idx];
+        MobTarget target = MOB_TARGET_UNIT;
+        int unit = -1;
+        if (argc >= 2) {
+            if (strcmp(args[1], "focus") == 0) target = MOB_TARGET_FOCUS;
+            else if (strcmp(args[1], "spread") == 0) target = MOB_TARGET_SPREAD;
+            else if (strcmp(args[1], "all") == 0) target = MOB_TARGET_ALL;
+            else if (parse_int_safe(args[1], &unit)) unit--;
+        }
+        if (c->mob_size == 0 || argc < 3 || !parse_int_safe(args[2], &value) ||
+            (target == MOB_TARGET_UNIT && (unit < 0 || unit >= c->mob_size))) {
+            fprintf(state->err, "batch:%d: usage: mobhp <mob> <unit#|focus|spread|all> <+/-change>\n", line_no);
+            return 0;
+        }
+        command.type = CMD_MOB_HP;
+        command.mob_hp.target = target;
+        command.mob_hp.unit = unit;
+        command.mob_hp.change = value;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "unitcond") == 0) {
+        Combatant* c = &state->combatants[idx];
+        int unit = 0;
+        /* Units carry built-in conditions only */
+        int cond = (argc >= 3) ? find_effect_by_name(state, args[2]) : -1;
+        if (c->mob_size == 0 || argc < 3 || !parse_int_safe(args[1], &unit) ||
+            unit < 1 || unit > c->mob_size || cond == -1 || cond >= NUM_CONDITIONS) {
+            fprintf(state->err, "batch:%d: usage: unitcond <mob> <unit#> <condition> [on|off]\n", line_no);
+            return 0;
+        }
+        uint16_t bits = state->mob_units[c->mob_first + unit - 1].conditions;
+        int active = !(bits & (1 << cond));
+        if (argc >= 4) active = (strcmp(args[3], "on") == 0);
+        command.type = CMD_UNIT_CONDITION;
+        command.condition.cond = cond;
+        command.condition.unit = unit - 1;
+        command.condition.active = active;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "damage") == 0 || strcmp(cmd, "heal") == 0 || strcmp(cmd, "hp") == 0) {
+        int is_hp = (strcmp(cmd, "hp") == 0);
+        if (argc < 2 || !parse_int_safe(args[1], &value) || (!is_hp && value < 0)) {
+            fprintf(state->err, "batch:%d: usage: %s <target> <%s>%s\n", line_no, cmd,
+                is_hp ? "+/-change" : "amount", strcmp(cmd, "damage") == 0 ? " [crit]" : "");
+            return 0;
+        }
+        if (cmd[0] == 'd') value = -value;
+        int is_crit = (argc >= 3 && strcmp(args[2], "crit") == 0);
+        command.type = CMD_HP;
+        command.hp.change = value;
+        command.hp.is_critical = is_crit;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "condition") == 0 || strcmp(cmd, "duration") == 0) {
+        int cond = (argc >= 2) ? find_effect_by_name(state, args[1]) : -1;
+        if (cond == -1) {
+            fprintf(state->err, "batch:%d: %s: unknown condition '%s'\n", line_no, cmd, argc >= 2 ? args[1] : "");
+            return 0;
+        }
+        Combatant* c = &state->combatants[idx];
+        int is_active = effect_test(state, c, cond);
+        if (cmd[0] == 'c') {
+            int active = !is_active;
+            if (argc >= 3) active = (strcmp(args[2], "on") == 0);
+            command.type = CMD_CONDITION;
+            command.condition.cond = cond;
+            command.condition.unit = -1;
+            command.condition.active = active;
+            return apply_command(state, &command);
+        }
+        ExpiryTiming timing = EXPIRE_ROUND_START;
+        if (argc >= 4) {
+            if (strcmp(args[3], "start") == 0) timing = EXPIRE_TURN_START;
+            else if (strcmp(args[3], "end") == 0) timing = EXPIRE_TURN_END;
+            else if (strcmp(args[3], "round") != 0) argc = 0;  /* Force the usage error below */
+        }
+        if (argc < 3 || !parse_int_safe(args[2], &value) || value < 0) {
+            fprintf(state->err, "batch:%d: usage: duration <target> <condition> <rounds> [round|start|end [anchor]]\n", line_no);
+            return 0;
+        }
+        if (!is_active) {
+            fprintf(state->err, "batch:%d: duration: %s is not active\n", line_no, effect_name(state, cond));
+            return 0;
+        }
+        /* Turn timings default to the combatant whose turn it is */
+        int anchor_id = state->current_turn_id;
+        if (argc >= 5) {
+            int anchor_idx = batch_find_target(state, args[4]);
+            if (anchor_idx == -1) {
+                fprintf(state->err, "batch:%d: duration: no combatant matches '%s'\n", line_no, args[4]);
+                return 0;
+            }
+            anchor_id = state->combatants[anchor_idx].id;
+        }
+        if (timing != EXPIRE_ROUND_START && get_index_by_id(state, anchor_id) == -1) {
+            fprintf(state->err, "batch:%d: duration: no turn to anchor to\n", line_no);
+            return 0;
+        }
+        command.type = CMD_EXPIRY;
+        command.expiry.cond = cond;
+        command.expiry.duration = value;
+        command.expiry.timing = timing;
+        command.expiry.anchor_id = anchor_id;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "init") == 0) {
+        if (argc < 2 || !parse_int_safe(args[1], &value)) {
+            fprintf(state->err, "batch:%d: usage: init <target> <value>\n", line_no);
+            return 0;
+        }
+        command.type = CMD_INITIATIVE;
+        command.initiative.value = value;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "dup") == 0) {
+        if (argc < 2 || !parse_int_safe(args[1], &value) || value < 1) {
+            fprintf(state->err, "batch:%d: usage: dup <target> <copies>\n", line_no);
+            return 0;
+        }
+        command.type = CMD_DUPLICATE;
+        command.duplicate.copies = value;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "remove") == 0 || strcmp(cmd, "deathsave") == 0 ||
+               strcmp(cmd, "stabilize") == 0 || strcmp(cmd, "togglemark") == 0) {
+        command.type = (cmd[0] == 'r') ? CMD_REMOVE : (cmd[0] == 'd') ? CMD_DEATH_SAVE :
+                       (cmd[0] == 's') ? CMD_STABILIZE : CMD_TOGGLE_MARK;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "select") == 0) {
+        return 1;
+    } else if (strcmp(cmd, "mark") == 0) {
+        int to_idx = idx;
+        if (argc >= 2 && (to_idx = batch_find_target(state, args[1])) == -1) {
+            fprintf(state->err, "batch:%d: mark: unknown combatant '%s'\n", line_no, args[1]);
+            return 0;
+        }
+        command.type = CMD_MARK;
+        command.mark.to_id = state->combatants[to_idx].id;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "markwhere") == 0) {
+        command.type = CMD_MARK_WHERE;
+        if (argc >= 1 && strcmp(args[0], "players") == 0) command.mark_where.filter = MARK_PLAYERS;
+        else if (argc >= 1 && strcmp(args[0], "enemies") == 0) command.mark_where.filter = MARK_ENEMIES;
+        else if (argc >= 2 && strcmp(args[0], "prefix") == 0) {
+            command.mark_where.filter = MARK_PREFIX;
+            strncpy(command.mark_where.prefix, args[1], NAME_LENGTH - 1);
+        } else {
+            fprintf(state->err, "batch:%d: usage: markwhere <players|enemies|prefix <text>>\n", line_no);
+            return 0;
+        }
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "clearmarks") == 0) {
+        command.type = CMD_CLEAR_MARKS;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "group") == 0) {
+        if (argc < 1 || !parse_int_safe(args[0], &value)) {
+            fprintf(state->err, "batch:%d: usage: group <+/-change>\n", line_no);
+            return 0;
+        }
+        if (count_marked(state) == 0) {
+            fprintf(state->err, "batch:%d: group: no combatants marked\n", line_no);
+            return 0;
+        }
+        command.type = CMD_GROUP_HP;
+        command.group.change = value;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "next") == 0 || strcmp(cmd, "prev") == 0) {
+        if (state->count == 0) {
+            fprintf(state->err, "batch:%d: %s: no combatants\n", line_no, cmd);
+            return 0;
+        }
+        command.type = (cmd[0] == 'n') ? CMD_NEXT_TURN : CMD_PREV_TURN;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "undo") == 0) {
+        if (state->undo_count == 0) {
+            fprintf(state->err, "batch:%d: undo: nothing to undo\n", line_no);
+            return 0;
+        }
+        command.type = CMD_UNDO;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "save") == 0 || strcmp(cmd, "load") == 0 || strcmp(cmd, "export") == 0) {
+        char path[256];
+        const char* default_name = (cmd[0] == 'e') ? LOG_EXPORT_FILE_NAME : state->save_file_name;
+        if (argc >= 1) {
+            snprintf(path, sizeof(path), "%s", args[0]);
+        } else if (!build_home_path(path, sizeof(path), default_name)) {
+            fprintf(state->err, "batch:%d: %s: path too long\n", line_no, cmd);
+            return 0;
+        }
+        if (cmd[0] == 's') return save_state_to_path(state, path);
+        if (cmd[0] == 'e') return export_log_to_path(state, path);
+        if (strlen(path) >= COMMAND_PATH_LENGTH) {
+            fprintf(state->err, "batch:%d: load: path too long\n", line_no);
+            return 0;
+        }
+        command.type = CMD_LOAD;
+        snprintf(command.file.path, sizeof(command.file.path), "%s", path);
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "library") == 0) {
+        const char* action = argc >= 1 ? args[0] : "list";
+        if (strcmp(action, "list") == 0) {
+            if (library_read_index(&state->library) < 0) {
+                fprintf(state->err, "batch:%d: library: cannot read the index\n", line_no);
+                return 0;
+            }
+            batch_print_library(state, state->out);
+            return 1;
+        }
+        if (argc < 2 || (strcmp(action, "save") != 0 && strcmp(action, "load") != 0 && strcmp(action, "delete") != 0)) {
+            fprintf(state->err, "batch:%d: usage: library [list] | library save|load|delete <name>\n", line_no);
+            return 0;
+        }
+        if (action[0] == 's') return library_save(state, args[1]);
+        if (action[0] == 'l') return library_load(state, args[1]);
+        return library_delete(state, args[1]);
+    } else if (strcmp(cmd, "bestiary") == 0) {
+        if (bestiary_open_default(state) == 0) {
+            fprintf(state->err, "batch:%d: bestiary: no ~/%s\n", line_no, BESTIARY_FILE_NAME);
+            return 0;
+        }
+        batch_print_bestiary(state, argc >= 1 ? args[0] : "", state->out);
+        return 1;
+    } else if (strcmp(cmd, "journal") == 0) {
+        char path[256];
+        if (argc >= 1) {
+            snprintf(path, sizeof(path), "%s", args[0]);
+        } else if (!build_home_path(path, sizeof(path), state->journal_file_name)) {
+            fprintf(state->err, "batch:%d: journal: path too long\n", line_no);
+            return 0;
+        }
+        return journal_write(state, path);
+    } else if (strcmp(cmd, "seed") == 0) {
+        if (argc < 1 || !parse_int_safe(args[0], &value)) {
+            fprintf(state->err, "batch:%d: usage: seed <n>\n", line_no);
+            return 0;
+        }
+        seed_commands(state, (uint64_t)(unsigned int)value);
+        return 1;
+    } else if (strcmp(cmd, "effect") == 0) {
+        command.type = CMD_EFFECT;
+        if (argc >= 1) strncpy(command.effect.name, args[0], EFFECT_NAME_LENGTH - 1);
+        if (argc < 1 || strlen(args[0]) >= EFFECT_NAME_LENGTH || !apply_command(state, &command)) {
+            fprintf(state->err, "batch:%d: usage: effect <name> (no | : , = characters, registry not full)\n", line_no);
+            return 0;
+        }
+        return 1;
+    } else if (strcmp(cmd, "effects") == 0) {
+        if (argc < 1 || strlen(args[0]) >= COMMAND_PATH_LENGTH) {
+            fprintf(state->err, "batch:%d: usage: effects <config path>\n", line_no);
+            return 0;
+        }
+        command.type = CMD_EFFECTS_FILE;
+        snprintf(command.file.path, sizeof(command.file.path), "%s", args[0]);
+        if (!apply_command(state, &command)) {
+            fprintf(state->err, "batch:%d: effects: cannot read %s or it has invalid entries\n", line_no, args[0]);
+            return 0;
+        }
+        return 1;
+    } else if (strcmp(cmd, "import") == 0) {
+        if (argc < 1 || strlen(args[0]) >= COMMAND_PATH_LENGTH) {
+            fprintf(state->err, "batch:%d: usage: import <csv or tsv path>\n", line_no);
+            return 0;
+        }
+        command.type = CMD_IMPORT;
+        snprintf(command.file.path, sizeof(command.file.path), "%s", args[0]);
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "list") == 0) {
+        batch_print_state(state, state->out);
+        return 1;
+    } else if (strcmp(cmd, "skip") == 0) {
+        int policy = 0;
+        for (int i = 0; i < argc; i++) {
+            if (strcmp(args[i], "dead") == 0) policy |= SKIP_DEAD;
+            else if (strcmp(args[i], "stable") == 0) policy |= SKIP_STABLE;
+            else if (strcmp(args[i], "incapacitated") == 0) policy |= SKIP_INCAPACITATED;
+            else if (strcmp(args[i], "all") == 0) policy |= SKIP_DEAD | SKIP_STABLE | SKIP_INCAPACITATED;
+            else if (strcmp(args[i], "none") != 0) argc = 0;
+        }
+        if (argc < 1) {
+            fprintf(state->err, "batch:%d: usage: skip <none|all|dead|stable|incapacitated>...\n", line_no);
+            return 0;
+        }
+        command.type = CMD_SKIP_POLICY;
+        command.skip.policy = policy;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "archive") == 0) {
+        batch_print_archive(state, state->out);
+        return 1;
+    } else if (strcmp(cmd, "restore") == 0) {
+        int slot = archive_find(state, args[0]);
+        value = 0;
+        if (slot == -1 || (argc >= 2 && (!parse_int_safe(args[1], &value) || value < 1))) {
+            fprintf(state->err, "batch:%d: usage: restore <archived #id|name> [revive hp]\n", line_no);
+            return 0;
+        }
+        command.type = CMD_RESTORE;
+        command.target_id = state->archive[slot].combatant.id;
+        command.restore.revive_hp = value;
+        return apply_command(state, &command);
+    } else if (strcmp(cmd, "query") == 0) {
+        int is_dying = (argc >= 1 && strcmp(args[0], "dying") == 0);
+        if (!is_dying && (argc < 2 || strcmp(args[0], "below") != 0 || !parse_int_safe(args[1], &value))) {
+            fprintf(state->err, "batch:%d: usage: query dying | query below <percent>\n", line_no);
+            return 0;
+        }
+        int* matches = (int*)malloc((size_t)(state->count > 0 ? state->count : 1) * sizeof(int));
+        if (!matches || !hot_sync(state)) {
+            free(matches);
+            fprintf(state->err, "batch:%d: query: out of memory\n", line_no);
+            return 0;
+        }
+        int n = is_dying ? hot_query_dying_players(&state->hot, matches)
+                         : hot_query_enemies_below(&state->hot, value, matches);
+        fprintf(state->out, "%d match%s\n", n, n == 1 ? "" : "es");
+        for (int i = 0; i < n; i++) {
+            const Combatant* c = &state->combatants[matches[i]];
+            fprintf(state->out, "  #%-4d %-20s hp %4d/%-4d\n", c->id, c->name, c->hp, c->max_hp);
+        }
+        free(matches);
+        return 1;
+    }
+
+    fprintf(state->err, "batch:%d: unknown command '%s'\n", line_no, cmd);
+    return 0;
+}
+
+/**
+ * Print the live archive entries, newest last.
+ */
+void batch_print_archive(GameState* state, FILE* out) {
+    fprintf(out, "Archive %d\n", archive_live_count(state));
+    for (int i = 0; i < state->archive_count; i++) {
+        const ArchiveEntry* entry = &state->archive[i];
+        if (entry->restored_epoch) continue;
+        const Combatant* c = &entry->combatant;
+        fprintf(out, "  #%-4d %-20s %c hp %4d/%-4d R%d %s\n", c->id, c->name, c->type == TYPE_PLAYER ? 'P' : 'E',
+            c->hp, c->max_hp, entry->round, entry->reason == ARCHIVE_DEAD ? "dead" : "removed");
+    }
+}
+
+/**
+ * Print the initiative order in a plain, diff-friendly format.
+ */
+void batch_print_state(GameState* state, FILE* out) {
+    fprintf(out, "Round %d\n", state->round);
+    for (int i = 0; i < state->count; i++) {
+        Combatant* c = &state->combatants[i];
+        fprintf(out, "%c%c#%-4d %-20s %c init %3d dex %3d hp %4d/%-4d",
+            c->id == state->current_turn_id ? '>' : ' ', c->is_marked ? '*' : ' ', c->id, c->name,
+            c->type == TYPE_PLAYER ? 'P' : 'E', c->initiative, c->dex, c->hp, c->max_hp);
+
+        if (combatant_is_dead(c)) fprintf(out, " DEAD");
+        else if (c->is_stable) fprintf(out, " STABLE");
+        else if (c->type == TYPE_PLAYER && c->hp <= 0)
+            fprintf(out, " S:%d F:%d", c->death_save_successes, c->death_save_failures);
+
+        for (int j = effect_next(state, c, 0); j != -1; j = effect_next(state, c, j + 1)) {
+            char timer[16];
+            if (format_condition_timer(state, c, j, timer, sizeof(timer))) fprintf(out, " %s(%s)", effect_name(state, j), timer);
+            else fprintf(out, " %s", effect_name(state, j));
+        }
+
+        if (c->mob_size > 0) {
+            fprintf(out, " mob %d/%d alive, units:", mob_alive_count(state, c), c->mob_size);
+            const MobUnit* units = &state->mob_units[c->mob_first];
+            for (int u = 0; u < c->mob_size; u++) {
+                fprintf(out, units[u].conditions ? " %d*" : " %d", units[u].hp);
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+ /* --- Bestiary Functions --- */
+
+/*
+ * Bestiary file: one stat block per line, `#` starts a comment.
+ *
+ *   name|dex|hp|hp dice|conditions
+ *   Goblin|2|7|2d6|
+ *   Shadow|2|16|3d8+3|Invisible
+ *
+ * The index beside it (<file>.idx) is a BestiaryIndexHeader followed by one
+ * BestiaryIndexEntry per stat block, sorted by name. It is rebuilt whenever
+ * the bestiary's size or mtime (to the nanosecond) no longer match the header.
+ */
+
+/**
+ * Read the bestiary at `path` and its index, building the index if it is
+ * missing or stale.
+ *
+ * @return Number of stat blocks, 0 if there is no usable bestiary
+ */
+int bestiary_open(Bestiary* b, const char* path) {
+    TRACE_SCOPE("bestiary_open");
+    bestiary_close(b);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return 0;
+    }
+    b->text = (char*)bestiary_read(fd, (size_t)st.st_size);
+    close(fd);
+    if (!b->text) return 0;
+    b->text_size = (size_t)st.st_size;
+
+    char index_path[COMMAND_PATH_LENGTH + 8];
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    fd = open(index_path, O_RDONLY);
+    struct stat ist;
+    BestiaryIndexHeader h;
+    if (fd >= 0 && fstat(fd, &ist) == 0 && (size_t)ist.st_size >= sizeof(h) &&
+        read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) &&
+        h.magic == BESTIARY_INDEX_MAGIC && h.source_size == (uint64_t)st.st_size &&
+        h.source_mtime == (int64_t)st.st_mtim.tv_sec && h.source_mtime_ns == (int64_t)st.st_mtim.tv_nsec &&
+        h.count <= INT_MAX && (size_t)ist.st_size == sizeof(h) + (size_t)h.count * sizeof(BestiaryIndexEntry)) {
+        BestiaryIndexEntry* entries = (BestiaryIndexEntry*)bestiary_read(fd, (size_t)h.count * sizeof(BestiaryIndexEntry));
+        int ok = entries != NULL;
+        for (uint32_t i = 0; ok && i < h.count; i++) {
+            ok = (size_t)entries[i].offset + entries[i].line_length <= b->text_size &&
+                 entries[i].name_length <= entries[i].line_length && entries[i].line_length <= BESTIARY_MAX_LINE;
+        }
+        if (ok) {
+            b->entries = entries;
+            b->count = (int)h.count;
+            b->index_reused = 1;
+        } else {
+            free(entries);
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    if (!b->entries && !bestiary_build_index(b, index_path, &st)) {
+        bestiary_close(b);
+        return 0;
+    }
+    return b->count;
+}
+
+/**
+ * Read exactly `size` bytes from `fd` into a new heap buffer.
+ *
+ * @return The buffer, or NULL on error or if the file is shorter than `size`
+ */
+void* bestiary_read(int fd, size_t size) {
+    char* buf = (char*)malloc(size > 0 ? size : 1);
+    if (!buf) return NULL;
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, buf + got, size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            free(buf);
+            return NULL;
+        }
+        got += (size_t)n;
+    }
+    return buf;
+}
+
+/**
+ * Open ~/.dnd_tracker_bestiary.txt unless a bestiary is already open.
+ *
+ * @return Number of stat blocks, 0 if there is none
+ */
+int bestiary_open_default(GameState* state) {
+    if (state->bestiary.text) return state->bestiary.count;
+    char path[COMMAND_PATH_LENGTH];
+    if (!build_home_path(path, sizeof(path), BESTIARY_FILE_NAME)) return 0;
+    state->stats.io_rebase = 1;  /* May write the index */
+    return bestiary_open(&state->bestiary, path);
+}
+
+/**
+ * Index the bestiary text and write the index to `index_path` for the next
+ * session. If it cannot be written the index is still used for this one.
+ *
+ * @return 1 on success, 0 if out of memory
+ */
+int bestiary_build_index(Bestiary* b, const char* index_path, const struct stat* st) {
+    TRACE_SCOPE("bestiary_build_index");
+    size_t capacity = 1024, count = 0;
+    BestiaryIndexEntry* entries = (BestiaryIndexEntry*)malloc(capacity * sizeof(BestiaryIndexEntry));
+    if (!entries) return 0;
+
+    size_t pos = 0;
+    while (pos < b->text_size) {
+        const char* line = b->text + pos;
+        const char* nl = (const char*)memchr(line, '\n', b->text_size - pos);
+        size_t len = nl ? (size_t)(nl - line) : b->text_size - pos;
+        pos += len + 1;
+        if (len > 0 && line[len - 1] == '\r') len--;
+        if (len == 0 || line[0] == '#' || len > BESTIARY_MAX_LINE) continue;
+        const char* bar = (const char*)memchr(line, '|', len);
+        size_t name_len = bar ? (size_t)(bar - line) : len;
+        while (name_len > 0 && isspace((unsigned char)line[name_len - 1])) name_len--;
+        if (name_len == 0) continue;
+
+        if (count == capacity) {
+            capacity *= 2;
+            BestiaryIndexEntry* grown = (BestiaryIndexEntry*)realloc(entries, capacity * sizeof(BestiaryIndexEntry));
+            if (!grown) {
+                free(entries);
+                return 0;
+            }
+            entries = grown;
+        }
+        entries[count].offset = (uint32_t)(line - b->text);
+        entries[count].name_length = (uint16_t)name_len;
+        entries[count].line_length = (uint16_t)len;
+        count++;
+    }
+    if (count > INT_MAX) count = INT_MAX;
+    bestiary_sort_text = b->text;
+    qsort(entries, count, sizeof(BestiaryIndexEntry), bestiary_compare_entries);
+
+    BestiaryIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = BESTIARY_INDEX_MAGIC;
+    header.count = (uint32_t)count;
+    header.source_size = (uint64_t)st->st_size;
+    header.source_mtime = (int64_t)st->st_mtim.tv_sec;
+    header.source_mtime_ns = (int64_t)st->st_mtim.tv_nsec;
+
+    /* Written aside and renamed, so another session never reads half an index */
+    char tmp_path[COMMAND_PATH_LENGTH + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", index_path);
+    FILE* f = fopen(tmp_path, "wb");
+    int written = f && fwrite(&header, sizeof(header), 1, f) == 1 &&
+                  (count == 0 || fwrite(entries, sizeof(BestiaryIndexEntry), count, f) == count);
+    if (f && fclose(f) != 0) written = 0;
+    if ((!written || rename(tmp_path, index_path) != 0) && f) unlink(tmp_path);
+    b->entries = entries;
+    b->count = (int)count;
+    return 1;
+}
+
+/* Case-insensitive name order, shorter first on a tie - the order prefix searches assume */
+int bestiary_compare_entries(const void* a, const void* b) {
+    const BestiaryIndexEntry* x = (const BestiaryIndexEntry*)a;
+    const BestiaryIndexEntry* y = (const BestiaryIndexEntry*)b;
+    const char* xs = bestiary_sort_text + x->offset;
+    const char* ys = bestiary_sort_text + y->offset;
+    size_t n = x->name_length < y->name_length ? x->name_length : y->name_length;
+    for (size_t i = 0; i < n; i++) {
+        int d = tolower((unsigned char)xs[i]) - tolower((unsigned char)ys[i]);
+        if (d != 0) return d;
+    }
+    return (int)x->name_length - (int)y->name_length;
+}
+
+/**
+ * Where entry `i` sorts relative to the names starting with `prefix`.
+ *
+ * @return <0 before them, 0 if it starts with `prefix`, >0 after them
+ */
+int bestiary_prefix_cmp(const Bestiary* b, int i, const char* prefix, size_t length) {
+    const BestiaryIndexEntry* e = &b->entries[i];
+    const char* name = b->text + e->offset;
+    size_t n = e->name_length < length ? e->name_length : length;
+    for (size_t k = 0; k < n; k++) {
+        int d = tolower((unsigned char)name[k]) - tolower((unsigned char)prefix[k]);
+        if (d != 0) return d;
+    }
+    return e->name_length < length ? -1 : 0;
+}
+
+/**
+ * Find the stat blocks whose names start with `prefix` (case-insensitive).
+ * Two binary searches over the index; nothing is parsed.
+ *
+ * @param first Set to the index of the first match
+ * @return Number of matches
+ */
+int bestiary_search(const Bestiary* b, const char* prefix, int* first) {
+    size_t length = strlen(prefix);
+    int lo = 0, hi = b->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (bestiary_prefix_cmp(b, mid, prefix, length) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *first = lo;
+    hi = b->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (bestiary_prefix_cmp(b, mid, prefix, length) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo - *first;
+}
+
+/**
+ * @return Index of the stat block named exactly `name` (any case), or -1
+ */
+int bestiary_find(const Bestiary* b, const char* name) {
+    int first;
+    int matches = bestiary_search(b, name, &first);
+    /* The exact name sorts first among the names it prefixes */
+    if (matches > 0 && b->entries[first].name_length == strlen(name)) return first;
+    return -1;
+}
+
+/**
+ * Parse stat block `i`. Missing trailing fields default to zero/empty.
+ *
+ * @return 1 on success, 0 if `i` is out of range
+ */
+int bestiary_entry(const Bestiary* b, int i, BestiaryEntry* out) {
+    if (i < 0 || i >= b->count) return 0;
+    const BestiaryIndexEntry* e = &b->entries[i];
+    memset(out, 0, sizeof(*out));
+    size_t name_len = e->name_length < NAME_LENGTH ? e->name_length : NAME_LENGTH - 1;
+    memcpy(out->name, b->text + e->offset, name_len);
+
+    char line[BESTIARY_MAX_LINE + 1];
+    memcpy(line, b->text + e->offset, e->line_length);
+    line[e->line_length] = '\0';
+    char* fields[5] = {NULL, NULL, NULL, NULL, NULL};
+    char* cursor = line;
+    for (int f = 0; f < 5 && cursor; f++) {
+        fields[f] = cursor;
+        cursor = strchr(cursor, '|');
+        if (cursor) *cursor++ = '\0';
+    }
+    if (fields[1]) out->dex = atoi(fields[1]);
+    if (fields[2]) out->hp = atoi(fields[2]);
+    if (fields[3]) parse_dice(fields[3], &out->hp_dice);
+    if (fields[4]) {
+        while (isspace((unsigned char)*fields[4])) fields[4]++;
+        snprintf(out->conditions, sizeof(out->conditions), "%s", fields[4]);
+        size_t len = strlen(out->conditions);
+        while (len > 0 && isspace((unsigned char)out->conditions[len - 1])) out->conditions[--len] = '\0';
+    }
+    if (out->hp <= 0 && out->hp_dice.count > 0) {
+        out->hp = out->hp_dice.count * (out->hp_dice.sides + 1) / 2 + out->hp_dice.bonus;
+    }
+    return 1;
+}
+
+void bestiary_close(Bestiary* b) {
+    free(b->entries);
+    free(b->text);
+    memset(b, 0, sizeof(*b));
+}
+
+/**
+ * Parse "NdS", "NdS+B", "NdS-B" or "dS".
+ *
+ * @return 1 on success, 0 if `text` is not a dice expression
+ */
+int parse_dice(const char* text, DiceSpec* dice) {
+    const char* p = text;
+    char* end;
+    long count = 1, sides, bonus = 0;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p != 'd' && *p != 'D') {
+        count = strtol(p, &end, 10);
+        if (end == p) return 0;
+        p = end;
+    }
+    if (*p != 'd' && *p != 'D') return 0;
+    p++;
+    sides = strtol(p, &end, 10);
+    if (end == p) return 0;
+    p = end;
+    if (*p == '+' || *p == '-') {
+        bonus = strtol(p, &end, 10);
+        if (end == p) return 0;
+        p = end;
+    }
+    while (isspace((unsigned char)*p)) p++;
+    if (*p != '\0' || count < 1 || count > 1000 || sides < 1 || sides > 1000 || labs(bonus) > 100000) return 0;
+    dice->count = (int)count;
+    dice->sides = (int)sides;
+    dice->bonus = (int)bonus;
+    return 1;
+}
+
+int roll_dice(GameState* state, const DiceSpec* dice) {
+    int total = dice->bonus;
+    for (int i = 0; i < dice->count; i++) total += roll_die(state, dice->sides);
+    return total;
+}
+
+/* "2d6", "3d8+3"; empty if there are no dice */
+void format_dice(const DiceSpec* dice, char* buf, size_t size) {
+    if (dice->count == 0) buf[0] = '\0';
+    else if (dice->bonus == 0) snprintf(buf, size, "%dd%d", dice->count, dice->sides);
+    else snprintf(buf, size, "%dd%d%+d", dice->count, dice->sides, dice->bonus);
+}
+
+/**
+ * Line editor for prompts that need more than get_input_string: an empty
+ * line is a valid answer, and with `complete` set the bestiary names
+ * starting with the typed text are listed above the prompt as you type.
+ * TAB completes to the highlighted name, UP/DOWN move the highlight.
+ *
+ * @return Length of the line in `buffer`, or -1 on ESC
+ */
+int get_input_line(GameState* state, const char* prompt, char* buffer, int max_len, int complete) {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    int input_y = rows - 2;
+    int len = 0, pick = -1, shown = 0;
+    buffer[0] = '\0';
+    curs_set(1);
+
+    for (;;) {
+        int first = 0, matches = 0;
+        if (complete && len > 0) matches = bestiary_search(&state->bestiary, buffer, &first);
+        int listed = matches < BESTIARY_SUGGESTIONS ? matches : BESTIARY_SUGGESTIONS;
+        if (pick >= listed) pick = listed - 1;
+
+        /* Suggestions stack upwards from the line above the prompt */
+        for (int i = 0; i < shown || i < listed; i++) {
+            int y = input_y - 1 - i;
+            if (y < 1) break;
+            move(y, 0);
+            clrtoeol();
+            if (i >= listed) continue;
+            BestiaryEntry entry;
+            bestiary_entry(&state->bestiary, first + i, &entry);
+            int pair = i == pick ? COLOR_MENU_SEL : COLOR_MENU_NORM;
+            attron(COLOR_PAIR(pair));
+            char dice[32];
+            format_dice(&entry.hp_dice, dice, sizeof(dice));
+            mvprintw(y, 0, " %-28s dex %+3d  hp %4d %-10s %-20.20s", entry.name, entry.dex, entry.hp, dice, entry.conditions);
+            attroff(COLOR_PAIR(pair));
+        }
+        shown = listed;
+        if (complete && matches > listed && input_y - 1 - listed >= 1) {
+            attron(A_DIM);
+            mvprintw(input_y - 1 - listed, 0, " ... %d more", matches - listed);
+            clrtoeol();
+            attroff(A_DIM);
+            shown = listed + 1;
+        }
+
+        attron(COLOR_PAIR(COLOR_HEADER));
+        mvprintw(input_y, 0, "%s", prompt);
+        attroff(COLOR_PAIR(COLOR_HEADER));
+        printw("%s", buffer);
+        clrtoeol();
+        int cursor_x = (int)strlen(prompt) + len;
+        move(input_y, cursor_x < cols ? cursor_x : cols - 1);
+        refresh();
+
+        int ch = getch();
+        if (ch == 27) {
+            len = -1;
+            break;
+        } else if (ch == '\n' || ch == '\r' || ch == KEY_ENTER) {
+            if (pick >= 0) {
+                BestiaryEntry entry;
+                bestiary_entry(&state->bestiary, first + pick, &entry);
+                snprintf(buffer, (size_t)max_len, "%s", entry.name);
+                len = (int)strlen(buffer);
+            }
+            break;
+        } else if (ch == '\t' && listed > 0) {
+            BestiaryEntry entry;
+            bestiary_entry(&state->bestiary, first + (pick >= 0 ? pick : 0), &entry);
+            snprintf(buffer, (size_t)max_len, "%s", entry.name);
+            len = (int)strlen(buffer);
+            pick = -1;
+        } else if (ch == KEY_UP && listed > 0) {
+            pick = pick < listed - 1 ? pick + 1 : listed - 1;
+        } else if (ch == KEY_DOWN) {
+            pick = pick >= 0 ? pick - 1 : -1;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (len > 0) buffer[--len] = '\0';
+            pick = -1;
+        } else if (ch >= 32 && ch < 127 && len < max_len - 1) {
+            buffer[len++] = (char)ch;
+            buffer[len] = '\0';
+            pick = -1;
+        }
+    }
+
+    for (int i = 0; i < shown; i++) {
+        if (input_y - 1 - i < 1) break;
+        move(input_y - 1 - i, 0);
+        clrtoeol();
+    }
+    move(input_y, 0);
+    clrtoeol();
+    curs_set(0);
+    refresh();
+    return len;
+}
+
+/**
+ * Like get_input_int, but an empty line takes `fallback`.
+ *
+ * @return 1 with `value` set, 0 on ESC or repeated invalid input
+ */
+int get_input_int_default(GameState* state, const char* prompt, int* value, int min_val, int max_val, int fallback) {
+    char buf[32];
+    for (int attempts = 0; attempts < 3; attempts++) {
+        int len = get_input_line(state, prompt, buf, sizeof(buf), 0);
+        if (len < 0) return 0;
+        if (len == 0) {
+            *value = fallback;
+            return 1;
+        }
+        if (parse_int_safe(buf, value) && *value >= min_val && *value <= max_val) return 1;
+        char err_msg[128];
+        snprintf(err_msg, sizeof(err_msg), "Enter a number between %d and %d, or nothing for %d", min_val, max_val, fallback);
+        show_message(state, err_msg, 1);
+        draw_message_queue(state);
+    }
+    return 0;
+}
+
+/**
+ * HP prompt prefilled from a stat block: an empty line takes its HP,
+ * "r" rolls its hit dice, a dice expression is rolled, a number is used as is.
+ *
+ * @return 1 with `value` set, 0 on ESC or repeated invalid input
+ */
+int get_input_hp(GameState* state, const char* label, const BestiaryEntry* entry, int* value, int max_val) {
+    char prompt[96], buf[32], dice_text[32];
+    format_dice(&entry->hp_dice, dice_text, sizeof(dice_text));
+    if (entry->hp_dice.count > 0) {
+        snprintf(prompt, sizeof(prompt), "%s (Enter = %d, r = roll %s): ", label, entry->hp, dice_text);
+    } else {
+        snprintf(prompt, sizeof(prompt), "%s (Enter = %d): ", label, entry->hp);
+    }
+    for (int attempts = 0; attempts < 3; attempts++) {
+        int len = get_input_line(state, prompt, buf, sizeof(buf), 0);
+        if (len < 0) return 0;
+        DiceSpec dice;
+        int rolled = 1;
+        if (len == 0) {
+            *value = entry->hp;
+        } else if ((strcmp(buf, "r") == 0 || strcmp(buf, "R") == 0) && entry->hp_dice.count > 0) {
+            *value = roll_dice(state, &entry->hp_dice);
+        } else if (parse_dice(buf, &dice)) {
+            *value = roll_dice(state, &dice);
+        } else if (!parse_int_safe(buf, value)) {
+            *value = 0;
+            rolled = 0;
+        } else {
+            rolled = 0;
+        }
+        /* A bad roll still leaves the creature standing */
+        if (rolled && *value < 1) *value = 1;
+        if (*value >= 1 && *value <= max_val) return 1;
+        char err_msg[128];
+        snprintf(err_msg, sizeof(err_msg), "Enter HP between 1 and %d, a dice roll like 2d6+1, or nothing", max_val);
+        show_message(state, err_msg, 1);
+        draw_message_queue(state);
+    }
+    return 0;
+}
+
+/* Set a stat block's default conditions on the combatant just added, one journaled command each */
+void apply_bestiary_conditions(GameState* state, const BestiaryEntry* entry, int id) {
+    char list[sizeof(entry->conditions)];
+    snprintf(list, sizeof(list), "%s", entry->conditions);
+    for (char* name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+        while (isspace((unsigned char)*name)) name++;
+        size_t len = strlen(name);
+        while (len > 0 && isspace((unsigned char)name[len - 1])) name[--len] = '\0';
+        if (len == 0) continue;
+        int cond = find_effect_by_name(state, name);
+        if (cond == -1) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "Bestiary: unknown condition '%s'", name);
+            show_message(state, msg, 1);
+            continue;
+        }
+        Command cmd = make_command(CMD_CONDITION, id);
+        cmd.condition.cond = cond;
+        cmd.condition.unit = -1;
+        cmd.condition.active = 1;
+        apply_command(state, &cmd);
+    }
+}
+
+void batch_print_bestiary(GameState* state, const char* prefix, FILE* out) {
+    int first;
+    int matches = bestiary_search(&state->bestiary, prefix, &first);
+    for (int i = 0; i < matches && i < 20; i++) {
+        BestiaryEntry entry;
+        bestiary_entry(&state->bestiary, first + i, &entry);
+        char dice[32];
+        format_dice(&entry.hp_dice, dice, sizeof(dice));
+        fprintf(out, "%-28s dex %+3d hp %4d %-10s %s\n", entry.name, entry.dex, entry.hp, dice, entry.conditions);
+    }
+    if (matches > 20) fprintf(out, "... %d more\n", matches - 20);
+}
+
+ /* --- Roster Import Functions --- */
+
+/*
+ * Rosters are CSV or TSV - whichever delimiter the first row uses - with
+ * the columns name, type, init, dex, hp, conditions. A first row naming
+ * them sets their order and lets other columns through to be ignored,
+ * which is what spreadsheet and VTT exports look like:
+ *
+ *   name,type,init,dex,hp,conditions
+ *   Thorin,player,17,1,44,
+ *   Goblin,enemy,d20+2,2,2d6,"Poisoned;Prone"
+ *
+ * Initiative and HP take a number or a dice expression to roll; an empty
+ * initiative rolls d20 + dex. Conditions are separated by `;` (or `,`
+ * inside a quoted field).
+ */
+
+void import_roster(GameState* state) {
+    TRACE_SCOPE("import_roster");
+    char path[COMMAND_PATH_LENGTH];
+    if (!get_input_string("Import roster (CSV/TSV path): ", path, sizeof(path))) return;
+
+    Command cmd = make_command(CMD_IMPORT, -1);
+    if (strncmp(path, "~/", 2) == 0) {
+        if (!build_home_path(cmd.file.path, sizeof(cmd.file.path), path + 2)) {
+            show_message(state, "Error: Path too long for roster file!", 1);
+            return;
+        }
+    } else {
+        snprintf(cmd.file.path, sizeof(cmd.file.path), "%s", path);
+    }
+    apply_command(state, &cmd);
+}
+
+/**
+ * Add every valid row of the roster at `path`. The file is streamed a line
+ * at a time; all rows go in with a single sorted merge, so the whole import
+ * is one command and one undo step. Bad rows are reported with their line
+ * numbers and skipped.
+ *
+ * @return 1 if at least one row was added, 0 otherwise (message already shown)
+ */
+int import_roster_from_path(GameState* state, const char* path) {
+    TRACE_SCOPE("import_roster_from_path");
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        char msg[COMMAND_PATH_LENGTH + 48];
+        snprintf(msg, sizeof(msg), "Import failed! Cannot open %s", path);
+        show_message(state, msg, 1);
+        return 0;
+    }
+
+    int columns[IMPORT_COLUMNS];
+    for (int k = 0; k < IMPORT_COLUMNS; k++) columns[k] = k;
+    char* fields[IMPORT_MAX_FIELDS];
+    char* line = NULL;
+    size_t line_cap = 0;
+    char delim = 0;
+    int line_no = 0, bad = 0, full = 0;
+    int room = MAX_COMBATANTS - state->count;
+    Combatant* batch = NULL;
+    int batch_count = 0, batch_capacity = 0;
+    char msg[160], error[96];
+
+    while (getline(&line, &line_cap, f) != -1) {
+        line_no++;
+        char* p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#') continue;
+
+        /* The first row settles the delimiter and whether there is a header */
+        int header = 0;
+        if (!delim) {
+            delim = strchr(line, '\t') ? '\t' : ',';
+            header = 1;
+        }
+        int field_count = import_split_row(line, delim, fields, IMPORT_MAX_FIELDS);
+        if (header) {
+            int named[IMPORT_COLUMNS];
+            int found_name = 0;
+            for (int k = 0; k < IMPORT_COLUMNS; k++) named[k] = -1;
+            for (int i = 0; i < field_count; i++) {
+                int column = import_header_column(fields[i]);
+                if (column >= 0 && named[column] == -1) named[column] = i;
+                if (column == IMPORT_NAME) found_name = 1;
+            }
+            if (found_name) {
+                memcpy(columns, named, sizeof(columns));
+                continue;
+            }
+        }
+
+        Combatant c;
+        int ok = field_count >= 0;
+        if (!ok) snprintf(error, sizeof(error), "unterminated quote");
+        else ok = import_parse_row(state, fields, field_count, columns, &c, error, sizeof(error));
+        if (!ok) {
+            if (bad++ < IMPORT_MAX_REPORTED) {
+                snprintf(msg, sizeof(msg), "Import: line %d: %s", line_no, error);
+                show_message(state, msg, 1);
+            }
+            continue;
+        }
+        if (batch_count == room) {
+            effect_release(state, &c);
+            full = line_no;
+            break;
+        }
+        if (batch_count == batch_capacity) {
+            int new_capacity = batch_capacity > 0 ? batch_capacity * 2 : 64;
+            Combatant* grown = (Combatant*)realloc(batch, (size_t)new_capacity * sizeof(Combatant));
+            if (!grown) {
+                free(batch);
+                free(line);
+                fclose(f);
+                show_message(state, "Import failed! Out of memory.", 1);
+                return 0;
+            }
+            batch = grown;
+            batch_capacity = new_capacity;
+        }
+        batch[batch_count++] = c;
+    }
+    free(line);
+    fclose(f);
+
+    if (bad > IMPORT_MAX_REPORTED) {
+        snprintf(msg, sizeof(msg), "Import: %d more bad rows not shown", bad - IMPORT_MAX_REPORTED);
+        show_message(state, msg, 1);
+    }
+    if (full) {
+        snprintf(msg, sizeof(msg), "Import: list full, stopped at line %d", full);
+        show_message(state, msg, 1);
+    }
+    if (batch_count == 0 || !ensure_combatant_capacity(state, state->count + batch_count)) {
+        free(batch);
+        show_message(state, batch_count == 0 ? "Import: no rows added." : "Import failed! Out of memory.", 1);
+        return 0;
+    }
+
+    for (int i = 0; i < batch_count; i++) {
+        if (state->next_id == INT_MAX) state->next_id = 1;
+        batch[i].id = state->next_id++;
+        name_index_note(state, batch[i].name);
+    }
+    int last_id = batch[batch_count - 1].id;
+    insert_sorted_batch(state, batch, batch_count);
+    free(batch);
+
+    state->selected_id = last_id;
+    if (state->round == 1 || state->current_turn_id == 0) state->current_turn_id = state->combatants[0].id;
+
+    log_action(state, "Imported %d combatants from %s.", batch_count, path);
+    snprintf(msg, sizeof(msg), "Imported %d combatants, %d bad rows skipped.", batch_count, bad);
+    show_message(state, msg, bad > 0);
+    return 1;
+}
+
+/**
+ * Split one CSV/TSV line in place. Quoted fields may contain the
+ * delimiter and "" for a quote; unquoted fields are trimmed.
+ *
+ * @return Number of fields, or -1 on an unterminated quote
+ */
+int import_split_row(char* line, char delim, char** fields, int max_fields) {
+    int count = 0;
+    char* p = line;
+    for (;;) {
+        while (*p == ' ' || (*p == '\t' && delim != '\t')) p++;
+        char* start = p;
+        char* end;
+        if (*p == '"') {
+            char* w = start;
+            p++;
+            for (;;) {
+                if (*p == '\0') return -1;
+                if (*p == '"') {
+                    if (p[1] != '"') break;
+                    p++;
+                }
+                *w++ = *p++;
+            }
+            end = w;
+            p++;
+            while (*p == ' ' || (*p == '\t' && delim != '\t')) p++;
+        } else {
+            while (*p != '\0' && *p != delim && *p != '\n' && *p != '\r') p++;
+            end = p;
+            while (end > start && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        }
+        char next = *p;
+        *end = '\0';
+        if (count < max_fields) fields[count++] = start;
+        if (next != delim) break;
+        p++;
+    }
+    return count;
+}
+
+/**
+ * @return The ImportColumn a header cell names, or -1 if it is not one of ours
+ */
+int import_header_column(const char* field) {
+    static const struct { const char* name; int column; } headers[] = {
+        {"name", IMPORT_NAME}, {"type", IMPORT_TYPE}, {"side", IMPORT_TYPE},
+        {"init", IMPORT_INIT}, {"initiative", IMPORT_INIT}, {"dex", IMPORT_DEX}, {"dexterity", IMPORT_DEX},
+        {"hp", IMPORT_HP}, {"max hp", IMPORT_HP}, {"max_hp", IMPORT_HP}, {"conditions", IMPORT_CONDITIONS},
+        {"condition", IMPORT_CONDITIONS},
+    };
+    for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++) {
+        if (strcasecmp(field, headers[i].name) == 0) return headers[i].column;
+    }
+    return -1;
+}
+
+/**
+ * Validate one roster row into a fresh combatant (no ID yet). Dice in the
+ * init and HP columns are rolled here.
+ *
+ * @return 1 on success, 0 with `error` set if the row is bad
+ */
+int import_parse_row(GameState* state, char** fields, int field_count, const int* columns, Combatant* c,
+    char* error, size_t error_size) {
+    const char* value[IMPORT_COLUMNS];
+    for (int k = 0; k < IMPORT_COLUMNS; k++) {
+        value[k] = (columns[k] >= 0 && columns[k] < field_count) ? fields[columns[k]] : "";
+    }
+    memset(c, 0, sizeof(*c));
+
+    if (value[IMPORT_NAME][0] == '\0') {
+        snprintf(error, error_size, "missing name");
+        return 0;
+    }
+    if (strlen(value[IMPORT_NAME]) >= NAME_LENGTH) {
+        snprintf(error, error_size, "name longer than %d characters", NAME_LENGTH - 1);
+        return 0;
+    }
+    memcpy(c->name, value[IMPORT_NAME], strlen(value[IMPORT_NAME]) + 1);
+
+    const char* type = value[IMPORT_TYPE];
+    if (strcasecmp(type, "player") == 0 || strcasecmp(type, "pc") == 0 || strcasecmp(type, "p") == 0) {
+        c->type = TYPE_PLAYER;
+    } else if (type[0] == '\0' || strcasecmp(type, "enemy") == 0 || strcasecmp(type, "npc") == 0 ||
+               strcasecmp(type, "monster") == 0 || strcasecmp(type, "e") == 0) {
+        c->type = TYPE_ENEMY;
+    } else {
+        snprintf(error, error_size, "unknown type '%.24s'", type);
+        return 0;
+    }
+
+    if (value[IMPORT_DEX][0] != '\0' && !parse_int_safe(value[IMPORT_DEX], &c->dex)) {
+        snprintf(error, error_size, "invalid dex '%.24s'", value[IMPORT_DEX]);
+        return 0;
+    }
+
+    DiceSpec dice;
+    if (value[IMPORT_INIT][0] == '\0') {
+        c->initiative = roll_die(state, 20) + c->dex;
+    } else if (parse_dice(value[IMPORT_INIT], &dice)) {
+        c->initiative = roll_dice(state, &dice);
+    } else if (!parse_int_safe(value[IMPORT_INIT], &c->initiative)) {
+        snprintf(error, error_size, "invalid initiative '%.24s'", value[IMPORT_INIT]);
+        return 0;
+    }
+
+    if (parse_dice(value[IMPORT_HP], &dice)) {
+        c->max_hp = roll_dice(state, &dice);
+        if (c->max_hp < 1) c->max_hp = 1;
+    } else if (!parse_int_safe(value[IMPORT_HP], &c->max_hp) || c->max_hp < 1) {
+        snprintf(error, error_size, value[IMPORT_HP][0] ? "invalid HP '%.24s'" : "missing HP%.0s", value[IMPORT_HP]);
+        return 0;
+    }
+    c->hp = c->max_hp;
+
+    char list[256];
+    snprintf(list, sizeof(list), "%s", value[IMPORT_CONDITIONS]);
+    for (char* name = strtok(list, ";,"); name; name = strtok(NULL, ";,")) {
+        while (isspace((unsigned char)*name)) name++;
+        size_t len = strlen(name);
+        while (len > 0 && isspace((unsigned char)name[len - 1])) name[--len] = '\0';
+        if (len == 0) continue;
+        int cond = find_effect_by_name(state, name);
+        if (cond == -1 || !effect_assign(state, c, cond, 1)) {
+            if (cond == -1) snprintf(error, error_size, "unknown condition '%.24s'", name);
+            else snprintf(error, error_size, "out of memory");
+            effect_release(state, c);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+ /* --- Library Functions --- */
+
+/**
+ * Path of `file_name` inside the library directory, or of the directory
+ * itself when `file_name` is NULL.
+ *
+ * @return 1 on success, 0 if the path does not fit
+ */
+int library_path(char* path, size_t size, const char* file_name) {
+    char relative[COMMAND_PATH_LENGTH];
+    int ret = file_name ? snprintf(relative, sizeof(relative), "%s/%s", LIBRARY_DIR_NAME, file_name)
+                        : snprintf(relative, sizeof(relative), "%s", LIBRARY_DIR_NAME);
+    if (ret < 0 || (size_t)ret >= sizeof(relative)) return 0;
+    return build_home_path(path, size, relative);
+}
+
+/**
+ * Fill `lib` from the index alone. A missing index is rebuilt from the
+ * save headers once; a missing library directory is just empty.
+ *
+ * @return Number of entries, or -1 if the library cannot be read
+ */
+int library_read_index(Library* lib) {
+    TRACE_SCOPE("library_read_index");
+    char path[COMMAND_PATH_LENGTH];
+    if (!library_path(path, sizeof(path), LIBRARY_INDEX_NAME)) return -1;
+    lib->count = 0;
+    FILE* f = fopen(path, "r");
+    if (!f) return errno == ENOENT ? library_rebuild_index(lib) : -1;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        LibraryEntry e;
+        memset(&e, 0, sizeof(e));
+        char* bar = strchr(line, '|');
+        if (!bar || bar - line >= TABLE_NAME_LENGTH) continue;
+        memcpy(e.name, line, (size_t)(bar - line));
+        if (sscanf(bar + 1, "%d|%d|%lld|%lld", &e.round, &e.count, &e.saved_at, &e.bytes) != 4) continue;
+        if (lib->count == lib->capacity) {
+            int new_capacity = lib->capacity ? lib->capacity * 2 : 64;
+            LibraryEntry* grown = (LibraryEntry*)realloc(lib->entries, (size_t)new_capacity * sizeof(LibraryEntry));
+            if (!grown) break;
+            lib->entries = grown;
+            lib->capacity = new_capacity;
+        }
+        lib->entries[lib->count++] = e;
+    }
+    fclose(f);
+    return lib->count;
+}
+
+/*
+ * Recreate the index from the directory listing. Only the first line of
+ * each save is read - it holds the round and the roster size.
+ */
+int library_rebuild_index(Library* lib) {
+    char dir_path[COMMAND_PATH_LENGTH];
+    if (!library_path(dir_path, sizeof(dir_path), NULL)) return -1;
+    lib->count = 0;
+    DIR* dir = opendir(dir_path);
+    if (!dir) return errno == ENOENT ? 0 : -1;
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len < 5 || len - 4 >= TABLE_NAME_LENGTH || strcmp(ent->d_name + len - 4, ".txt") != 0 ||
+            strcmp(ent->d_name, LIBRARY_INDEX_NAME) == 0) {
+            continue;
+        }
+        LibraryEntry e;
+        memset(&e, 0, sizeof(e));
+        memcpy(e.name, ent->d_name, len - 4);
+        if (!server_valid_table_name(e.name)) continue;
+
+        char path[COMMAND_PATH_LENGTH];
+        struct stat st;
+        if (!library_path(path, sizeof(path), ent->d_name) || stat(path, &st) != 0) continue;
+        FILE* f = fopen(path, "r");
+        if (!f) continue;
+        char header[128];
+        int next_id;
+        int ok = fgets(header, sizeof(header), f) && sscanf(header, "%d|%d|%d", &e.round, &next_id, &e.count) == 3;
+        fclose(f);
+        if (!ok) continue;
+        e.saved_at = (long long)st.st_mtime;
+        e.bytes = (long long)st.st_size;
+
+        if (lib->count == lib->capacity) {
+            int new_capacity = lib->capacity ? lib->capacity * 2 : 64;
+            LibraryEntry* grown = (LibraryEntry*)realloc(lib->entries, (size_t)new_capacity * sizeof(LibraryEntry));
+            if (!grown) break;
+            lib->entries = grown;
+            lib->capacity = new_capacity;
+        }
+        /* Newest first, as library_save keeps it */
+        int at = lib->count;
+        while (at > 0 && lib->entries[at - 1].saved_at < e.saved_at) {
+            lib->entries[at] = lib->entries[at - 1];
+            at--;
+        }
+        lib->entries[at] = e;
+        lib->count++;
+    }
+    closedir(dir);
+    if (lib->count > 0) library_write_index(lib);
+    return lib->count;
+}
+
+/**
+ * Replace the index file (written aside and renamed, so a reader never
+ * sees half an index).
+ *
+ * @return 1 on success, 0 on failure
+ */
+int library_write_index(const Library* lib) {
+    char path[COMMAND_PATH_LENGTH], tmp_path[COMMAND_PATH_LENGTH + 8];
+    if (!library_path(path, sizeof(path), LIBRARY_INDEX_NAME)) return 0;
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* f = fopen(tmp_path, "w");
+    if (!f) return 0;
+    int ok = fprintf(f, "%s\n# name|round|combatants|saved at|bytes\n", LIBRARY_INDEX_HEADER) >= 0;
+    for (int i = 0; i < lib->count && ok; i++) {
+        const LibraryEntry* e = &lib->entries[i];
+        ok = fprintf(f, "%s|%d|%d|%lld|%lld\n", e->name, e->round, e->count, e->saved_at, e->bytes) >= 0;
+    }
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+int library_find(const Library* lib, const char* name) {
+    for (int i = 0; i < lib->count; i++) {
+        if (strcmp(lib->entries[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+/**
+ * Save the current encounter as `name` (replacing an older save of that
+ * name) and move it to the top of the index.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int library_save(GameState* state, const char* name) {
+    TRACE_SCOPE("library_save");
+    state->stats.io_rebase = 1;
+    if (!server_valid_table_name(name)) {
+        show_message(state, "Encounter names use letters, digits, - and _ (up to 31).", 1);
+        return 0;
+    }
+    char dir_path[COMMAND_PATH_LENGTH], file_name[TABLE_NAME_LENGTH + 8], path[COMMAND_PATH_LENGTH];
+    snprintf(file_name, sizeof(file_name), "%s.txt", name);
+    if (!library_path(dir_path, sizeof(dir_path), NULL) || !library_path(path, sizeof(path), file_name)) {
+        show_message(state, "Error: Path too long for save library!", 1);
+        return 0;
+    }
+    if (mkdir(dir_path, 0755) != 0 && errno != EEXIST) {
+        show_message(state, "Save failed! Cannot create the save library directory.", 1);
+        return 0;
+    }
+
+    Library* lib = &state->library;
+    if (library_read_index(lib) < 0) {
+        show_message(state, "Save failed! Cannot read the save library index.", 1);
+        return 0;
+    }
+    if (!save_state_to_path(state, path)) return 0;
+    struct stat st;
+    LibraryEntry e;
+    memset(&e, 0, sizeof(e));
+    snprintf(e.name, sizeof(e.name), "%s", name);
+    e.round = state->round;
+    e.count = state->count;
+    e.saved_at = (long long)time(NULL);
+    e.bytes = stat(path, &st) == 0 ? (long long)st.st_size : 0;
+
+    int at = library_find(lib, name);
+    if (at == -1) {
+        if (lib->count == lib->capacity) {
+            int new_capacity = lib->capacity ? lib->capacity * 2 : 64;
+            LibraryEntry* grown = (LibraryEntry*)realloc(lib->entries, (size_t)new_capacity * sizeof(LibraryEntry));
+            if (!grown) {
+                show_message(state, "Saved, but the library index is out of memory.", 1);
+                return 0;
+            }
+            lib->entries = grown;
+            lib->capacity = new_capacity;
+        }
+        at = lib->count++;
+    }
+    memmove(&lib->entries[1], &lib->entries[0], (size_t)at * sizeof(LibraryEntry));
+    lib->entries[0] = e;
+    lib->cursor = 0;
+    if (!library_write_index(lib)) {
+        show_message(state, "Saved, but the library index could not be written.", 1);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Load the encounter saved as `name`. Goes through the journal like any
+ * other load, so a replay restores the same encounter.
+ *
+ * @return 1 on success, 0 on failure (message already shown)
+ */
+int library_load(GameState* state, const char* name) {
+    state->stats.io_rebase = 1;  /* Reading the index may rebuild it */
+    char file_name[TABLE_NAME_LENGTH + 8];
+    Command cmd = make_command(CMD_LOAD, -1);
+    if (!server_valid_table_name(name)) {
+        show_message(state, "No such encounter in the save library.", 1);
+        return 0;
+    }
+    snprintf(file_name, sizeof(file_name), "%s.txt", name);
+    if (!library_path(cmd.file.path, sizeof(cmd.file.path), file_name)) {
+        show_message(state, "Error: Path too long for save library!", 1);
+        return 0;
+    }
+    return apply_command(state, &cmd);
+}
+
+/**
+ * @return 1 if the encounter was removed from the library
+ */
+int library_delete(GameState* state, const char* name) {
+    state->stats.io_rebase = 1;
+    Library* lib = &state->library;
+    char file_name[TABLE_NAME_LENGTH + 8], path[COMMAND_PATH_LENGTH];
+    if (library_read_index(lib) < 0) {
+        show_message(state, "Cannot read the save library index.", 1);
+        return 0;
+    }
+    int at = library_find(lib, name);
+    if (at == -1) {
+        show_message(state, "No such encounter in the save library.", 1);
+        return 0;
+    }
+    snprintf(file_name, sizeof(file_name), "%s.txt", name);
+    if (library_path(path, sizeof(path), file_name)) unlink(path);
+    memmove(&lib->entries[at], &lib->entries[at + 1], (size_t)(lib->count - at - 1) * sizeof(LibraryEntry));
+    lib->count--;
+    if (lib->cursor >= lib->count && lib->cursor > 0) lib->cursor = lib->count - 1;
+    if (!library_write_index(lib)) {
+        show_message(state, "Deleted, but the library index could not be written.", 1);
+        return 0;
+    }
+    return 1;
+}
+
+void library_free(Library* lib) {
+    free(lib->entries);
+    lib->entries = NULL;
+    lib->count = 0;
+    lib->capacity = 0;
+    lib->cursor = 0;
+}
+
+void open_library_menu(GameState* state) {
+    TRACE_SCOPE("open_library_menu");
+    state->stats.io_rebase = 1;  /* Reading the index may rebuild it */
+    if (library_read_index(&state->library) < 0) {
+        show_message(state, "Cannot read the save library index.", 1);
+        return;
+    }
+    state->library.cursor = 0;
+    state->mode = MODE_LIBRARY;
+}
+
+/**
+ * Draw the save library picker, most recently saved first.
+ */
+void draw_library_menu(GameState* state) {
+    Library* lib = &state->library;
+    if (lib->cursor >= lib->count) lib->cursor = lib->count > 0 ? lib->count - 1 : 0;
+
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+
+    int visible = lib->count > 0 ? lib->count : 1;
+    if (visible > rows - 6) visible = rows - 6;
+    if (visible < 1) visible = 1;
+    int top = lib->cursor - visible + 1;
+    if (top < 0) top = 0;
+
+    int menu_height = visible + 6;
+    int menu_width = 68;
+    int start_y = (rows - menu_height) / 2;
+    int start_x = (cols - menu_width) / 2;
+    if (start_y < 0) start_y = 0;
+    if (start_x < 0) start_x = 0;
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    for (int y = start_y; y < start_y + menu_height && y < rows; y++) {
+        for (int x = start_x; x < start_x + menu_width && x < cols; x++) {
+            mvaddch(y, x, ' ');
+        }
+    }
+    attroff(COLOR_PAIR(COLOR_HEADER));
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    mvprintw(start_y, start_x + 2, "Save Library (%d)", lib->count);
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + 1, start_x, ACS_HLINE, menu_width);
+
+    attron(COLOR_PAIR(COLOR_HEADER) | A_DIM);
+    mvprintw(start_y + 2, start_x + 2, "UP/DOWN: Navigate | ENTER: Load | S: Save as | D: Delete");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_DIM);
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + 3, start_x, ACS_HLINE, menu_width);
+
+    if (lib->count == 0) {
+        mvprintw(start_y + 4, start_x + 2, "No saved encounters - press S to save this one.");
+    }
+    for (int i = top; i < top + visible && i < lib->count; i++) {
+        const LibraryEntry* e = &lib->entries[i];
+        char when[32];
+        time_t saved_at = (time_t)e->saved_at;
+        struct tm tm_saved;
+        if (!localtime_r(&saved_at, &tm_saved) || strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm_saved) == 0) {
+            snprintf(when, sizeof(when), "?");
+        }
+        int is_selected = (i == lib->cursor);
+        int pair = is_selected ? COLOR_MENU_SEL : COLOR_MENU_NORM;
+        attron(COLOR_PAIR(pair));
+        if (is_selected) attron(A_BOLD);
+        mvprintw(start_y + 4 + (i - top), start_x + 2, "%-24s R%-4d %6d combatants  %s",
+            e->name, e->round, e->count, when);
+        if (is_selected) attroff(A_BOLD);
+        attroff(COLOR_PAIR(pair));
+    }
+
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(start_y + menu_height - 2, start_x, ACS_HLINE, menu_width);
+    mvprintw(start_y + menu_height - 1, start_x + (menu_width - 20) / 2, "ESC or 'q' to close");
+    attroff(COLOR_PAIR(COLOR_HEADER));
+}
+
+/**
+ * Handle input in library mode. Only the selected save is ever opened.
+ */
+int handle_library_menu_input(GameState* state, int ch) {
+    TRACE_SCOPE("handle_library_menu_input");
+    Library* lib = &state->library;
+
+    switch (ch) {
+        case KEY_UP:
+        case 'k':
+            if (lib->count > 0) lib->cursor = (lib->cursor - 1 + lib->count) % lib->count;
+            return 1;
+        case KEY_DOWN:
+        case 'j':
+            if (lib->count > 0) lib->cursor = (lib->cursor + 1) % lib->count;
+            return 1;
+        case '\n':
+        case '\r':
+        case ' ':
+            if (lib->count == 0) return 1;
+            if (state->count > 0 && !get_input_confirm("Loading will wipe current state. Are you sure? (y/n): ")) {
+                return 1;
+            }
+            if (library_load(state, lib->entries[lib->cursor].name)) state->mode = MODE_COMBAT;
+            return 1;
+        case 's':
+        case 'S':
+            {
+                char name[TABLE_NAME_LENGTH];
+                if (!get_input_string("Save encounter as: ", name, sizeof(name))) return 1;
+                if (library_find(lib, name) != -1) {
+                    char prompt[96];
+                    snprintf(prompt, sizeof(prompt), "Replace saved encounter '%s'? (y/n): ", name);
+                    if (!get_input_confirm(prompt)) return 1;
+                }
+                library_save(state, name);
+            }
+            return 1;
+        case 'd':
+        case 'D':
+            if (lib->count == 0) return 1;
+            {
+                char prompt[96];
+                snprintf(prompt, sizeof(prompt), "Delete saved encounter '%s'? (y/n): ", lib->entries[lib->cursor].name);
+                if (get_input_confirm(prompt) && library_delete(state, lib->entries[lib->cursor].name)) {
+                    show_message(state, "Encounter deleted.", 0);
+                }
+            }
+            return 1;
+        case 'q':
+        case 'Q':
+        case 27: /* ESC */
+            state->mode = MODE_COMBAT;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void batch_print_library(GameState* state, FILE* out) {
+    Library* lib = &state->library;
+    for (int i = 0; i < lib->count; i++) {
+        const LibraryEntry* e = &lib->entries[i];
+        char when[32];
+        time_t saved_at = (time_t)e->saved_at;
+        struct tm tm_saved;
+        if (!localtime_r(&saved_at, &tm_saved) || strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &tm_saved) == 0) {
+            snprintf(when, sizeof(when), "?");
+        }
+        fprintf(out, "%-24s round %-4d %6d combatants %10lld bytes  %s\n", e->name, e->round, e->count, e->bytes, when);
+    }
+}
+
+ /* --- Autosave Functions --- */
+
+/**
+ * Start the autosave writer for `path`. Pending changes are saved every
+ * `interval_s` seconds, or once `changes` commands have piled up (0 turns
+ * the count off).
+ *
+ * @return The autosaver, or NULL if the thread could not start
+ */
+Autosaver* autosave_start(GameState* state, const char* path, int interval_s, int changes) {
+    Autosaver* a = (Autosaver*)calloc(1, sizeof(Autosaver));
+    if (!a) return NULL;
+    snprintf(a->path, sizeof(a->path), "%s", path);
+    a->interval_s = interval_s;
+    a->changes = changes;
+    a->pending = -1;
+    a->writing = -1;
+    a->journal_mark = state->journal_count;
+    clock_gettime(CLOCK_MONOTONIC, &a->last_publish);
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->wake, NULL);
+    if (pthread_create(&a->thread, NULL, autosave_thread, a) != 0) {
+        pthread_cond_destroy(&a->wake);
+        pthread_mutex_destroy(&a->lock);
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+/**
+ * Make `buf` hold at least `needed` elements. Snapshot buffers only grow,
+ * so after the first few saves a snapshot is nothing but memcpy.
+ *
+ * @return The (possibly moved) buffer, or NULL if it could not grow
+ */
+void* autosave_grow(void* buf, int* capacity, int needed, size_t size) {
+    if (buf && needed <= *capacity) return buf;
+    int new_capacity = needed > 0 ? needed : 1;
+    void* grown = realloc(buf, (size_t)new_capacity * size);
+    if (!grown) return NULL;
+    *capacity = new_capacity;
+    return grown;
+}
+
+/**
+ * Copy what write_save_records() reads - header fields, roster, mob units,
+ * archive, effect names and entries, numbering marks - from `src` into the snapshot `dst`.
+ *
+ * @return 1 on success, 0 if a buffer could not grow
+ */
+int autosave_snapshot(GameState* dst, GameState* src) {
+    Combatant* combatants = (Combatant*)autosave_grow(dst->combatants, &dst->capacity, src->count, sizeof(Combatant));
+    if (!combatants) return 0;
+    dst->combatants = combatants;
+    MobUnit* units = (MobUnit*)autosave_grow(dst->mob_units, &dst->mob_unit_capacity, src->mob_unit_count, sizeof(MobUnit));
+    if (!units) return 0;
+    dst->mob_units = units;
+    ArchiveEntry* archive = (ArchiveEntry*)autosave_grow(dst->archive, &dst->archive_capacity, src->archive_count, sizeof(ArchiveEntry));
+    if (!archive) return 0;
+    dst->archive = archive;
+    MobUnit* archive_units = (MobUnit*)autosave_grow(dst->archive_units, &dst->archive_unit_capacity,
+        src->archive_unit_count, sizeof(MobUnit));
+    if (!archive_units) return 0;
+    dst->archive_units = archive_units;
+    char (*names)[EFFECT_NAME_LENGTH] = (char (*)[EFFECT_NAME_LENGTH])autosave_grow(dst->registry.names,
+        &dst->registry.capacity, src->registry.count, EFFECT_NAME_LENGTH);
+    if (!names) return 0;
+    dst->registry.names = names;
+    if (!effect_store_copy(&dst->effect_store, &src->effect_store)) return 0;
+    int slot_capacity = dst->name_index.slots ? dst->name_index.capacity : 0;
+    NameIndexEntry* slots = (NameIndexEntry*)autosave_grow(dst->name_index.slots, &slot_capacity,
+        src->name_index.capacity, sizeof(NameIndexEntry));
+    if (!slots) return 0;
+    dst->name_index.slots = slots;
+
+    memcpy(dst->combatants, src->combatants, (size_t)src->count * sizeof(Combatant));
+    memcpy(dst->mob_units, src->mob_units, (size_t)src->mob_unit_count * sizeof(MobUnit));
+    memcpy(dst->archive, src->archive, (size_t)src->archive_count * sizeof(ArchiveEntry));
+    memcpy(dst->archive_units, src->archive_units, (size_t)src->archive_unit_count * sizeof(MobUnit));
+    memcpy(dst->registry.names, src->registry.names, (size_t)src->registry.count * EFFECT_NAME_LENGTH);
+    if (src->name_index.capacity > 0) {
+        memcpy(dst->name_index.slots, src->name_index.slots, (size_t)src->name_index.capacity * sizeof(NameIndexEntry));
+    }
+    memset(dst->name_index.slots + src->name_index.capacity, 0,
+        (size_t)(slot_capacity - src->name_index.capacity) * sizeof(NameIndexEntry));
+    dst->name_index.capacity = slot_capacity;
+    dst->name_index.count = src->name_index.count;
+    dst->count = src->count;
+    dst->mob_unit_count = src->mob_unit_count;
+    dst->archive_count = src->archive_count;
+    dst->archive_unit_count = src->archive_unit_count;
+    dst->registry.count = src->registry.count;
+    dst->round = src->round;
+    dst->next_id = src->next_id;
+    dst->current_turn_id = src->current_turn_id;
+    dst->selected_id = src->selected_id;
+    dst->skip_policy = src->skip_policy;
+    return 1;
+}
+
+/**
+ * TUI-thread side: snapshot the state into the buffer the writer is not
+ * using and hand it over. Costs a few memcpys; the formatting and disk
+ * writes all happen on the autosave thread.
+ */
+void autosave_publish(Autosaver* a, GameState* state) {
+    TRACE_SCOPE("autosave_publish");
+    uint64_t start_ns = trace_now_ns();
+    pthread_mutex_lock(&a->lock);
+    int target = a->writing == 0 ? 1 : 0;
+    int ok = autosave_snapshot(&a->buffers[target], state);
+    if (ok) {
+        a->pending = target;
+        pthread_cond_signal(&a->wake);
+    } else if (a->pending == target) {
+        a->pending = -1;  /* Half-copied - don't let the writer see it */
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    a->journal_mark = state->journal_count;
+    clock_gettime(CLOCK_MONOTONIC, &a->last_publish);
+    state->stats.autosaves++;
+    state->stats.autosave_ns += trace_now_ns() - start_ns;
+    if (!ok) show_message(state, "Autosave skipped! Out of memory.", 1);
+}
+
+/**
+ * Called by the TUI loop before it waits for input: reports a failed
+ * write and publishes a snapshot once enough changes or time have passed.
+ */
+void autosave_tick(Autosaver* a, GameState* state) {
+    if (!a) return;
+    pthread_mutex_lock(&a->lock);
+    int error = a->error;
+    a->error = 0;
+    pthread_mutex_unlock(&a->lock);
+    if (error) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Autosave failed! %s", strerror(error));
+        show_message(state, msg, 1);
+    }
+
+    /* Every change goes through the journal, so its length is the dirty count */
+    int changes = state->journal_count - a->journal_mark;
+    if (changes == 0) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((a->changes == 0 || changes < a->changes) && now.tv_sec - a->last_publish.tv_sec < a->interval_s) return;
+    autosave_publish(a, state);
+}
+
+/* Save any unsaved changes, wait for the writer to finish and free it */
+void autosave_stop(Autosaver* a, GameState* state) {
+    if (!a) return;
+    if (state->journal_count != a->journal_mark) autosave_publish(a, state);
+    pthread_mutex_lock(&a->lock);
+    a->stop = 1;
+    pthread_cond_signal(&a->wake);
+    pthread_mutex_unlock(&a->lock);
+    pthread_join(a->thread, NULL);
+
+    for (int i = 0; i < 2; i++) {
+        free(a->buffers[i].combatants);
+        free(a->buffers[i].mob_units);
+        free(a->buffers[i].archive);
+        free(a->buffers[i].archive_units);
+        free(a->buffers[i].registry.names);
+        free(a->buffers[i].name_index.slots);
+        effect_store_free(&a->buffers[i].effect_store);
+    }
+    pthread_cond_destroy(&a->wake);
+    pthread_mutex_destroy(&a->lock);
+    free(a);
+}
+
+/*
+ * Writes each snapshot to "<path>.tmp" and renames it over the autosave,
+ * so a crash mid-write leaves the previous autosave intact. Stopping
+ * writes whatever is still pending first.
+ */
+void* autosave_thread(void* arg) {
+    Autosaver* a = (Autosaver*)arg;
+    trace_thread_name("autosave");
+    char tmp_path[COMMAND_PATH_LENGTH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", a->path);
+
+    pthread_mutex_lock(&a->lock);
+    for (;;) {
+        while (a->pending == -1 && !a->stop) pthread_cond_wait(&a->wake, &a->lock);
+        if (a->pending == -1) break;
+        int buffer = a->pending;
+        a->pending = -1;
+        a->writing = buffer;
+        pthread_mutex_unlock(&a->lock);
+
+        int error = 0;
+        {
+            TRACE_SCOPE("autosave_write");
+            errno = 0;
+            FILE* f = fopen(tmp_path, "w");
+            if (!f) {
+                error = errno;
+            } else {
+                int ok = write_save_records(&a->buffers[buffer], f) && fflush(f) == 0 && fsync(fileno(f)) == 0;
+                if (!ok) error = errno ? errno : EIO;
+                if (fclose(f) != 0 && !error) error = errno ? errno : EIO;
+                if (!error && rename(tmp_path, a->path) != 0) error = errno;
+            }
+        }
+
+        pthread_mutex_lock(&a->lock);
+        a->writing = -1;
+        if (error) a->error = error;
+        else a->written++;
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+
+ /* --- Campaign History Functions --- */
+
+/*
+ * Schema of the history database. Sessions are runs of the tracker; events
+ * are log lines, typed where a query needs it; snapshots are every
+ * combatant's HP and conditions at the start of each round. Rows carry
+ * the undo step they happened in; an undo marks every row from the
+ * reverted step on as undone, so a redone hit is only counted once.
+ *
+ *   SELECT SUM(amount) FROM events WHERE combatant = 'Thorin' AND kind = 'damage' AND undone = 0;
+ *
+ * is answered from events_combatant alone: the index also carries the
+ * amount, so the table rows are never read.
+ */
+#ifdef INITIATIVE_SQLITE
+static const char history_schema[] =
+    "PRAGMA journal_mode = WAL;"
+    "PRAGMA synchronous = NORMAL;"
+    "CREATE TABLE IF NOT EXISTS sessions(id INTEGER PRIMARY KEY, started INTEGER NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS events(session INTEGER NOT NULL, round INTEGER NOT NULL, turn_id INTEGER,"
+    " combatant_id INTEGER, combatant TEXT COLLATE NOCASE, kind TEXT NOT NULL, amount INTEGER,"
+    " time INTEGER NOT NULL, message TEXT NOT NULL, step INTEGER NOT NULL, undone INTEGER NOT NULL DEFAULT 0);"
+    "CREATE INDEX IF NOT EXISTS events_session_round ON events(session, round);"
+    "CREATE INDEX IF NOT EXISTS events_session_step ON events(session, step);"
+    "CREATE INDEX IF NOT EXISTS events_combatant ON events(combatant, kind, undone, amount);"
+    "CREATE TABLE IF NOT EXISTS snapshots(session INTEGER NOT NULL, round INTEGER NOT NULL, time INTEGER NOT NULL,"
+    " combatant_id INTEGER NOT NULL, combatant TEXT NOT NULL COLLATE NOCASE, type TEXT NOT NULL,"
+    " hp INTEGER NOT NULL, max_hp INTEGER NOT NULL, conditions TEXT NOT NULL, step INTEGER NOT NULL,"
+    " undone INTEGER NOT NULL DEFAULT 0);"
+    "CREATE INDEX IF NOT EXISTS snapshots_session_round ON snapshots(session, round);"
+    "CREATE INDEX IF NOT EXISTS snapshots_combatant ON snapshots(combatant);"
+    "INSERT INTO sessions(started) VALUES(strftime('%s', 'now'));";
+#endif
+
+/**
+ * Open (or create) the history database at `path`, start a session in it
+ * and start the writer thread. Errors are printed to stderr.
+ *
+ * @return The history sink, or NULL if it could not start
+ */
+History* history_start(const char* path) {
+#ifndef INITIATIVE_SQLITE
+    fprintf(stderr, "Cannot open %s: this build has no SQLite support (rebuild with `make SQLITE=1`)\n", path);
+    return NULL;
+#else
+    History* h = (History*)calloc(1, sizeof(History));
+    if (!h) return NULL;
+    snprintf(h->path, sizeof(h->path), "%s", path);
+
+    char* sql_error = NULL;
+    if (sqlite3_open(path, &h->db) != SQLITE_OK ||
+        sqlite3_busy_timeout(h->db, 5000) != SQLITE_OK ||
+        sqlite3_exec(h->db, history_schema, NULL, NULL, &sql_error) != SQLITE_OK ||
+        sqlite3_prepare_v2(h->db,
+            "INSERT INTO events(session, round, turn_id, combatant_id, combatant, kind, amount, time, message, step)"
+            " VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)", -1, &h->insert_event, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(h->db,
+            "INSERT INTO snapshots(session, round, time, combatant_id, combatant, type, hp, max_hp, conditions, step)"
+            " VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)", -1, &h->insert_snapshot, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(h->db, "UPDATE events SET undone = 1 WHERE session = ?1 AND step >= ?2 AND undone = 0",
+            -1, &h->mark_undone[0], NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2(h->db, "UPDATE snapshots SET undone = 1 WHERE session = ?1 AND step >= ?2 AND undone = 0",
+            -1, &h->mark_undone[1], NULL) != SQLITE_OK) {
+        fprintf(stderr, "Cannot open history %s: %s\n", path, sql_error ? sql_error : sqlite3_errmsg(h->db));
+        sqlite3_free(sql_error);
+        sqlite3_finalize(h->insert_event);
+        sqlite3_finalize(h->insert_snapshot);
+        sqlite3_finalize(h->mark_undone[0]);
+        sqlite3_finalize(h->mark_undone[1]);
+        sqlite3_close(h->db);
+        free(h);
+        return NULL;
+    }
+    h->session = sqlite3_last_insert_rowid(h->db);
+
+    pthread_mutex_init(&h->lock, NULL);
+    pthread_cond_init(&h->wake, NULL);
+    if (pthread_create(&h->thread, NULL, history_thread, h) != 0) {
+        fprintf(stderr, "Cannot start the history writer thread\n");
+        pthread_cond_destroy(&h->wake);
+        pthread_mutex_destroy(&h->lock);
+        sqlite3_finalize(h->insert_event);
+        sqlite3_finalize(h->insert_snapshot);
+        sqlite3_finalize(h->mark_undone[0]);
+        sqlite3_finalize(h->mark_undone[1]);
+        sqlite3_close(h->db);
+        free(h);
+        return NULL;
+    }
+    return h;
+#endif
+}
 
-        for(int j=0; j<NUM_CONDITIONS; j++) {
-            token = strtok(NULL, "|");
-            if (!token) break;
-            if (!parse_int_safe(token, &c->condition_duration[j])) {
-                c->condition_duration[j] = 0;  /* Default on parse failure */
-            }
+/**
+ * Claim the next row of the buffer being filled. Called with the lock held;
+ * wakes the writer once a batch has built up.
+ *
+ * @return The row to fill in, or NULL if it was dropped (queue full or out of memory)
+ */
+HistoryRow* history_reserve(History* h) {
+    int buffer = h->filling;
+    if (h->row_count[buffer] >= HISTORY_MAX_QUEUED) {
+        h->dropped++;
+        return NULL;
+    }
+    if (h->row_count[buffer] == h->row_capacity[buffer]) {
+        int capacity = h->row_capacity[buffer] > 0 ? h->row_capacity[buffer] * 2 : HISTORY_BATCH_ROWS;
+        HistoryRow* rows = (HistoryRow*)realloc(h->rows[buffer], (size_t)capacity * sizeof(HistoryRow));
+        if (!rows) {
+            h->dropped++;
+            return NULL;
         }
-
-        idx++;
+        h->rows[buffer] = rows;
+        h->row_capacity[buffer] = capacity;
     }
-    state->count = idx;
+    if (++h->row_count[buffer] == HISTORY_BATCH_ROWS) pthread_cond_signal(&h->wake);
+    return &h->rows[buffer][h->row_count[buffer] - 1];
+}
 
-    if (fclose(f) != 0) {
-        show_message(state, "Load warning: Error closing file.", 1);
+/* Queue one log entry. Costs a copy under an uncontended lock; no I/O. */
+void history_note(History* h, const CombatLogEntry* entry, const Combatant* c, HistoryKind kind, int amount, int step) {
+    if (!h) return;
+    pthread_mutex_lock(&h->lock);
+    HistoryRow* row = history_reserve(h);
+    if (row) {
+        row->kind = (int)kind;
+        row->round = entry->round;
+        row->turn_id = entry->turn_id;
+        row->combatant_id = c ? c->id : 0;
+        row->amount = amount;
+        row->step = step;
+        row->time = entry->timestamp;
+        snprintf(row->combatant, sizeof(row->combatant), "%s", c ? c->name : "");
+        snprintf(row->text, sizeof(row->text), "%s", entry->message);
     }
+    pthread_mutex_unlock(&h->lock);
+}
 
-    /* Recalculate next_id to prevent collisions from corrupt/manually edited save files */
-    int max_id = 0;
+/* Queue every combatant's HP and conditions as the round starts */
+void history_snapshot(History* h, GameState* state) {
+    if (!h || state->suppress_feedback) return;
+    time_t now = time(NULL);
+    pthread_mutex_lock(&h->lock);
     for (int i = 0; i < state->count; i++) {
-        if (state->combatants[i].id > max_id) {
-            max_id = state->combatants[i].id;
+        const Combatant* c = &state->combatants[i];
+        HistoryRow* row = history_reserve(h);
+        if (!row) break;
+        row->kind = HISTORY_SNAPSHOT;
+        row->round = state->round;
+        row->turn_id = state->current_turn_id;
+        row->combatant_id = c->id;
+        row->amount = 0;
+        row->step = state->undo_step;
+        row->hp = c->hp;
+        row->max_hp = c->max_hp;
+        row->is_player = c->type == TYPE_PLAYER;
+        row->time = now;
+        snprintf(row->combatant, sizeof(row->combatant), "%s", c->name);
+        size_t len = 0;
+        row->text[0] = '\0';
+        for (int e = effect_next(state, c, 0); e != -1 && len < sizeof(row->text); e = effect_next(state, c, e + 1)) {
+            int n = snprintf(row->text + len, sizeof(row->text) - len, "%s%s", len > 0 ? "," : "", effect_name(state, e));
+            if (n < 0) break;
+            len += (size_t)n;
         }
     }
-    state->next_id = max_id + 1;
-    if (state->next_id <= 0 || state->next_id == INT_MAX) {
-        state->next_id = 1;  /* Fallback to 1 if overflow or invalid */
-    }
+    pthread_mutex_unlock(&h->lock);
+}
 
-    sort_combatants(state);
-    state->message_queue_count = 0;
+/* Called by the TUI loop: report a batch the writer could not commit */
+void history_tick(History* h, GameState* state) {
+    if (!h) return;
+    char error[sizeof(h->error)];
+    pthread_mutex_lock(&h->lock);
+    snprintf(error, sizeof(error), "%s", h->error);
+    h->error[0] = '\0';
+    pthread_mutex_unlock(&h->lock);
+    if (error[0]) {
+        char msg[200];
+        snprintf(msg, sizeof(msg), "History write failed! %s", error);
+        show_message(state, msg, 1);
+    }
+}
 
-    log_action(state, "Game Loaded from save file. Round set to %d.", state->round);
-    show_message(state, "Game Loaded.", 0);
+/* Commit whatever is still queued, stop the writer and close the database */
+void history_stop(History* h) {
+    if (!h) return;
+    pthread_mutex_lock(&h->lock);
+    h->stop = 1;
+    pthread_cond_signal(&h->wake);
+    pthread_mutex_unlock(&h->lock);
+    pthread_join(h->thread, NULL);
+
+#ifdef INITIATIVE_SQLITE
+    sqlite3_finalize(h->insert_event);
+    sqlite3_finalize(h->insert_snapshot);
+    sqlite3_finalize(h->mark_undone[0]);
+    sqlite3_finalize(h->mark_undone[1]);
+    sqlite3_close(h->db);
+#endif
+    free(h->rows[0]);
+    free(h->rows[1]);
+    pthread_cond_destroy(&h->wake);
+    pthread_mutex_destroy(&h->lock);
+    free(h);
 }
 
-/* --- Death Save Functions --- */
+/*
+ * Swaps out the filled buffer every HISTORY_FLUSH_MS, or as soon as
+ * HISTORY_BATCH_ROWS have queued, and inserts it in one transaction. The
+ * TUI keeps appending to the other buffer meanwhile.
+ */
+void* history_thread(void* arg) {
+    History* h = (History*)arg;
+    trace_thread_name("history");
+    pthread_mutex_lock(&h->lock);
+    for (;;) {
+        if (!h->stop && h->row_count[h->filling] < HISTORY_BATCH_ROWS) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += HISTORY_FLUSH_MS / 1000;
+            deadline.tv_nsec += (long)(HISTORY_FLUSH_MS % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&h->wake, &h->lock, &deadline);
+        }
+        int buffer = h->filling;
+        int count = h->row_count[buffer];
+        if (count == 0) {
+            if (h->stop) break;
+            continue;
+        }
+        h->filling = 1 - buffer;
+        pthread_mutex_unlock(&h->lock);
 
-void reset_death_saves(Combatant* c) {
-    c->death_save_successes = 0;
-    c->death_save_failures = 0;
-    c->is_stable = 0;
+        int ok;
+        {
+            TRACE_SCOPE("history_write");
+            ok = history_write_batch(h, h->rows[buffer], count);
+        }
+
+        pthread_mutex_lock(&h->lock);
+        h->row_count[buffer] = 0;
+        h->batches++;
+        if (ok) h->written += count;
+    }
+    pthread_mutex_unlock(&h->lock);
+    return NULL;
 }
 
 /**
- * Roll a death saving throw for a combatant.
- *
- * @param state Game state pointer
- * @param c Combatant pointer. If NULL, uses the currently selected combatant (state->selected_id).
- *          This allows convenient manual death saves via 'X' key without requiring selection.
+ * Insert `count` rows in one transaction with the prepared statements.
+ * On failure the batch is rolled back and the error kept for history_tick.
  *
- * Rules implemented:
- * - Natural 20: Regain 1 HP immediately
- * - Natural 1: Two failures
- * - 10-19: Success (counts toward 3 successes = stable)
- * - 2-9: Failure (counts toward 3 failures = death)
- * - Only works for players at 0 HP who are not stable or dead
+ * @return 1 if the batch was committed
  */
-void roll_death_save(GameState* state, Combatant* c) {
-    /* Convenience: NULL uses selected combatant for manual 'X' key */
-    if (!c) {
-        int idx = get_index_by_id(state, state->selected_id);
-        if (idx == -1) return;
-        c = &state->combatants[idx];
+int history_write_batch(History* h, const HistoryRow* rows, int count) {
+#ifndef INITIATIVE_SQLITE
+    (void)h;
+    (void)rows;
+    (void)count;
+    return 0;
+#else
+    int rc = sqlite3_exec(h->db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+    for (int i = 0; i < count && rc == SQLITE_OK; i++) {
+        const HistoryRow* row = &rows[i];
+        sqlite3_stmt* stmt;
+        if (row->kind == HISTORY_SNAPSHOT) {
+            stmt = h->insert_snapshot;
+            sqlite3_bind_int64(stmt, 1, h->session);
+            sqlite3_bind_int(stmt, 2, row->round);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64)row->time);
+            sqlite3_bind_int(stmt, 4, row->combatant_id);
+            sqlite3_bind_text(stmt, 5, row->combatant, -1, SQLITE_STATIC);
+            sqlite3_bind_text(stmt, 6, row->is_player ? "player" : "enemy", -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 7, row->hp);
+            sqlite3_bind_int(stmt, 8, row->max_hp);
+            sqlite3_bind_text(stmt, 9, row->text, -1, SQLITE_STATIC);
+        } else {
+            if (row->kind == HISTORY_UNDONE) {
+                /* Everything since the reverted snapshot is no longer part of the encounter */
+                for (int t = 0; t < 2 && rc == SQLITE_OK; t++) {
+                    sqlite3_bind_int64(h->mark_undone[t], 1, h->session);
+                    sqlite3_bind_int(h->mark_undone[t], 2, row->amount);
+                    rc = sqlite3_step(h->mark_undone[t]) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+                    sqlite3_reset(h->mark_undone[t]);
+                }
+                if (rc != SQLITE_OK) break;
+            }
+            stmt = h->insert_event;
+            sqlite3_bind_int64(stmt, 1, h->session);
+            sqlite3_bind_int(stmt, 2, row->round);
+            sqlite3_bind_int(stmt, 3, row->turn_id);
+            if (row->combatant_id) {
+                sqlite3_bind_int(stmt, 4, row->combatant_id);
+                sqlite3_bind_text(stmt, 5, row->combatant, -1, SQLITE_STATIC);
+            } else {
+                sqlite3_bind_null(stmt, 4);
+                sqlite3_bind_null(stmt, 5);
+            }
+            sqlite3_bind_text(stmt, 6, history_kind_names[row->kind], -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 7, row->amount);
+            sqlite3_bind_int64(stmt, 8, (sqlite3_int64)row->time);
+            sqlite3_bind_text(stmt, 9, row->text, -1, SQLITE_STATIC);
+        }
+        sqlite3_bind_int(stmt, 10, row->step);
+        rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+        sqlite3_reset(stmt);
     }
+    if (rc == SQLITE_OK) rc = sqlite3_exec(h->db, "COMMIT", NULL, NULL, NULL);
+    if (rc == SQLITE_OK) return 1;
+
+    char error[sizeof(h->error)];
+    snprintf(error, sizeof(error), "%s (%d rows lost)", sqlite3_errmsg(h->db), count);
+    sqlite3_exec(h->db, "ROLLBACK", NULL, NULL, NULL);
+    pthread_mutex_lock(&h->lock);
+    snprintf(h->error, sizeof(h->error), "%s", error);
+    pthread_mutex_unlock(&h->lock);
+    return 0;
+#endif
+}
 
-    if (c->type != TYPE_PLAYER) return;
-    if (c->hp > 0 || c->is_stable || c->is_dead) return;
-
-    int roll = (rand() % 20) + 1;
-
-    if (roll == 20) {
-        /* 5e rule: natural 20 = regain 1 HP immediately */
-        c->hp = 1;
-        c->conditions &= (uint16_t)~COND_UNCONSCIOUS;
-        reset_death_saves(c);
-        show_message(state, "NATURAL 20! Regained 1 HP!", 0);
-        log_action(state, "%s rolled a NATURAL 20 on death save! Regained 1 HP.", c->name);
-    } else if (roll == 1) {
-        /* 5e rule: natural 1 = two failures */
-        c->death_save_failures += 2;
-        log_action(state, "%s rolled a NATURAL 1 on death save (2 failures). Total: %d failures.",
-            c->name, c->death_save_failures);
+ /* --- Stats Functions --- */
 
-        if (c->death_save_failures >= 3) {
-            c->is_dead = 1;
-            show_message(state, "DEATH! (3 failures)", 1);
-            log_action(state, "%s has died (3 death save failures).", c->name);
-        }
-    } else if (roll >= 10) {
-        c->death_save_successes++;
-        log_action(state, "%s rolled %d on death save (SUCCESS). Total: %d successes.",
-            c->name, roll, c->death_save_successes);
+/**
+ * Start counting terminal output. ncurses writes straight to the tty, so the
+ * count is the main thread's write(2) byte counter, sampled after each
+ * refresh() and, when the thread wrote a file or pipe since, before it too.
+ * Linux only; elsewhere terminal bytes are reported as n/a.
+ */
+void stats_open_terminal_counter(GameState* state) {
+    state->stats.io_fd = open("/proc/thread-self/io", O_RDONLY);
+}
 
-        if (c->death_save_successes >= 3) {
-            c->is_stable = 1;
-            show_message(state, "STABLE! (3 successes)", 0);
-            log_action(state, "%s is now STABLE (3 death save successes).", c->name);
-        }
-    } else {
-        c->death_save_failures++;
-        log_action(state, "%s rolled %d on death save (FAILURE). Total: %d failures.",
-            c->name, roll, c->death_save_failures);
+/** Bytes this thread has passed to write(2) so far, or -1 if unknown. */
+long long stats_thread_written(GameState* state) {
+    if (state->stats.io_fd < 0) return -1;
+    char buf[512];
+    ssize_t n = pread(state->stats.io_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    const char* field = strstr(buf, "wchar:");
+    return field ? strtoll(field + 6, NULL, 10) : -1;
+}
 
-        if (c->death_save_failures >= 3) {
-            c->is_dead = 1;
-            show_message(state, "DEATH! (3 failures)", 1);
-            log_action(state, "%s has died (3 death save failures).", c->name);
-        }
+/**
+ * Heap and struct memory held by the state, one row per component.
+ *
+ * @return Number of rows filled (at most STATS_MEMORY_ROWS)
+ */
+int stats_memory(GameState* state, StatsRow* rows) {
+    size_t undo = 0;
+    for (int i = 0; i < MAX_UNDO_STACK; i++) {
+        undo += (size_t)state->undo_stack[i].capacity * sizeof(Combatant) +
+                (size_t)state->undo_stack[i].mob_unit_capacity * sizeof(MobUnit) +
+                (size_t)state->undo_stack[i].effects.word_capacity * sizeof(EffectWord) +
+                (size_t)state->undo_stack[i].effects.timer_capacity * sizeof(EffectTimer);
+    }
+    size_t expiry = (size_t)state->expiry.rounds.capacity * sizeof(ExpiryEvent) +
+                    (size_t)state->expiry.anchor_capacity * sizeof(ExpiryAnchor);
+    for (int i = 0; i < state->expiry.anchor_capacity; i++) {
+        expiry += (size_t)(state->expiry.anchors[i].turn[0].capacity +
+                           state->expiry.anchors[i].turn[1].capacity) * sizeof(ExpiryEvent);
     }
+    size_t hot_row = 4 * sizeof(int) + sizeof(uint64_t) + 2 * sizeof(uint8_t);
+    size_t indexes = (size_t)state->name_index.capacity * sizeof(NameIndexEntry) + expiry +
+                     (size_t)state->eligible_capacity * sizeof(uint64_t) +
+                     (size_t)state->visual_map_capacity * sizeof(int) +
+                     (size_t)state->hot.capacity * hot_row +
+                     (size_t)state->registry.capacity * EFFECT_NAME_LENGTH;
+
+    int n = 0;
+    rows[n++] = (StatsRow){ "game state struct", sizeof(GameState) };
+    rows[n++] = (StatsRow){ "roster", (size_t)state->capacity * sizeof(Combatant) };
+    rows[n++] = (StatsRow){ "mob units", (size_t)state->mob_unit_capacity * sizeof(MobUnit) };
+    rows[n++] = (StatsRow){ "effects, timers", (size_t)state->effect_store.word_capacity * sizeof(EffectWord) +
+                                               (size_t)state->effect_store.timer_capacity * sizeof(EffectTimer) };
+    rows[n++] = (StatsRow){ "undo snapshots", undo };
+    rows[n++] = (StatsRow){ "combat log", (size_t)state->log_capacity * sizeof(CombatLogEntry) };
+    rows[n++] = (StatsRow){ "archive", (size_t)state->archive_capacity * sizeof(ArchiveEntry) +
+                                       (size_t)state->archive_unit_capacity * sizeof(MobUnit) };
+    rows[n++] = (StatsRow){ "command journal", (size_t)state->journal_capacity * sizeof(Command) };
+    rows[n++] = (StatsRow){ "indexes, mirrors", indexes };
+    return n;
 }
 
-void handle_damage_at_zero_hp(GameState* state, Combatant* c, int damage, int is_critical) {
-    if (c->type != TYPE_PLAYER || c->hp > 0 || c->is_dead) return;
+/** Format a byte count as B, KiB or MiB. */
+void stats_format_bytes(char* buf, size_t size, double bytes) {
+    if (bytes < 0) snprintf(buf, size, "n/a");
+    else if (bytes < 1024.0) snprintf(buf, size, "%.0f B", bytes);
+    else if (bytes < 1024.0 * 1024.0) snprintf(buf, size, "%.1f KiB", bytes / 1024.0);
+    else snprintf(buf, size, "%.1f MiB", bytes / (1024.0 * 1024.0));
+}
 
-    /* 5e rule: damage at 0 HP = 1 failure, critical = 2 failures */
-    if (is_critical) {
-        c->death_save_failures += 2;
-        log_action(state, "%s took %d CRITICAL damage at 0 HP (2 failures). Total: %d failures.",
-            c->name, damage, c->death_save_failures);
+/**
+ * The report shown by --stats and the 'I' overlay, one line per entry.
+ *
+ * @return Number of lines filled (at most STATS_LINES)
+ */
+int stats_format_lines(GameState* state, char lines[][STATS_LINE_LENGTH]) {
+    const Stats* s = &state->stats;
+    char a[32], b[32];
+    int n = 0;
+
+    if (s->terminal_bytes >= 0) {
+        stats_format_bytes(a, sizeof(a), (double)s->terminal_bytes);
+        snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%s to the terminal)", "redraws", s->redraws, a);
     } else {
-        c->death_save_failures++;
-        log_action(state, "%s took %d damage at 0 HP (1 failure). Total: %d failures.",
-            c->name, damage, c->death_save_failures);
+        snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld", "redraws", s->redraws);
     }
-
-    /* Damage breaks stability */
-    if (c->is_stable) {
-        c->is_stable = 0;
-        log_action(state, "%s is no longer stable due to damage.", c->name);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%lld reallocs, %d kept)", "log entries",
+        s->log_entries, s->log_reallocs, state->log_count);
+    stats_format_bytes(a, sizeof(a), (double)s->undo_bytes);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%s copied)", "undo snapshots", s->undo_snapshots, a);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%lld comparisons)", "sorts", s->sorts, s->sort_comparisons);
+    stats_format_bytes(a, sizeof(a), (double)s->save_bytes);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%s, %.2f ms)", "saves", s->saves, a, (double)s->save_ns / 1e6);
+    stats_format_bytes(a, sizeof(a), (double)s->load_bytes);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%s, %.2f ms)", "loads", s->loads, a, (double)s->load_ns / 1e6);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %lld (%.1f us each on the UI thread)", "autosaves", s->autosaves,
+        s->autosaves > 0 ? (double)s->autosave_ns / 1e3 / (double)s->autosaves : 0.0);
+
+    StatsRow rows[STATS_MEMORY_ROWS];
+    int count = stats_memory(state, rows);
+    size_t total = 0;
+    for (int i = 0; i < count; i++) total += rows[i].bytes;
+    stats_format_bytes(a, sizeof(a), (double)total);
+    snprintf(lines[n++], STATS_LINE_LENGTH, "%-20s %s", "memory", a);
+    for (int i = 0; i < count; i++) {
+        stats_format_bytes(b, sizeof(b), (double)rows[i].bytes);
+        snprintf(lines[n++], STATS_LINE_LENGTH, "  %-18s %s", rows[i].label, b);
     }
+    return n;
+}
 
-    if (c->death_save_failures >= 3) {
-        c->is_dead = 1;
-        show_message(state, "DEATH! (3 failures from damage)", 1);
-        log_action(state, "%s has died (3 death save failures).", c->name);
-    }
+void stats_print(GameState* state, FILE* out) {
+    char lines[STATS_LINES][STATS_LINE_LENGTH];
+    int n = stats_format_lines(state, lines);
+    fprintf(out, "stats:\n");
+    for (int i = 0; i < n; i++) fprintf(out, "  %s\n", lines[i]);
 }
 
-void stabilize_combatant(GameState* state) {
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) return;
+/**
+ * Draw the stats overlay ('I'); counters keep updating while it is open.
+ */
+void draw_stats_overlay(GameState* state) {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
 
-    Combatant* c = &state->combatants[idx];
+    char lines[STATS_LINES][STATS_LINE_LENGTH];
+    int n = stats_format_lines(state, lines);
+    int s_height = n + 6;
+    int s_width = 60;
+    int s_start_y = (rows - s_height) / 2;
+    int s_start_x = (cols - s_width) / 2;
+    if (s_start_y < 0) s_start_y = 0;
+    if (s_start_x < 0) s_start_x = 0;
 
-    if (c->type != TYPE_PLAYER) {
-        show_message(state, "Only players can be stabilized!", 1);
-        return;
+    attron(COLOR_PAIR(COLOR_HEADER));
+    for (int y = s_start_y; y < s_start_y + s_height && y < rows; y++) {
+        for (int x = s_start_x; x < s_start_x + s_width && x < cols; x++) {
+            mvaddch(y, x, ' ');
+        }
     }
+    attroff(COLOR_PAIR(COLOR_HEADER));
 
-    if (c->hp > 0) {
-        show_message(state, "Combatant is not at 0 HP!", 1);
-        return;
-    }
+    attron(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
+    mvprintw(s_start_y, s_start_x + (s_width - 13) / 2, "SESSION STATS");
+    attroff(COLOR_PAIR(COLOR_HEADER) | A_BOLD);
 
-    if (c->is_dead) {
-        show_message(state, "Combatant is already dead!", 1);
-        return;
+    attron(COLOR_PAIR(COLOR_HEADER));
+    mvhline(s_start_y + 1, s_start_x, ACS_HLINE, s_width);
+    for (int i = 0; i < n && s_start_y + 3 + i < rows; i++) {
+        mvprintw(s_start_y + 3 + i, s_start_x + 2, "%.*s", s_width - 4, lines[i]);
     }
+    mvhline(s_start_y + s_height - 2, s_start_x, ACS_HLINE, s_width);
+    mvprintw(s_start_y + s_height - 1, s_start_x + (s_width - 22) / 2, "Press any key to close");
+    attroff(COLOR_PAIR(COLOR_HEADER));
+}
 
-    if (c->is_stable) {
-        show_message(state, "Combatant is already stable!", 1);
-        return;
-    }
+ /* --- Trace Functions --- */
 
-    reset_death_saves(c);
-    c->is_stable = 1;
-    show_message(state, "Combatant stabilized!", 0);
-    log_action(state, "%s has been stabilized (Spare the Dying/Medicine check/Healer's Kit).", c->name);
+uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
 }
 
-/* --- Helper Functions --- */
+/**
+ * Turn tracing on for the rest of the process. The trace is written to
+ * `path` at exit, and on SIGUSR1 without stopping.
+ *
+ * @return 1 on success, 0 if the path is too long
+ */
+int trace_start(const char* path) {
+    if (strlen(path) >= sizeof(trace_path)) return 0;
+    strcpy(trace_path, path);
+    trace_origin_ns = trace_now_ns();
+    trace_thread_name("main");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    atexit(trace_dump_at_exit);
+    atomic_store(&trace_enabled, 1);
+    return 1;
+}
 
-void move_selection(GameState* state, int direction) {
-    int idx = get_index_by_id(state, state->selected_id);
-    if (idx == -1) {
-        if (state->count > 0) state->selected_id = state->combatants[0].id;
-        return;
-    }
+/** Label the calling thread in the trace; call before its first span. */
+void trace_thread_name(const char* name) {
+    trace_local_name = name;
+}
 
-    idx = (idx + direction + state->count) % state->count;
-    state->selected_id = state->combatants[idx].id;
+TraceSpan trace_begin(const char* name, int arg) {
+    TraceSpan span = { name, 0, arg };
+    if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) span.start_ns = trace_now_ns();
+    return span;
 }
 
-void sort_combatants(GameState* state) {
-    if (state->count <= 1) return;
-    qsort(state->combatants, (size_t)state->count, sizeof(Combatant), compare_combatants);
+void trace_end(TraceSpan* span) {
+    if (span->start_ns == 0) return;
+    TraceRing* ring = trace_ring();
+    if (!ring || !ring->events) return;
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceEvent* e = &ring->events[head % TRACE_RING_EVENTS];
+    e->name = span->name;
+    e->start_ns = span->start_ns;
+    e->duration_ns = trace_now_ns() - span->start_ns;
+    e->arg = span->arg;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
 }
 
-int compare_combatants(const void* a, const void* b) {
-    const Combatant* ca = (const Combatant*)a;
-    const Combatant* cb = (const Combatant*)b;
+/**
+ * The calling thread's ring, claimed and allocated on its first span.
+ * Threads past TRACE_MAX_THREADS (or out of memory) record nothing.
+ */
+TraceRing* trace_ring(void) {
+    if (trace_local_ring) return trace_local_ring;
+    int slot = atomic_fetch_add(&trace_ring_count, 1);
+    if (slot >= TRACE_MAX_THREADS) return NULL;
+
+    TraceRing* ring = &trace_rings[slot];
+    ring->thread_name = trace_local_name ? trace_local_name : "thread";
+    ring->events = (TraceEvent*)calloc(TRACE_RING_EVENTS, sizeof(TraceEvent));
+    trace_local_ring = ring;
+    return ring;
+}
 
-    if (cb->initiative != ca->initiative) {
-        return cb->initiative - ca->initiative;
-    }
-    if (cb->dex != ca->dex) {
-        return cb->dex - ca->dex;
+/**
+ * Write every ring as Chrome trace-event JSON: one complete ("X") event per
+ * span, timestamps in microseconds since trace_start().
+ * Rings of other threads may be written to meanwhile, so the oldest part of
+ * a full ring (where the writer could be lapping the reader) is skipped.
+ *
+ * @return Spans written, or -1 if the file cannot be written
+ */
+int trace_dump(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) return -1;
+
+    long pid = (long)getpid();
+    int written = 0;
+    int rings = atomic_load(&trace_ring_count);
+    if (rings > TRACE_MAX_THREADS) rings = TRACE_MAX_THREADS;
+    int any = 0;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int r = 0; r < rings; r++) {
+        TraceRing* ring = &trace_rings[r];
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head == 0) continue;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            any ? ",\n" : "", pid, r + 1, ring->thread_name);
+        any = 1;
+        uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS + TRACE_RING_EVENTS / 16 : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const TraceEvent* e = &ring->events[i % TRACE_RING_EVENTS];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"initiative\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f", e->name, pid, r + 1,
+                (double)(e->start_ns - trace_origin_ns) / 1000.0, (double)e->duration_ns / 1000.0);
+            if (e->arg != TRACE_NO_ARG) fprintf(f, ",\"args\":{\"arg\":%d}", e->arg);
+            fputc('}', f);
+            written++;
+        }
     }
-    return ca->id - cb->id;
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) return -1;
+    return written;
 }
 
-int get_index_by_id(GameState* state, int id) {
-    for (int i = 0; i < state->count; i++) {
-        if (state->combatants[i].id == id) return i;
+void trace_dump_at_exit(void) {
+    if (!atomic_load(&trace_enabled)) return;
+    atomic_store(&trace_enabled, 0);
+    int spans = trace_dump(trace_path);
+    if (spans < 0) fprintf(stderr, "trace: cannot write %s: %s\n", trace_path, strerror(errno));
+    else fprintf(stderr, "trace: %d spans written to %s\n", spans, trace_path);
+}
+
+void trace_signal_handler(int sig) {
+    (void)sig;
+    trace_dump_requested = 1;
+}
+
+/**
+ * Write the trace if SIGUSR1 asked for it; called from the main loops.
+ *
+ * @return Spans written, 0 if no dump was requested, -1 on failure
+ */
+int trace_poll_dump(void) {
+    if (!trace_dump_requested) return 0;
+    trace_dump_requested = 0;
+    return trace_dump(trace_path);
+}
+
+ /* --- Replay --- */
+
+/**
+ * FNV-1a over the printed roster and archive. Two runs that end in the same
+ * encounter hash the same; any difference in HP, conditions, timers, turn
+ * order or marks changes the hash.
+ */
+uint64_t state_hash(GameState* state) {
+    char* text = NULL;
+    size_t len = 0;
+    FILE* f = open_memstream(&text, &len);
+    if (!f) return 0;
+    batch_print_state(state, f);
+    batch_print_archive(state, f);
+    fclose(f);
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 0x100000001b3ull;
     }
-    return -1;
+    free(text);
+    return hash;
+}
+
+int replay_compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
 }
 
 /**
- * Safely parse an integer from a string.
+ * Re-run a recorded journal (or any batch script) through the rules and,
+ * unless headless, the real renderer, drawing the screen after every
+ * command. At realtime speed each command waits for its recorded issue time.
+ * Reports the total time, the per-command latency distribution (apply plus
+ * draw) and a hash of the final state on stdout.
  *
- * @param str Input string to parse (must not be NULL)
- * @param out Pointer to store parsed value (must not be NULL)
- * @return 1 on success, 0 on failure (invalid format, overflow, etc.)
+ * Lines without a seed prefix draw from a fixed seed, so plain batch scripts
+ * replay identically too.
  *
- * NOTE: Accepts optional leading/trailing whitespace.
- * Returns 0 for: NULL input, empty string, non-numeric characters,
- * overflow/underflow beyond INT_MIN/INT_MAX.
+ * @return Process exit status: 0 if every command succeeded, 1 otherwise
  */
-int parse_int_safe(const char* str, int* out) {
-    if (str == NULL || *str == '\0') return 0;
+int run_replay(const char* path, int realtime, int headless, int show_stats) {
+    FILE* f = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    FILE* quiet = fopen("/dev/null", "w");
+    if (!f || !quiet) {
+        fprintf(stderr, "replay: cannot open %s: %s\n", path, strerror(errno));
+        if (quiet) fclose(quiet);
+        return 1;
+    }
 
-    char* endptr;
-    errno = 0;  /* Reset errno before call */
-    long val = strtol(str, &endptr, 10);
+    GameState state;
+    init_state(&state);
+    state.headless = headless;
+    state.out = quiet;
+    state.err = headless ? stderr : quiet;
+    seed_commands(&state, 0);
+
+    if (!headless) {
+        initscr();
+        cbreak();
+        noecho();
+        curs_set(0);
+        if (has_colors()) {
+            start_color();
+            init_colors();
+        }
+        draw_ui(&state);
+    }
+
+    double* latency_us = NULL;
+    int latency_capacity = 0;
+    int commands = 0;
+    int errors = 0;
+    char line[1024];
+    int line_no = 0;
+    struct timespec start, end, t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+
+        /* Wait for the command's recorded issue time */
+        char* stamp = (realtime && *p == '@') ? memchr(p, '+', strcspn(p, " \t\n")) : NULL;
+        if (stamp) {
+            long long due_ms = strtoll(stamp + 1, NULL, 10);
+            struct timespec due = start;
+            due.tv_sec += (time_t)(due_ms / 1000);
+            due.tv_nsec += (long)(due_ms % 1000) * 1000000L;
+            if (due.tv_nsec >= 1000000000L) {
+                due.tv_sec++;
+                due.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) {}
+        }
+
+        if (commands >= latency_capacity) {
+            int new_capacity = latency_capacity > 0 ? latency_capacity * 2 : 1024;
+            double* grown = (double*)realloc(latency_us, (size_t)new_capacity * sizeof(double));
+            if (!grown) break;
+            latency_us = grown;
+            latency_capacity = new_capacity;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (!execute_batch_command(&state, p, line_no)) errors++;
+        if (!headless) {
+            clear_old_messages(&state);
+            draw_ui(&state);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        latency_us[commands++] = (double)(t1.tv_sec - t0.tv_sec) * 1e6 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e3;
+    }
 
-    /* Check for conversion errors */
-    if (endptr == str) return 0;  /* No digits parsed */
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!headless) endwin();
+    if (f != stdin) fclose(f);
+
+    double total_ms = (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+    double busy_ms = 0.0;
+    for (int i = 0; i < commands; i++) busy_ms += latency_us[i] / 1000.0;
+
+    printf("replay: %d commands (%d journaled), %d errors, %.3f ms total, %.3f ms in commands%s\n",
+        commands, state.journal_count, errors, total_ms, busy_ms, headless ? "" : " (with drawing)");
+    if (commands > 0) {
+        qsort(latency_us, (size_t)commands, sizeof(double), replay_compare_double);
+        printf("latency us: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+            latency_us[(int)(0.50 * (commands - 1))], latency_us[(int)(0.90 * (commands - 1))],
+            latency_us[(int)(0.99 * (commands - 1))], latency_us[(int)(0.999 * (commands - 1))],
+            latency_us[commands - 1]);
+    }
+    printf("state hash: %016llx\n", (unsigned long long)state_hash(&state));
+    if (show_stats) stats_print(&state, stderr);
 
-    /* Skip trailing whitespace */
-    while (*endptr == ' ' || *endptr == '\t') endptr++;
+    free(latency_us);
+    cleanup_state(&state);
+    fclose(quiet);
+    return errors > 0 ? 1 : 0;
+}
 
-    /* Ensure entire string was consumed (except whitespace) */
-    if (*endptr != '\0' && *endptr != '\n' && *endptr != '\r') return 0;
+ /* --- Server Mode --- */
 
-    /* Check for overflow/underflow */
-    if (errno == ERANGE || val > INT_MAX || val < INT_MIN) return 0;
+/*
+ * Protocol: one request per line, "<table> <batch command>", answered in
+ * order. Reply lines start with '-' (command output) or '!' (errors and
+ * messages) and the reply ends with "+OK" or "+ERR". Tables are created on
+ * first use. Lines starting with '.' are server commands: ".tables",
+ * ".drop <table>" and ".stats".
+ */
 
-    *out = (int)val;
+/**
+ * Resolve the socket path: the one given, or ~/.dnd_tracker.sock.
+ */
+int server_socket_path(char* path, size_t size, const char* requested) {
+    if (requested) {
+        if (strlen(requested) >= size) return 0;
+        snprintf(path, size, "%s", requested);
+        return 1;
+    }
+    return build_home_path(path, size, SOCKET_FILE_NAME);
+}
+
+/**
+ * Table names end up in save file names, so keep them to [A-Za-z0-9_-].
+ */
+int server_valid_table_name(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= TABLE_NAME_LENGTH) return 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-') return 0;
+    }
     return 1;
 }
 
 /**
- * Get condition name safely with bounds checking.
+ * Look up a table, optionally creating it with a fresh headless state.
  *
- * @param index Condition index (0 to NUM_CONDITIONS-1)
- * @return Condition name string, or "Unknown" if index is invalid
+ * @return The table, or NULL if it does not exist (or cannot be created)
  */
-const char* get_condition_name(int index) {
-    if (index >= 0 && index < NUM_CONDITIONS) {
-        return condition_data[index].name;
+ServerTable* server_find_table(Server* server, const char* name, int create) {
+    unsigned int mask = (unsigned int)server->table_capacity - 1;
+    unsigned int i = name_index_hash(name) & mask;
+    while (server->tables[i].state) {
+        if (strcmp(server->tables[i].name, name) == 0) return &server->tables[i];
+        i = (i + 1) & mask;
     }
-    return "Unknown";
+    if (!create) return NULL;
+
+    if ((server->table_count + 1) * 2 > server->table_capacity) {
+        int new_capacity = server->table_capacity * 2;
+        ServerTable* grown = (ServerTable*)calloc((size_t)new_capacity, sizeof(ServerTable));
+        if (!grown) return NULL;
+        unsigned int new_mask = (unsigned int)new_capacity - 1;
+        for (int t = 0; t < server->table_capacity; t++) {
+            if (!server->tables[t].state) continue;
+            unsigned int j = name_index_hash(server->tables[t].name) & new_mask;
+            while (grown[j].state) j = (j + 1) & new_mask;
+            grown[j] = server->tables[t];
+        }
+        free(server->tables);
+        server->tables = grown;
+        server->table_capacity = new_capacity;
+        return server_find_table(server, name, 1);
+    }
+
+    GameState* state = (GameState*)malloc(sizeof(GameState));
+    if (!state) return NULL;
+    init_state(state);
+    state->headless = 1;
+    seed_commands(state, (uint64_t)time(NULL) ^ ((uint64_t)name_index_hash(name) << 32));
+    snprintf(state->save_file_name, sizeof(state->save_file_name), ".dnd_tracker_save.%s.txt", name);
+    snprintf(state->journal_file_name, sizeof(state->journal_file_name), ".dnd_tracker_journal.%s.txt", name);
+
+    ServerTable* table = &server->tables[i];
+    memset(table, 0, sizeof(*table));
+    snprintf(table->name, sizeof(table->name), "%s", name);
+    table->state = state;
+    server->table_count++;
+    return table;
 }
 
 /**
- * Get string input from user with proper cursor management.
+ * Free a table and close the gap in its probe chain (backward-shift
+ * deletion, so lookups never need tombstones).
  *
- * @param prompt Prompt string to display
- * @param buffer Buffer to store input (must be at least max_len bytes)
- * @param max_len Maximum length including null terminator
- * @return 1 on success (non-empty input), 0 on cancellation or empty input
+ * @return 1 if the table existed
  */
-int get_input_string(const char* prompt, char* buffer, int max_len) {
-    if (!buffer || max_len < 1) return 0;
+int server_drop_table(Server* server, const char* name) {
+    ServerTable* table = server_find_table(server, name, 0);
+    if (!table) return 0;
+
+    cleanup_state(table->state);
+    free(table->state);
+    server->table_count--;
+
+    unsigned int mask = (unsigned int)server->table_capacity - 1;
+    unsigned int hole = (unsigned int)(table - server->tables);
+    server->tables[hole].state = NULL;
+    for (unsigned int j = (hole + 1) & mask; server->tables[j].state; j = (j + 1) & mask) {
+        unsigned int home = name_index_hash(server->tables[j].name) & mask;
+        /* Entries whose home lies cyclically in (hole, j] are still reachable */
+        int reachable = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (reachable) continue;
+        server->tables[hole] = server->tables[j];
+        server->tables[j].state = NULL;
+        hole = j;
+    }
+    return 1;
+}
 
-    int rows, cols_unused;
-    getmaxyx(stdscr, rows, cols_unused);
-    (void)cols_unused;
-    int input_y = rows - 2;
+void server_free_tables(Server* server) {
+    for (int i = 0; i < server->table_capacity; i++) {
+        if (!server->tables[i].state) continue;
+        cleanup_state(server->tables[i].state);
+        free(server->tables[i].state);
+    }
+    free(server->tables);
+    server->tables = NULL;
+    server->table_count = 0;
+}
 
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvprintw(input_y, 0, "%s", prompt);
-    clrtoeol();
-    attroff(COLOR_PAIR(COLOR_HEADER));
+int server_append(ServerClient* client, const char* data, size_t len) {
+    if (client->out_len + len > client->out_cap) {
+        size_t new_cap = client->out_cap ? client->out_cap : 4096;
+        while (new_cap < client->out_len + len) new_cap *= 2;
+        char* grown = (char*)realloc(client->out, new_cap);
+        if (!grown) return 0;
+        client->out = grown;
+        client->out_cap = new_cap;
+    }
+    memcpy(client->out + client->out_len, data, len);
+    client->out_len += len;
+    return 1;
+}
 
-    int prompt_len = (int)strlen(prompt);
-    move(input_y, prompt_len);
+/**
+ * Append each line of `body` to the reply, prefixed with `tag`.
+ */
+int server_append_lines(ServerClient* client, char tag, const char* body, size_t len) {
+    size_t pos = 0;
+    while (pos < len) {
+        const char* nl = (const char*)memchr(body + pos, '\n', len - pos);
+        size_t line_len = nl ? (size_t)(nl - (body + pos)) : len - pos;
+        if (!server_append(client, &tag, 1) ||
+            !server_append(client, body + pos, line_len) ||
+            !server_append(client, "\n", 1)) return 0;
+        pos += line_len + 1;
+    }
+    return 1;
+}
 
-    curs_set(1);
-    refresh();
+/**
+ * Server commands: ".tables", ".drop <table>", ".stats".
+ */
+void server_handle_admin(Server* server, ServerClient* client, char* line) {
+    char* cursor = line;
+    char* cmd = batch_next_token(&cursor);
+    char buf[128];
+    int ok = 1;
+
+    if (strcmp(cmd, ".tables") == 0) {
+        for (int i = 0; i < server->table_capacity; i++) {
+            const ServerTable* t = &server->tables[i];
+            if (!t->state) continue;
+            int len = snprintf(buf, sizeof(buf), "-%s %d combatants, round %d, %lld commands, %lld errors\n",
+                t->name, t->state->count, t->state->round, t->commands, t->errors);
+            server_append(client, buf, (size_t)len);
+        }
+    } else if (strcmp(cmd, ".drop") == 0) {
+        char* name = batch_next_token(&cursor);
+        if (!name || !server_drop_table(server, name)) {
+            int len = snprintf(buf, sizeof(buf), "!drop: no table '%.*s'\n", TABLE_NAME_LENGTH, name ? name : "");
+            server_append(client, buf, (size_t)len);
+            ok = 0;
+        }
+    } else if (strcmp(cmd, ".stats") == 0) {
+        int len = snprintf(buf, sizeof(buf), "-tables %d clients %d commands %lld\n",
+            server->table_count, server->client_count, server->commands);
+        server_append(client, buf, (size_t)len);
+    } else {
+        int len = snprintf(buf, sizeof(buf), "!unknown server command '%.*s'\n", 32, cmd);
+        server_append(client, buf, (size_t)len);
+        ok = 0;
+    }
+    server_append(client, ok ? "+OK\n" : "+ERR\n", ok ? 4 : 5);
+}
 
-    int ret = 0;
-    noecho();
-    int ch = getch();
+/**
+ * Run one request line against its table, capturing the command's output
+ * and errors into the client's reply buffer.
+ */
+void server_handle_line(Server* server, ServerClient* client, char* line) {
+    TRACE_SCOPE("server_handle_line");
+    size_t len = strlen(line);
+    while (len > 0 && isspace((unsigned char)line[len - 1])) line[--len] = '\0';
+    while (isspace((unsigned char)*line)) line++;
+    if (*line == '\0' || *line == '#') return;
+
+    server->commands++;
+    if (*line == '.') {
+        server_handle_admin(server, client, line);
+        return;
+    }
 
-    if (ch != 27 && ch != '\n' && ch != '\r') {
-        ungetch(ch);
-        echo();
-        if (getnstr(buffer, max_len - 1) != ERR && buffer[0] != '\0') {
-            ret = 1;
-        }
+    char* cursor = line;
+    char* name = batch_next_token(&cursor);
+    while (isspace((unsigned char)*cursor)) cursor++;
+    const char* failure = NULL;
+    ServerTable* table = NULL;
+    if (!server_valid_table_name(name)) failure = "!invalid table name (use up to 31 of A-Z a-z 0-9 _ -)\n";
+    else if (*cursor == '\0') failure = "!missing command\n";
+    else if (!(table = server_find_table(server, name, 1))) failure = "!out of memory\n";
+    if (failure) {
+        server_append(client, failure, strlen(failure));
+        server_append(client, "+ERR\n", 5);
+        return;
     }
 
-    noecho();
-    curs_set(0);
+    char* out_buf = NULL;
+    char* err_buf = NULL;
+    size_t out_len = 0, err_len = 0;
+    FILE* out = open_memstream(&out_buf, &out_len);
+    FILE* err = open_memstream(&err_buf, &err_len);
+    int ok = 0;
+    if (out && err) {
+        table->state->out = out;
+        table->state->err = err;
+        ok = execute_batch_command(table->state, cursor, (int)(table->commands + 1));
+        table->state->out = stdout;
+        table->state->err = stderr;
+    }
+    if (out) fclose(out);
+    if (err) fclose(err);
+
+    table->commands++;
+    if (!ok) table->errors++;
+    if (!out || !err) server_append(client, "!out of memory\n", 15);
+    server_append_lines(client, '-', out_buf, out_len);
+    server_append_lines(client, '!', err_buf, err_len);
+    server_append(client, ok ? "+OK\n" : "+ERR\n", ok ? 4 : 5);
+    free(out_buf);
+    free(err_buf);
+}
 
-    move(input_y, 0);
-    clrtoeol();
-    refresh();
+#ifdef SERVER_EPOLL
 
-    return ret;
+/* Server Loop Prototypes */
+void server_signal_handler(int sig);
+int server_listen(const char* path);
+void server_accept(Server* server);
+void server_client_close(Server* server, ServerClient* client);
+int server_client_read(ServerClient* client);
+int server_client_flush(ServerClient* client);
+
+void server_signal_handler(int sig) {
+    (void)sig;
+    server_stop_requested = 1;
 }
 
 /**
- * Get integer input from user with validation and error feedback.
+ * Bind a non-blocking listening socket. A stale socket file left by a
+ * crashed server is replaced; a live one is an error.
  *
- * @param state Game state for message display
- * @param prompt Prompt string to display
- * @param value Pointer to store parsed integer value
- * @param min_val Minimum allowed value (INT_MIN if no limit)
- * @param max_val Maximum allowed value (INT_MAX if no limit)
- * @return 1 on success, 0 on cancellation or invalid input
+ * @return The socket, or -1 on error (reported on stderr)
  */
-int get_input_int(GameState* state, const char* prompt, int* value, int min_val, int max_val) {
-    char buf[32];
-    int attempts = 0;
-    const int max_attempts = 3;
+int server_listen(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "serve: socket path too long: %s\n", path);
+        return -1;
+    }
+    memcpy(addr.sun_path, path, strlen(path) + 1);
 
-    while (attempts < max_attempts) {
-        if (!get_input_string(prompt, buf, sizeof(buf))) {
-            return 0; /* User cancelled */
+    if (!unix_socket_reclaim("serve", &addr)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "serve: socket: %s\n", strerror(errno));
+        return -1;
+    }
+    /* Owner-only: clients can load and save files as this user */
+    mode_t old_mask = umask(077);
+    int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound != 0 || listen(fd, SOMAXCONN) != 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        fprintf(stderr, "serve: cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void server_accept(Server* server) {
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) fprintf(stderr, "serve: accept: %s\n", strerror(errno));
+            return;
         }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-        if (parse_int_safe(buf, value)) {
-            if (*value < min_val || *value > max_val) {
-                char err_msg[128];
-                snprintf(err_msg, sizeof(err_msg), "Value must be between %d and %d", min_val, max_val);
-                show_message(state, err_msg, 1);
-                attempts++;
+        if (server->client_count == server->client_capacity) {
+            int new_capacity = server->client_capacity ? server->client_capacity * 2 : 16;
+            ServerClient** grown = (ServerClient**)realloc(server->clients, (size_t)new_capacity * sizeof(ServerClient*));
+            if (!grown) {
+                close(fd);
                 continue;
             }
-            return 1;
+            server->clients = grown;
+            server->client_capacity = new_capacity;
         }
-
-        show_message(state, "Invalid number! Please enter a valid integer.", 1);
-        attempts++;
+        ServerClient* client = (ServerClient*)calloc(1, sizeof(ServerClient));
+        if (!client) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->events = EPOLLIN;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = client->events;
+        ev.data.ptr = client;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(client);
+            continue;
+        }
+        client->slot = server->client_count;
+        server->clients[server->client_count++] = client;
     }
-
-    show_message(state, "Too many invalid attempts. Cancelled.", 1);
-    return 0;
 }
 
-int get_input_char(const char* prompt, const char* allowed) {
-    attron(COLOR_PAIR(COLOR_HEADER));
-    mvprintw(LINES-2, 0, "%s", prompt);
-    clrtoeol();
-    attroff(COLOR_PAIR(COLOR_HEADER));
-    while(1) {
-        int ch = getch();
-        if(ch == 27) return 0;
-        if(strchr(allowed, tolower(ch))) return ch;
-    }
+void server_client_close(Server* server, ServerClient* client) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    ServerClient* last = server->clients[--server->client_count];
+    server->clients[client->slot] = last;
+    last->slot = client->slot;
+    free(client->in);
+    free(client->out);
+    free(client);
 }
 
-int get_input_confirm(const char* prompt) {
-    int ch = get_input_char(prompt, "ynYN");
-    return (tolower(ch) == 'y');
+/**
+ * One read per wakeup keeps a busy client from starving the rest.
+ *
+ * @return 0 if the connection failed
+ */
+int server_client_read(ServerClient* client) {
+    /* Always leave room for a terminator after the last partial line */
+    if (client->in_cap - client->in_len < 4097) {
+        size_t new_cap = client->in_cap ? client->in_cap * 2 : 8192;
+        char* grown = (char*)realloc(client->in, new_cap);
+        if (!grown) return 0;
+        client->in = grown;
+        client->in_cap = new_cap;
+    }
+    ssize_t n;
+    do {
+        n = read(client->fd, client->in + client->in_len, client->in_cap - client->in_len - 1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) client->in_len += (size_t)n;
+    else if (n == 0) client->eof = 1;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK) return 0;
+    return 1;
 }
 
-void show_message(GameState* state, const char* msg, int is_error) {
-    if (!state) return;
-
-    clear_old_messages(state);
-
-    /* Drop oldest message when queue is full (FIFO) */
-    if (state->message_queue_count >= MAX_MESSAGE_QUEUE) {
-        for (int i = 0; i < MAX_MESSAGE_QUEUE - 1; i++) {
-            state->message_queue[i] = state->message_queue[i + 1];
+/**
+ * @return 0 if the connection failed
+ */
+int server_client_flush(ServerClient* client) {
+    while (client->out_off < client->out_len) {
+        ssize_t n = send(client->fd, client->out + client->out_off, client->out_len - client->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+            return 0;
         }
-        state->message_queue_count = MAX_MESSAGE_QUEUE - 1;
+        client->out_off += (size_t)n;
     }
-
-    MessageQueueEntry* entry = &state->message_queue[state->message_queue_count];
-    strncpy(entry->text, msg, sizeof(entry->text) - 1);
-    entry->text[sizeof(entry->text) - 1] = '\0';
-    entry->is_error = is_error;
-    entry->timestamp = time(NULL);
-    state->message_queue_count++;
+    client->out_off = client->out_len = 0;
+    return 1;
 }
 
-void clear_old_messages(GameState* state) {
-    if (!state) return;
-
-    time_t now = time(NULL);
-    int write_idx = 0;
-
-    for (int i = 0; i < state->message_queue_count; i++) {
-        double elapsed = difftime(now, state->message_queue[i].timestamp);
-        if (elapsed < MESSAGE_DISPLAY_DURATION_SECONDS) {
-            if (write_idx != i) {
-                state->message_queue[write_idx] = state->message_queue[i];
+/**
+ * Answer every complete line buffered for a client, write what the socket
+ * accepts, and update the epoll interest. Reading pauses while a client
+ * has SERVER_MAX_PENDING unsent bytes, so a slow reader cannot make the
+ * server buffer without bound.
+ *
+ * @return 0 when the connection should be closed
+ */
+int server_client_service(Server* server, ServerClient* client) {
+    size_t start = 0;
+    while (client->out_len - client->out_off < SERVER_MAX_PENDING) {
+        char* nl = (char*)memchr(client->in + start, '\n', client->in_len - start);
+        if (!nl) {
+            size_t partial = client->in_len - start;
+            if (partial > SERVER_MAX_LINE) {
+                server_append(client, "!line too long\n+ERR\n", 20);
+                client->eof = 1;
+                start = client->in_len;
+            } else if (client->eof && partial > 0) {
+                client->in[client->in_len] = '\0';
+                server_handle_line(server, client, client->in + start);
+                start = client->in_len;
             }
-            write_idx++;
+            break;
         }
+        *nl = '\0';
+        server_handle_line(server, client, client->in + start);
+        start = (size_t)(nl - client->in) + 1;
+    }
+    if (start > 0) {
+        memmove(client->in, client->in + start, client->in_len - start);
+        client->in_len -= start;
     }
 
-    state->message_queue_count = write_idx;
+    if (!server_client_flush(client)) return 0;
+    size_t pending = client->out_len - client->out_off;
+    if (client->eof && pending == 0 && client->in_len == 0) return 0;
+
+    unsigned int want = 0;
+    if (!client->eof && pending < SERVER_MAX_PENDING) want |= EPOLLIN;
+    if (pending > 0) want |= EPOLLOUT;
+    if (want != client->events) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = want;
+        ev.data.ptr = client;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) != 0) return 0;
+        client->events = want;
+    }
+    return 1;
 }
 
 /**
- * Draw message queue at the bottom of the screen.
- * Uses a reserved area to prevent visual artifacts from clearing/redrawing.
+ * Host many encounters in one process. Every table is an independent
+ * headless GameState driven by the batch command set; a single epoll loop
+ * serves all connections, so commands never run concurrently.
+ *
+ * @param socket_path Unix socket to listen on, or NULL for ~/.dnd_tracker.sock
+ * @return Process exit status
  */
-void draw_message_queue(GameState* state) {
-    if (!state || state->message_queue_count == 0) return;
+int run_server(const char* socket_path) {
+    char path[256];
+    if (!server_socket_path(path, sizeof(path), socket_path)) {
+        fprintf(stderr, "serve: socket path too long\n");
+        return 1;
+    }
 
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.table_capacity = SERVER_INITIAL_TABLES;
+    server.tables = (ServerTable*)calloc((size_t)server.table_capacity, sizeof(ServerTable));
+    if (!server.tables) {
+        fprintf(stderr, "serve: out of memory\n");
+        return 1;
+    }
 
-    /* Reserve bottom area to prevent message overlap with content */
-    int message_area_start = rows - MAX_MESSAGE_QUEUE - 1;
-    if (message_area_start < 0) message_area_start = 0;
+    server.listen_fd = server_listen(path);
+    if (server.listen_fd < 0) {
+        free(server.tables);
+        return 1;
+    }
+    server.epoll_fd = epoll_create1(0);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; /* The listener is the only entry without a client */
+    if (server.epoll_fd < 0 || epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &ev) != 0) {
+        fprintf(stderr, "serve: epoll: %s\n", strerror(errno));
+        close(server.listen_fd);
+        unlink(path);
+        free(server.tables);
+        return 1;
+    }
 
-    /* Draw newest messages at bottom, older ones above */
-    int y = rows - 1;
-    for (int i = state->message_queue_count - 1; i >= 0 && y >= message_area_start; i--) {
-        MessageQueueEntry* entry = &state->message_queue[i];
-        int pair = entry->is_error ? COLOR_MSG_ERROR : COLOR_MSG_SUCCESS;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "serve: listening on %s\n", path);
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_stop_requested) {
+        int n = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (trace_poll_dump() < 0) fprintf(stderr, "serve: cannot write trace %s\n", trace_path);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "serve: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            ServerClient* client = (ServerClient*)events[i].data.ptr;
+            if (!client) {
+                server_accept(&server);
+                continue;
+            }
+            int ok = 1;
+            if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !client->eof) ok = server_client_read(client);
+            if (ok) ok = server_client_service(&server, client);
+            if (!ok) server_client_close(&server, client);
+        }
+    }
 
-        int text_len = (int)strlen(entry->text);
-        int x_start = cols / 2 - text_len / 2 - 1;
-        if (x_start < 0) x_start = 0;
-        if (x_start + text_len + 2 > cols) x_start = cols - text_len - 2;
+    fprintf(stderr, "serve: shutting down, %d tables, %lld commands\n", server.table_count, server.commands);
+    while (server.client_count > 0) server_client_close(&server, server.clients[0]);
+    free(server.clients);
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    unlink(path);
+    server_free_tables(&server);
+    return 0;
+}
 
-        move(y, 0);
-        clrtoeol();
+#else
 
-        attron(COLOR_PAIR(pair) | A_BOLD);
-        mvprintw(y, x_start, " %s ", entry->text);
-        attroff(COLOR_PAIR(pair) | A_BOLD);
-        y--;
+int run_server(const char* socket_path) {
+    (void)socket_path;
+    fprintf(stderr, "serve: server mode needs epoll (Linux)\n");
+    return 1;
+}
+
+#endif /* SERVER_EPOLL */
+
+/**
+ * Line client: sends each stdin line to one table and prints the reply,
+ * output on stdout and errors on stderr - the same contract as --batch.
+ * Lines starting with '.' are sent as server commands.
+ *
+ * @return Process exit status: 0 if every command succeeded, 1 otherwise
+ */
+int run_client(const char* table, const char* socket_path) {
+    char path[256];
+    struct sockaddr_un addr;
+    if (!server_valid_table_name(table)) {
+        fprintf(stderr, "client: invalid table name '%s'\n", table);
+        return 2;
     }
+    if (!server_socket_path(path, sizeof(path), socket_path) || strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "client: socket path too long\n");
+        return 2;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "client: cannot connect to %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    FILE* replies = fdopen(fd, "r");
+    if (!replies) {
+        close(fd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    int interactive = isatty(STDIN_FILENO);
+    int errors = 0;
+    char line[SERVER_MAX_LINE];
+    char request[SERVER_MAX_LINE + TABLE_NAME_LENGTH + 2];
+    char reply[SERVER_MAX_LINE * 4];
+    for (;;) {
+        if (interactive) {
+            fprintf(stderr, "%s> ", table);
+            fflush(stderr);
+        }
+        if (!fgets(line, sizeof(line), stdin)) break;
+        char* p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0' || *p == '#') continue;
+
+        int len = (*p == '.') ? snprintf(request, sizeof(request), "%s", p)
+                              : snprintf(request, sizeof(request), "%s %s", table, p);
+        if (len > 0 && request[len - 1] != '\n' && (size_t)len + 1 < sizeof(request)) {
+            request[len++] = '\n';
+            request[len] = '\0';
+        }
+        if (send(fd, request, (size_t)len, MSG_NOSIGNAL) != (ssize_t)len) {
+            fprintf(stderr, "client: connection lost\n");
+            errors++;
+            break;
+        }
 
-    while (y >= message_area_start && y >= 0) {
-        move(y, 0);
-        clrtoeol();
-        y--;
+        int done = 0;
+        while (!done && fgets(reply, sizeof(reply), replies)) {
+            switch (reply[0]) {
+                case '-': fputs(reply + 1, stdout); break;
+                case '!': fputs(reply + 1, stderr); break;
+                case '+':
+                    if (strncmp(reply, "+ERR", 4) == 0) errors++;
+                    done = 1;
+                    break;
+                default: break;
+            }
+        }
+        fflush(stdout);
+        if (!done) {
+            fprintf(stderr, "client: connection closed by server\n");
+            errors++;
+            break;
+        }
     }
+
+    fclose(replies);
+    return errors > 0 ? 1 : 0;
 }
@@ -0,0 +1,283 @@
+/*
+ * Load generator for the initiative tracker server.
+ *
+ * Build with `make loadgen`, start a server with
+ * `./initiative --serve /tmp/initiative.sock`, then run
+ * `./initiative_loadgen -s /tmp/initiative.sock`. Every connection keeps
+ * `depth` requests in flight against randomly chosen tables (closed loop)
+ * and the round-trip time of each request is recorded.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define LOADGEN_MAX_CONNECTIONS 256
+#define LOADGEN_MAX_DEPTH 64
+#define LOADGEN_BUFFER 65536
+#define LOADGEN_PLAYERS 4
+#define LOADGEN_ENEMIES 6
+#define LOADGEN_TABLE_IDS (LOADGEN_PLAYERS + LOADGEN_ENEMIES + 1) /* Plus one mob */
+
+typedef struct {
+    int fd;
+    char in[LOADGEN_BUFFER];
+    size_t in_len;
+    double sent_ns[LOADGEN_MAX_DEPTH]; /* FIFO of send times - replies come back in order */
+    int head;
+    int inflight;
+} LoadConn;
+
+/* Load Generator Prototypes */
+double loadgen_now_ns(void);
+int loadgen_connect(const char* path);
+int loadgen_send(int fd, const char* data, size_t len);
+int loadgen_format_command(char* buf, size_t size, int tables);
+int loadgen_setup_table(int fd, int table);
+int loadgen_compare_double(const void* a, const void* b);
+double loadgen_percentile(const double* sorted, long long n, double p);
+
+double loadgen_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int loadgen_connect(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int loadgen_send(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+/**
+ * One request from the table-side mix: mostly HP changes and turn
+ * advances, with conditions, mob damage and the occasional full listing.
+ */
+int loadgen_format_command(char* buf, size_t size, int tables) {
+    int table = rand() % tables;
+    int id = 1 + rand() % (LOADGEN_TABLE_IDS - 1);
+    int roll = rand() % 100;
+    if (roll < 25) return snprintf(buf, size, "lg%d damage #%d %d\n", table, id, 1 + rand() % 8);
+    if (roll < 50) return snprintf(buf, size, "lg%d heal #%d %d\n", table, id, 1 + rand() % 8);
+    if (roll < 70) return snprintf(buf, size, "lg%d next\n", table);
+    if (roll < 80) return snprintf(buf, size, "lg%d condition #%d %s\n", table, id, (rand() % 2) ? "poisoned" : "prone");
+    if (roll < 88) return snprintf(buf, size, "lg%d mobhp #%d spread -%d\n", table, LOADGEN_TABLE_IDS, 1 + rand() % 12);
+    if (roll < 95) return snprintf(buf, size, "lg%d query below 50\n", table);
+    return snprintf(buf, size, "lg%d list\n", table);
+}
+
+/**
+ * Reset a table and seat a fixed party; HP is high enough that the random
+ * damage never kills anyone, so every id stays valid for the whole run.
+ *
+ * @return 0 if the server did not answer or rejected a command
+ */
+int loadgen_setup_table(int fd, int table) {
+    char script[2048];
+    size_t len = 0;
+    len += (size_t)snprintf(script + len, sizeof(script) - len, ".drop lg%d\n", table);
+    for (int i = 0; i < LOADGEN_PLAYERS; i++) {
+        len += (size_t)snprintf(script + len, sizeof(script) - len,
+            "lg%d add player Hero%d %d 2 100000\n", table, i + 1, 5 + rand() % 15);
+    }
+    for (int i = 0; i < LOADGEN_ENEMIES; i++) {
+        len += (size_t)snprintf(script + len, sizeof(script) - len,
+            "lg%d add enemy Brute%d %d 1 100000\n", table, i + 1, 5 + rand() % 15);
+    }
+    len += (size_t)snprintf(script + len, sizeof(script) - len, "lg%d addmob Horde 10 1 5000 20\n", table);
+    if (!loadgen_send(fd, script, len)) return 0;
+
+    /* Drain one reply per request line */
+    int expected = 2 + LOADGEN_PLAYERS + LOADGEN_ENEMIES;
+    int first = 1; /* The .drop fails harmlessly on a fresh server */
+    char reply[4096];
+    size_t have = 0;
+    while (expected > 0) {
+        ssize_t n = read(fd, reply + have, sizeof(reply) - have);
+        if (n <= 0) return 0;
+        have += (size_t)n;
+        size_t start = 0;
+        for (size_t i = 0; i < have; i++) {
+            if (reply[i] != '\n') continue;
+            if (reply[start] == '+') {
+                if (reply[start + 1] == 'E' && !first) return 0;
+                first = 0;
+                expected--;
+            }
+            start = i + 1;
+        }
+        memmove(reply, reply + start, have - start);
+        have -= start;
+    }
+    return 1;
+}
+
+int loadgen_compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+double loadgen_percentile(const double* sorted, long long n, double p) {
+    long long i = (long long)(p / 100.0 * (double)(n - 1) + 0.5);
+    return sorted[i];
+}
+
+int main(int argc, char** argv) {
+    const char* socket_path = NULL;
+    int tables = 100, connections = 16, depth = 1;
+    long long total = 200000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:c:n:d:")) != -1) {
+        switch (opt) {
+            case 's': socket_path = optarg; break;
+            case 't': tables = atoi(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 'n': total = atoll(optarg); break;
+            case 'd': depth = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s -s <socket> [-t tables] [-c connections] [-n commands] [-d depth]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (!socket_path || tables < 1 || connections < 1 || connections > LOADGEN_MAX_CONNECTIONS ||
+        depth < 1 || depth > LOADGEN_MAX_DEPTH || total < 1) {
+        fprintf(stderr, "Usage: %s -s <socket> [-t tables] [-c 1-%d connections] [-n commands] [-d 1-%d depth]\n",
+            argv[0], LOADGEN_MAX_CONNECTIONS, LOADGEN_MAX_DEPTH);
+        return 2;
+    }
+    srand(12345);
+
+    LoadConn* conns = (LoadConn*)calloc((size_t)connections, sizeof(LoadConn));
+    struct pollfd* fds = (struct pollfd*)calloc((size_t)connections, sizeof(struct pollfd));
+    double* latency_us = (double*)malloc((size_t)total * sizeof(double));
+    if (!conns || !fds || !latency_us) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        return 1;
+    }
+    for (int c = 0; c < connections; c++) {
+        conns[c].fd = loadgen_connect(socket_path);
+        if (conns[c].fd < 0) {
+            fprintf(stderr, "loadgen: cannot connect to %s: %s\n", socket_path, strerror(errno));
+            return 1;
+        }
+        fds[c].fd = conns[c].fd;
+        fds[c].events = POLLIN;
+    }
+
+    double setup_start = loadgen_now_ns();
+    for (int t = 0; t < tables; t++) {
+        if (!loadgen_setup_table(conns[0].fd, t)) {
+            fprintf(stderr, "loadgen: table setup failed\n");
+            return 1;
+        }
+    }
+    double setup_ms = (loadgen_now_ns() - setup_start) / 1e6;
+
+    long long issued = 0, completed = 0, errors = 0;
+    char request[256];
+    double start = loadgen_now_ns();
+    for (int c = 0; c < connections; c++) {
+        for (int d = 0; d < depth && issued < total; d++) {
+            LoadConn* conn = &conns[c];
+            int len = loadgen_format_command(request, sizeof(request), tables);
+            conn->sent_ns[(conn->head + conn->inflight) % LOADGEN_MAX_DEPTH] = loadgen_now_ns();
+            conn->inflight++;
+            issued++;
+            if (!loadgen_send(conn->fd, request, (size_t)len)) {
+                fprintf(stderr, "loadgen: send failed\n");
+                return 1;
+            }
+        }
+    }
+
+    while (completed < total) {
+        if (poll(fds, (nfds_t)connections, -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "loadgen: poll: %s\n", strerror(errno));
+            return 1;
+        }
+        for (int c = 0; c < connections; c++) {
+            if (!(fds[c].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            LoadConn* conn = &conns[c];
+            ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+            if (n <= 0) {
+                fprintf(stderr, "loadgen: server closed the connection\n");
+                return 1;
+            }
+            conn->in_len += (size_t)n;
+
+            size_t line_start = 0;
+            for (size_t i = 0; i < conn->in_len; i++) {
+                if (conn->in[i] != '\n') continue;
+                if (conn->in[line_start] == '+') {
+                    double now = loadgen_now_ns();
+                    latency_us[completed++] = (now - conn->sent_ns[conn->head]) / 1e3;
+                    conn->head = (conn->head + 1) % LOADGEN_MAX_DEPTH;
+                    conn->inflight--;
+                    if (conn->in[line_start + 1] == 'E') errors++;
+
+                    if (issued < total) {
+                        int len = loadgen_format_command(request, sizeof(request), tables);
+                        conn->sent_ns[(conn->head + conn->inflight) % LOADGEN_MAX_DEPTH] = loadgen_now_ns();
+                        conn->inflight++;
+                        issued++;
+                        if (!loadgen_send(conn->fd, request, (size_t)len)) {
+                            fprintf(stderr, "loadgen: send failed\n");
+                            return 1;
+                        }
+                    }
+                }
+                line_start = i + 1;
+            }
+            memmove(conn->in, conn->in + line_start, conn->in_len - line_start);
+            conn->in_len -= line_start;
+        }
+    }
+    double elapsed_s = (loadgen_now_ns() - start) / 1e9;
+
+    qsort(latency_us, (size_t)total, sizeof(double), loadgen_compare_double);
+    printf("loadgen: %d tables set up in %.1f ms\n", tables, setup_ms);
+    printf("loadgen: %lld commands, %d connections x depth %d, %.3f s, %.0f commands/s, %lld errors\n",
+        total, connections, depth, elapsed_s, (double)total / elapsed_s, errors);
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+        loadgen_percentile(latency_us, total, 50.0), loadgen_percentile(latency_us, total, 90.0),
+        loadgen_percentile(latency_us, total, 99.0), loadgen_percentile(latency_us, total, 99.9),
+        latency_us[total - 1]);
+
+    for (int c = 0; c < connections; c++) close(conns[c].fd);
+    free(conns);
+    free(fds);
+    free(latency_us);
+    return errors > 0 ? 1 : 0;
+}